@@ -83,6 +83,24 @@ static void BM_MinifyCss(benchmark::State& state) {
 }
 BENCHMARK_RANGE(BM_MinifyCss, 1 << 6, 1 << 18);
 
+// Same input, minified from the token stream without building a Stylesheet.
+static void BM_MinifyCssStreaming(benchmark::State& state) {
+  GoogleString in_text;
+  for (int i = 0; i < state.iterations(); i += strlen(CSS_console_css)) {
+    in_text += CSS_console_css;
+  }
+  in_text.resize(state.iterations());
+
+  NullMessageHandler handler;
+  for (int i = 0; i < state.iterations(); ++i) {
+    GoogleString result;
+    StringWriter writer(&result);
+    CssMinify minify(&writer, &handler);
+    minify.MinifyStylesheetStreaming(in_text);
+  }
+}
+BENCHMARK_RANGE(BM_MinifyCssStreaming, 1 << 6, 1 << 18);
+
 // Common-case, all chars are normal alpha-num that don't need to be escaped.
 static void BM_EscapeStringNormal(benchmark::State& state) {
   GoogleString ident(state.iterations(), 'A');
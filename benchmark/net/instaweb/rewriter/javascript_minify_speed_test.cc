@@ -74,6 +74,24 @@ void TestMinifyJavascript(bool use_experimental_minifier,
   }
 }
 
+void TestTokenizeJavascript(bool use_regexes, benchmark::State& state) {
+  GoogleString in_text;
+  for (int i = 0; i < state.iterations(); i += strlen(JS_console_js)) {
+    in_text += JS_console_js;
+  }
+  in_text.resize(state.iterations());
+
+  pagespeed::js::JsTokenizerPatterns js_tokenizer_patterns;
+  for (int i = 0; i < state.iterations(); ++i) {
+    pagespeed::js::JsTokenizer tokenizer(&js_tokenizer_patterns, in_text);
+    tokenizer.set_use_regexes_for_test(use_regexes);
+    StringPiece token;
+    while (tokenizer.NextToken(&token) != pagespeed::JsKeywords::kEndOfInput &&
+           !tokenizer.has_error()) {
+    }
+  }
+}
+
 static void BM_MinifyJavascriptNew(benchmark::State& state) {
   TestMinifyJavascript(true, state);
 }
@@ -84,6 +102,17 @@ static void BM_MinifyJavascriptOld(benchmark::State& state) {
 }
 BENCHMARK_RANGE(BM_MinifyJavascriptOld, 1 << 6, 1 << 18);
 
+static void BM_TokenizeJavascript(benchmark::State& state) {
+  TestTokenizeJavascript(false, state);
+}
+BENCHMARK_RANGE(BM_TokenizeJavascript, 1 << 6, 1 << 18);
+
+// The same, but matching tokens with the RE2 patterns only, for comparison.
+static void BM_TokenizeJavascriptRegexes(benchmark::State& state) {
+  TestTokenizeJavascript(true, state);
+}
+BENCHMARK_RANGE(BM_TokenizeJavascriptRegexes, 1 << 6, 1 << 18);
+
 }  // namespace
 
 }  // namespace net_instaweb
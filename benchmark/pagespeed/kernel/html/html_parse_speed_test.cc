@@ -168,6 +168,39 @@ static void BM_ParseAndSerializeReuseParserX50(benchmark::State& state) {
 }
 BENCHMARK(BM_ParseAndSerializeReuseParserX50);
 
+// Start tags whose attributes are written the way HtmlWriterFilter would
+// write them, which the writer can copy out of the source verbatim, fed to
+// the parser in chunks the way a fetch delivers them.
+static void BM_ParseAndSerializeAttributeTagsChunked(benchmark::State& state) {
+  StopBenchmarkTiming();
+  GoogleString text;
+  for (int i = 0; i < 2000; ++i) {
+    GoogleString n = IntegerToString(i);
+    StrAppend(&text, "<div class=\"row\" id=\"r", n, "\">",
+              "<a href=\"/item/", n, "\" title=\"Item\">");
+    StrAppend(&text, "<img src=\"/i/", n, ".png\" width=\"16\"",
+              " height=\"16\" alt=\"\"></a></div>\n");
+  }
+  const int kChunkSize = 8192;
+
+  NullWriter writer;
+  NullMessageHandler handler;
+  HtmlParse parser(&handler);
+  HtmlWriterFilter writer_filter(&parser);
+  parser.AddFilter(&writer_filter);
+  writer_filter.set_writer(&writer);
+
+  StartBenchmarkTiming();
+  for (int i = 0; i < state.iterations(); ++i) {
+    parser.StartParse("http://example.com/benchmark");
+    for (int pos = 0, n = text.size(); pos < n; pos += kChunkSize) {
+      parser.ParseText(StringPiece(text).substr(pos, kChunkSize));
+    }
+    parser.FinishParse();
+  }
+}
+BENCHMARK(BM_ParseAndSerializeAttributeTagsChunked);
+
 }  // namespace
 
 }  // namespace net_instaweb
@@ -22,6 +22,7 @@
 #include "base/logging.h"
 #include "net/instaweb/http/public/async_fetch.h"
 #include "net/instaweb/http/public/async_fetch_with_lock.h"
+#include "net/instaweb/http/public/fetch_coalescer.h"
 #include "net/instaweb/http/public/http_cache.h"
 #include "net/instaweb/http/public/http_value.h"
 #include "net/instaweb/http/public/http_value_writer.h"
@@ -55,7 +56,8 @@ class CachePutFetch : public SharedAsyncFetch {
                 AsyncFetch* base_fetch,
                 ResponseHeaders::VaryOption respect_vary,
                 bool default_cache_html, HTTPCache* cache,
-                Histogram* backend_first_byte_latency, MessageHandler* handler)
+                Histogram* backend_first_byte_latency, MessageHandler* handler,
+                FetchCoalescer::Flight* flight)
       : SharedAsyncFetch(base_fetch),
         url_(url),
         fragment_(fragment),
@@ -65,6 +67,7 @@ class CachePutFetch : public SharedAsyncFetch {
         cache_(cache),
         backend_first_byte_latency_(backend_first_byte_latency),
         handler_(handler),
+        flight_(flight),
         cacheable_(false),
         cache_value_writer_(&cache_value_, cache_),
         saved_headers_(http_options_),
@@ -105,6 +108,12 @@ class CachePutFetch : public SharedAsyncFetch {
       // cache_value_writer_ later.
       saved_headers_.CopyFrom(*headers);
     }
+    // Only what we'd cache, and so serve to anyone, is passed on to the
+    // requests waiting on this fetch.  Do it before base_fetch() gets a
+    // chance to change the headers.
+    if (flight_ != nullptr) {
+      flight_->HeadersComplete(*headers, cacheable_);
+    }
 
     SharedAsyncFetch::HandleHeadersComplete();
   }
@@ -112,6 +121,9 @@ class CachePutFetch : public SharedAsyncFetch {
   bool HandleWrite(const StringPiece& content,
                    MessageHandler* handler) override {
     bool ret = true;
+    if (flight_ != nullptr) {
+      flight_->Write(content, handler);
+    }
     ret &= SharedAsyncFetch::HandleWrite(content, handler);
     if (cacheable_) {
       ret &= cache_value_writer_.Write(content, handler);
@@ -162,6 +174,11 @@ class CachePutFetch : public SharedAsyncFetch {
       cache_->Put(url_, fragment_, req_properties_, http_options_,
                   &cache_value_, handler_);
     }
+    // Land the flight only now, so that later requests for the URL find the
+    // response in the cache instead of fetching it again.
+    if (flight_ != nullptr) {
+      flight_->Done(success);
+    }
     // Note: We explicitly do not remember fetch failure, uncacheable nor
     // empty resources here since we still want to proxy those through every
     // time they are requested.
@@ -179,6 +196,7 @@ class CachePutFetch : public SharedAsyncFetch {
   HTTPCache* cache_;
   Histogram* backend_first_byte_latency_;
   MessageHandler* handler_;
+  FetchCoalescer::Flight* flight_;  // may be NULL.
 
   bool cacheable_;
   HTTPValue cache_value_;
@@ -190,7 +208,8 @@ class CachePutFetch : public SharedAsyncFetch {
   DISALLOW_COPY_AND_ASSIGN(CachePutFetch);
 };
 
-class CacheFindCallback : public HTTPCache::Callback {
+class CacheFindCallback : public HTTPCache::Callback,
+                          public FetchCoalescer::Follower {
  public:
   class BackgroundFreshenFetch : public AsyncFetchWithLock {
    public:
@@ -210,7 +229,8 @@ class CacheFindCallback : public HTTPCache::Callback {
 
     void StartFetch(UrlAsyncFetcher* fetcher,
                     MessageHandler* handler) override {
-      AsyncFetch* fetch = callback_->WrapCachePutFetchAndConditionalFetch(this);
+      AsyncFetch* fetch =
+          callback_->WrapCachePutFetchAndConditionalFetch(this, nullptr);
       fetcher->Fetch(url(), handler, fetch);
     }
 
@@ -249,6 +269,8 @@ class CacheFindCallback : public HTTPCache::Callback {
         num_proactively_freshen_user_facing_request_(
             owner->num_proactively_freshen_user_facing_request()),
         handler_(handler),
+        fetch_coalescer_(owner->fetch_coalescer()),
+        follower_fetch_(nullptr),
         http_options_(base_fetch->request_context()->options()),
         respect_vary_(ResponseHeaders::GetVaryOption(owner->respect_vary())),
         ignore_recent_fetch_failed_(owner->ignore_recent_fetch_failed()),
@@ -379,7 +401,18 @@ class CacheFindCallback : public HTTPCache::Callback {
               base_fetch = fallback_fetch;
             }
 
-            base_fetch = WrapCachePutFetchAndConditionalFetch(base_fetch);
+            FetchCoalescer::Flight* flight = nullptr;
+            if (CanCoalesce()) {
+              follower_fetch_ = base_fetch;
+              flight = fetch_coalescer_->JoinOrLead(CoalescingKey(), this);
+              if (flight == nullptr) {
+                // Another request is already fetching this; its flight now
+                // owns us, and may have deleted us already.
+                return;
+              }
+            }
+            base_fetch = WrapCachePutFetchAndConditionalFetch(base_fetch,
+                                                              flight);
           }
 
           fetcher_->Fetch(url_, handler_, base_fetch);
@@ -405,7 +438,42 @@ class CacheFindCallback : public HTTPCache::Callback {
     response_sequence_ = sequence;
   }
 
+  AsyncFetch* follower_fetch() override { return follower_fetch_; }
+
+  // The fetch we were waiting on can't be shared, so go to the origin
+  // ourselves.
+  void Detach() override {
+    fetcher_->Fetch(url_, handler_, WrapCachePutFetchAndConditionalFetch(
+                                        follower_fetch_, nullptr));
+  }
+
  private:
+  bool CanCoalesce() const {
+    // The answer to a conditional request may be a 304 that means nothing to
+    // anyone else.
+    return fetch_coalescer_ != nullptr &&
+           !request_headers()->Has(HttpAttributes::kIfNoneMatch) &&
+           !request_headers()->Has(HttpAttributes::kIfModifiedSince);
+  }
+
+  // Requests may only share a fetch if we'd make the same caching decisions
+  // about the response for each of them.
+  GoogleString CoalescingKey() const {
+    RequestHeaders::Properties properties = req_properties();
+    GoogleString flags(6, '0');
+    if (properties.has_cookie) flags[0] = '1';
+    if (properties.has_cookie2) flags[1] = '1';
+    if (properties.has_authorization) flags[2] = '1';
+    if (respect_vary_ == ResponseHeaders::kRespectVaryOnResources) {
+      flags[3] = '1';
+    }
+    if (default_cache_html_) flags[4] = '1';
+    // Followers replay the leader's response as it came from the origin, so
+    // a client that can't take gzip mustn't share a fetch with one that can.
+    if (base_fetch_->request_context()->accepts_gzip()) flags[5] = '1';
+    return StrCat(flags, " ", fragment_, " ", url_);
+  }
+
   bool ServedStaleContentWhileRevalidate(AsyncFetch* base_fetch) {
     if (serve_stale_while_revalidate_threshold_sec_ == 0 ||
         fallback_http_value() == nullptr || fallback_http_value()->Empty()) {
@@ -504,10 +572,11 @@ class CacheFindCallback : public HTTPCache::Callback {
         cache_->timer()->NowMs(), headers.http_options());
   }
 
-  AsyncFetch* WrapCachePutFetchAndConditionalFetch(AsyncFetch* base_fetch) {
+  AsyncFetch* WrapCachePutFetchAndConditionalFetch(
+      AsyncFetch* base_fetch, FetchCoalescer::Flight* flight) {
     CachePutFetch* put_fetch = new CachePutFetch(
         url_, fragment_, base_fetch, respect_vary_, default_cache_html_, cache_,
-        backend_first_byte_latency_, handler_);
+        backend_first_byte_latency_, handler_, flight);
     DCHECK_EQ(response_headers(), base_fetch_->response_headers());
 
     // Remove any Etags added by us before sending the request out. This is the
@@ -541,6 +610,8 @@ class CacheFindCallback : public HTTPCache::Callback {
   Variable* num_conditional_refreshes_;
   Variable* num_proactively_freshen_user_facing_request_;
   MessageHandler* handler_;
+  FetchCoalescer* fetch_coalescer_;
+  AsyncFetch* follower_fetch_;  // Fetch to complete when following a flight.
 
   const HttpOptions http_options_;
   // TODO(sligocki): Remove and use http_options_.respect_vary instead.
@@ -569,6 +640,7 @@ CacheUrlAsyncFetcher::CacheUrlAsyncFetcher(const Hasher* lock_hasher,
       fragment_(fragment),
       fetcher_(fetcher),
       async_op_hooks_(async_op_hooks),
+      fetch_coalescer_(nullptr),
       backend_first_byte_latency_(nullptr),
       fallback_responses_served_(nullptr),
       fallback_responses_served_while_revalidate_(nullptr),
@@ -0,0 +1,310 @@
+/*
+ * Licensed to the Apache Software Foundation (ASF) under one
+ * or more contributor license agreements.  See the NOTICE file
+ * distributed with this work for additional information
+ * regarding copyright ownership.  The ASF licenses this file
+ * to you under the Apache License, Version 2.0 (the
+ * "License"); you may not use this file except in compliance
+ * with the License.  You may obtain a copy of the License at
+ * 
+ *   http://www.apache.org/licenses/LICENSE-2.0
+ * 
+ * Unless required by applicable law or agreed to in writing,
+ * software distributed under the License is distributed on an
+ * "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY
+ * KIND, either express or implied.  See the License for the
+ * specific language governing permissions and limitations
+ * under the License.
+ */
+
+#include "net/instaweb/http/public/fetch_coalescer.h"
+
+#include <algorithm>
+
+#include "base/logging.h"
+#include "net/instaweb/http/public/async_fetch.h"
+#include "pagespeed/kernel/base/abstract_mutex.h"
+#include "pagespeed/kernel/base/message_handler.h"
+#include "pagespeed/kernel/base/string.h"
+#include "pagespeed/kernel/base/string_util.h"
+#include "pagespeed/kernel/base/thread_system.h"
+#include "pagespeed/kernel/http/header_block.h"
+#include "pagespeed/kernel/http/response_headers.h"
+
+namespace net_instaweb {
+
+FetchCoalescer::Follower::~Follower() {}
+
+FetchCoalescer::Flight::Flight(FetchCoalescer* coalescer,
+                               const GoogleString& key, AbstractMutex* mutex)
+    : coalescer_(coalescer),
+      key_(key),
+      mutex_(mutex),
+      landed_(false),
+      handler_(nullptr),
+      headers_complete_(false),
+      content_start_(0),
+      replay_closed_(false),
+      delivering_(false),
+      done_(false),
+      success_(false) {}
+
+FetchCoalescer::Flight::~Flight() {}
+
+bool FetchCoalescer::Flight::Attach(Follower* follower, bool* deliver) {
+  if (replay_closed_) {
+    return false;
+  }
+  Passenger passenger = {follower, false, 0};
+  passengers_.push_back(passenger);
+  *deliver = headers_complete_ && StartDeliveryLockHeld();
+  return true;
+}
+
+void FetchCoalescer::Flight::HeadersComplete(const ResponseHeaders& headers,
+                                             bool shareable) {
+  if (!shareable) {
+    std::vector<Follower*> followers;
+    Land(&followers);
+    for (Follower* follower : followers) {
+      follower->Detach();
+      delete follower;
+    }
+    return;
+  }
+  bool deliver;
+  {
+    ScopedMutex lock(mutex_.get());
+    DCHECK(!headers_complete_);
+    headers_ = HeaderBlock(headers);
+    headers_complete_ = true;
+    deliver = StartDeliveryLockHeld();
+  }
+  if (deliver) {
+    Deliver();
+  }
+}
+
+void FetchCoalescer::Flight::Write(const StringPiece& content,
+                                   MessageHandler* handler) {
+  if (landed_) {
+    return;
+  }
+  bool deliver;
+  {
+    ScopedMutex lock(mutex_.get());
+    DCHECK(headers_complete_);
+    handler_ = handler;
+    content.AppendToString(&content_);
+    if (content_start_ + static_cast<int64>(content_.size()) >
+        kMaxReplayBytes) {
+      replay_closed_ = true;
+    }
+    deliver = StartDeliveryLockHeld();
+  }
+  if (deliver) {
+    Deliver();
+  }
+}
+
+void FetchCoalescer::Flight::Done(bool success) {
+  bool streamed;
+  {
+    ScopedMutex lock(mutex_.get());
+    streamed = headers_complete_;
+  }
+  if (!streamed) {
+    // If the fetch failed before we had anything to pass on, the followers
+    // are better off trying for themselves.
+    std::vector<Follower*> followers;
+    Land(&followers);
+    for (Follower* follower : followers) {
+      follower->Detach();
+      delete follower;
+    }
+    delete this;
+    return;
+  }
+
+  // Once out of the coalescer no more followers can attach, so whoever is
+  // delivering will find done_ set when it runs out of things to send.
+  landed_ = true;
+  coalescer_->Remove(this);
+  bool deliver;
+  {
+    ScopedMutex lock(mutex_.get());
+    done_ = true;
+    success_ = success;
+    deliver = StartDeliveryLockHeld();
+  }
+  if (deliver) {
+    Deliver();
+  }
+}
+
+bool FetchCoalescer::Flight::StartDeliveryLockHeld() {
+  if (delivering_) {
+    return false;
+  }
+  delivering_ = true;
+  return true;
+}
+
+void FetchCoalescer::Flight::Deliver() {
+  struct Delivery {
+    Follower* follower;
+    bool send_headers;
+    // Offset into pending of the content this fetch hasn't had yet.
+    int64 offset;
+  };
+  std::vector<Delivery> deliveries;
+  GoogleString pending;
+  HeaderBlock headers;
+  std::vector<Passenger> finished;
+  bool success;
+  while (true) {
+    MessageHandler* handler;
+    deliveries.clear();
+    {
+      ScopedMutex lock(mutex_.get());
+      DCHECK(delivering_);
+      int64 content_end = content_start_ + content_.size();
+      int64 pending_start = content_end;
+      for (const Passenger& passenger : passengers_) {
+        pending_start = std::min(pending_start, passenger.bytes_sent);
+      }
+      pending = content_.substr(pending_start - content_start_);
+      for (Passenger& passenger : passengers_) {
+        if (!passenger.headers_sent || (passenger.bytes_sent < content_end)) {
+          Delivery delivery = {passenger.follower, !passenger.headers_sent,
+                               passenger.bytes_sent - pending_start};
+          deliveries.push_back(delivery);
+          passenger.headers_sent = true;
+          passenger.bytes_sent = content_end;
+        }
+      }
+      TrimContentLockHeld();
+      handler = handler_;
+      headers = headers_;
+
+      if (deliveries.empty()) {
+        if (!done_) {
+          delivering_ = false;
+          return;
+        }
+        // Everything has been sent and nothing more can come in, so this
+        // thread owns what is left of the flight.
+        finished.swap(passengers_);
+        success = success_;
+        break;
+      }
+    }
+
+    for (const Delivery& delivery : deliveries) {
+      AsyncFetch* fetch = delivery.follower->follower_fetch();
+      if (delivery.send_headers) {
+        headers.CopyToResponseHeaders(fetch->response_headers());
+        fetch->response_headers()->ComputeCaching();
+        fetch->HeadersComplete();
+      }
+      if (delivery.offset < static_cast<int64>(pending.size())) {
+        fetch->Write(StringPiece(pending).substr(delivery.offset), handler);
+      }
+    }
+  }
+
+  for (const Passenger& passenger : finished) {
+    passenger.follower->follower_fetch()->Done(success);
+    delete passenger.follower;
+  }
+  delete this;
+}
+
+void FetchCoalescer::Flight::TrimContentLockHeld() {
+  if (!replay_closed_) {
+    return;
+  }
+  int64 content_end = content_start_ + content_.size();
+  int64 keep_from = content_end;
+  for (const Passenger& passenger : passengers_) {
+    keep_from = std::min(keep_from, passenger.bytes_sent);
+  }
+  content_.erase(0, keep_from - content_start_);
+  content_start_ = keep_from;
+}
+
+void FetchCoalescer::Flight::Land(std::vector<Follower*>* followers) {
+  // landed_ is only touched by the leader, so needs no lock.
+  if (landed_) {
+    return;
+  }
+  landed_ = true;
+  coalescer_->Remove(this);
+
+  // Any JoinOrLead that found us before we were removed already holds
+  // mutex_, so this waits for it to finish attaching.
+  ScopedMutex lock(mutex_.get());
+  DCHECK(!headers_complete_);
+  for (const Passenger& passenger : passengers_) {
+    followers->push_back(passenger.follower);
+  }
+  passengers_.clear();
+}
+
+FetchCoalescer::FetchCoalescer(ThreadSystem* thread_system)
+    : thread_system_(thread_system), mutex_(thread_system->NewMutex()) {}
+
+FetchCoalescer::~FetchCoalescer() { DCHECK(flights_.empty()); }
+
+FetchCoalescer::Flight* FetchCoalescer::JoinOrLead(const GoogleString& key,
+                                                   Follower* follower) {
+  mutex_->Lock();
+  FlightMap::iterator iter = flights_.find(key);
+  if (iter == flights_.end()) {
+    Flight* flight = NewFlightLockHeld(key);
+    mutex_->Unlock();
+    return flight;
+  }
+
+  // Take the flight's lock before letting go of ours, so that it can't land
+  // in between.  Catching the follower up can take a while, so it is done
+  // after letting go of both.
+  Flight* flight = iter->second;
+  flight->mutex_->Lock();
+  bool deliver = false;
+  if (!flight->Attach(follower, &deliver)) {
+    // Too late to catch up; the old flight lands on its own once it is done.
+    flight->mutex_->Unlock();
+    flight = NewFlightLockHeld(key);
+    mutex_->Unlock();
+    return flight;
+  }
+  mutex_->Unlock();
+  flight->mutex_->Unlock();
+  if (deliver) {
+    flight->Deliver();
+  }
+  return nullptr;
+}
+
+FetchCoalescer::Flight* FetchCoalescer::NewFlightLockHeld(
+    const GoogleString& key) {
+  Flight* flight = new Flight(this, key, thread_system_->NewMutex());
+  flights_[key] = flight;
+  return flight;
+}
+
+int FetchCoalescer::num_flights() const {
+  ScopedMutex lock(mutex_.get());
+  return flights_.size();
+}
+
+void FetchCoalescer::Remove(Flight* flight) {
+  ScopedMutex lock(mutex_.get());
+  FlightMap::iterator iter = flights_.find(flight->key_);
+  if (iter != flights_.end() && iter->second == flight) {
+    flights_.erase(iter);
+  }
+}
+
+}  // namespace net_instaweb
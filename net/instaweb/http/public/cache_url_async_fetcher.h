@@ -28,6 +28,7 @@
 namespace net_instaweb {
 
 class AsyncFetch;
+class FetchCoalescer;
 class Hasher;
 class Histogram;
 class HTTPCache;
@@ -57,6 +58,10 @@ class Variable;
 // otherwise, fetcher object accessed by BackgroundFreshenFetch may be deleted
 // by the time origin fetch finishes.
 //
+// If a FetchCoalescer is set, concurrent cache misses on a URL share one
+// origin fetch: later ones are streamed the response to the first, so long
+// as it is cacheable.
+//
 // TODO(sligocki): In order to use this for fetching resources for rewriting
 // we'd need to integrate resource locking in this class. Do we want that?
 class CacheUrlAsyncFetcher : public UrlAsyncFetcher {
@@ -133,6 +138,9 @@ class CacheUrlAsyncFetcher : public UrlAsyncFetcher {
     return num_proactively_freshen_user_facing_request_;
   }
 
+  void set_fetch_coalescer(FetchCoalescer* x) { fetch_coalescer_ = x; }
+  FetchCoalescer* fetch_coalescer() const { return fetch_coalescer_; }
+
   void set_respect_vary(bool x) { respect_vary_ = x; }
   bool respect_vary() const { return respect_vary_; }
 
@@ -196,6 +204,7 @@ class CacheUrlAsyncFetcher : public UrlAsyncFetcher {
   GoogleString fragment_;
   UrlAsyncFetcher* fetcher_;  // may be NULL.
   AsyncOpHooks* async_op_hooks_;
+  FetchCoalescer* fetch_coalescer_;  // may be NULL.
 
   Histogram* backend_first_byte_latency_;                  // may be NULL.
   Variable* fallback_responses_served_;                    // may be NULL.
@@ -0,0 +1,184 @@
+/*
+ * Licensed to the Apache Software Foundation (ASF) under one
+ * or more contributor license agreements.  See the NOTICE file
+ * distributed with this work for additional information
+ * regarding copyright ownership.  The ASF licenses this file
+ * to you under the Apache License, Version 2.0 (the
+ * "License"); you may not use this file except in compliance
+ * with the License.  You may obtain a copy of the License at
+ * 
+ *   http://www.apache.org/licenses/LICENSE-2.0
+ * 
+ * Unless required by applicable law or agreed to in writing,
+ * software distributed under the License is distributed on an
+ * "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY
+ * KIND, either express or implied.  See the License for the
+ * specific language governing permissions and limitations
+ * under the License.
+ */
+
+#ifndef NET_INSTAWEB_HTTP_PUBLIC_FETCH_COALESCER_H_
+#define NET_INSTAWEB_HTTP_PUBLIC_FETCH_COALESCER_H_
+
+#include <map>
+#include <memory>
+#include <vector>
+
+#include "pagespeed/kernel/base/abstract_mutex.h"
+#include "pagespeed/kernel/base/basictypes.h"
+#include "pagespeed/kernel/base/string.h"
+#include "pagespeed/kernel/base/string_util.h"
+#include "pagespeed/kernel/base/thread_annotations.h"
+#include "pagespeed/kernel/http/header_block.h"
+
+namespace net_instaweb {
+
+class AsyncFetch;
+class MessageHandler;
+class ResponseHeaders;
+class ThreadSystem;
+
+// Lets concurrent fetches of the same resource share one trip to the origin.
+// The first fetch of a key becomes the leader of a Flight and reports the
+// response to it as it arrives; fetches of the same key that come along
+// while the flight is in the air are attached to it as followers, and are
+// streamed the response, starting with whatever has arrived already.
+//
+// The leader decides, once it has the headers, whether the response may be
+// shared at all.  If not, or if the fetch fails before then, the followers
+// are detached and must fetch for themselves.
+//
+// One FetchCoalescer is shared by all the CacheUrlAsyncFetchers of a server,
+// which use it for their cache misses.
+class FetchCoalescer {
+ public:
+  // A fetch waiting for a flight to land.
+  class Follower {
+   public:
+    Follower() {}
+    virtual ~Follower();
+
+    // The fetch to stream the shared response into.
+    virtual AsyncFetch* follower_fetch() = 0;
+
+    // Called instead of streaming anything into follower_fetch() if the
+    // response can't be shared.  Should arrange for follower_fetch() to be
+    // completed some other way.
+    virtual void Detach() = 0;
+
+   private:
+    DISALLOW_COPY_AND_ASSIGN(Follower);
+  };
+
+  // An origin fetch being shared.  The leader must call HeadersComplete (at
+  // most once), Write, and finally Done, which deletes the flight.
+  //
+  // Followers are never called with a lock held.  Whichever thread finds
+  // something to pass on (the leader, or a fetch catching up as it attaches)
+  // delivers to every follower until nothing is left, while other threads
+  // just queue up their part of the response for it; that keeps each
+  // follower's view of the response in order.
+  class Flight {
+   public:
+    // Streams headers to the followers if shareable, else detaches them and
+    // stops taking on new ones.
+    void HeadersComplete(const ResponseHeaders& headers, bool shareable);
+    void Write(const StringPiece& content, MessageHandler* handler);
+    void Done(bool success);
+
+   private:
+    friend class FetchCoalescer;
+
+    // A follower, and how much of the response it has been sent.
+    struct Passenger {
+      Follower* follower;
+      bool headers_sent;
+      int64 bytes_sent;
+    };
+
+    Flight(FetchCoalescer* coalescer, const GoogleString& key,
+           AbstractMutex* mutex);
+    ~Flight();
+
+    // Adds follower, unless the flight has stopped keeping the response for
+    // late followers, in which case it returns false.  Sets *deliver if the
+    // caller must call Deliver once it has released mutex_.
+    bool Attach(Follower* follower, bool* deliver)
+        EXCLUSIVE_LOCKS_REQUIRED(mutex_);
+
+    // Returns true if the caller is to deliver, i.e. nobody else is.
+    bool StartDeliveryLockHeld() EXCLUSIVE_LOCKS_REQUIRED(mutex_);
+
+    // Passes on to each follower what it hasn't been sent yet, until there
+    // is nothing left.  If the leader is done by then, completes the
+    // followers and deletes the flight.
+    void Deliver() LOCKS_EXCLUDED(mutex_);
+
+    // Drops content every follower has been sent, once no more followers
+    // can attach.
+    void TrimContentLockHeld() EXCLUSIVE_LOCKS_REQUIRED(mutex_);
+
+    // Takes the flight out of the coalescer, so that no more followers can
+    // attach, and returns the followers it has.  Only for use before the
+    // headers are complete, when no delivery can be in progress.
+    void Land(std::vector<Follower*>* followers) LOCKS_EXCLUDED(mutex_);
+
+    FetchCoalescer* coalescer_;
+    const GoogleString key_;
+    std::unique_ptr<AbstractMutex> mutex_;
+    std::vector<Passenger> passengers_ GUARDED_BY(mutex_);
+    bool landed_;
+    MessageHandler* handler_ GUARDED_BY(mutex_);
+    bool headers_complete_ GUARDED_BY(mutex_);
+    // Shared by every follower's delivery, which copies it out under the
+    // lock at the cost of a reference.
+    HeaderBlock headers_ GUARDED_BY(mutex_);
+    // The body from content_start_ on.  Kept in full, so that followers
+    // attaching late can catch up, until it reaches kMaxReplayBytes.
+    GoogleString content_ GUARDED_BY(mutex_);
+    int64 content_start_ GUARDED_BY(mutex_);
+    bool replay_closed_ GUARDED_BY(mutex_);
+    bool delivering_ GUARDED_BY(mutex_);
+    bool done_ GUARDED_BY(mutex_);
+    bool success_ GUARDED_BY(mutex_);
+
+    DISALLOW_COPY_AND_ASSIGN(Flight);
+  };
+
+  // Once this much of a body has arrived, a flight stops taking on followers
+  // (later fetches of the key lead a flight of their own), and no longer
+  // keeps the body beyond what its followers have yet to be sent.  Bounds
+  // the memory a large coalesced response costs.
+  static const int64 kMaxReplayBytes = 1024 * 1024;
+
+  explicit FetchCoalescer(ThreadSystem* thread_system);
+  ~FetchCoalescer();
+
+  // If a flight for key is in the air, and not past kMaxReplayBytes,
+  // attaches follower to it and returns NULL; the flight takes ownership of
+  // follower, and may be caught up on the response so far before this
+  // returns.  Otherwise returns a new Flight, for which the caller must
+  // fetch key, and does not take follower.
+  Flight* JoinOrLead(const GoogleString& key, Follower* follower);
+
+  // Number of flights in the air.
+  int num_flights() const;
+
+ private:
+  typedef std::map<GoogleString, Flight*> FlightMap;
+
+  // Starts a new flight for key.
+  Flight* NewFlightLockHeld(const GoogleString& key)
+      EXCLUSIVE_LOCKS_REQUIRED(mutex_);
+  void Remove(Flight* flight) LOCKS_EXCLUDED(mutex_);
+
+  ThreadSystem* thread_system_;
+  std::unique_ptr<AbstractMutex> mutex_;
+  FlightMap flights_ GUARDED_BY(mutex_);
+
+  DISALLOW_COPY_AND_ASSIGN(FetchCoalescer);
+};
+
+}  // namespace net_instaweb
+
+#endif  // NET_INSTAWEB_HTTP_PUBLIC_FETCH_COALESCER_H_
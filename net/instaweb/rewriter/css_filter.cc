@@ -177,6 +177,7 @@ CssFilter::Context::Context(CssFilter* filter, RewriteDriver* driver,
       css_rewritten_(false),
       has_utf8_bom_(false),
       fallback_mode_(false),
+      streaming_mode_(false),
       rewrite_element_(nullptr),
       rewrite_inline_element_(nullptr),
       rewrite_inline_char_node_(nullptr),
@@ -394,6 +395,18 @@ bool CssFilter::Context::RewriteCssText(const GoogleUrl& css_base_gurl,
                                         int64 in_text_size,
                                         bool text_is_declarations,
                                         MessageHandler* handler) {
+  if (CanRewriteStreaming(text_is_declarations)) {
+    // Nothing needs the parse tree, so slot the URLs as the fallback path
+    // does and minify from the token stream in Harvest().
+    streaming_mode_ = true;
+    if (FallbackRewriteUrls(css_base_gurl, css_trim_gurl, in_text)) {
+      return true;
+    }
+    // Some URL could not be parsed; let the full parser decide.
+    streaming_mode_ = false;
+    fallback_mode_ = false;
+  }
+
   // Load stylesheet w/o expanding background attributes and preserving as
   // much content as possible from the original document.
   CssStringPiece tmp(in_text.data(), in_text.size());
@@ -560,6 +573,64 @@ bool CssFilter::Context::FallbackRewriteUrls(const GoogleUrl& css_base_gurl,
   return ret;
 }
 
+bool CssFilter::Context::CanRewriteStreaming(bool text_is_declarations) const {
+  return (!text_is_declarations &&
+          Driver()->options()->css_streaming_rewrite() &&
+          css_image_rewriter_->StreamingRewriteOk());
+}
+
+bool CssFilter::Context::SerializeCssStreaming(GoogleString* out_text,
+                                               bool* ok,
+                                               MessageHandler* handler) {
+  StringPiece contents = input_resource_->ExtractUncompressedContents();
+  StripUtf8Bom(&contents);
+  StringWriter writer(out_text);
+  if (has_utf8_bom_) {
+    writer.Write(kUtf8Bom, handler);
+  }
+  CssMinify minify(&writer, handler);
+  minify.set_url_transformer(fallback_transformer_.get());
+  GoogleUrl css_base_gurl;
+  GetCssBaseUrlToUse(input_resource_, &css_base_gurl);
+  if (!minify.MinifyStylesheetStreaming(contents)) {
+    handler->Message(kWarning, "CSS lexing error in %s",
+                     css_base_gurl.spec_c_str());
+    filter_->num_parse_failures_->Add(1);
+    mutable_output_partition(0)->add_debug_message(
+        StrCat("CSS rewrite failed: Parse error in ", css_base_gurl.Spec()));
+    out_text->clear();
+    return false;
+  }
+
+  // As in SerializeCss, don't rewrite if we didn't edit it or make it any
+  // smaller.
+  int64 bytes_saved = in_text_size_ - static_cast<int64>(out_text->size());
+  *ok = (bytes_saved > 0 || NestedSlotWasOptimized() ||
+         Driver()->options()->always_rewrite_css());
+  if (*ok) {
+    filter_->num_blocks_rewritten_->Add(1);
+    filter_->total_bytes_saved_->Add(bytes_saved);
+    filter_->total_original_bytes_->Add(in_text_size_);
+  } else {
+    filter_->num_rewrites_dropped_->Add(1);
+    mutable_output_partition(0)->add_debug_message(
+        StrCat("CSS rewrite failed: Cannot improve ", css_base_gurl.Spec()));
+  }
+  return true;
+}
+
+bool CssFilter::Context::NestedSlotWasOptimized() const {
+  for (int i = 0; i < num_nested(); ++i) {
+    RewriteContext* nested_context = nested(i);
+    for (int j = 0; j < nested_context->num_slots(); ++j) {
+      if (nested_context->slot(j)->was_optimized()) {
+        return true;
+      }
+    }
+  }
+  return false;
+}
+
 void CssFilter::Context::Harvest() {
   GoogleString out_text;
   bool ok = false;
@@ -567,8 +638,12 @@ void CssFilter::Context::Harvest() {
   // Propagate any info on images from child rewrites.
   CssImageRewriter::InheritChildImageInfo(this);
 
-  if (fallback_mode_) {
-    // If CSS was not successfully parsed.
+  if (streaming_mode_ &&
+      SerializeCssStreaming(&out_text, &ok, Driver()->message_handler())) {
+    // Minified from the token stream.
+  } else if (fallback_mode_) {
+    // If CSS was not successfully parsed, or could not even be lexed in
+    // streaming mode.
     if (fallback_transformer_.get() != nullptr) {
       StringWriter out(&out_text);
       ok = CssTagScanner::TransformUrls(
@@ -597,16 +672,7 @@ void CssFilter::Context::Harvest() {
     // If CSS was successfully parsed.
     hierarchy_.RollUpStylesheets();
 
-    bool previously_optimized = false;
-    for (int i = 0; !previously_optimized && i < num_nested(); ++i) {
-      RewriteContext* nested_context = nested(i);
-      for (int j = 0; j < nested_context->num_slots(); ++j) {
-        if (nested_context->slot(j)->was_optimized()) {
-          previously_optimized = true;
-          break;
-        }
-      }
-    }
+    bool previously_optimized = NestedSlotWasOptimized();
 
     GoogleUrl css_base_gurl_to_use;
     GetCssBaseUrlToUse(input_resource_, &css_base_gurl_to_use);
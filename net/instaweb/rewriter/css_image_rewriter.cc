@@ -88,6 +88,17 @@ bool CssImageRewriter::RewritesEnabled(int64 image_inline_max_bytes) const {
           options->Enabled(RewriteOptions::kSpriteImages));
 }
 
+bool CssImageRewriter::FlatteningEnabled() const {
+  return driver()->options()->Enabled(RewriteOptions::kFlattenCssImports);
+}
+
+bool CssImageRewriter::StreamingRewriteOk() const {
+  const RewriteOptions* options = driver()->options();
+  return (!FlatteningEnabled() &&
+          !options->Enabled(RewriteOptions::kSpriteImages) &&
+          options->Enabled(RewriteOptions::kFallbackRewriteCssUrls));
+}
+
 bool CssImageRewriter::RewriteImport(RewriteContext* parent,
                                      CssHierarchy* hierarchy,
                                      bool* is_authorized) {
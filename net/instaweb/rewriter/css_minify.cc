@@ -20,6 +20,7 @@
 #include "net/instaweb/rewriter/public/css_minify.h"
 
 #include <algorithm>
+#include <cstring>
 #include <vector>
 
 #include "base/logging.h"
@@ -55,7 +56,220 @@ bool CssMinify::ParseStylesheet(StringPiece stylesheet_text) {
   parser.set_preservation_mode(true);  // Leave in unparseable regions.
   parser.set_quirks_mode(false);       // Don't fix badly formatted colors.
   std::unique_ptr<Css::Stylesheet> stylesheet(parser.ParseRawStylesheet());
+  ReportParseErrors(parser);
 
+  Minify(*stylesheet);
+  return ok_ && (parser.errors_seen_mask() == Css::Parser::kNoError);
+}
+
+// Writes the tokens of a stylesheet, dropping comments and whitespace that
+// is not needed to separate tokens.
+class CssMinify::TokenMinifier : public Css::Parser::TokenHandler {
+ public:
+  explicit TokenMinifier(CssMinify* minify)
+      : minify_(minify),
+        last_char_('\0'),
+        pending_space_(false),
+        pending_comment_(false),
+        pending_semicolon_(false),
+        statement_tokens_(0),
+        statement_opens_rule_list_(false),
+        statement_starts_with_ident_(false) {}
+
+  void HandleToken(Css::Parser::TokenType type, CssStringPiece text) override {
+    switch (type) {
+      case Css::Parser::kWhitespaceToken:
+        pending_space_ = true;
+        return;
+      case Css::Parser::kCommentToken:
+        // Unlike whitespace, a comment does not separate simple selectors:
+        // ".a/**/.b" is ".a.b".
+        pending_comment_ = true;
+        return;
+      case Css::Parser::kDelimToken:
+        if (text[0] == ';') {
+          if (InDeclarations() && statement_tokens_ == 0) {
+            // An empty declaration, as in "a{;b:c;;}", is dropped.  At the
+            // top level a stray ';' starts the prelude of the next rule, so
+            // it is kept there.
+            pending_space_ = false;
+            pending_comment_ = false;
+            return;
+          }
+          if (pending_semicolon_) {
+            Emit(";");
+          }
+          // Whitespace before the ';' is never needed.
+          pending_space_ = false;
+          pending_comment_ = false;
+          pending_semicolon_ = true;
+          StartStatement();
+          return;
+        } else if (text[0] == ':' && InPropertyName()) {
+          // "margin :0" is "margin:0", though "a :hover" is not "a:hover".
+          pending_space_ = false;
+          pending_comment_ = false;
+        } else if (text[0] == '{') {
+          block_is_declarations_.push_back(!statement_opens_rule_list_);
+        } else if (text[0] == '}' && !block_is_declarations_.empty()) {
+          block_is_declarations_.pop_back();
+        }
+        break;
+      default:
+        break;
+    }
+    StartToken(text[0]);
+    Emit(StringPiece(text.data(), text.size()));
+    if (type == Css::Parser::kDelimToken &&
+        (text[0] == '{' || text[0] == '}')) {
+      StartStatement();
+    } else {
+      CountStatementToken(type, text);
+    }
+  }
+
+  void HandleUrl(CssStringPiece text, const UnicodeText& url) override {
+    GoogleString url_string(url.utf8_data(), url.utf8_length());
+    CssTagScanner::Transformer* transformer = minify_->url_transformer_;
+    if (transformer != nullptr) {
+      GoogleString transformed = url_string;
+      if (transformer->Transform(&transformed) ==
+          CssTagScanner::Transformer::kFailure) {
+        minify_->ok_ = false;
+      } else {
+        url_string.swap(transformed);
+      }
+    }
+    if (minify_->url_collector_ != nullptr) {
+      minify_->url_collector_->push_back(url_string);
+    }
+    StartToken(text[0]);
+    CountStatementToken(Css::Parser::kUrlToken, text);
+    if (text[0] == '"' || text[0] == '\'') {
+      // The string form of @import.
+      Emit(StrCat("\"", Css::EscapeString(url_string), "\""));
+    } else {
+      Emit(StrCat("url(", Css::EscapeUrl(url_string), ")"));
+    }
+  }
+
+  void Finish() {
+    if (pending_semicolon_) {
+      Emit(";");
+    }
+  }
+
+ private:
+  // Whitespace may be dropped after these characters...
+  static bool SeparatesAfter(char c) {
+    return c == '\0' || strchr("{};:,>(", c) != nullptr;
+  }
+  // ... and before these.
+  static bool SeparatesBefore(char c) {
+    return strchr("{};,>)!", c) != nullptr;
+  }
+  static bool IsIdentChar(char c) {
+    return ((c >= 'A' && c <= 'Z') || (c >= 'a' && c <= 'z') ||
+            (c >= '0' && c <= '9') || c == '-' || c == '_' || c == '\\' ||
+            (c & 0x80) != 0);
+  }
+
+  // At-rules whose blocks hold rules rather than declarations.
+  static bool OpensRuleList(CssStringPiece at_keyword) {
+    static const char* const kRuleListAtRules[] = {
+        "@container", "@document", "@-moz-document", "@layer",
+        "@media",     "@scope",    "@starting-style", "@supports"};
+    for (const char* at_rule : kRuleListAtRules) {
+      if (StringCaseEqual(StringPiece(at_keyword.data(), at_keyword.size()),
+                          at_rule)) {
+        return true;
+      }
+    }
+    return false;
+  }
+
+  void StartStatement() {
+    statement_tokens_ = 0;
+    statement_opens_rule_list_ = false;
+    statement_starts_with_ident_ = false;
+  }
+
+  void CountStatementToken(Css::Parser::TokenType type, CssStringPiece text) {
+    if (statement_tokens_++ == 0) {
+      statement_opens_rule_list_ =
+          (type == Css::Parser::kAtKeywordToken && OpensRuleList(text));
+      statement_starts_with_ident_ = (type == Css::Parser::kIdentToken);
+    }
+  }
+
+  // Whether the innermost open block holds declarations.
+  bool InDeclarations() const {
+    return !block_is_declarations_.empty() && block_is_declarations_.back();
+  }
+
+  // Whether the tokens so far can only be the name of a property.
+  bool InPropertyName() const {
+    return (InDeclarations() && statement_tokens_ == 1 &&
+            statement_starts_with_ident_);
+  }
+
+  // Writes whatever must precede a token starting with first_char.
+  void StartToken(char first_char) {
+    if (pending_semicolon_) {
+      pending_semicolon_ = false;
+      // The last declaration in a block does not need its ';'.
+      if (first_char != '}') {
+        Emit(";");
+      }
+    }
+    if (pending_space_) {
+      if (!SeparatesAfter(last_char_) && !SeparatesBefore(first_char)) {
+        Emit(" ");
+      }
+    } else if (pending_comment_ && IsIdentChar(last_char_) &&
+               IsIdentChar(first_char)) {
+      // Keep "a/**/b" as two tokens.
+      Emit("/**/");
+    }
+    pending_space_ = false;
+    pending_comment_ = false;
+  }
+
+  void Emit(StringPiece text) {
+    minify_->Write(text);
+    last_char_ = text[text.size() - 1];
+  }
+
+  CssMinify* minify_;
+  char last_char_;
+  bool pending_space_;
+  bool pending_comment_;
+  bool pending_semicolon_;
+
+  // For each open block, whether it holds declarations (as opposed to
+  // rules, as in @media).
+  std::vector<bool> block_is_declarations_;
+  // Tokens since the last '{', '}' or ';', not counting whitespace and
+  // comments, and what the first of them was.
+  int statement_tokens_;
+  bool statement_opens_rule_list_;
+  bool statement_starts_with_ident_;
+
+  DISALLOW_COPY_AND_ASSIGN(TokenMinifier);
+};
+
+bool CssMinify::MinifyStylesheetStreaming(StringPiece stylesheet_text) {
+  ok_ = true;
+  CssStringPiece tmp(stylesheet_text.data(), stylesheet_text.size());
+  Css::Parser parser(tmp);
+  TokenMinifier minifier(this);
+  parser.Tokenize(&minifier);
+  minifier.Finish();
+  ReportParseErrors(parser);
+  return ok_ && (parser.errors_seen_mask() == Css::Parser::kNoError);
+}
+
+void CssMinify::ReportParseErrors(const Css::Parser& parser) {
   // Report error summary.
   if (error_writer_ != nullptr) {
     if (parser.errors_seen_mask() != Css::Parser::kNoError) {
@@ -79,9 +293,6 @@ bool CssMinify::ParseStylesheet(StringPiece stylesheet_text) {
       error_writer_->Write("\n", handler_);
     }
   }
-
-  Minify(*stylesheet);
-  return ok_ && (parser.errors_seen_mask() == Css::Parser::kNoError);
 }
 
 bool CssMinify::Declarations(const Css::Declarations& declarations,
@@ -98,6 +309,7 @@ CssMinify::CssMinify(Writer* writer, MessageHandler* handler)
       handler_(handler),
       ok_(true),
       url_collector_(nullptr),
+      url_transformer_(nullptr),
       in_css_calc_function_(false) {}
 
 CssMinify::~CssMinify() {}
@@ -32,6 +32,7 @@ namespace net_instaweb {
 
 DeviceProperties::DeviceProperties(UserAgentMatcher* matcher)
     : ua_matcher_(matcher),
+      classified_(kNotSet),
       supports_critical_css_(kNotSet),
       supports_image_inlining_(kNotSet),
       supports_js_defer_(kNotSet),
@@ -55,6 +56,7 @@ void DeviceProperties::SetUserAgent(const StringPiece& user_agent_string) {
   user_agent_string.CopyToString(&user_agent_);
 
   // Reset everything determined by user agent.
+  classified_ = kNotSet;
   supports_critical_css_ = kNotSet;
   supports_image_inlining_ = kNotSet;
   supports_js_defer_ = kNotSet;
@@ -91,6 +93,15 @@ void DeviceProperties::ParseRequestHeaders(
   has_via_header_ = request_headers.Has(HttpAttributes::kVia) ? kTrue : kFalse;
 }
 
+const UserAgentMatcher::Classification& DeviceProperties::classification()
+    const {
+  if (classified_ == kNotSet) {
+    ua_matcher_->Classify(user_agent_, &classification_);
+    classified_ = kTrue;
+  }
+  return classification_;
+}
+
 bool DeviceProperties::AcceptsGzip() const {
   if (accepts_gzip_ == kNotSet) {
     LOG(DFATAL) << "Check of AcceptsGzip before value is set.";
@@ -102,7 +113,7 @@ bool DeviceProperties::AcceptsGzip() const {
 bool DeviceProperties::SupportsImageInlining() const {
   if (supports_image_inlining_ == kNotSet) {
     supports_image_inlining_ =
-        ua_matcher_->SupportsImageInlining(user_agent_) ? kTrue : kFalse;
+        classification().SupportsImageInlining() ? kTrue : kFalse;
   }
   return (supports_image_inlining_ == kTrue);
 }
@@ -110,8 +121,8 @@ bool DeviceProperties::SupportsImageInlining() const {
 bool DeviceProperties::SupportsLazyloadImages() const {
   if (supports_lazyload_images_ == kNotSet) {
     supports_lazyload_images_ =
-        (!IsBot() && ua_matcher_->SupportsLazyloadImages(user_agent_)) ? kTrue
-                                                                       : kFalse;
+        (!IsBot() && classification().SupportsLazyloadImages()) ? kTrue
+                                                                : kFalse;
   }
   return (supports_lazyload_images_ == kTrue);
 }
@@ -124,7 +135,7 @@ bool DeviceProperties::SupportsCriticalCss() const {
   // X-UA-Compatible, which can come in both meta and header flavors. Once we
   // have a good way of detecting this case, we can enable us for strict IE10.
   if (supports_critical_css_ == kNotSet) {
-    supports_critical_css_ = !ua_matcher_->IsIe(user_agent_) ? kTrue : kFalse;
+    supports_critical_css_ = !classification().IsIe() ? kTrue : kFalse;
   }
   return (supports_critical_css_ == kTrue);
 }
@@ -142,9 +153,8 @@ bool DeviceProperties::SupportsCriticalImagesBeacon() const {
 // value for allow_mobile.
 bool DeviceProperties::SupportsJsDefer(bool allow_mobile) const {
   if (supports_js_defer_ == kNotSet) {
-    supports_js_defer_ = ua_matcher_->SupportsJsDefer(user_agent_, allow_mobile)
-                             ? kTrue
-                             : kFalse;
+    supports_js_defer_ =
+        classification().SupportsJsDefer(allow_mobile) ? kTrue : kFalse;
   }
   return (supports_js_defer_ == kTrue);
 }
@@ -164,7 +174,7 @@ bool DeviceProperties::SupportsWebpInPlace() const {
 // by only checking the "accept" header.
 bool DeviceProperties::SupportsWebpRewrittenUrls() const {
   if (supports_webp_rewritten_urls_ == kNotSet) {
-    if ((accepts_webp_ == kTrue) || ua_matcher_->LegacyWebp(user_agent_)) {
+    if ((accepts_webp_ == kTrue) || classification().LegacyWebp()) {
       supports_webp_rewritten_urls_ = kTrue;
     } else {
       supports_webp_rewritten_urls_ = kFalse;
@@ -176,7 +186,7 @@ bool DeviceProperties::SupportsWebpRewrittenUrls() const {
 bool DeviceProperties::SupportsWebpLosslessAlpha() const {
   if (supports_webp_lossless_alpha_ == kNotSet) {
     if ((accepts_webp_ == kTrue) &&
-        ua_matcher_->SupportsWebpLosslessAlpha(user_agent_)) {
+        classification().SupportsWebpLosslessAlpha()) {
       supports_webp_lossless_alpha_ = kTrue;
     } else {
       supports_webp_lossless_alpha_ = kFalse;
@@ -188,7 +198,7 @@ bool DeviceProperties::SupportsWebpLosslessAlpha() const {
 bool DeviceProperties::SupportsWebpAnimated() const {
   if (supports_webp_animated_ == kNotSet) {
     if ((accepts_webp_ == kTrue) &&
-        ua_matcher_->SupportsWebpAnimated(user_agent_)) {
+        classification().SupportsWebpAnimated()) {
       supports_webp_animated_ = kTrue;
     } else {
       supports_webp_animated_ = kFalse;
@@ -206,7 +216,7 @@ bool DeviceProperties::IsBot() const {
 
 UserAgentMatcher::DeviceType DeviceProperties::GetDeviceType() const {
   if (device_type_set_ == kNotSet) {
-    device_type_ = ua_matcher_->GetDeviceTypeForUA(user_agent_);
+    device_type_ = classification().device_type();
     device_type_set_ = kTrue;
   }
   return device_type_;
@@ -216,13 +226,13 @@ UserAgentMatcher::DeviceType DeviceProperties::GetDeviceType() const {
 // WebP on these devices is forbidden.
 // https://bugs.chromium.org/p/chromium/issues/detail?id=402514
 bool DeviceProperties::ForbidWebpInlining() const {
-  if (ua_matcher_->IsiOSUserAgent(user_agent_)) {
+  if (classification().IsiOSUserAgent()) {
     int major = kNotSet;
     int minor = kNotSet;
     int build = kNotSet;
     int patch = kNotSet;
-    if (ua_matcher_->GetChromeBuildNumber(user_agent_, &major, &minor, &build,
-                                          &patch) &&
+    if (classification().GetChromeBuildNumber(&major, &minor, &build,
+                                               &patch) &&
         (major == 36 || major == 37)) {
       return true;
     }
@@ -79,9 +79,9 @@ void FileInputResource::FillInPartitionInputInfo(HashHint include_content_hash,
     // unset.  We should be preventing this at a higher level because
     // FileInputResource::UseHttpCache returns false.  But we'll
     // defensively fill in the timestamp anyway in production.
-    FileSystem* file_system = server_context_->file_system();
-    if (!file_system->Mtime(filename_, &last_modified_time_sec_,
-                            server_context()->message_handler())) {
+    if (!server_context_->LoadFromFileMtime(
+            filename_, &last_modified_time_sec_,
+            server_context()->message_handler())) {
       LOG(DFATAL) << "Could not get last_modified_time_ for file " << filename_;
     }
   }
@@ -149,7 +149,8 @@ void FileInputResource::LoadAndCallback(
     // TODO(jefftk): Refactor the FileSystem API to allow you to Open() a handle
     // and then make a series of calls on it.  Probably caching stat responses.
     FileSystem* file_system = server_context_->file_system();
-    if (file_system->Mtime(filename_, &last_modified_time_sec_, handler) &&
+    if (server_context_->LoadFromFileMtime(filename_, &last_modified_time_sec_,
+                                           handler) &&
         last_modified_time_sec_ != kTimestampUnset &&
         file_system->ReadFile(filename_.c_str(), max_file_size_, &value_,
                               handler)) {
@@ -0,0 +1,43 @@
+/*
+ * Licensed to the Apache Software Foundation (ASF) under one
+ * or more contributor license agreements.  See the NOTICE file
+ * distributed with this work for additional information
+ * regarding copyright ownership.  The ASF licenses this file
+ * to you under the Apache License, Version 2.0 (the
+ * "License"); you may not use this file except in compliance
+ * with the License.  You may obtain a copy of the License at
+ * 
+ *   http://www.apache.org/licenses/LICENSE-2.0
+ * 
+ * Unless required by applicable law or agreed to in writing,
+ * software distributed under the License is distributed on an
+ * "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY
+ * KIND, either express or implied.  See the License for the
+ * specific language governing permissions and limitations
+ * under the License.
+ */
+
+#include "net/instaweb/rewriter/public/head_flush_filter.h"
+
+#include "net/instaweb/rewriter/public/rewrite_driver.h"
+#include "pagespeed/kernel/html/html_element.h"
+#include "pagespeed/kernel/html/html_name.h"
+
+namespace net_instaweb {
+
+HeadFlushFilter::HeadFlushFilter(RewriteDriver* driver)
+    : driver_(driver), seen_head_(false) {}
+
+HeadFlushFilter::~HeadFlushFilter() {}
+
+void HeadFlushFilter::StartDocument() { seen_head_ = false; }
+
+void HeadFlushFilter::EndElement(HtmlElement* element) {
+  // Only the first head counts; browsers merge any later ones into the body.
+  if (!seen_head_ && (element->keyword() == HtmlName::kHead)) {
+    seen_head_ = true;
+    driver_->HeadParsed();
+  }
+}
+
+}  // namespace net_instaweb
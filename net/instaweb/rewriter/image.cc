@@ -54,6 +54,7 @@ extern "C" {
 #include "pagespeed/kernel/image/jpeg_utils.h"
 #include "pagespeed/kernel/image/png_optimizer.h"
 #include "pagespeed/kernel/image/read_image.h"
+#include "pagespeed/kernel/image/resampling_pyramid.h"
 #include "pagespeed/kernel/image/scanline_interface.h"
 #include "pagespeed/kernel/image/scanline_status.h"
 #include "pagespeed/kernel/image/scanline_utils.h"
@@ -75,6 +76,7 @@ extern "C" {
 using pagespeed::image_compression::AnalyzeImage;
 using pagespeed::image_compression::ConversionTimeoutHandler;
 using pagespeed::image_compression::CreateScanlineReader;
+using pagespeed::image_compression::CreateScanlineReaderForSize;
 using pagespeed::image_compression::CreateScanlineWriter;
 using pagespeed::image_compression::GifReader;
 using pagespeed::image_compression::GRAY_8;
@@ -92,6 +94,7 @@ using pagespeed::image_compression::PngReader;
 using pagespeed::image_compression::PngReaderInterface;
 using pagespeed::image_compression::PngScanlineWriter;
 using pagespeed::image_compression::PreferredLibwebpLevel;
+using pagespeed::image_compression::ResamplingPyramid;
 using pagespeed::image_compression::RETAIN;
 using pagespeed::image_compression::RGB_888;
 using pagespeed::image_compression::RGBA_8888;
@@ -215,6 +218,10 @@ class ImageImpl : public Image {
 
   void Dimensions(ImageDim* natural_dim) override;
   bool ResizeTo(const ImageDim& new_dim) override;
+  ResamplingPyramid* NewResamplingPyramid() override;
+  void SetResamplingPyramid(const ResamplingPyramid* pyramid) override {
+    pyramid_ = pyramid;
+  }
   bool DrawImage(Image* image, int x, int y) override;
   bool EnsureLoaded(bool output_useful) override;
   bool ShouldConvertToProgressive(int64 quality) const override;
@@ -322,6 +329,7 @@ class ImageImpl : public Image {
   ImageDim dims_;
   ImageDim resized_dimensions_;
   GoogleString resized_image_;
+  const ResamplingPyramid* pyramid_;
   std::unique_ptr<Image::CompressionOptions> options_;
   bool low_quality_enabled_;
   Timer* timer_;
@@ -359,6 +367,7 @@ ImageImpl::ImageImpl(const StringPiece& original_contents,
       file_prefix_(file_prefix.data(), file_prefix.size()),
       changed_(false),
       url_(url),
+      pyramid_(nullptr),
       options_(options),
       low_quality_enabled_(false),
       timer_(timer) {
@@ -387,6 +396,7 @@ ImageImpl::ImageImpl(int width, int height, ImageType type,
     : Image(type),
       file_prefix_(tmp_dir.data(), tmp_dir.size()),
       changed_(false),
+      pyramid_(nullptr),
       low_quality_enabled_(false),
       timer_(timer) {
   options_.reset(options);
@@ -660,9 +670,18 @@ bool ImageImpl::ResizeTo(const ImageDim& new_dim) {
     return false;
   }
 
-  std::unique_ptr<ScanlineReaderInterface> image_reader(
-      CreateScanlineReader(original_format, original_contents_.data(),
-                           original_contents_.length(), handler_.get()));
+  std::unique_ptr<ScanlineReaderInterface> image_reader;
+  if (pyramid_ != nullptr) {
+    // Start from the smallest already-decoded copy that is large enough.
+    image_reader.reset(pyramid_->NewReader(new_dim.width(), new_dim.height(),
+                                           handler_.get()));
+  } else {
+    // Large JPEG reductions are partly done by libjpeg while decoding.
+    image_reader.reset(CreateScanlineReaderForSize(
+        original_format, original_contents_.data(),
+        original_contents_.length(), new_dim.width(), new_dim.height(),
+        handler_.get()));
+  }
   if (image_reader == nullptr) {
     resize_debug_message_ =
         absl::StrFormat("Cannot resize: Cannot open the image%s to resize",
@@ -746,6 +765,21 @@ bool ImageImpl::ResizeTo(const ImageDim& new_dim) {
   return true;
 }
 
+ResamplingPyramid* ImageImpl::NewResamplingPyramid() {
+  // Same restriction as ResizeTo.
+  const ImageFormat original_format = ImageTypeToImageFormat(image_type());
+  if (original_format == pagespeed::image_compression::IMAGE_WEBP) {
+    return nullptr;
+  }
+  std::unique_ptr<ScanlineReaderInterface> image_reader(
+      CreateScanlineReader(original_format, original_contents_.data(),
+                           original_contents_.length(), handler_.get()));
+  if (image_reader == nullptr) {
+    return nullptr;
+  }
+  return ResamplingPyramid::Create(image_reader.get(), handler_.get());
+}
+
 void ImageImpl::UndoChange() {
   if (changed_) {
     output_valid_ = false;
@@ -25,6 +25,7 @@
 #include <algorithm>
 #include <climits>
 #include <cstdarg>
+#include <memory>
 #include <utility>
 #include <vector>
 
@@ -57,6 +58,7 @@
 #include "net/instaweb/util/public/property_cache.h"
 #include "pagespeed/controller/central_controller.h"
 #include "pagespeed/controller/expensive_operation_callback.h"
+#include "pagespeed/kernel/base/abstract_mutex.h"
 #include "pagespeed/kernel/base/basictypes.h"
 #include "pagespeed/kernel/base/escaping.h"
 #include "pagespeed/kernel/base/message_handler.h"
@@ -64,6 +66,7 @@
 #include "pagespeed/kernel/base/statistics.h"
 #include "pagespeed/kernel/base/string.h"
 #include "pagespeed/kernel/base/string_util.h"
+#include "pagespeed/kernel/base/thread_system.h"
 #include "pagespeed/kernel/base/timer.h"
 #include "pagespeed/kernel/html/html_element.h"
 #include "pagespeed/kernel/html/html_name.h"
@@ -74,6 +77,7 @@
 #include "pagespeed/kernel/http/response_headers.h"
 #include "pagespeed/kernel/http/semantic_type.h"
 #include "pagespeed/kernel/image/image_util.h"
+#include "pagespeed/kernel/image/resampling_pyramid.h"
 #include "pagespeed/kernel/thread/queued_worker_pool.h"
 #include "pagespeed/kernel/util/simple_random.h"
 #include "pagespeed/opt/logging/enums.pb.h"
@@ -81,6 +85,8 @@
 
 namespace net_instaweb {
 
+using pagespeed::image_compression::ResamplingPyramid;
+
 namespace {
 
 void DetermineQualities(const RewriteOptions& options,
@@ -236,7 +242,10 @@ const char ImageRewriteFilter::kImageRewritesDroppedDueToLoad[] =
     "image_rewrites_dropped_due_to_load";
 const char ImageRewriteFilter::kImageRewritesSquashingForMobileScreen[] =
     "image_rewrites_squashing_for_mobile_screen";
-const char kImageRewriteTotalBytesSaved[] = "image_rewrite_total_bytes_saved";
+const char ImageRewriteFilter::kImageResizedFromSharedDecode[] =
+    "image_resized_from_shared_decode";
+const char ImageRewriteFilter::kImageRewriteTotalBytesSaved[] =
+    "image_rewrite_total_bytes_saved";
 const char kImageRewriteTotalOriginalBytes[] =
     "image_rewrite_total_original_bytes";
 const char kImageRewriteUses[] = "image_rewrite_uses";
@@ -395,7 +404,11 @@ class ImageRewriteFilter::Context : public SingleRewriteContext {
         in_noscript_element_(in_noscript_element),
         is_resized_using_rendered_dimensions_(
             is_resized_using_rendered_dimensions) {}
-  ~Context() override {}
+  ~Context() override {
+    if (!shared_source_url_.empty()) {
+      filter_->ReleaseSharedSource(shared_source_url_);
+    }
+  }
 
   bool PolicyPermitsRendering() const override;
   void Render() override;
@@ -434,6 +447,9 @@ class ImageRewriteFilter::Context : public SingleRewriteContext {
   const int html_index_;
   bool in_noscript_element_;
   bool is_resized_using_rendered_dimensions_;
+  // Set if this context shares its decoded input with the contexts for the
+  // other variants of a responsive image.
+  GoogleString shared_source_url_;
 
   DISALLOW_COPY_AND_ASSIGN(Context);
 };
@@ -640,7 +656,10 @@ void ImageRewriteFilter::Context::EncodeUserAgentIntoResourceContext(
 }
 
 ImageRewriteFilter::ImageRewriteFilter(RewriteDriver* driver)
-    : RewriteFilter(driver), image_counter_(0), saw_end_document_(false) {
+    : RewriteFilter(driver),
+      image_counter_(0),
+      saw_end_document_(false),
+      shared_sources_mutex_(server_context()->thread_system()->NewMutex()) {
   Statistics* stats = server_context()->statistics();
   image_rewrites_ = stats->GetVariable(kImageRewrites);
   image_resized_using_rendered_dimensions_ =
@@ -663,6 +682,8 @@ ImageRewriteFilter::ImageRewriteFilter(RewriteDriver* driver)
       stats->GetTimedVariable(kImageRewritesDroppedDueToLoad);
   image_rewrites_squashing_for_mobile_screen_ =
       stats->GetTimedVariable(kImageRewritesSquashingForMobileScreen);
+  image_resized_from_shared_decode_ =
+      stats->GetVariable(kImageResizedFromSharedDecode);
   image_rewrite_total_bytes_saved_ =
       stats->GetVariable(kImageRewriteTotalBytesSaved);
   image_rewrite_total_original_bytes_ =
@@ -744,6 +765,7 @@ void ImageRewriteFilter::InitStats(Statistics* statistics) {
                                Statistics::kDefaultGroup);
   statistics->AddTimedVariable(kImageRewritesSquashingForMobileScreen,
                                Statistics::kDefaultGroup);
+  statistics->AddVariable(kImageResizedFromSharedDecode);
   statistics->AddVariable(kImageRewriteTotalBytesSaved);
   statistics->AddVariable(kImageRewriteTotalOriginalBytes);
   statistics->AddVariable(kImageRewriteUses);
@@ -889,8 +911,9 @@ Image::CompressionOptions* ImageRewriteFilter::ImageOptionsForLoadedResource(
 // Resize image if necessary, returning true if this resizing succeeds and false
 // if it's unnecessary or fails.
 bool ImageRewriteFilter::ResizeImageIfNecessary(
-    const Context* rewrite_context, const GoogleString& url,
+    const Context* rewrite_context, const ResourcePtr& input_resource,
     ResourceContext* resource_context, Image* image, CachedResult* cached) {
+  const GoogleString& url = input_resource->url();
   bool resized = false;
   // Begin by resizing the image if necessary
   ImageDim image_dim;
@@ -913,14 +936,22 @@ bool ImageRewriteFilter::ResizeImageIfNecessary(
     DCHECK_LT(0, desired_dim->width());
     DCHECK_LT(0, desired_dim->height());
 
+    std::shared_ptr<const ResamplingPyramid> pyramid =
+        SharedPyramid(rewrite_context, input_resource, image);
+    image->SetResamplingPyramid(pyramid.get());
+
     const char* message;  // Informational message for logging only.
     if (image->ResizeTo(*desired_dim)) {
       post_resize_dim = desired_dim;
       message = "Resized";
       resized = true;
+      if (pyramid != nullptr) {
+        image_resized_from_shared_decode_->Add(1);
+      }
     } else {
       message = "Couldn't resize";
     }
+    image->SetResamplingPyramid(nullptr);
 
     driver()->InfoAt(rewrite_context, "%s image `%s' from %dx%d to %dx%d",
                      message, url.c_str(), image_dim.width(),
@@ -943,6 +974,56 @@ bool ImageRewriteFilter::ResizeImageIfNecessary(
   return resized;
 }
 
+void ImageRewriteFilter::AddSharedSource(const GoogleString& url) {
+  ScopedMutex lock(shared_sources_mutex_.get());
+  ++shared_sources_[url].num_contexts;
+}
+
+void ImageRewriteFilter::ReleaseSharedSource(const GoogleString& url) {
+  ScopedMutex lock(shared_sources_mutex_.get());
+  SharedSourceMap::iterator p = shared_sources_.find(url);
+  DCHECK(p != shared_sources_.end());
+  if (p != shared_sources_.end() && --p->second.num_contexts == 0) {
+    shared_sources_.erase(p);
+  }
+}
+
+std::shared_ptr<const ResamplingPyramid> ImageRewriteFilter::SharedPyramid(
+    const Context* rewrite_context, const ResourcePtr& input_resource,
+    Image* image) {
+  std::shared_ptr<const ResamplingPyramid> pyramid;
+  const GoogleString& url = rewrite_context->shared_source_url_;
+  if (url.empty()) {
+    return pyramid;
+  }
+  // The virtual images were all fetched separately, so make sure they really
+  // do have the same contents before sharing a decode between them.
+  GoogleString contents_hash = input_resource->ContentsHash();
+  {
+    ScopedMutex lock(shared_sources_mutex_.get());
+    SharedSourceMap::iterator p = shared_sources_.find(url);
+    if (p != shared_sources_.end() && p->second.pyramid != nullptr &&
+        p->second.contents_hash == contents_hash) {
+      pyramid = p->second.pyramid;
+      return pyramid;
+    }
+  }
+
+  // Decode without holding the lock. The variants of an image are normally
+  // rewritten one after another on the driver's low-priority worker, so two
+  // of them racing to build the same pyramid is rare and merely wasteful.
+  pyramid.reset(image->NewResamplingPyramid());
+  if (pyramid != nullptr) {
+    ScopedMutex lock(shared_sources_mutex_.get());
+    SharedSourceMap::iterator p = shared_sources_.find(url);
+    if (p != shared_sources_.end()) {
+      p->second.contents_hash.swap(contents_hash);
+      p->second.pyramid = pyramid;
+    }
+  }
+  return pyramid;
+}
+
 // Determines whether an image should be resized based on the current options.
 //
 // Returns the dimensions to resize to in *desired_dimensions.
@@ -1085,7 +1166,7 @@ RewriteResult ImageRewriteFilter::RewriteLoadedResourceImpl(
   Timer* timer = server_context()->timer();
   int64 rewrite_time_start_ms = GetCurrentCpuTimeMs(timer);
   CachedResult* cached = result->EnsureCachedResultCreated();
-  is_resized = ResizeImageIfNecessary(rewrite_context, input_resource->url(),
+  is_resized = ResizeImageIfNecessary(rewrite_context, input_resource,
                                       &resource_context, image.get(), cached);
 
   // When the "resize_images" filter has been turned on and the IMG tag has
@@ -1456,6 +1537,10 @@ void ImageRewriteFilter::BeginRewriteImageUrl(HtmlElement* element,
       nullptr /*not nested */, resource_context.release(),
       Context::Place::kHtmlAttr, image_counter_++,
       noscript_element() != nullptr, is_resized_using_rendered_dimensions);
+  if (element->HasAttribute(HtmlName::kDataPagespeedResponsiveTemp)) {
+    context->shared_source_url_ = input_resource->url();
+    AddSharedSource(context->shared_source_url_);
+  }
   ResourceSlotPtr slot(driver()->GetSlot(input_resource, element, src));
   context->AddSlot(slot);
 
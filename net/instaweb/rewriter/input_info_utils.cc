@@ -160,8 +160,8 @@ bool IsInputValid(ServerContext* server_context, const RewriteOptions* options,
         return false;
       }
       int64 mtime_sec;
-      server_context->file_system()->Mtime(input_info.filename(), &mtime_sec,
-                                           server_context->message_handler());
+      server_context->LoadFromFileMtime(input_info.filename(), &mtime_sec,
+                                        server_context->message_handler());
       int64 mtime_ms = mtime_sec * Timer::kSecondMs;
 
       CacheInterface* fsmdc = server_context->filesystem_metadata_cache();
@@ -324,6 +324,22 @@ class CssFilter::Context : public SingleRewriteContext {
                            const GoogleUrl& css_trim_gurl,
                            const StringPiece& in_text);
 
+  // Whether the stylesheet can be rewritten from its token stream alone,
+  // without building a Css::Stylesheet.
+  bool CanRewriteStreaming(bool text_is_declarations) const;
+
+  // Minifies the input from its token stream, rewriting URLs with
+  // fallback_transformer_.  Used in Harvest() instead of SerializeCss when
+  // streaming_mode_ is set.  Returns false, leaving out_text empty, if the
+  // input could not be lexed, in which case Harvest() falls back to
+  // rewriting just the URLs.  Otherwise sets *ok to whether out_text should
+  // be used, which like SerializeCss requires it to be an improvement.
+  bool SerializeCssStreaming(GoogleString* out_text, bool* ok,
+                             MessageHandler* handler);
+
+  // Whether any nested rewrite (of an image, say) optimized its slot.
+  bool NestedSlotWasOptimized() const;
+
   // Tries to write out a (potentially edited) stylesheet out to out_text,
   // and returns whether we should consider the result as an improvement.
   bool SerializeCss(int64 in_text_size, const Css::Stylesheet* stylesheet,
@@ -354,6 +370,9 @@ class CssFilter::Context : public SingleRewriteContext {
 
   // Are we performing a fallback rewrite?
   bool fallback_mode_;
+  // Are we rewriting from the token stream by choice (see
+  // CanRewriteStreaming)?  Implies fallback_mode_, whose slots it shares.
+  bool streaming_mode_;
   // Transformer used by CssTagScanner to rewrite URLs if we failed to
   // parse CSS. This will only be defined if CSS parsing failed.
   std::unique_ptr<AssociationTransformer> fallback_transformer_;
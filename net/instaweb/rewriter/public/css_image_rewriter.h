@@ -67,6 +67,11 @@ class CssImageRewriter {
   // Are any rewrites enabled?
   bool RewritesEnabled(int64 image_inline_max_bytes) const;
 
+  // Can images be rewritten through URL slots alone, without a parsed
+  // stylesheet?  False if @import flattening or spriting needs the tree, or
+  // if fallback URL rewriting, which the slots come from, is disabled.
+  bool StreamingRewriteOk() const;
+
   // Rewrite an image already loaded into a slot. Used by RewriteImage and
   // AssociationTransformer to rewrite images in either case.
   void RewriteSlot(const ResourceSlotPtr& slot, int64 image_inline_max_bytes,
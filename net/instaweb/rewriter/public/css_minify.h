@@ -20,10 +20,12 @@
 #ifndef NET_INSTAWEB_REWRITER_PUBLIC_CSS_MINIFY_H_
 #define NET_INSTAWEB_REWRITER_PUBLIC_CSS_MINIFY_H_
 
+#include "net/instaweb/rewriter/public/css_tag_scanner.h"
 #include "pagespeed/kernel/base/basictypes.h"
 #include "pagespeed/kernel/base/string_util.h"
 
 namespace Css {
+class Parser;
 class Stylesheet;
 class Charsets;
 class Import;
@@ -61,6 +63,15 @@ class CssMinify {
   // be added to the string-vector passed to set_url_collector.
   bool ParseStylesheet(StringPiece stylesheet_text);
 
+  // Streaming alternative to ParseStylesheet for stylesheets that only need
+  // comments and whitespace removed and URLs rewritten.  The text is lexed
+  // with Css::Parser::Tokenize, so no Css::Stylesheet is built and all
+  // other tokens are passed through as written.  URLs are run through the
+  // transformer passed to set_url_transformer, if any, and collected as for
+  // ParseStylesheet.  Returns false on lexing errors or if a URL could not be
+  // transformed.
+  bool MinifyStylesheetStreaming(StringPiece stylesheet_text);
+
   // Writes minified Stylesheet from already-parsed stylesheet object.
   static bool Stylesheet(const Css::Stylesheet& stylesheet, Writer* writer,
                          MessageHandler* handler);
@@ -72,12 +83,20 @@ class CssMinify {
   // Establishes a string-vector to collect all parsed URLs.
   void set_url_collector(StringVector* urls) { url_collector_ = urls; }
 
+  // Establishes a transformer for URLs seen by MinifyStylesheetStreaming.
+  void set_url_transformer(CssTagScanner::Transformer* transformer) {
+    url_transformer_ = transformer;
+  }
+
   // Sets a writer to receive a stream of error messages.  The default is
   // that all error messages are eaten.
   void set_error_writer(Writer* writer) { error_writer_ = writer; }
 
  private:
+  class TokenMinifier;
+
   void Write(const StringPiece& str);
+  void ReportParseErrors(const Css::Parser& parser);
   void WriteURL(const UnicodeText& url);
 
   template <typename Container>
@@ -130,6 +149,7 @@ class CssMinify {
   bool ok_;
 
   StringVector* url_collector_;
+  CssTagScanner::Transformer* url_transformer_;
   bool in_css_calc_function_;
 
   DISALLOW_COPY_AND_ASSIGN(CssMinify);
@@ -88,9 +88,15 @@ class DeviceProperties {
   friend class ImageRewriteTest;
   friend class RequestProperties;
 
+  // Classifies user_agent_ on first use, so that the matcher is consulted
+  // once per user agent rather than once per question.
+  const UserAgentMatcher::Classification& classification() const;
+
   GoogleString user_agent_;
   GoogleString accept_header_;
   UserAgentMatcher* ua_matcher_;
+  mutable LazyBool classified_;
+  mutable UserAgentMatcher::Classification classification_;
 
   mutable LazyBool supports_critical_css_;
   mutable LazyBool supports_image_inlining_;
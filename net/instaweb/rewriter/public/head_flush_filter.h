@@ -0,0 +1,54 @@
+/*
+ * Licensed to the Apache Software Foundation (ASF) under one
+ * or more contributor license agreements.  See the NOTICE file
+ * distributed with this work for additional information
+ * regarding copyright ownership.  The ASF licenses this file
+ * to you under the Apache License, Version 2.0 (the
+ * "License"); you may not use this file except in compliance
+ * with the License.  You may obtain a copy of the License at
+ * 
+ *   http://www.apache.org/licenses/LICENSE-2.0
+ * 
+ * Unless required by applicable law or agreed to in writing,
+ * software distributed under the License is distributed on an
+ * "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY
+ * KIND, either express or implied.  See the License for the
+ * specific language governing permissions and limitations
+ * under the License.
+ */
+
+#ifndef NET_INSTAWEB_REWRITER_PUBLIC_HEAD_FLUSH_FILTER_H_
+#define NET_INSTAWEB_REWRITER_PUBLIC_HEAD_FLUSH_FILTER_H_
+
+#include "pagespeed/kernel/base/basictypes.h"
+#include "pagespeed/kernel/html/empty_html_filter.h"
+
+namespace net_instaweb {
+
+class HtmlElement;
+class RewriteDriver;
+
+// This filter is run immediately after lexing when streaming HTML into the
+// system, when adaptive_flush_window is on.  It tells the driver when the
+// head has been parsed, so that the resources it references can be rewritten
+// and sent to the browser in a flush window of their own.
+class HeadFlushFilter : public EmptyHtmlFilter {
+ public:
+  explicit HeadFlushFilter(RewriteDriver* driver);
+  ~HeadFlushFilter() override;
+
+  void StartDocument() override;
+  void EndElement(HtmlElement* element) override;
+
+  const char* Name() const override { return "HeadFlushFilter"; }
+
+ private:
+  RewriteDriver* driver_;
+  bool seen_head_;
+
+  DISALLOW_COPY_AND_ASSIGN(HeadFlushFilter);
+};
+
+}  // namespace net_instaweb
+
+#endif  // NET_INSTAWEB_REWRITER_PUBLIC_HEAD_FLUSH_FILTER_H_
@@ -30,6 +30,12 @@
 #include "pagespeed/kernel/http/image_types.pb.h"
 #include "pagespeed/kernel/image/image_util.h"
 
+namespace pagespeed {
+namespace image_compression {
+class ResamplingPyramid;
+}  // namespace image_compression
+}  // namespace pagespeed
+
 namespace net_instaweb {
 class Histogram;
 class MessageHandler;
@@ -181,6 +187,20 @@ class Image {
   // fails.  Otherwise the image contents and type can change.
   virtual bool ResizeTo(const ImageDim& new_dim) = 0;
 
+  // Decodes the image into a pyramid from which ResizeTo can produce any
+  // number of sizes without decoding the image again; see
+  // SetResamplingPyramid. Returns NULL if the image can't be resized or fails
+  // to decode. The caller owns the result.
+  virtual pagespeed::image_compression::ResamplingPyramid*
+  NewResamplingPyramid() = 0;
+
+  // Makes ResizeTo read from pyramid, which must have been built from the
+  // same contents as this image, rather than decoding the image. Pass NULL to
+  // go back to decoding. Does not take ownership; pyramid must outlive any
+  // calls to ResizeTo.
+  virtual void SetResamplingPyramid(
+      const pagespeed::image_compression::ResamplingPyramid* pyramid) = 0;
+
   // Enable the transformation to low res image. If low res image is enabled,
   // all jpeg images are transformed to low quality jpeg images and all webp
   // images to low quality webp images, if possible.
@@ -21,6 +21,7 @@
 #define NET_INSTAWEB_REWRITER_PUBLIC_IMAGE_REWRITE_FILTER_H_
 
 #include <map>
+#include <memory>
 
 #include "net/instaweb/rewriter/cached_result.pb.h"
 #include "net/instaweb/rewriter/public/image.h"
@@ -33,11 +34,13 @@
 #include "net/instaweb/rewriter/public/rewrite_options.h"
 #include "net/instaweb/rewriter/public/rewrite_result.h"
 #include "net/instaweb/rewriter/public/server_context.h"
+#include "pagespeed/kernel/base/abstract_mutex.h"
 #include "pagespeed/kernel/base/basictypes.h"
 #include "pagespeed/kernel/base/printf_format.h"
 #include "pagespeed/kernel/base/statistics.h"
 #include "pagespeed/kernel/base/string.h"
 #include "pagespeed/kernel/base/string_util.h"
+#include "pagespeed/kernel/base/thread_annotations.h"
 #include "pagespeed/kernel/html/html_element.h"
 #include "pagespeed/kernel/http/content_type.h"
 #include "pagespeed/kernel/http/image_types.pb.h"
@@ -75,6 +78,7 @@ class ImageRewriteFilter : public RewriteFilter {
   static const char kImageRewriteLatencyFailedMs[];
   static const char kImageRewriteLatencyOkMs[];
   static const char kImageRewriteLatencyTotalMs[];
+  static const char kImageRewriteTotalBytesSaved[];
   static const char kImageRewritesDroppedDecodeFailure[];
   static const char kImageRewritesDroppedDueToLoad[];
   static const char kImageRewritesDroppedMIMETypeUnknown[];
@@ -82,6 +86,7 @@ class ImageRewriteFilter : public RewriteFilter {
   static const char kImageRewritesDroppedNoSavingResize[];
   static const char kImageRewritesDroppedServerWriteFail[];
   static const char kImageRewritesSquashingForMobileScreen[];
+  static const char kImageResizedFromSharedDecode[];
   static const char kImageRewrites[];
   static const char kImageWebpRewrites[];
   static const char kImageWebpFromGifFailureMs[];
@@ -198,8 +203,24 @@ class ImageRewriteFilter : public RewriteFilter {
   // Resize image if necessary, returning true if this resizing succeeds and
   // false if it's unnecessary or fails.
   bool ResizeImageIfNecessary(const Context* rewrite_context,
-                              const GoogleString& url, ResourceContext* context,
-                              Image* image, CachedResult* cached);
+                              const ResourcePtr& input_resource,
+                              ResourceContext* context, Image* image,
+                              CachedResult* cached);
+
+  // Registers a context rewriting one of the virtual images that
+  // ResponsiveImageFilter derives from a single <img>, so that the contexts
+  // for the same source URL can share one decode of it. Every call must be
+  // matched by a call to ReleaseSharedSource once the context is done.
+  void AddSharedSource(const GoogleString& url);
+  void ReleaseSharedSource(const GoogleString& url);
+
+  // Returns the decoded pyramid for the registered source of rewrite_context,
+  // decoding image to build it if no other context has already done so for
+  // the same contents. Returns NULL if the context isn't sharing its source
+  // or the image can't be decoded.
+  std::shared_ptr<const pagespeed::image_compression::ResamplingPyramid>
+  SharedPyramid(const Context* rewrite_context,
+                const ResourcePtr& input_resource, Image* image);
 
   // Allocate and initialize CompressionOptions object based on RewriteOptions
   // and ResourceContext.
@@ -338,6 +359,9 @@ class ImageRewriteFilter : public RewriteFilter {
   Variable* image_webp_rewrites_;
   // # of images being rewritten right now.
   UpDownCounter* image_ongoing_rewrites_;
+  // # of images resized from a decode shared with other responsive variants
+  // of the same source, rather than from a decode of their own.
+  Variable* image_resized_from_shared_decode_;
 
   // # total number of milliseconds spent rewriting images since server start
   Variable* image_rewrite_latency_total_ms_;
@@ -367,6 +391,20 @@ class ImageRewriteFilter : public RewriteFilter {
   // Used to figure out which RenderDone() call is the last one.
   bool saw_end_document_;
 
+  // Sources shared between responsive image variants, keyed by URL. The
+  // pyramid is kept only while contexts that might still use it are alive,
+  // and only reused by contexts whose input has the same contents_hash.
+  struct SharedSource {
+    SharedSource() : num_contexts(0) {}
+    int num_contexts;
+    GoogleString contents_hash;
+    std::shared_ptr<const pagespeed::image_compression::ResamplingPyramid>
+        pyramid;
+  };
+  typedef std::map<GoogleString, SharedSource> SharedSourceMap;
+  std::unique_ptr<AbstractMutex> shared_sources_mutex_;
+  SharedSourceMap shared_sources_ GUARDED_BY(shared_sources_mutex_);
+
   DISALLOW_COPY_AND_ASSIGN(ImageRewriteFilter);
 };
 
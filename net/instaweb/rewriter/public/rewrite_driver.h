@@ -21,6 +21,7 @@
 #define NET_INSTAWEB_REWRITER_PUBLIC_REWRITE_DRIVER_H_
 
 #include <map>
+#include <memory>
 #include <set>
 #include <vector>
 
@@ -49,6 +50,7 @@
 #include "pagespeed/kernel/base/abstract_mutex.h"
 #include "pagespeed/kernel/base/atomic_bool.h"
 #include "pagespeed/kernel/base/basictypes.h"
+#include "pagespeed/kernel/base/cache_interface.h"
 #include "pagespeed/kernel/base/function.h"
 #include "pagespeed/kernel/base/printf_format.h"
 #include "pagespeed/kernel/base/proto_util.h"
@@ -155,6 +157,12 @@ class RewriteDriver : public HtmlParse {
   static const char kSubresourcesPropertyName[];
   // Status codes of previous responses.
   static const char kStatusCodePropertyName[];
+  // Moving average of how long the flush windows of previous responses
+  // needed to wait for their rewrites, in milliseconds.
+  static const char kFlushWindowRewriteMs[];
+  // Number of bytes of the previous response that had been parsed when its
+  // head was closed.
+  static const char kHeadEndBytes[];
 
   RewriteDriver(MessageHandler* message_handler, FileSystem* file_system,
                 UrlAsyncFetcher* url_async_fetcher);
@@ -879,6 +887,16 @@ class RewriteDriver : public HtmlParse {
   void DeregisterForPartitionKey(const GoogleString& partition_key,
                                  RewriteContext* candidate);
 
+  // Looks up key in the metadata cache, reporting the result to callback.
+  // While the contexts initiated by a Flush are starting, lookups are held
+  // back and then issued together as a single MultiGet, so a page with many
+  // resources costs one round-trip to a remote cache rather than one per
+  // resource. Otherwise the lookup is issued immediately.
+  //
+  // Must only be called from rewrite thread.
+  void LookupMetadata(const GoogleString& key,
+                      CacheInterface::Callback* callback);
+
   // Indicates that a Flush through the HTML parser chain should happen
   // soon, e.g. once the network pauses its incoming byte stream.
   void RequestFlush() { flush_requested_ = true; }
@@ -914,9 +932,30 @@ class RewriteDriver : public HtmlParse {
 
   // Initiates an asynchronous Flush.  done->Run() will be called when
   // the flush is complete.  Further calls to ParseText should be deferred until
-  // the callback is called. Scheduler mutex is not held while done is called.
+  // the callback is called, unless they are bracketed by BeginParseAhead and
+  // EndParseAhead, and made from html_worker(). Scheduler mutex is not held
+  // while done is called.
   void FlushAsync(Function* done);
 
+  // Returns whether text may be parsed ahead of an outstanding FlushAsync.
+  // It may not be when parsing is skipped, as the text would then be written
+  // out ahead of the window being flushed, nor when the debug filter is timing
+  // the parse, nor while events are buffered until AMPness is discovered, as
+  // the discovery may disable filters between the pre-render and render
+  // phases of the flush.
+  bool CanParseAhead();
+
+  // Called by the adaptive flush window policy when the head has been
+  // parsed. Records where the head ended and requests a flush, so the head
+  // is not held back behind body text waiting for a network flush.
+  void HeadParsed();
+
+  // Returns how many more bytes should be let into the current flush window
+  // before flushing, given the configured buffer_limit. With
+  // adaptive_flush_window this is lowered, until the head has been parsed,
+  // to where previous responses for this URL pattern closed their head.
+  int64 FlushWindowBufferLimitBytes(int64 buffer_limit);
+
   // Queues up a task to run on the (high-priority) rewrite thread.
   void AddRewriteTask(Function* task);
 
@@ -1267,9 +1306,24 @@ class RewriteDriver : public HtmlParse {
   // (configured via max_page_processing_delay_ms()).
   int64 ComputeCurrentFlushWindowRewriteDelayMs();
 
+  // Returns the per-flush window deadline learned from earlier requests for
+  // this URL pattern, as a replacement for the configured deadline, or
+  // deadline itself when adaptive_flush_window is off or nothing has been
+  // learned yet.
+  int64 AdaptFlushWindowDeadlineMs(int64 deadline);
+
+  // Reads what earlier requests learned about flush windows for this URL
+  // pattern from the dom cohort. Only the first call does anything.
+  void ReadLearnedFlushWindow();
+
   // Queues up invocation of FlushAsyncDone in our html_workers sequence.
   void QueueFlushAsyncDone(int num_rewrites, Function* callback);
 
+  // Rewrite-thread tasks bracketing the Start tasks queued by a Flush, so
+  // that their metadata lookups are batched. See LookupMetadata.
+  void StartMetadataLookupBatch();
+  void IssueMetadataLookups();
+
   // Called as part of implementation of FinishParseAsync, after the
   // flush is complete.
   void QueueFinishParseAfterFlush(Function* user_callback);
@@ -1611,6 +1665,12 @@ class RewriteDriver : public HtmlParse {
   typedef std::map<GoogleString, RewriteContext*> PrimaryRewriteContextMap;
   PrimaryRewriteContextMap primary_rewrite_context_map_;
 
+  // Metadata cache lookups collected by LookupMetadata while the contexts
+  // initiated by a Flush start up. Non-null only between
+  // StartMetadataLookupBatch and IssueMetadataLookups, both of which run
+  // in the rewrite thread.
+  std::unique_ptr<CacheInterface::MultiGetRequest> pending_metadata_lookups_;
+
   HtmlResourceSlotSet slots_;
   InlineResourceSlotSet inline_slots_;
   InlineAttributeSlotSet inline_attribute_slots_;
@@ -1676,6 +1736,18 @@ class RewriteDriver : public HtmlParse {
   // The total number of bytes for which ParseText is called.
   int num_bytes_in_;
 
+  // State for adaptive_flush_window. The learned_ values are read from the
+  // property cache and are -1 if unknown. max_flush_window_rewrite_ms_ is
+  // the longest wait for rewrites seen by this request, and head_end_bytes_
+  // is num_bytes_in_ when the head was parsed; both are -1 until seen.
+  bool learned_flush_window_read_;
+  int64 learned_flush_window_rewrite_ms_;
+  int64 learned_head_end_bytes_;
+  int64 flush_window_start_ms_;
+  int64 flush_window_deadline_ms_;
+  int64 max_flush_window_rewrite_ms_;
+  int64 head_end_bytes_;
+
   DebugFilter* debug_filter_;
 
   std::unique_ptr<FlushEarlyInfo> flush_early_info_;
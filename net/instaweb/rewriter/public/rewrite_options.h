@@ -250,6 +250,7 @@ class RewriteOptions {
   // css_filter.cc.
   static const char kAcceptInvalidSignatures[];
   static const char kAccessControlAllowOrigins[];
+  static const char kAdaptiveFlushWindow[];
   static const char kAddOptionsToUrls[];
   static const char kAllowLoggingUrlsInLogRecord[];
   static const char kAllowOptionsToBeSetByCookies[];
@@ -273,6 +274,7 @@ class RewriteOptions {
   static const char kCssInlineMaxBytes[];
   static const char kCssOutlineMinBytes[];
   static const char kCssPreserveURLs[];
+  static const char kCssStreamingRewrite[];
   static const char kDefaultCacheHtml[];
   static const char kDisableBackgroundFetchesForBots[];
   static const char kDisableRewriteOnNoTransform[];
@@ -301,6 +303,7 @@ class RewriteOptions {
   static const char kGoogleFontCssInlineMaxBytes[];
   static const char kForbidAllDisabledFilters[];
   static const char kHideRefererUsingMeta[];
+  static const char kHtmlCompressionLevel[];
   static const char kHttpCacheCompressionLevel[];
   static const char kHonorCsp[];
   static const char kIdleFlushTimeMs[];
@@ -368,6 +371,7 @@ class RewriteOptions {
   static const char kObliviousPagespeedUrls[];
   static const char kOptionCookiesDurationMs[];
   static const char kOverrideCachingTtlMs[];
+  static const char kPipelineHtmlParse[];
   static const char kPreserveSubresourceHints[];
   static const char kPreserveUrlRelativity[];
   static const char kPrivateNotVaryForIE[];
@@ -2016,6 +2020,13 @@ class RewriteOptions {
     return remote_configuration_url_.value();
   }
 
+  void set_html_compression_level(int x) {
+    set_option(x, &html_compression_level_);
+  }
+  int html_compression_level() const {
+    return html_compression_level_.value();
+  }
+
   void set_http_cache_compression_level(int x) {
     set_option(x, &http_cache_compression_level_);
   }
@@ -2119,6 +2130,11 @@ class RewriteOptions {
   }
   void set_css_preserve_urls(bool x) { set_option(x, &css_preserve_urls_); }
 
+  bool css_streaming_rewrite() const { return css_streaming_rewrite_.value(); }
+  void set_css_streaming_rewrite(bool x) {
+    set_option(x, &css_streaming_rewrite_);
+  }
+
   bool image_preserve_urls() const {
     return CheckBandwidthOption(image_preserve_urls_);
   }
@@ -2292,6 +2308,16 @@ class RewriteOptions {
   void set_follow_flushes(bool x) { set_option(x, &follow_flushes_); }
   bool follow_flushes() const { return follow_flushes_.value(); }
 
+  void set_pipeline_html_parse(bool x) {
+    set_option(x, &pipeline_html_parse_);
+  }
+  bool pipeline_html_parse() const { return pipeline_html_parse_.value(); }
+
+  void set_adaptive_flush_window(bool x) {
+    set_option(x, &adaptive_flush_window_);
+  }
+  bool adaptive_flush_window() const { return adaptive_flush_window_.value(); }
+
   void set_enable_defer_js_experimental(bool x) {
     set_option(x, &enable_defer_js_experimental_);
   }
@@ -3550,6 +3576,10 @@ class RewriteOptions {
   Option<int64> css_outline_min_bytes_;
   Option<int64> google_font_css_inline_max_bytes_;
 
+  // Rewrite stylesheets from a token stream rather than a parsed tree when
+  // no structural CSS transforms are needed.
+  Option<bool> css_streaming_rewrite_;
+
   // Preserve URL options
   Option<bool> css_preserve_urls_;
   Option<bool> js_preserve_urls_;
@@ -3661,6 +3691,12 @@ class RewriteOptions {
   // If set to true, ProxyFetch will request a flush on its RewriteDriver when
   // Flush() is called on it.
   Option<bool> follow_flushes_;
+  // If set to true, ProxyFetch lexes newly arrived HTML while the previous
+  // flush window is still waiting for its rewrites.
+  Option<bool> pipeline_html_parse_;
+  // If set to true, flush window deadlines and the first flush point are
+  // chosen from what earlier requests for the same URL pattern learned.
+  Option<bool> adaptive_flush_window_;
   // Should we serve stale responses if the fetch results in a server side
   // error.
   Option<bool> serve_stale_if_fetch_error_;
@@ -3960,6 +3996,10 @@ class RewriteOptions {
   // The level to set the gzip compression of HTTPCache items.
   Option<int> http_cache_compression_level_;
 
+  // The gzip compression level for rewritten HTML streamed to clients that
+  // accept it; 0 leaves compression to the server.
+  Option<int> html_compression_level_;
+
   // Pass this string in url to allow for pagespeed options.
   Option<GoogleString> request_option_override_;
 
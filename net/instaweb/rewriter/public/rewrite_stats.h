@@ -70,6 +70,16 @@ class RewriteStats {
     return num_cache_control_not_rewritable_resources_;
   }
   Variable* num_flushes() { return num_flushes_; }
+  // Flush windows whose rewrite deadline was lowered or raised from
+  // rewrite_deadline_ms by the adaptive flush window policy.
+  Variable* num_flush_window_deadlines_shortened() {
+    return num_flush_window_deadlines_shortened_;
+  }
+  Variable* num_flush_window_deadlines_extended() {
+    return num_flush_window_deadlines_extended_;
+  }
+  // Flushes requested by the adaptive policy once the head was parsed.
+  Variable* num_head_flushes() { return num_head_flushes_; }
   Variable* resource_404_count() { return resource_404_count_; }
   Variable* resource_url_domain_acceptances() {
     return resource_url_domain_acceptances_;
@@ -140,6 +150,9 @@ class RewriteStats {
   Variable* num_cache_control_rewritable_resources_;
   Variable* num_cache_control_not_rewritable_resources_;
   Variable* num_flushes_;
+  Variable* num_flush_window_deadlines_shortened_;
+  Variable* num_flush_window_deadlines_extended_;
+  Variable* num_head_flushes_;
   Variable* page_load_count_;
   Variable* resource_404_count_;
   Variable* resource_url_domain_acceptances_;
@@ -68,6 +68,8 @@ class CriticalImagesFinder;
 class CriticalSelectorFinder;
 class RequestProperties;
 class ExperimentMatcher;
+class FetchCoalescer;
+class FileMtimeCache;
 class FileSystem;
 class GoogleUrl;
 class MessageHandler;
@@ -182,6 +184,14 @@ class ServerContext {
   const Hasher* contents_hasher() const { return &contents_hasher_; }
   FileSystem* file_system() { return file_system_; }
   void set_file_system(FileSystem* fs) { file_system_ = fs; }
+  // Optional in-memory cache of LoadFromFile input mtimes.  This class does
+  // not take ownership.
+  FileMtimeCache* file_mtime_cache() const { return file_mtime_cache_; }
+  void set_file_mtime_cache(FileMtimeCache* x) { file_mtime_cache_ = x; }
+  // Looks up the modification time of a file-based input, consulting
+  // file_mtime_cache() if one is set.  Returns false on failure.
+  bool LoadFromFileMtime(StringPiece filename, int64* mtime_sec,
+                         MessageHandler* handler);
   UrlNamer* url_namer() const { return url_namer_; }
   void set_url_namer(UrlNamer* n) { url_namer_ = n; }
   RewriteOptionsManager* rewrite_options_manager() const {
@@ -220,6 +230,10 @@ class ServerContext {
   HTTPCache* http_cache() const { return http_cache_.get(); }
   void set_http_cache(HTTPCache* x) { http_cache_.reset(x); }
 
+  // Shared by the fetchers made by CreateCustomCacheFetcher, so that their
+  // concurrent cache misses on a URL result in a single origin fetch.
+  FetchCoalescer* fetch_coalescer() const { return fetch_coalescer_.get(); }
+
   // Creates PagePropertyCache object with the provided PropertyStore object.
   void MakePagePropertyCache(PropertyStore* property_store);
 
@@ -669,6 +683,7 @@ class ServerContext {
   RewriteStats* rewrite_stats_;
   GoogleString file_prefix_;
   FileSystem* file_system_;
+  FileMtimeCache* file_mtime_cache_;
   UrlNamer* url_namer_;
   std::unique_ptr<RewriteOptionsManager> rewrite_options_manager_;
   UserAgentMatcher* user_agent_matcher_;
@@ -692,6 +707,7 @@ class ServerContext {
 
   Timer* timer_;
   std::unique_ptr<HTTPCache> http_cache_;
+  std::unique_ptr<FetchCoalescer> fetch_coalescer_;
   std::unique_ptr<PropertyCache> page_property_cache_;
   CacheInterface* filesystem_metadata_cache_;
   CacheInterface* metadata_cache_;
@@ -78,6 +78,7 @@
 #include "net/instaweb/rewriter/public/google_analytics_filter.h"
 #include "net/instaweb/rewriter/public/google_font_css_inline_filter.h"
 #include "net/instaweb/rewriter/public/handle_noscript_redirect_filter.h"
+#include "net/instaweb/rewriter/public/head_flush_filter.h"
 #include "net/instaweb/rewriter/public/image_combine_filter.h"
 #include "net/instaweb/rewriter/public/image_rewrite_filter.h"
 #include "net/instaweb/rewriter/public/in_place_rewrite_context.h"
@@ -167,6 +168,15 @@ namespace {
 const int kTestTimeoutMs = 10000;
 const char kDeadlineExceeded[] = "deadline_exceeded";
 
+// Bounds on the per-flush window deadline chosen by adaptive_flush_window,
+// relative to the configured rewrite_deadline_ms.
+const int64 kMinAdaptedDeadlineDivisor = 4;
+const int64 kMaxAdaptedDeadlineMultiple = 2;
+
+// Each response moves the learned flush window rewrite time 1/4 of the way
+// towards what it saw.
+const int64 kFlushWindowRewriteMsWeight = 4;
+
 // Implementation of RemoveCommentsFilter::OptionsInterface that wraps
 // a RewriteOptions instance.
 class RemoveCommentsFilterOptions
@@ -225,6 +235,8 @@ const char RewriteDriver::kSubresourcesPropertyName[] = "subresources";
 const char RewriteDriver::kStatusCodePropertyName[] = "status_code";
 
 const char RewriteDriver::kLastRequestTimestamp[] = "last_request_timestamp";
+const char RewriteDriver::kFlushWindowRewriteMs[] = "flush_window_rewrite_ms";
+const char RewriteDriver::kHeadEndBytes[] = "head_end_bytes";
 const char RewriteDriver::kParseSizeLimitExceeded[] =
     "parse_size_limit_exceeded";
 
@@ -277,6 +289,13 @@ RewriteDriver::RewriteDriver(MessageHandler* message_handler,
       xhtml_status_(kXhtmlUnknown),
       num_inline_preview_images_(0),
       num_bytes_in_(0),
+      learned_flush_window_read_(false),
+      learned_flush_window_rewrite_ms_(-1),
+      learned_head_end_bytes_(-1),
+      flush_window_start_ms_(0),
+      flush_window_deadline_ms_(0),
+      max_flush_window_rewrite_ms_(-1),
+      head_end_bytes_(-1),
       debug_filter_(nullptr),
       can_rewrite_resources_(true),
       is_nested_(false),
@@ -457,6 +476,13 @@ void RewriteDriver::Clear() NO_THREAD_SAFETY_ANALYSIS {
   fast_blocking_rewrite_ = true;
   num_inline_preview_images_ = 0;
   num_bytes_in_ = 0;
+  learned_flush_window_read_ = false;
+  learned_flush_window_rewrite_ms_ = -1;
+  learned_head_end_bytes_ = -1;
+  flush_window_start_ms_ = 0;
+  flush_window_deadline_ms_ = 0;
+  max_flush_window_rewrite_ms_ = -1;
+  head_end_bytes_ = -1;
   flush_early_info_.reset(nullptr);
   can_rewrite_resources_ = true;
   is_nested_ = false;
@@ -693,6 +719,14 @@ void RewriteDriver::FlushAsync(Function* callback) {
     initiated_rewrites_.insert(rewrites_.begin(), rewrites_.end());
     num_initiated_rewrites_ += num_rewrites;
 
+    // The rewrite thread runs tasks in order, so bracketing the Start tasks
+    // queued by Initiate lets their metadata lookups go out as one MultiGet.
+    bool batch_lookups = (num_rewrites > 1);
+    if (batch_lookups) {
+      AddRewriteTask(
+          MakeFunction(this, &RewriteDriver::StartMetadataLookupBatch));
+    }
+
     // We must also start tasks while holding the lock, as otherwise a
     // successor task may complete and delete itself before we see if we
     // are the ones to start it.
@@ -702,6 +736,12 @@ void RewriteDriver::FlushAsync(Function* callback) {
         rewrite_context->Initiate();
       }
     }
+    if (batch_lookups) {
+      // Issue the lookups even if the sequence is being cancelled, as each
+      // holds a callback that must be run.
+      AddRewriteTask(MakeFunction(this, &RewriteDriver::IssueMetadataLookups,
+                                  &RewriteDriver::IssueMetadataLookups));
+    }
   }
   rewrites_.clear();
 
@@ -715,13 +755,93 @@ void RewriteDriver::FlushAsync(Function* callback) {
       CheckForCompletionAsync(kWaitForCompletion, -1, flush_async_done);
     } else {
       int64 deadline = ComputeCurrentFlushWindowRewriteDelayMs();
+      flush_window_start_ms_ = server_context_->timer()->NowMs();
+      flush_window_deadline_ms_ = deadline;
+      if (num_rewrites > 0) {
+        int64 configured = rewrite_deadline_ms();
+        int64 adapted = AdaptFlushWindowDeadlineMs(configured);
+        RewriteStats* stats = server_context_->rewrite_stats();
+        if (adapted < configured) {
+          stats->num_flush_window_deadlines_shortened()->Add(1);
+        } else if (adapted > configured) {
+          stats->num_flush_window_deadlines_extended()->Add(1);
+        }
+      }
       CheckForCompletionAsync(kWaitForCachedRender, deadline, flush_async_done);
     }
   }
 }
 
+bool RewriteDriver::CanParseAhead() {
+  return !ShouldSkipParsing() && (debug_filter_ == nullptr) &&
+         !buffer_events();
+}
+
+void RewriteDriver::HeadParsed() {
+  if (head_end_bytes_ >= 0) {
+    return;
+  }
+  head_end_bytes_ = num_bytes_in_;
+  server_context_->rewrite_stats()->num_head_flushes()->Add(1);
+  RequestFlush();
+}
+
+int64 RewriteDriver::FlushWindowBufferLimitBytes(int64 buffer_limit) {
+  if (!options()->adaptive_flush_window() || (head_end_bytes_ >= 0)) {
+    return buffer_limit;
+  }
+  ReadLearnedFlushWindow();
+  int64 to_head_end = learned_head_end_bytes_ - num_bytes_in_;
+  if (to_head_end > 0) {
+    return std::min(buffer_limit, to_head_end);
+  }
+  return buffer_limit;
+}
+
+void RewriteDriver::ReadLearnedFlushWindow() {
+  if (learned_flush_window_read_) {
+    return;
+  }
+  learned_flush_window_read_ = true;
+  const PropertyCache::Cohort* dom_cohort = server_context_->dom_cohort();
+  FallbackPropertyPage* page = fallback_property_page();
+  if ((dom_cohort == nullptr) || (page == nullptr)) {
+    return;
+  }
+  int64 value;
+  PropertyValue* property_value =
+      page->GetProperty(dom_cohort, kFlushWindowRewriteMs);
+  if (property_value->has_value() &&
+      StringToInt64(property_value->value(), &value) && (value >= 0)) {
+    learned_flush_window_rewrite_ms_ = value;
+  }
+  property_value = page->GetProperty(dom_cohort, kHeadEndBytes);
+  if (property_value->has_value() &&
+      StringToInt64(property_value->value(), &value) && (value > 0)) {
+    learned_head_end_bytes_ = value;
+  }
+}
+
+int64 RewriteDriver::AdaptFlushWindowDeadlineMs(int64 deadline) {
+  if ((deadline <= 0) || !options()->adaptive_flush_window()) {
+    return deadline;
+  }
+  ReadLearnedFlushWindow();
+  if (learned_flush_window_rewrite_ms_ < 0) {
+    return deadline;
+  }
+  // The learned value is an average, so leave half again as much headroom.
+  // Bound it so that one slow or fast history can't make us give up on
+  // rewrites immediately or hold the page for much longer than configured.
+  int64 adapted =
+      learned_flush_window_rewrite_ms_ + learned_flush_window_rewrite_ms_ / 2;
+  adapted = std::max(adapted, std::max(deadline / kMinAdaptedDeadlineDivisor,
+                                       static_cast<int64>(1)));
+  return std::min(adapted, deadline * kMaxAdaptedDeadlineMultiple);
+}
+
 int64 RewriteDriver::ComputeCurrentFlushWindowRewriteDelayMs() {
-  int64 deadline = rewrite_deadline_ms();
+  int64 deadline = AdaptFlushWindowDeadlineMs(rewrite_deadline_ms());
   // If we've configured a max processing delay for the entire page, enforce
   // that limit here.
   if (max_page_processing_delay_ms_ > 0) {
@@ -765,6 +885,20 @@ void RewriteDriver::FlushAsyncDone(int num_rewrites, Function* callback) {
     RewriteStats* stats = server_context_->rewrite_stats();
     stats->cached_output_hits()->Add(completed_rewrites);
     stats->cached_output_missed_deadline()->Add(still_pending_rewrites);
+
+    if ((num_rewrites > 0) && !fully_rewrite_on_flush_ &&
+        options()->adaptive_flush_window()) {
+      int64 wait_ms =
+          server_context_->timer()->NowMs() - flush_window_start_ms_;
+      if (still_pending_rewrites > 0) {
+        // We don't know how much longer the stragglers will take, so ask for
+        // noticeably more time than we gave them.
+        wait_ms = std::max(
+            wait_ms, flush_window_deadline_ms_ * kMaxAdaptedDeadlineMultiple);
+      }
+      max_flush_window_rewrite_ms_ =
+          std::max(max_flush_window_rewrite_ms_, wait_ms);
+    }
     {
       // Add completed_rewrites (from this flush window) to the logged value.
       ScopedMutex lock(log_record()->mutex());
@@ -1015,6 +1149,9 @@ void RewriteDriver::AddPreRenderFilters() {
     // based on the content it sees.
     add_event_listener(new FlushHtmlFilter(this));
   }
+  if (rewrite_options->adaptive_flush_window()) {
+    add_event_listener(new HeadFlushFilter(this));
+  }
   add_event_listener(new AmpDocumentFilter(
       this, NewPermanentCallback(this, &RewriteDriver::SetIsAmpDocument)));
 
@@ -2319,11 +2456,42 @@ void RewriteDriver::DeregisterForPartitionKey(const GoogleString& partition_key,
   }
 }
 
+void RewriteDriver::LookupMetadata(const GoogleString& key,
+                                   CacheInterface::Callback* callback) {
+  if (pending_metadata_lookups_ != nullptr) {
+    pending_metadata_lookups_->push_back(
+        CacheInterface::KeyCallback(key, callback));
+  } else {
+    server_context_->metadata_cache()->Get(key, callback);
+  }
+}
+
+void RewriteDriver::StartMetadataLookupBatch() {
+  DCHECK(pending_metadata_lookups_ == nullptr);
+  pending_metadata_lookups_.reset(new CacheInterface::MultiGetRequest);
+}
+
+void RewriteDriver::IssueMetadataLookups() {
+  std::unique_ptr<CacheInterface::MultiGetRequest> request(
+      pending_metadata_lookups_.release());
+  if (request == nullptr || request->empty()) {
+    return;
+  }
+  CacheInterface* metadata_cache = server_context_->metadata_cache();
+  if (request->size() == 1) {
+    const CacheInterface::KeyCallback& key_callback = (*request)[0];
+    metadata_cache->Get(key_callback.key, key_callback.callback);
+  } else {
+    metadata_cache->MultiGet(request.release());
+  }
+}
+
 void RewriteDriver::WriteDomCohortIntoPropertyCache() {
   // Only update the property cache if there is a filter or option enabled that
   // actually makes use of it.
   if (!(write_property_cache_dom_cohort_ ||
-        options()->max_html_parse_bytes() > 0)) {
+        options()->max_html_parse_bytes() > 0 ||
+        options()->adaptive_flush_window())) {
     return;
   }
 
@@ -2353,6 +2521,26 @@ void RewriteDriver::WriteDomCohortIntoPropertyCache() {
         page, kParseSizeLimitExceeded,
         num_bytes_in_ > options()->max_html_parse_bytes() ? "1" : "0");
   }
+  if (options()->adaptive_flush_window()) {
+    // Both are learned per URL pattern, so update the fallback page too.
+    ReadLearnedFlushWindow();
+    if (max_flush_window_rewrite_ms_ >= 0) {
+      int64 rewrite_ms = max_flush_window_rewrite_ms_;
+      if (learned_flush_window_rewrite_ms_ >= 0) {
+        rewrite_ms = (learned_flush_window_rewrite_ms_ *
+                          (kFlushWindowRewriteMsWeight - 1) +
+                      rewrite_ms) /
+                     kFlushWindowRewriteMsWeight;
+      }
+      UpdatePropertyValueInDomCohort(fallback_property_page(),
+                                     kFlushWindowRewriteMs,
+                                     Integer64ToString(rewrite_ms));
+    }
+    if (head_end_bytes_ >= 0) {
+      UpdatePropertyValueInDomCohort(fallback_property_page(), kHeadEndBytes,
+                                     Integer64ToString(head_end_bytes_));
+    }
+  }
   if (flush_early_info_.get() != nullptr) {
     GoogleString value;
     flush_early_info_->SerializeToString(&value);
@@ -263,6 +263,8 @@ UrlNamer* RewriteDriverFactory::url_namer() {
 UserAgentMatcher* RewriteDriverFactory::user_agent_matcher() {
   if (user_agent_matcher_ == nullptr) {
     user_agent_matcher_.reset(DefaultUserAgentMatcher());
+    user_agent_matcher_->EnableClassificationCache(
+        thread_system(), UserAgentMatcher::kDefaultClassificationCacheSize);
   }
   return user_agent_matcher_.get();
 }
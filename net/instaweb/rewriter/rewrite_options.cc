@@ -55,6 +55,7 @@ namespace net_instaweb {
 // rather are (say) Apache specific, and move them out.
 // TODO(jmarantz): Use consistent naming from semantic_type.h for all option
 // names that reference css/styles/js/scripts etc. such as CssPreserveUrls.
+const char RewriteOptions::kAdaptiveFlushWindow[] = "AdaptiveFlushWindow";
 const char RewriteOptions::kAddOptionsToUrls[] = "AddOptionsToUrls";
 const char RewriteOptions::kAcceptInvalidSignatures[] =
     "AcceptInvalidSignatures";
@@ -89,6 +90,7 @@ const char RewriteOptions::kCssImageInlineMaxBytes[] = "CssImageInlineMaxBytes";
 const char RewriteOptions::kCssInlineMaxBytes[] = "CssInlineMaxBytes";
 const char RewriteOptions::kCssOutlineMinBytes[] = "CssOutlineMinBytes";
 const char RewriteOptions::kCssPreserveURLs[] = "CssPreserveURLs";
+const char RewriteOptions::kCssStreamingRewrite[] = "CssStreamingRewrite";
 const char RewriteOptions::kDefaultCacheHtml[] = "DefaultCacheHtml";
 const char RewriteOptions::kDisableRewriteOnNoTransform[] =
     "DisableRewriteOnNoTransform";
@@ -133,6 +135,7 @@ const char RewriteOptions::kForbidAllDisabledFilters[] =
 const char RewriteOptions::kGoogleFontCssInlineMaxBytes[] =
     "GoogleFontCssInlineMaxBytes";
 const char RewriteOptions::kHideRefererUsingMeta[] = "HideRefererUsingMeta";
+const char RewriteOptions::kHtmlCompressionLevel[] = "HtmlCompressionLevel";
 const char RewriteOptions::kHttpCacheCompressionLevel[] =
     "HttpCacheCompressionLevel";
 const char RewriteOptions::kHonorCsp[] = "HonorCsp";
@@ -233,6 +236,7 @@ const char RewriteOptions::kObliviousPagespeedUrls[] = "ObliviousPagespeedUrls";
 const char RewriteOptions::kOptionCookiesDurationMs[] =
     "OptionCookiesDurationMs";
 const char RewriteOptions::kOverrideCachingTtlMs[] = "OverrideCachingTtlMs";
+const char RewriteOptions::kPipelineHtmlParse[] = "PipelineHtmlParse";
 const char RewriteOptions::kPreserveSubresourceHints[] =
     "PreserveSubresourceHints";
 const char RewriteOptions::kPreserveUrlRelativity[] = "PreserveUrlRelativity";
@@ -1456,6 +1460,12 @@ void RewriteOptions::AddProperties() {
   AddBaseProperty(false, &RewriteOptions::css_preserve_urls_, "cpu",
                   kCssPreserveURLs, kDirectoryScope,
                   "Disable the rewriting of CSS URLs.", true);
+  AddBaseProperty(false, &RewriteOptions::css_streaming_rewrite_, "csr",
+                  kCssStreamingRewrite, kDirectoryScope,
+                  "Minify and rewrite URLs in stylesheets without building a "
+                  "parse tree when @import flattening and image spriting "
+                  "are off.",
+                  true);
   AddBaseProperty(false, &RewriteOptions::image_preserve_urls_, "ipu",
                   kImagePreserveURLs, kDirectoryScope,
                   "Disable the rewriting of Image URLs.", true);
@@ -1481,6 +1491,19 @@ void RewriteOptions::AddProperties() {
       "Attempt to mirror incoming flushes for html streams in the output "
       "when ProxyFetch is used.",
       true);
+  AddBaseProperty(
+      false, &RewriteOptions::pipeline_html_parse_, "phtp", kPipelineHtmlParse,
+      kDirectoryScope,
+      "Lex html arriving from the origin while ProxyFetch is waiting for the "
+      "rewrites of the previous flush window, rather than after it.",
+      true);
+  AddBaseProperty(
+      false, &RewriteOptions::adaptive_flush_window_, "afw",
+      kAdaptiveFlushWindow, kDirectoryScope,
+      "Size html flush window deadlines from the rewrite latency seen on "
+      "earlier requests for the same URL pattern, and flush once the head "
+      "has been parsed.",
+      true);
   AddBaseProperty(false, &RewriteOptions::enable_defer_js_experimental_, "edje",
                   kEnableDeferJsExperimental, kDirectoryScope,
                   "Enable experimental options in defer javascript.", true);
@@ -1576,6 +1599,13 @@ void RewriteOptions::AddProperties() {
       "Compression level for HTTPCache. [-1-9] where 0 is off, 1 is minimum"
       "compression, and 9 (the default) is maximum compression.",
       true);
+  AddBaseProperty(
+      0, &RewriteOptions::html_compression_level_, "htcl",
+      kHtmlCompressionLevel, kDirectoryScope,
+      "Compression level for gzipping rewritten HTML as it streams to the "
+      "client. [0-9] where 0 (the default) leaves compression to the server, "
+      "1 is fastest and 9 is maximum compression.",
+      true);
   AddBaseProperty(
       "", &RewriteOptions::lazyload_images_blank_url_, "llbu",
       kLazyloadImagesBlankUrl, kDirectoryScope,
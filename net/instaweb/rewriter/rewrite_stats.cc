@@ -40,6 +40,11 @@ const char kResourceFetchConstructSuccesses[] =
 const char kResourceFetchConstructFailures[] =
     "resource_fetch_construct_failures";
 const char kNumFlushes[] = "num_flushes";
+const char kNumFlushWindowDeadlinesShortened[] =
+    "num_flush_window_deadlines_shortened";
+const char kNumFlushWindowDeadlinesExtended[] =
+    "num_flush_window_deadlines_extended";
+const char kNumHeadFlushes[] = "num_head_flushes";
 const char kFallbackResponsesServed[] = "num_fallback_responses_served";
 const char kProactivelyFreshenUserFacingRequest[] =
     "num_proactively_freshen_user_facing_request";
@@ -123,6 +128,9 @@ void RewriteStats::InitStats(Statistics* statistics) {
   statistics->AddVariable(kNumCacheControlRewritableResources);
   statistics->AddVariable(kNumCacheControlNotRewritableResources);
   statistics->AddVariable(kNumFlushes);
+  statistics->AddVariable(kNumFlushWindowDeadlinesShortened);
+  statistics->AddVariable(kNumFlushWindowDeadlinesExtended);
+  statistics->AddVariable(kNumHeadFlushes);
   statistics->AddHistogram(kBeaconTimingsMsHistogram);
   statistics->AddHistogram(kFetchLatencyHistogram);
   statistics->AddHistogram(kRewriteLatencyHistogram);
@@ -167,6 +175,11 @@ RewriteStats::RewriteStats(bool has_waveforms, Statistics* stats,
       num_cache_control_not_rewritable_resources_(
           stats->GetVariable(kNumCacheControlNotRewritableResources)),
       num_flushes_(stats->GetVariable(kNumFlushes)),
+      num_flush_window_deadlines_shortened_(
+          stats->GetVariable(kNumFlushWindowDeadlinesShortened)),
+      num_flush_window_deadlines_extended_(
+          stats->GetVariable(kNumFlushWindowDeadlinesExtended)),
+      num_head_flushes_(stats->GetVariable(kNumHeadFlushes)),
       page_load_count_(stats->GetVariable(kPageLoadCount)),
       resource_404_count_(stats->GetVariable(kInstawebResource404Count)),
       resource_url_domain_acceptances_(
@@ -25,6 +25,7 @@
 
 #include "base/logging.h"  // for operator<<, etc
 #include "net/instaweb/http/public/async_fetch.h"
+#include "net/instaweb/http/public/fetch_coalescer.h"
 #include "net/instaweb/http/public/http_cache.h"
 #include "net/instaweb/http/public/sync_fetcher_adapter_callback.h"
 #include "net/instaweb/http/public/url_async_fetcher.h"
@@ -53,6 +54,7 @@
 #include "pagespeed/kernel/base/abstract_mutex.h"
 #include "pagespeed/kernel/base/basictypes.h"
 #include "pagespeed/kernel/base/escaping.h"
+#include "pagespeed/kernel/base/file_system.h"
 #include "pagespeed/kernel/base/hasher.h"
 #include "pagespeed/kernel/base/md5_hasher.h"
 #include "pagespeed/kernel/base/message_handler.h"
@@ -75,6 +77,7 @@
 #include "pagespeed/kernel/http/response_headers.h"
 #include "pagespeed/kernel/http/user_agent_matcher.h"
 #include "pagespeed/kernel/thread/thread_synchronizer.h"
+#include "pagespeed/kernel/util/file_mtime_cache.h"
 #include "pagespeed/opt/http/property_store.h"
 
 namespace net_instaweb {
@@ -233,6 +236,7 @@ ServerContext::ServerContext(RewriteDriverFactory* factory)
     : thread_system_(factory->thread_system()),
       rewrite_stats_(nullptr),
       file_system_(factory->file_system()),
+      file_mtime_cache_(nullptr),
       url_namer_(nullptr),
       user_agent_matcher_(nullptr),
       scheduler_(factory->scheduler()),
@@ -243,6 +247,7 @@ ServerContext::ServerContext(RewriteDriverFactory* factory)
       contents_hasher_(21),
       statistics_(nullptr),
       timer_(nullptr),
+      fetch_coalescer_(new FetchCoalescer(thread_system_)),
       filesystem_metadata_cache_(nullptr),
       metadata_cache_(nullptr),
       store_outputs_in_file_system_(false),
@@ -397,6 +402,14 @@ void ServerContext::set_filename_prefix(const StringPiece& file_prefix) {
   file_prefix.CopyToString(&file_prefix_);
 }
 
+bool ServerContext::LoadFromFileMtime(StringPiece filename, int64* mtime_sec,
+                                      MessageHandler* handler) {
+  if (file_mtime_cache_ != nullptr) {
+    return file_mtime_cache_->Mtime(filename, mtime_sec, handler);
+  }
+  return file_system_->Mtime(filename, mtime_sec, handler);
+}
+
 void ServerContext::ApplyInputCacheControl(const ResourceVector& inputs,
                                            ResponseHeaders* headers) {
   headers->ComputeCaching();
@@ -1338,6 +1351,7 @@ CacheUrlAsyncFetcher* ServerContext::CreateCustomCacheFetcher(
   CacheUrlAsyncFetcher* cache_fetcher = new CacheUrlAsyncFetcher(
       lock_hasher(), lock_manager(), http_cache(), fragment, hooks, fetcher);
   RewriteStats* stats = rewrite_stats();
+  cache_fetcher->set_fetch_coalescer(fetch_coalescer_.get());
   cache_fetcher->set_respect_vary(options->respect_vary());
   cache_fetcher->set_default_cache_html(options->default_cache_html());
   cache_fetcher->set_backend_first_byte_latency_histogram(
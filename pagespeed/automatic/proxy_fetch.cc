@@ -44,6 +44,8 @@
 #include "pagespeed/kernel/base/ref_counted_ptr.h"
 #include "pagespeed/kernel/base/request_trace.h"
 #include "pagespeed/kernel/base/stl_util.h"
+#include "pagespeed/kernel/base/string.h"
+#include "pagespeed/kernel/base/string_util.h"
 #include "pagespeed/kernel/base/thread_system.h"
 #include "pagespeed/kernel/base/timer.h"
 #include "pagespeed/kernel/http/content_type.h"
@@ -53,6 +55,8 @@
 #include "pagespeed/kernel/http/response_headers.h"
 #include "pagespeed/kernel/thread/queued_alarm.h"
 #include "pagespeed/kernel/thread/thread_synchronizer.h"
+#include "pagespeed/kernel/util/deflating_writer.h"
+#include "pagespeed/kernel/util/gzip_inflater.h"
 #include "pagespeed/opt/logging/log_record.h"
 #include "pagespeed/opt/logging/request_timing_info.h"
 
@@ -494,6 +498,8 @@ ProxyFetch::ProxyFetch(
       finishing_(false),
       done_result_(false),
       waiting_for_flush_to_finish_(false),
+      parse_ahead_job_created_(false),
+      parse_ahead_bytes_(0),
       idle_alarm_(nullptr),
       factory_(factory),
       trusted_input_(false) {
@@ -519,6 +525,7 @@ ProxyFetch::~ProxyFetch() {
   DCHECK(!network_flush_outstanding_);
   DCHECK(!done_outstanding_);
   DCHECK(!waiting_for_flush_to_finish_);
+  DCHECK(!parse_ahead_job_created_);
   DCHECK(text_queue_.empty());
   DCHECK(property_cache_callback_ == nullptr);
 }
@@ -713,6 +720,8 @@ void ProxyFetch::SetupForHtml() {
       // HTML sizes are likely to be altered by HTML rewriting.
       response_headers()->RemoveAll(HttpAttributes::kContentLength);
 
+      MaybeCompressHtml();
+
       // TODO(sligocki): See mod_instaweb.cc line 528, which strips Expires and
       // Content-MD5.  Perhaps we should do that here as well.
     }
@@ -798,7 +807,11 @@ void ProxyFetch::ScheduleQueueExecutionIfNeeded() {
   // We're waiting for any property-cache lookups and previous flushes to
   // complete, so no need to queue it here.  The queuing will happen when
   // the PropertyCache lookup is complete or from FlushDone.
-  if (waiting_for_flush_to_finish_ || (property_cache_callback_ != nullptr)) {
+  if (property_cache_callback_ != nullptr) {
+    return;
+  }
+  if (waiting_for_flush_to_finish_) {
+    ScheduleParseAheadIfNeeded();
     return;
   }
 
@@ -806,6 +819,16 @@ void ProxyFetch::ScheduleQueueExecutionIfNeeded() {
   sequence_->Add(MakeFunction(this, &ProxyFetch::ExecuteQueued));
 }
 
+void ProxyFetch::ScheduleParseAheadIfNeeded() {
+  mutex_->DCheckLocked();
+  if (parse_ahead_job_created_ || text_queue_.empty() ||
+      !Options()->pipeline_html_parse()) {
+    return;
+  }
+  parse_ahead_job_created_ = true;
+  sequence_->Add(MakeFunction(this, &ProxyFetch::ExecuteParseAhead));
+}
+
 void ProxyFetch::PropertyCacheComplete(
     ProxyFetchPropertyCallbackCollector* callback_collector) {
   driver_->TraceLiteral("PropertyCache lookup completed");
@@ -985,32 +1008,86 @@ bool ProxyFetch::IsCachedResultValid(const ResponseHeaders& headers) {
 }
 
 void ProxyFetch::FlushDone() {
+  if (driver_->parsing_ahead()) {
+    // The window is written out, so the text lexed meanwhile can join the
+    // next one.
+    driver_->EndParseAhead();
+  }
+
   ScopedMutex lock(mutex_.get());
   DCHECK(waiting_for_flush_to_finish_);
   waiting_for_flush_to_finish_ = false;
 
-  if (!text_queue_.empty() || network_flush_outstanding_ || done_outstanding_) {
+  if (!text_queue_.empty() || network_flush_outstanding_ ||
+      done_outstanding_ || (parse_ahead_bytes_ != 0)) {
     ScheduleQueueExecutionIfNeeded();
   }
 }
 
+void ProxyFetch::ExecuteParseAhead() {
+  bool can_parse_ahead = driver_->CanParseAhead();
+  StringStarVector v;
+  {
+    ScopedMutex lock(mutex_.get());
+    parse_ahead_job_created_ = false;
+
+    // If the flush completed before we got to run, FlushDone has already
+    // scheduled ExecuteQueued to pick up the text.
+    if (!waiting_for_flush_to_finish_ || !can_parse_ahead) {
+      return;
+    }
+
+    // Bound the next window to what ExecuteQueued would have let into it.
+    size_t buffer_limit = Options()->flush_buffer_limit_bytes();
+    size_t c = 0;
+    for (size_t n = text_queue_.size();
+         (c < n) && (parse_ahead_bytes_ < buffer_limit); ++c) {
+      v.push_back(text_queue_[c]);
+      parse_ahead_bytes_ += text_queue_[c]->length();
+    }
+    text_queue_.erase(text_queue_.begin(), text_queue_.begin() + c);
+  }
+
+  if (!v.empty() && !driver_->parsing_ahead()) {
+    driver_->BeginParseAhead();
+  }
+  for (int i = 0, n = v.size(); i < n; ++i) {
+    GoogleString* str = v[i];
+    driver_->ParseText(*str);
+    delete str;
+  }
+}
+
 void ProxyFetch::ExecuteQueued() {
   bool do_flush = false;
   bool do_finish = false;
   bool done_result = false;
   bool force_flush = false;
 
-  size_t buffer_limit = Options()->flush_buffer_limit_bytes();
+  // With adaptive_flush_window, a flush the driver asked for while parsing
+  // the previous batch, e.g. at the end of the head, is made before any more
+  // text is let into the window.
+  bool adaptive_flush_window = Options()->adaptive_flush_window();
+  bool content_flush = adaptive_flush_window && driver_->flush_requested();
+  size_t buffer_limit = driver_->FlushWindowBufferLimitBytes(
+      Options()->flush_buffer_limit_bytes());
   StringStarVector v;
   {
     ScopedMutex lock(mutex_.get());
     DCHECK(!waiting_for_flush_to_finish_);
 
-    size_t total = 0;
+    // Text lexed ahead of the last flush is already in the driver, but
+    // counts toward this window.
+    size_t total = parse_ahead_bytes_;
+    parse_ahead_bytes_ = 0;
     size_t force_flush_chunk_count = 0;  // set only if force_flush is true.
-    if (network_flush_outstanding_ && Options()->follow_flushes()) {
+    if (content_flush) {
+      force_flush = true;
+    } else if (network_flush_outstanding_ && Options()->follow_flushes()) {
       force_flush = true;
       force_flush_chunk_count = text_queue_.size();
+    } else if (total >= buffer_limit) {
+      force_flush = true;
     } else {
       // See if we should force a flush based on how much stuff has
       // accumulated.
@@ -1047,7 +1124,11 @@ void ProxyFetch::ExecuteQueued() {
     do_finish = done_outstanding_;
     done_result = done_result_;
 
-    network_flush_outstanding_ = false;
+    // A content flush lets none of the queued text into the window, so a
+    // network flush that arrived behind that text is still owed to it.
+    if (!content_flush || text_queue_.empty()) {
+      network_flush_outstanding_ = false;
+    }
 
     // Note that we don't clear done_outstanding_ here yet, as we
     // can only handle it if we are not also handling a flush.
@@ -1056,6 +1137,10 @@ void ProxyFetch::ExecuteQueued() {
       // Stop queuing up invocations of us until the flush we will do
       // below is done.
       waiting_for_flush_to_finish_ = true;
+
+      // Text left over by a partial flush can be lexed while the flush
+      // waits for its rewrites.
+      ScheduleParseAheadIfNeeded();
     }
   }
 
@@ -1070,6 +1155,17 @@ void ProxyFetch::ExecuteQueued() {
     driver_->ParseText(*str);
     delete str;
   }
+  if (!do_flush && !do_finish && adaptive_flush_window &&
+      driver_->flush_requested()) {
+    // The text just parsed asked for a flush. Make it now unless more text
+    // already got ExecuteQueued scheduled, which will then make it first.
+    ScopedMutex lock(mutex_.get());
+    if (!queue_run_job_created_) {
+      do_flush = true;
+      waiting_for_flush_to_finish_ = true;
+      ScheduleParseAheadIfNeeded();
+    }
+  }
   if (do_flush) {
     if (force_flush) {
       driver_->RequestFlush();
@@ -1153,8 +1249,49 @@ void ProxyFetch::Finish(bool success) {
   sync->Signal(kHeadersSetupRaceDone);
 }
 
+void ProxyFetch::MaybeCompressHtml() {
+  int level = Options()->html_compression_level();
+  if (level <= 0 || !request_headers()->AcceptsGzip() ||
+      response_headers()->Has(HttpAttributes::kContentEncoding)) {
+    return;
+  }
+
+  // HEAD, 204 and 304 responses have no body, so a gzip header and trailer
+  // would be the only bytes sent.
+  int status_code = response_headers()->status_code();
+  if ((request_headers()->method() == RequestHeaders::kHead) ||
+      (status_code == HttpStatus::kNoContent) ||
+      (status_code == HttpStatus::kNotModified)) {
+    return;
+  }
+
+  html_deflater_.reset(
+      new DeflatingWriter(GzipInflater::kGzip, level, driver_->writer()));
+  driver_->SetWriter(html_deflater_.get());
+  response_headers()->Add(HttpAttributes::kContentEncoding,
+                          HttpAttributes::kGzip);
+
+  // The compressed body is no longer byte-identical to the one a strong
+  // ETag names, so downgrade it to a weak validator.
+  const char* etag = response_headers()->Lookup1(HttpAttributes::kEtag);
+  if ((etag != nullptr) && !StringPiece(etag).starts_with("W/")) {
+    GoogleString weak_etag = StrCat("W/", etag);
+    response_headers()->Replace(HttpAttributes::kEtag, weak_etag);
+  }
+  if (!response_headers()->HasValue(HttpAttributes::kVary,
+                                    HttpAttributes::kAcceptEncoding)) {
+    response_headers()->Add(HttpAttributes::kVary,
+                            HttpAttributes::kAcceptEncoding);
+  }
+  response_headers()->ComputeCaching();
+}
+
 void ProxyFetch::CompleteFinishParse(bool success) {
   driver_ = nullptr;
+  if (html_deflater_ != nullptr) {
+    // Emit the gzip trailer before the base fetch is completed.
+    html_deflater_->Finish(factory_->message_handler());
+  }
   // Have to call directly -- sequence is gone with driver.
   Finish(success);
 }
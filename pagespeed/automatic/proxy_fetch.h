@@ -49,6 +49,7 @@
 namespace net_instaweb {
 
 class CacheUrlAsyncFetcher;
+class DeflatingWriter;
 class GoogleUrl;
 class MessageHandler;
 class ProxyFetch;
@@ -309,7 +310,9 @@ class ProxyFetchPropertyCallbackCollector {
 // dedicated fetcher thread.  We use a QueuedWorkerPool::Sequence to
 // offload them to a worker-thread.  This implementation bundles together
 // multiple Writes, and depending on the timing, may move Flushes to
-// follow Writes and collapse multiple Flushes into one.
+// follow Writes and collapse multiple Flushes into one.  With the
+// PipelineHtmlParse option, Writes arriving while a flush waits for its
+// rewrites are lexed during that wait instead of after it.
 class ProxyFetch : public SharedAsyncFetch {
  public:
   // These strings identify sync-points for reproducing races between
@@ -354,6 +357,7 @@ class ProxyFetch : public SharedAsyncFetch {
   friend class MockProxyFetch;
   FRIEND_TEST(ProxyFetchTest, TestInhibitParsing);
   FRIEND_TEST(ProxyFetchTest, TestFollowFlushes);
+  FRIEND_TEST(ProxyFetchTest, TestPipelineHtmlParse);
 
   // Called by ProxyFetchPropertyCallbackCollector when all property-cache
   // fetches are complete.  This function takes ownership of collector.
@@ -397,6 +401,14 @@ class ProxyFetch : public SharedAsyncFetch {
   // held.
   void ScheduleQueueExecutionIfNeeded();
 
+  // While a flush is outstanding, schedules ExecuteParseAhead to lex any
+  // buffered text if the options allow it. Assumes mutex held.
+  void ScheduleParseAheadIfNeeded();
+
+  // Lexes buffered text, up to a flush window's worth, ahead of the
+  // outstanding flush.  Runs in sequence_.
+  void ExecuteParseAhead();
+
   // Frees up the RewriteDriver (via FinishParse or Cleanup),
   // calls the callback (nulling out callback_ to ensure that we don't
   // do it again), notifies the ProxyInterface that the fetch is
@@ -422,6 +434,11 @@ class ProxyFetch : public SharedAsyncFetch {
   // Handler for the alarm; run in sequence_.
   void HandleIdleAlarm();
 
+  // If options request it and the client accepts gzip, routes the rewritten
+  // HTML through a DeflatingWriter so it is compressed as each flush window
+  // is serialized, rather than buffered and compressed by the server.
+  void MaybeCompressHtml();
+
   GoogleString url_;
   ServerContext* server_context_;
   Timer* timer_;
@@ -442,6 +459,9 @@ class ProxyFetch : public SharedAsyncFetch {
   // Has a call to RewriteDriver::ParseText been made yet.
   bool parse_text_called_;
 
+  // Non-null when rewritten HTML is gzipped on its way to the base fetch.
+  std::unique_ptr<DeflatingWriter> html_deflater_;
+
   // Tracks whether Done() has been called.
   bool done_called_;
 
@@ -499,6 +519,13 @@ class ProxyFetch : public SharedAsyncFetch {
   // on actually dispatching things queued up above.
   bool waiting_for_flush_to_finish_;
 
+  // True if we have queued up ExecuteParseAhead but did not execute it yet.
+  bool parse_ahead_job_created_;
+
+  // Bytes that ExecuteParseAhead has moved from text_queue_ into driver_
+  // since the last ExecuteQueued, which counts them toward its window.
+  size_t parse_ahead_bytes_;
+
   // Alarm used to keep track of inactivity, in order to help issue
   // flushes. Must only be accessed from the thread context of sequence_
   QueuedAlarm* idle_alarm_;
@@ -19,8 +19,11 @@
 
 #include "pagespeed/automatic/static_rewriter.h"
 
+#include <algorithm>
 #include <cstdio>
 #include <cstdlib>  // for exit()
+#include <memory>
+#include <vector>
 
 #include "base/logging.h"
 #include "net/instaweb/http/public/http_cache.h"
@@ -28,11 +31,16 @@
 #include "net/instaweb/http/public/url_async_fetcher.h"
 #include "net/instaweb/http/public/wget_url_fetcher.h"
 #include "net/instaweb/rewriter/public/critical_selector_finder.h"
+#include "net/instaweb/rewriter/public/css_filter.h"
+#include "net/instaweb/rewriter/public/file_load_policy.h"
+#include "net/instaweb/rewriter/public/image_rewrite_filter.h"
+#include "net/instaweb/rewriter/public/javascript_code_block.h"
 #include "net/instaweb/rewriter/public/rewrite_driver.h"
 #include "net/instaweb/rewriter/public/rewrite_driver_factory.h"
 #include "net/instaweb/rewriter/public/rewrite_gflags.h"
 #include "net/instaweb/rewriter/public/rewrite_options.h"
 #include "net/instaweb/rewriter/public/server_context.h"
+#include "pagespeed/kernel/base/abstract_mutex.h"
 #include "pagespeed/kernel/base/cache_interface.h"
 #include "pagespeed/kernel/base/file_system.h"
 #include "pagespeed/kernel/base/google_message_handler.h"
@@ -44,9 +52,15 @@
 #include "pagespeed/kernel/base/stdio_file_system.h"
 #include "pagespeed/kernel/base/string.h"
 #include "pagespeed/kernel/base/string_util.h"
+#include "pagespeed/kernel/base/string_writer.h"
+#include "pagespeed/kernel/base/thread.h"
+#include "pagespeed/kernel/base/thread_annotations.h"
 #include "pagespeed/kernel/base/thread_system.h"
+#include "pagespeed/kernel/base/timer.h"
+#include "pagespeed/kernel/cache/file_cache.h"
 #include "pagespeed/kernel/cache/lru_cache.h"
 #include "pagespeed/kernel/cache/threadsafe_cache.h"
+#include "pagespeed/kernel/cache/write_through_cache.h"
 #include "pagespeed/kernel/http/content_type.h"
 #include "pagespeed/kernel/http/http_names.h"
 #include "pagespeed/kernel/http/request_headers.h"
@@ -72,8 +86,124 @@ class FileServerContext : public ServerContext {
   virtual bool ProxiesHtml() const { return false; }
 };
 
+// Sums the byte savings reported by the resource rewriters.
+int64 ResourceBytesSaved(Statistics* stats) {
+  int64 saved = 0;
+  Variable* var =
+      stats->FindVariable(ImageRewriteFilter::kImageRewriteTotalBytesSaved);
+  if (var != NULL) {
+    saved += var->Get();
+  }
+  var = stats->FindVariable(JavascriptRewriteConfig::kTotalBytesSaved);
+  if (var != NULL) {
+    saved += var->Get();
+  }
+  UpDownCounter* counter =
+      stats->FindUpDownCounter(CssFilter::kTotalBytesSaved);
+  if (counter != NULL) {
+    saved += counter->Get();
+  }
+  return saved;
+}
+
+bool IsHtmlFilename(const StringPiece& filename) {
+  return StringCaseEndsWith(filename, ".html") ||
+         StringCaseEndsWith(filename, ".htm");
+}
+
 }  // namespace
 
+// Shared between the threads of a RewriteBatch() run.
+struct StaticRewriter::BatchState {
+  BatchState(const StringVector& html_names, AbstractMutex* mutex)
+      : html_names(html_names), next_index(0), mutex(mutex) {}
+
+  GoogleString base_url;
+  GoogleString input_dir;
+  GoogleString output_dir;
+  const StringVector& html_names;
+  // Options for every driver in the batch; each driver gets a clone.
+  std::unique_ptr<RewriteOptions> options;
+
+  int next_index GUARDED_BY(mutex);
+  StaticRewriter::BatchSummary summary GUARDED_BY(mutex);
+  std::unique_ptr<AbstractMutex> mutex;
+};
+
+// Takes files from the shared BatchState until there are none left,
+// rewriting each one synchronously.
+class StaticRewriter::BatchWorker : public ThreadSystem::Thread {
+ public:
+  BatchWorker(StaticRewriter* rewriter, BatchState* state)
+      : Thread(rewriter->file_rewriter_.thread_system(), "static rewrite",
+               ThreadSystem::kJoinable),
+        rewriter_(rewriter),
+        state_(state) {}
+
+  void Run() override {
+    for (;;) {
+      int index;
+      {
+        ScopedMutex lock(state_->mutex.get());
+        index = state_->next_index++;
+      }
+      if (index >= static_cast<int>(state_->html_names.size())) {
+        return;
+      }
+      RewriteOne(state_->html_names[index]);
+    }
+  }
+
+ private:
+  void RewriteOne(const GoogleString& name) {
+    FileSystem* file_system = rewriter_->file_system();
+    MessageHandler* handler = rewriter_->message_handler();
+    GoogleString url = StrCat(state_->base_url, name);
+    GoogleString input_path = StrCat(state_->input_dir, "/", name);
+    GoogleString output_path = StrCat(state_->output_dir, "/", name);
+    GoogleString input, output;
+    StringWriter writer(&output);
+    ServerContext* server_context = rewriter_->server_context_;
+    // Clone() doesn't carry over the signature, which the driver's cache
+    // lookups need.
+    RewriteOptions* options = state_->options->Clone();
+    server_context->ComputeSignature(options);
+    RewriteDriver* driver = server_context->NewCustomRewriteDriver(
+        options, RequestContext::NewTestRequestContext(
+                     server_context->thread_system()));
+
+    bool ok = false;
+    if (!file_system->ReadFile(input_path.c_str(), &input, handler)) {
+      handler->Message(kError, "Failed to read %s", input_path.c_str());
+      driver->Cleanup();
+    } else if (!rewriter_->RewriteHtml(driver, url, input_path, input,
+                                       &writer)) {
+      // RewriteHtml has already cleaned up the driver and said why.
+    } else if (!file_system->RecursivelyMakeDir(
+                   StringPiece(output_path).substr(0, output_path.rfind('/')),
+                   handler) ||
+               !file_system->WriteFileAtomic(output_path, output, handler)) {
+      handler->Message(kError, "Failed to write %s", output_path.c_str());
+    } else {
+      ok = true;
+    }
+
+    ScopedMutex lock(state_->mutex.get());
+    if (ok) {
+      ++state_->summary.files_rewritten;
+      state_->summary.html_input_bytes += input.size();
+      state_->summary.html_output_bytes += output.size();
+    } else {
+      ++state_->summary.files_failed;
+    }
+  }
+
+  StaticRewriter* rewriter_;
+  BatchState* state_;
+
+  DISALLOW_COPY_AND_ASSIGN(BatchWorker);
+};
+
 FileRewriter::FileRewriter(const ProcessContext& process_context,
                            const net_instaweb::RewriteGflags* gflags,
                            bool echo_errors_to_stdout)
@@ -82,6 +212,7 @@ FileRewriter::FileRewriter(const ProcessContext& process_context,
       simple_stats_(thread_system()),
       echo_errors_to_stdout_(echo_errors_to_stdout) {
   RewriteDriverFactory::InitStats(&simple_stats_);
+  FileCache::InitStats(&simple_stats_);
   InitializeDefaultOptions();
   SetStatistics(&simple_stats_);
 }
@@ -120,6 +251,26 @@ void FileRewriter::SetupCaches(ServerContext* server_context) {
   CacheInterface* cache =
       new ThreadsafeCache(lru_cache, thread_system()->NewMutex());
   Statistics* stats = server_context->statistics();
+
+  // With a file cache behind the LRU, rewrites done by one run are reused by
+  // the next, and by any server sharing the same cache directory.
+  const SystemRewriteOptions* options =
+      SystemRewriteOptions::DynamicCast(server_context->global_options());
+  if (options != NULL && !options->file_cache_path().empty()) {
+    TakeOwnership(lru_cache);
+    TakeOwnership(cache);
+    FileCache::CachePolicy* policy = new FileCache::CachePolicy(
+        timer(), hasher(), options->file_cache_clean_interval_ms(),
+        options->file_cache_clean_size_kb() * 1024,
+        options->file_cache_clean_inode_limit());
+    FileCache* file_cache = new FileCache(
+        options->file_cache_path(), file_system(), thread_system(),
+        NULL /* no cleaning worker */, policy, stats, message_handler());
+    TakeOwnership(file_cache);
+    cache = new WriteThroughCache(cache, file_cache);
+    TakeOwnership(cache);
+  }
+
   HTTPCache* http_cache = new HTTPCache(cache, timer(), hasher(), stats);
   http_cache->SetCompressionLevel(
       server_context->global_options()->http_cache_compression_level());
@@ -183,9 +334,15 @@ StaticRewriter::~StaticRewriter() {}
 bool StaticRewriter::ParseText(const StringPiece& url, const StringPiece& id,
                                const StringPiece& text,
                                const StringPiece& output_dir, Writer* writer) {
+  file_rewriter_.set_filename_prefix(output_dir);
   RewriteDriver* driver = server_context_->NewRewriteDriver(
       RequestContext::NewTestRequestContext(server_context_->thread_system()));
+  return RewriteHtml(driver, url, id, text, writer);
+}
 
+bool StaticRewriter::RewriteHtml(RewriteDriver* driver, const StringPiece& url,
+                                 const StringPiece& id,
+                                 const StringPiece& text, Writer* writer) {
   // For this simple file transformation utility we always want to perform
   // any optimizations we can, so we wait until everything is done rather
   // than using a deadline, the way a server deployment would.
@@ -199,7 +356,6 @@ bool StaticRewriter::ParseText(const StringPiece& url, const StringPiece& id,
       " Chrome/42.0.2302.4 Safari/537.36");
   driver->SetRequestHeaders(request_headers);
 
-  file_rewriter_.set_filename_prefix(output_dir);
   driver->SetWriter(writer);
   if (!driver->StartParseId(url, id, kContentTypeHtml)) {
     fprintf(stderr, "StartParseId failed on url %s\n", url.as_string().c_str());
@@ -220,6 +376,137 @@ bool StaticRewriter::ParseText(const StringPiece& url, const StringPiece& id,
   return true;
 }
 
+bool StaticRewriter::FindHtmlFiles(const StringPiece& dir,
+                                   StringVector* html_names) {
+  FileSystem* file_system = file_rewriter_.file_system();
+  MessageHandler* handler = file_rewriter_.message_handler();
+  GoogleString root = dir.as_string();
+  while (!root.empty() && root[root.size() - 1] == '/') {
+    root.resize(root.size() - 1);
+  }
+  StringVector pending;
+  pending.push_back(root);
+  while (!pending.empty()) {
+    GoogleString path = pending.back();
+    pending.pop_back();
+    StringVector entries;
+    if (!file_system->ListContents(path, &entries, handler)) {
+      return false;
+    }
+    for (int i = 0, n = entries.size(); i < n; ++i) {
+      if (file_system->IsDir(entries[i].c_str(), handler).is_true()) {
+        pending.push_back(entries[i]);
+      } else if (IsHtmlFilename(entries[i])) {
+        html_names->push_back(entries[i].substr(root.size() + 1));
+      }
+    }
+  }
+  return true;
+}
+
+bool StaticRewriter::ReadManifest(const StringPiece& manifest_path,
+                                  const StringPiece& base_url,
+                                  StringVector* html_names) {
+  GoogleString contents;
+  if (!file_rewriter_.file_system()->ReadFile(
+          manifest_path.as_string().c_str(), &contents,
+          file_rewriter_.message_handler())) {
+    return false;
+  }
+  // As in RewriteBatch, so that "http://host/dir2/" isn't taken to be under
+  // "http://host/dir".
+  GoogleString base_dir_url = base_url.as_string();
+  if (!StringPiece(base_dir_url).ends_with("/")) {
+    base_dir_url += "/";
+  }
+  StringPieceVector lines;
+  SplitStringPieceToVector(contents, "\n", &lines, true);
+  for (int i = 0, n = lines.size(); i < n; ++i) {
+    StringPiece line = lines[i];
+    TrimWhitespace(&line);
+    if (line.empty() || line.starts_with("#")) {
+      continue;
+    }
+    // The name is joined onto the output directory, so it must not be a
+    // URL that isn't under base_url, an absolute path, or climb out of it.
+    bool ok = true;
+    if (line.starts_with(base_dir_url)) {
+      line.remove_prefix(base_dir_url.size());
+      while (line.starts_with("/")) {
+        line.remove_prefix(1);
+      }
+    } else if (line.find("://") != StringPiece::npos ||
+               line.starts_with("/")) {
+      ok = false;
+    }
+    StringPieceVector components;
+    SplitStringPieceToVector(line, "/", &components, false);
+    for (int j = 0, m = components.size(); j < m; ++j) {
+      if (components[j] == "..") {
+        ok = false;
+      }
+    }
+    if (!ok || line.empty()) {
+      file_rewriter_.message_handler()->Message(
+          kWarning, "Skipping %s in %s: not a file under %s",
+          lines[i].as_string().c_str(), manifest_path.as_string().c_str(),
+          base_url.as_string().c_str());
+      continue;
+    }
+    html_names->push_back(line.as_string());
+  }
+  return true;
+}
+
+bool StaticRewriter::RewriteBatch(const StringPiece& base_url,
+                                  const StringPiece& input_dir,
+                                  const StringPiece& output_dir,
+                                  const StringVector& html_names,
+                                  int num_threads, BatchSummary* summary) {
+  Timer* timer = file_rewriter_.timer();
+  Statistics* stats = file_rewriter_.statistics();
+  int64 start_ms = timer->NowMs();
+  int64 start_bytes_saved = ResourceBytesSaved(stats);
+
+  BatchState state(html_names, file_rewriter_.thread_system()->NewMutex());
+  state.base_url = base_url.as_string();
+  if (!StringPiece(state.base_url).ends_with("/")) {
+    state.base_url += "/";
+  }
+  state.input_dir = input_dir.as_string();
+  state.output_dir = output_dir.as_string();
+
+  // Load resources directly from input_dir rather than fetching them.
+  state.options.reset(server_context_->global_options()->Clone());
+  state.options->file_load_policy()->Associate(
+      state.base_url, StrCat(state.input_dir, "/"));
+  server_context_->ComputeSignature(state.options.get());
+  file_rewriter_.set_filename_prefix(output_dir);
+
+  std::vector<std::unique_ptr<BatchWorker>> workers;
+  for (int i = 0; i < std::max(num_threads, 1); ++i) {
+    workers.push_back(std::make_unique<BatchWorker>(this, &state));
+    if (!workers.back()->Start()) {
+      LOG(ERROR) << "Could not start static rewrite thread";
+      workers.pop_back();
+      break;
+    }
+  }
+  if (workers.empty()) {
+    // No threads at all; do the work here instead.
+    BatchWorker(this, &state).Run();
+  }
+  for (int i = 0, n = workers.size(); i < n; ++i) {
+    workers[i]->Join();
+  }
+
+  ScopedMutex lock(state.mutex.get());
+  *summary = state.summary;
+  summary->resource_bytes_saved = ResourceBytesSaved(stats) - start_bytes_saved;
+  summary->elapsed_ms = timer->NowMs() - start_ms;
+  return summary->files_failed == 0;
+}
+
 FileSystem* StaticRewriter::file_system() {
   return file_rewriter_.file_system();
 }
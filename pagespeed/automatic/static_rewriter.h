@@ -24,6 +24,7 @@
 #include "net/instaweb/rewriter/public/rewrite_gflags.h"
 #include "pagespeed/kernel/base/basictypes.h"
 #include "pagespeed/kernel/base/statistics.h"
+#include "pagespeed/kernel/base/string.h"
 #include "pagespeed/kernel/base/string_util.h"
 #include "pagespeed/kernel/base/writer.h"
 #include "pagespeed/kernel/util/simple_stats.h"
@@ -35,12 +36,14 @@ class Hasher;
 class MessageHandler;
 class NamedLockManager;
 class ProcessContext;
+class RewriteDriver;
 class RewriteOptions;
 class ServerContext;
 class UrlAsyncFetcher;
 
 // Implements a baseline RewriteDriverFactory with the simplest possible
-// options for cache, fetchers, & system interface.
+// options for cache, fetchers, & system interface.  If the FileCachePath
+// option is set, the LRU cache is backed by a persistent file cache there.
 //
 // TODO(jmarantz): fill out enough functionality so that this will be
 // a functional static rewriter that could optimize an HTML file
@@ -72,9 +75,29 @@ class FileRewriter : public RewriteDriverFactory {
 };
 
 // Encapsulates the instantiation of a FileRewriter & a simple one-shot
-// interface to rewrite some HTML text.
+// interface to rewrite some HTML text, plus a batch mode that rewrites a
+// whole site.
 class StaticRewriter {
  public:
+  // Totals reported by RewriteBatch().
+  struct BatchSummary {
+    BatchSummary()
+        : files_rewritten(0),
+          files_failed(0),
+          html_input_bytes(0),
+          html_output_bytes(0),
+          resource_bytes_saved(0),
+          elapsed_ms(0) {}
+
+    int files_rewritten;
+    int files_failed;
+    int64 html_input_bytes;
+    int64 html_output_bytes;
+    // As reported by the image, CSS and JavaScript rewriters.
+    int64 resource_bytes_saved;
+    int64 elapsed_ms;
+  };
+
   StaticRewriter(const ProcessContext& process_context, int* argc,
                  char*** argv);
   explicit StaticRewriter(const ProcessContext& process_context);
@@ -84,10 +107,43 @@ class StaticRewriter {
                  const StringPiece& id, const StringPiece& output_dir,
                  Writer* writer);
 
+  // Appends to html_names the paths, relative to dir, of every .html or .htm
+  // file in the tree rooted at dir.  Returns false if dir couldn't be listed.
+  bool FindHtmlFiles(const StringPiece& dir, StringVector* html_names);
+
+  // Appends to html_names the HTML files listed in manifest_path, one per
+  // line, each either a path relative to base_url or a URL under it.  Blank
+  // lines and lines starting with '#' are ignored.  Absolute paths, URLs not
+  // under base_url, and paths with ".." components are skipped with a
+  // warning, so that no name can lead outside the output directory.  Returns
+  // false if the manifest couldn't be read.
+  bool ReadManifest(const StringPiece& manifest_path,
+                    const StringPiece& base_url, StringVector* html_names);
+
+  // Rewrites each of html_names, a path relative to both input_dir and
+  // base_url, from input_dir into the same path under output_dir.  The files
+  // are spread over num_threads threads that share this rewriter's
+  // ServerContext and caches.  Resources referenced from base_url are loaded
+  // straight from input_dir, so they are rewritten and cached too.  Blocks
+  // until every file has been processed, and returns true if all of them were
+  // rewritten successfully.
+  bool RewriteBatch(const StringPiece& base_url, const StringPiece& input_dir,
+                    const StringPiece& output_dir,
+                    const StringVector& html_names, int num_threads,
+                    BatchSummary* summary);
+
   FileSystem* file_system();
   MessageHandler* message_handler();
 
  private:
+  class BatchWorker;
+  struct BatchState;
+
+  // Rewrites text through driver, which is consumed.
+  bool RewriteHtml(RewriteDriver* driver, const StringPiece& url,
+                   const StringPiece& id, const StringPiece& text,
+                   Writer* writer);
+
   RewriteGflags gflags_;
   FileRewriter file_rewriter_;
   ServerContext* server_context_;
@@ -38,6 +38,13 @@ CentralControllerRpcServer::CentralControllerRpcServer(
       rewrite_controller_(rewrite_controller),
       handler_(handler) {}
 
+void CentralControllerRpcServer::AddListeningAddress(
+    const GoogleString& address) {
+  if (address != listen_address_) {
+    extra_listen_addresses_.push_back(address);
+  }
+}
+
 int CentralControllerRpcServer::Setup() {
   ::grpc::ServerBuilder builder;
   // InsecureServerCredentials means unencrytped, unauthenticated. In future
@@ -45,6 +52,9 @@ int CentralControllerRpcServer::Setup() {
   // encrypt and/or authenticate.
   builder.AddListeningPort(listen_address_,
                            ::grpc::InsecureServerCredentials());
+  for (const GoogleString& address : extra_listen_addresses_) {
+    builder.AddListeningPort(address, ::grpc::InsecureServerCredentials());
+  }
   builder.RegisterService(&service_);
   queue_ = builder.AddCompletionQueue();
   server_ = builder.BuildAndStart();
@@ -27,6 +27,7 @@
 #include "pagespeed/controller/schedule_rewrite_controller.h"
 #include "pagespeed/kernel/base/message_handler.h"
 #include "pagespeed/kernel/base/string.h"
+#include "pagespeed/kernel/base/string_util.h"
 #include "pagespeed/kernel/util/grpc.h"
 #include "pagespeed/system/controller_process.h"
 
@@ -47,6 +48,11 @@ class CentralControllerRpcServer : public ControllerProcess {
       ScheduleRewriteController* rewrite_controller, MessageHandler* handler);
   ~CentralControllerRpcServer() override {}
 
+  // Also accept RPCs on address, for instance so that the controllers on
+  // other nodes of a cluster can reach this one. Must be called before
+  // Setup().
+  void AddListeningAddress(const GoogleString& address);
+
   // ControllerProcess implementation.
   int Setup() override;
   int Run() override;
@@ -57,6 +63,7 @@ class CentralControllerRpcServer : public ControllerProcess {
 
  private:
   const GoogleString listen_address_;
+  StringVector extra_listen_addresses_;
   std::unique_ptr<::grpc::Server> server_;
   std::unique_ptr<::grpc::ServerCompletionQueue> queue_;
   CentralControllerRpcService::AsyncService service_;
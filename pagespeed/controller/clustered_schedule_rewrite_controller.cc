@@ -0,0 +1,194 @@
+/*
+ * Licensed to the Apache Software Foundation (ASF) under one
+ * or more contributor license agreements.  See the NOTICE file
+ * distributed with this work for additional information
+ * regarding copyright ownership.  The ASF licenses this file
+ * to you under the Apache License, Version 2.0 (the
+ * "License"); you may not use this file except in compliance
+ * with the License.  You may obtain a copy of the License at
+ * 
+ *   http://www.apache.org/licenses/LICENSE-2.0
+ * 
+ * Unless required by applicable law or agreed to in writing,
+ * software distributed under the License is distributed on an
+ * "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY
+ * KIND, either express or implied.  See the License for the
+ * specific language governing permissions and limitations
+ * under the License.
+ */
+
+#include "pagespeed/controller/clustered_schedule_rewrite_controller.h"
+
+#include <utility>
+
+#include "base/logging.h"
+#include "pagespeed/kernel/base/function.h"
+#include "pagespeed/kernel/base/statistics.h"
+#include "pagespeed/kernel/base/string.h"
+#include "pagespeed/kernel/base/thread_system.h"
+
+namespace net_instaweb {
+
+const char ClusteredScheduleRewriteController::kNumRewritesScheduledLocally[] =
+    "clustered-controller-num-rewrites-scheduled-locally";
+const char ClusteredScheduleRewriteController::kNumRewritesForwarded[] =
+    "clustered-controller-num-rewrites-forwarded";
+const char ClusteredScheduleRewriteController::kNumRewritesPeerUnreachable[] =
+    "clustered-controller-num-rewrites-peer-unreachable";
+
+// Passes the decision of whichever controller a key was routed to on to the
+// original callback, forgetting the route if the request was rejected.
+class ClusteredScheduleRewriteController::RoutedCallback : public Function {
+ public:
+  RoutedCallback(ClusteredScheduleRewriteController* controller,
+                 const GoogleString& key, Function* callback)
+      : controller_(controller), key_(key), callback_(callback) {}
+  ~RoutedCallback() override {}
+
+  void Run() override { callback_->CallRun(); }
+
+  void Cancel() override {
+    controller_->ReleaseRoute(key_);
+    callback_->CallCancel();
+  }
+
+ private:
+  ClusteredScheduleRewriteController* controller_;
+  const GoogleString key_;
+  Function* callback_;
+
+  DISALLOW_COPY_AND_ASSIGN(RoutedCallback);
+};
+
+ClusteredScheduleRewriteController::ClusteredScheduleRewriteController(
+    const GoogleString& self, const PeerMap& peers,
+    ScheduleRewriteController* local_controller, ThreadSystem* thread_system,
+    Statistics* statistics)
+    : self_(self),
+      local_controller_(local_controller),
+      mutex_(thread_system->NewMutex()),
+      num_rewrites_scheduled_locally_(
+          statistics->GetTimedVariable(kNumRewritesScheduledLocally)),
+      num_rewrites_forwarded_(
+          statistics->GetTimedVariable(kNumRewritesForwarded)),
+      num_rewrites_peer_unreachable_(
+          statistics->GetTimedVariable(kNumRewritesPeerUnreachable)) {
+  ring_.AddNode(self_);
+  for (const auto& peer : peers) {
+    CHECK_NE(peer.first, self_);
+    ring_.AddNode(peer.first);
+    peers_[peer.first].reset(peer.second);
+  }
+}
+
+ClusteredScheduleRewriteController::~ClusteredScheduleRewriteController() {}
+
+void ClusteredScheduleRewriteController::InitStats(Statistics* statistics) {
+  statistics->AddTimedVariable(kNumRewritesScheduledLocally,
+                               Statistics::kDefaultGroup);
+  statistics->AddTimedVariable(kNumRewritesForwarded,
+                               Statistics::kDefaultGroup);
+  statistics->AddTimedVariable(kNumRewritesPeerUnreachable,
+                               Statistics::kDefaultGroup);
+}
+
+ScheduleRewriteController* ClusteredScheduleRewriteController::ChooseController(
+    const GoogleString& key) {
+  const GoogleString& owner = ring_.Owner(key);
+  if (owner == self_) {
+    num_rewrites_scheduled_locally_->IncBy(1);
+    return local_controller_.get();
+  }
+  Peer* peer = peers_[owner].get();
+  if (!peer->IsReachable()) {
+    num_rewrites_peer_unreachable_->IncBy(1);
+    return local_controller_.get();
+  }
+  num_rewrites_forwarded_->IncBy(1);
+  return peer;
+}
+
+void ClusteredScheduleRewriteController::Schedule(const GoogleString& key,
+                                                  Function* callback,
+                                                  bool forwarded) {
+  ScheduleRewriteController* controller;
+  {
+    ScopedMutex lock(mutex_.get());
+    RouteMap::iterator iter = routes_.find(key);
+    if (iter == routes_.end()) {
+      if (forwarded) {
+        num_rewrites_scheduled_locally_->IncBy(1);
+        controller = local_controller_.get();
+      } else {
+        controller = ChooseController(key);
+      }
+      Route route = {controller, 0};
+      iter = routes_.insert(std::make_pair(key, route)).first;
+    } else if (forwarded &&
+               iter->second.controller != local_controller_.get()) {
+      // We've forwarded this key to a node that forwarded it straight back,
+      // so we disagree about who owns it. Somebody is already working on it,
+      // which is all that matters.
+      lock.Release();
+      callback->CallCancel();
+      return;
+    }
+    controller = iter->second.controller;
+    ++iter->second.num_outstanding;
+  }
+
+  controller->ScheduleRewrite(key, new RoutedCallback(this, key, callback));
+}
+
+void ClusteredScheduleRewriteController::ScheduleRewrite(
+    const GoogleString& key, Function* callback) {
+  Schedule(key, callback, false /* forwarded */);
+}
+
+void ClusteredScheduleRewriteController::ScheduleForwardedRewrite(
+    const GoogleString& key, Function* callback) {
+  Schedule(key, callback, true /* forwarded */);
+}
+
+ScheduleRewriteController* ClusteredScheduleRewriteController::ReleaseRoute(
+    const GoogleString& key) {
+  ScopedMutex lock(mutex_.get());
+  RouteMap::iterator iter = routes_.find(key);
+  if (iter == routes_.end()) {
+    return nullptr;
+  }
+  ScheduleRewriteController* controller = iter->second.controller;
+  if (--iter->second.num_outstanding == 0) {
+    routes_.erase(iter);
+  }
+  return controller;
+}
+
+void ClusteredScheduleRewriteController::NotifyRewriteComplete(
+    const GoogleString& key) {
+  ScheduleRewriteController* controller = ReleaseRoute(key);
+  if (controller == nullptr) {
+    LOG(DFATAL) << "NotifyRewriteComplete for unscheduled key: " << key;
+    return;
+  }
+  controller->NotifyRewriteComplete(key);
+}
+
+void ClusteredScheduleRewriteController::NotifyRewriteFailed(
+    const GoogleString& key) {
+  ScheduleRewriteController* controller = ReleaseRoute(key);
+  if (controller == nullptr) {
+    LOG(DFATAL) << "NotifyRewriteFailed for unscheduled key: " << key;
+    return;
+  }
+  controller->NotifyRewriteFailed(key);
+}
+
+void ClusteredScheduleRewriteController::ShutDown() {
+  local_controller_->ShutDown();
+  for (const auto& peer : peers_) {
+    peer.second->ShutDown();
+  }
+}
+
+}  // namespace net_instaweb
@@ -0,0 +1,135 @@
+/*
+ * Licensed to the Apache Software Foundation (ASF) under one
+ * or more contributor license agreements.  See the NOTICE file
+ * distributed with this work for additional information
+ * regarding copyright ownership.  The ASF licenses this file
+ * to you under the Apache License, Version 2.0 (the
+ * "License"); you may not use this file except in compliance
+ * with the License.  You may obtain a copy of the License at
+ * 
+ *   http://www.apache.org/licenses/LICENSE-2.0
+ * 
+ * Unless required by applicable law or agreed to in writing,
+ * software distributed under the License is distributed on an
+ * "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY
+ * KIND, either express or implied.  See the License for the
+ * specific language governing permissions and limitations
+ * under the License.
+ */
+
+#ifndef PAGESPEED_CONTROLLER_CLUSTERED_SCHEDULE_REWRITE_CONTROLLER_H_
+#define PAGESPEED_CONTROLLER_CLUSTERED_SCHEDULE_REWRITE_CONTROLLER_H_
+
+#include <map>
+#include <memory>
+#include <unordered_map>
+
+#include "pagespeed/controller/consistent_hash_ring.h"
+#include "pagespeed/controller/schedule_rewrite_controller.h"
+#include "pagespeed/kernel/base/abstract_mutex.h"
+#include "pagespeed/kernel/base/basictypes.h"
+#include "pagespeed/kernel/base/function.h"
+#include "pagespeed/kernel/base/statistics.h"
+#include "pagespeed/kernel/base/string.h"
+#include "pagespeed/kernel/base/thread_annotations.h"
+#include "pagespeed/kernel/base/thread_system.h"
+
+namespace net_instaweb {
+
+// ScheduleRewriteController for a cluster of servers that share a metadata
+// cache, so that each expensive rewrite happens once across the cluster rather
+// than once per server. Every node's controller is configured with the same
+// set of nodes, and consistent-hashes each key to the node that owns it.
+// Requests for keys this node owns go to the local controller; the rest are
+// forwarded to the owner's controller, whose decision is passed back.
+//
+// Forwarded requests are always scheduled by the node that receives them, so
+// nodes that disagree about the cluster (say, in the middle of a config push)
+// may both run a rewrite, but can't bounce a request between them. If the
+// owner can't be reached the key is scheduled locally instead.
+//
+// Once a key has been scheduled, completions and further requests for it are
+// routed to the same controller until it is done, even if the owner's
+// reachability changes in the meantime.
+class ClusteredScheduleRewriteController : public ScheduleRewriteController {
+ public:
+  // The controller on another node, as seen from this one.
+  class Peer : public ScheduleRewriteController {
+   public:
+    ~Peer() override {}
+
+    // Returns false if the peer is known to be unreachable, in which case the
+    // keys it owns are scheduled locally.
+    virtual bool IsReachable() = 0;
+
+   protected:
+    Peer() {}
+
+   private:
+    DISALLOW_COPY_AND_ASSIGN(Peer);
+  };
+
+  // Maps node names (as they appear on the ring) to their controllers.
+  typedef std::map<GoogleString, Peer*> PeerMap;
+
+  static const char kNumRewritesScheduledLocally[];
+  static const char kNumRewritesForwarded[];
+  static const char kNumRewritesPeerUnreachable[];
+
+  // self is this node's name on the ring; peers are all the other nodes. Takes
+  // ownership of local_controller and of the peers.
+  ClusteredScheduleRewriteController(
+      const GoogleString& self, const PeerMap& peers,
+      ScheduleRewriteController* local_controller, ThreadSystem* thread_system,
+      Statistics* statistics);
+  ~ClusteredScheduleRewriteController() override;
+
+  static void InitStats(Statistics* statistics);
+
+  // ScheduleRewriteController interface.
+  void ScheduleRewrite(const GoogleString& key, Function* callback) override;
+  void ScheduleForwardedRewrite(const GoogleString& key,
+                                Function* callback) override;
+  void NotifyRewriteComplete(const GoogleString& key) override;
+  void NotifyRewriteFailed(const GoogleString& key) override;
+  void ShutDown() override;
+
+ private:
+  class RoutedCallback;
+
+  // Where an outstanding key was sent, and how many requests for it have not
+  // yet been canceled or notified.
+  struct Route {
+    ScheduleRewriteController* controller;
+    int num_outstanding;
+  };
+  typedef std::unordered_map<GoogleString, Route> RouteMap;
+
+  // Picks the controller that should schedule a key with no outstanding
+  // requests.
+  ScheduleRewriteController* ChooseController(const GoogleString& key);
+
+  void Schedule(const GoogleString& key, Function* callback, bool forwarded);
+
+  // Returns the controller that key was routed to and drops one outstanding
+  // request from its route, or returns nullptr if there is no route for key.
+  ScheduleRewriteController* ReleaseRoute(const GoogleString& key);
+
+  const GoogleString self_;
+  ConsistentHashRing ring_;
+  std::map<GoogleString, std::unique_ptr<Peer>> peers_;
+  std::unique_ptr<ScheduleRewriteController> local_controller_;
+
+  std::unique_ptr<AbstractMutex> mutex_;
+  RouteMap routes_ GUARDED_BY(mutex_);
+
+  TimedVariable* num_rewrites_scheduled_locally_;
+  TimedVariable* num_rewrites_forwarded_;
+  TimedVariable* num_rewrites_peer_unreachable_;
+
+  DISALLOW_COPY_AND_ASSIGN(ClusteredScheduleRewriteController);
+};
+
+}  // namespace net_instaweb
+
+#endif  // PAGESPEED_CONTROLLER_CLUSTERED_SCHEDULE_REWRITE_CONTROLLER_H_
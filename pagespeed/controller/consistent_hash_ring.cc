@@ -0,0 +1,68 @@
+/*
+ * Licensed to the Apache Software Foundation (ASF) under one
+ * or more contributor license agreements.  See the NOTICE file
+ * distributed with this work for additional information
+ * regarding copyright ownership.  The ASF licenses this file
+ * to you under the Apache License, Version 2.0 (the
+ * "License"); you may not use this file except in compliance
+ * with the License.  You may obtain a copy of the License at
+ * 
+ *   http://www.apache.org/licenses/LICENSE-2.0
+ * 
+ * Unless required by applicable law or agreed to in writing,
+ * software distributed under the License is distributed on an
+ * "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY
+ * KIND, either express or implied.  See the License for the
+ * specific language governing permissions and limitations
+ * under the License.
+ */
+
+#include "pagespeed/controller/consistent_hash_ring.h"
+
+#include <algorithm>
+
+#include "base/logging.h"
+#include "pagespeed/kernel/base/string_util.h"
+
+namespace net_instaweb {
+
+ConsistentHashRing::ConsistentHashRing() {}
+
+ConsistentHashRing::~ConsistentHashRing() {}
+
+void ConsistentHashRing::AddNode(const GoogleString& node) {
+  if (std::find(nodes_.begin(), nodes_.end(), node) != nodes_.end()) {
+    return;
+  }
+  int index = nodes_.size();
+  nodes_.push_back(node);
+  for (int i = 0; i < kPointsPerNode; ++i) {
+    points_.push_back(
+        Point(hasher_.HashToUint64(StrCat(node, "#", IntegerToString(i))),
+              index));
+  }
+  // Ties between nodes are broken by name rather than by the order in which
+  // they were added, so that every process agrees on them.
+  std::sort(points_.begin(), points_.end(),
+            [this](const Point& a, const Point& b) {
+              if (a.first != b.first) {
+                return a.first < b.first;
+              }
+              return nodes_[a.second] < nodes_[b.second];
+            });
+}
+
+const GoogleString& ConsistentHashRing::Owner(StringPiece key) const {
+  CHECK(!points_.empty());
+  uint64 hash = hasher_.HashToUint64(key);
+  // The owner is the first point at or after the key's hash, wrapping around.
+  std::vector<Point>::const_iterator p = std::lower_bound(
+      points_.begin(), points_.end(), hash,
+      [](const Point& point, uint64 h) { return point.first < h; });
+  if (p == points_.end()) {
+    p = points_.begin();
+  }
+  return nodes_[p->second];
+}
+
+}  // namespace net_instaweb
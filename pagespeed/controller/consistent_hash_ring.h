@@ -0,0 +1,71 @@
+/*
+ * Licensed to the Apache Software Foundation (ASF) under one
+ * or more contributor license agreements.  See the NOTICE file
+ * distributed with this work for additional information
+ * regarding copyright ownership.  The ASF licenses this file
+ * to you under the Apache License, Version 2.0 (the
+ * "License"); you may not use this file except in compliance
+ * with the License.  You may obtain a copy of the License at
+ * 
+ *   http://www.apache.org/licenses/LICENSE-2.0
+ * 
+ * Unless required by applicable law or agreed to in writing,
+ * software distributed under the License is distributed on an
+ * "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY
+ * KIND, either express or implied.  See the License for the
+ * specific language governing permissions and limitations
+ * under the License.
+ */
+
+#ifndef PAGESPEED_CONTROLLER_CONSISTENT_HASH_RING_H_
+#define PAGESPEED_CONTROLLER_CONSISTENT_HASH_RING_H_
+
+#include <utility>
+#include <vector>
+
+#include "pagespeed/kernel/base/basictypes.h"
+#include "pagespeed/kernel/base/md5_hasher.h"
+#include "pagespeed/kernel/base/string.h"
+#include "pagespeed/kernel/base/string_util.h"
+
+namespace net_instaweb {
+
+// Assigns each key to one of a set of nodes, such that every process
+// configured with the same nodes agrees on the owner of every key, and adding
+// or removing a node only moves the keys that node gains or loses. Each node
+// is hashed onto the ring at kPointsPerNode places, which keeps the share of
+// keys owned by each node close to even. Hashing is MD5 based, so the
+// assignment doesn't depend on the platform or on the order nodes are added.
+//
+// Not thread-safe while nodes are being added; Owner() may be called
+// concurrently once the ring is complete.
+class ConsistentHashRing {
+ public:
+  static const int kPointsPerNode = 128;
+
+  ConsistentHashRing();
+  ~ConsistentHashRing();
+
+  // Adding the same node more than once has no effect.
+  void AddNode(const GoogleString& node);
+
+  // Returns the node that owns key. Must not be called on an empty ring.
+  const GoogleString& Owner(StringPiece key) const;
+
+  int num_nodes() const { return nodes_.size(); }
+  bool empty() const { return nodes_.empty(); }
+
+ private:
+  // Position on the ring, index into nodes_.
+  typedef std::pair<uint64, int> Point;
+
+  MD5Hasher hasher_;
+  StringVector nodes_;
+  std::vector<Point> points_;  // Sorted.
+
+  DISALLOW_COPY_AND_ASSIGN(ConsistentHashRing);
+};
+
+}  // namespace net_instaweb
+
+#endif  // PAGESPEED_CONTROLLER_CONSISTENT_HASH_RING_H_
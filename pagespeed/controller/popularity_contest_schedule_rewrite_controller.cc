@@ -19,6 +19,7 @@
 
 #include "pagespeed/controller/popularity_contest_schedule_rewrite_controller.h"
 
+#include <algorithm>
 #include <unordered_map>
 #include <utility>
 
@@ -28,10 +29,19 @@
 #include "pagespeed/kernel/base/scoped_ptr.h"
 #include "pagespeed/kernel/base/statistics.h"
 #include "pagespeed/kernel/base/string.h"
+#include "pagespeed/kernel/base/string_util.h"
 #include "pagespeed/kernel/base/thread_system.h"
 
 namespace net_instaweb {
 
+namespace {
+
+// Bound on the number of filter types we keep cost averages for, in case keys
+// turn out not to be rewrite context lock names.
+const size_t kMaxFilterTypes = 256;
+
+}  // namespace
+
 const char PopularityContestScheduleRewriteController::kNumRewritesRequested[] =
     "popularity-contest-num-rewrites-requested";
 const char PopularityContestScheduleRewriteController::kNumRewritesSucceeded[] =
@@ -51,6 +61,18 @@ const char PopularityContestScheduleRewriteController::kNumRewritesRunning[] =
 const char
     PopularityContestScheduleRewriteController::kNumRewritesAwaitingRetry[] =
         "popularity-contest-num-rewrites-awaiting-retry";
+const char
+    PopularityContestScheduleRewriteController::kNumRequestsCostPenalized[] =
+        "popularity-contest-num-requests-cost-penalized";
+const char PopularityContestScheduleRewriteController::kRewriteRunTimeMs[] =
+    "popularity-contest-rewrite-run-time-ms";
+
+const int64 PopularityContestScheduleRewriteController::kMinCostUs =
+    Timer::kMsUs;
+const int64 PopularityContestScheduleRewriteController::kRequestWeight =
+    1000 * 1000;
+const int64 PopularityContestScheduleRewriteController::kAgingPeriodMs =
+    30 * Timer::kSecondMs;
 
 PopularityContestScheduleRewriteController::
     PopularityContestScheduleRewriteController(ThreadSystem* thread_system,
@@ -59,6 +81,7 @@ PopularityContestScheduleRewriteController::
                                                int max_queued_rewrites)
     : mutex_(thread_system->NewMutex()),
       timer_(timer),
+      start_ms_(timer->NowMs()),
       running_rewrites_(0),
       max_running_rewrites_(max_running_rewrites),
       max_queued_rewrites_(max_queued_rewrites),
@@ -72,7 +95,10 @@ PopularityContestScheduleRewriteController::
       queue_size_(stats->GetUpDownCounter(kRewriteQueueSize)),
       num_rewrites_running_(stats->GetUpDownCounter(kNumRewritesRunning)),
       num_rewrites_awaiting_retry_(
-          stats->GetUpDownCounter(kNumRewritesAwaitingRetry)) {
+          stats->GetUpDownCounter(kNumRewritesAwaitingRetry)),
+      num_requests_cost_penalized_(
+          stats->GetTimedVariable(kNumRequestsCostPenalized)),
+      rewrite_run_time_ms_(stats->GetTimedVariable(kRewriteRunTimeMs)) {
   // Technically the code should work with these *at* zero, but then what's the
   // point?
   CHECK_GT(max_running_rewrites_, 0);
@@ -90,6 +116,9 @@ void PopularityContestScheduleRewriteController::InitStats(Statistics* stats) {
   stats->AddUpDownCounter(kRewriteQueueSize);
   stats->AddUpDownCounter(kNumRewritesRunning);
   stats->AddUpDownCounter(kNumRewritesAwaitingRetry);
+  stats->AddTimedVariable(kNumRequestsCostPenalized,
+                          Statistics::kDefaultGroup);
+  stats->AddTimedVariable(kRewriteRunTimeMs, Statistics::kDefaultGroup);
 }
 
 PopularityContestScheduleRewriteController::
@@ -133,7 +162,7 @@ void PopularityContestScheduleRewriteController::ScheduleRewrite(
   if (rewrite->state == RUNNING) {
     // The key is already being processed by another worker, so cancel this
     // request.
-    ++rewrite->saved_priority;
+    rewrite->saved_priority += RequestWeight(rewrite);
     num_rewrites_rejected_in_progress_->IncBy(1);
     lock.Release();
     callback->CallCancel();
@@ -149,10 +178,12 @@ void PopularityContestScheduleRewriteController::ScheduleRewrite(
     rewrite->callback = nullptr;
   }
 
-  int priority = 1;
-  if (rewrite->state == AWAITING_RETRY) {
-    // saved_priority is what was left over from the previous failed attempt. It
-    // may be zero.
+  int64 priority = RequestWeight(rewrite);
+  if (rewrite->state == STOPPED) {
+    priority += InitialPriority();
+  } else if (rewrite->state == AWAITING_RETRY) {
+    // saved_priority is what was left over from the previous failed attempt,
+    // including the age it had then.
     priority += rewrite->saved_priority;
     rewrite->saved_priority = 0;
     retry_queue_.Remove(rewrite);
@@ -235,6 +266,7 @@ Function* PopularityContestScheduleRewriteController::StartRewrite(
   DCHECK(rewrite->callback != nullptr);
   if (rewrite->callback != nullptr) {
     rewrite->state = RUNNING;
+    rewrite->start_us = timer_->NowUs();
     ++running_rewrites_;
     num_rewrites_running_->Add(1);
     callback = rewrite->callback;
@@ -250,6 +282,59 @@ void PopularityContestScheduleRewriteController::StopRewrite(Rewrite* rewrite) {
   rewrite->state = STOPPED;
   --running_rewrites_;
   num_rewrites_running_->Add(-1);
+
+  int64 cost_us = std::max<int64>(timer_->NowUs() - rewrite->start_us, 0);
+  rewrite_run_time_ms_->IncBy(cost_us / Timer::kMsUs);
+  rewrite->cost_us = std::max(cost_us, kMinCostUs);
+  StringPiece filter_type = FilterType(rewrite->key);
+  if (filter_type.empty()) {
+    return;
+  }
+  CostMap::iterator i = filter_cost_us_.find(filter_type.as_string());
+  if (i != filter_cost_us_.end()) {
+    // Exponentially weighted, so that the estimate follows changes in load.
+    i->second += (rewrite->cost_us - i->second) / 4;
+  } else if (filter_cost_us_.size() < kMaxFilterTypes) {
+    filter_cost_us_.emplace(filter_type.as_string(), rewrite->cost_us);
+  }
+}
+
+int64 PopularityContestScheduleRewriteController::RequestWeight(
+    const Rewrite* rewrite) {
+  int64 cost_us = rewrite->cost_us;
+  if (cost_us == 0) {
+    StringPiece filter_type = FilterType(rewrite->key);
+    if (!filter_type.empty()) {
+      CostMap::const_iterator i =
+          filter_cost_us_.find(filter_type.as_string());
+      if (i != filter_cost_us_.end()) {
+        cost_us = i->second;
+      }
+    }
+  }
+  if (cost_us <= kMinCostUs) {
+    return kRequestWeight;
+  }
+  num_requests_cost_penalized_->IncBy(1);
+  // Never let a request count for nothing.
+  return std::max<int64>(kRequestWeight * kMinCostUs / cost_us, 1);
+}
+
+int64 PopularityContestScheduleRewriteController::InitialPriority() const {
+  // A rewrite that has been queued for kAgingPeriodMs ranks the same as one
+  // that was queued now with one extra cheap request. Rather than updating
+  // every queued priority as time passes we lower the starting priority of
+  // later rewrites, which has the same effect on their relative order.
+  return -(timer_->NowMs() - start_ms_) * kRequestWeight / kAgingPeriodMs;
+}
+
+StringPiece PopularityContestScheduleRewriteController::FilterType(
+    const GoogleString& key) {
+  size_t pos = key.find('_');
+  if (pos == GoogleString::npos) {
+    return StringPiece();
+  }
+  return StringPiece(key.data(), pos);
 }
 
 void PopularityContestScheduleRewriteController::SaveRewriteForRetry(
@@ -31,6 +31,7 @@
 #include "pagespeed/kernel/base/scoped_ptr.h"
 #include "pagespeed/kernel/base/statistics.h"
 #include "pagespeed/kernel/base/string.h"
+#include "pagespeed/kernel/base/string_util.h"
 #include "pagespeed/kernel/base/thread_annotations.h"
 #include "pagespeed/kernel/base/thread_system.h"
 #include "pagespeed/kernel/base/timer.h"
@@ -40,6 +41,16 @@
 // client will be waiting for a given key. Also limits the number of queued
 // rewrites and the number of rewrites running in parallel.
 //
+// Requests are weighted by the estimated cost of the rewrite, so that when the
+// controller is saturated it prefers popular, cheap rewrites over equally
+// popular expensive ones. The cost of a rewrite is the time between it being
+// started and reported complete or failed. It is remembered per key for as
+// long as the Rewrite exists (ie: across retries) and averaged per filter type,
+// which is the part of the key before the first '_' (the rewrite context lock
+// names look like "rc:rname/<filter id>_<signature>/..."). Rewrites that have
+// been queued for a while gain priority with age, so that expensive rewrites
+// are not starved forever.
+//
 // Every request is tracked in a Rewrite object, the lifetime of which is
 // described by the following state digram:
 //
@@ -90,6 +101,20 @@ class PopularityContestScheduleRewriteController
   static const char kRewriteQueueSize[];
   static const char kNumRewritesRunning[];
   static const char kNumRewritesAwaitingRetry[];
+  // Counts requests that added less than kRequestWeight because their rewrite
+  // is expected to be expensive, whether or not that changed which rewrite
+  // ran first.
+  static const char kNumRequestsCostPenalized[];
+  static const char kRewriteRunTimeMs[];
+
+  // Rewrites estimated to take at most this long are all considered equally
+  // cheap; a request for one adds kRequestWeight to the priority of the
+  // rewrite. A request for a rewrite expected to take N times as long adds
+  // 1/N as much. Rewrites with no history are assumed to be cheap.
+  static const int64 kMinCostUs;
+  static const int64 kRequestWeight;
+  // Time spent queued that is worth as much as a single cheap request.
+  static const int64 kAgingPeriodMs;
 
   // max_running_rewrites and max_queued_rewrites are CHECKed to be > 0.
   // Since max_running_rewrites is implicity bounded by the queue size,
@@ -118,13 +143,25 @@ class PopularityContestScheduleRewriteController
 
   struct Rewrite {
     Rewrite(const GoogleString& k)
-        : key(k), saved_priority(0), callback(nullptr), state(STOPPED) {}
+        : key(k),
+          saved_priority(0),
+          callback(nullptr),
+          state(STOPPED),
+          cost_us(0),
+          start_us(0) {}
     GoogleString key;
-    int saved_priority;
+    int64 saved_priority;
     Function* callback;
     RewriteState state;
+    // Measured duration of the last run of this rewrite, or 0 if it has never
+    // finished running.
+    int64 cost_us;
+    // When the rewrite was last started.
+    int64 start_us;
   };
 
+  typedef std::unordered_map<GoogleString, int64> CostMap;
+
   struct StringPtrHash {
     size_t operator()(const GoogleString* x) const {
       return std::hash<GoogleString>()(*x);
@@ -153,9 +190,23 @@ class PopularityContestScheduleRewriteController
   Function* StartRewrite(Rewrite* rewrite)
       EXCLUSIVE_LOCKS_REQUIRED(mutex_) WARN_UNUSED_RESULT;
 
-  // Stop the supplied rewrite. Undoes the bookkeeping from Start.
+  // Stop the supplied rewrite. Undoes the bookkeeping from Start and records
+  // how long the rewrite took.
   void StopRewrite(Rewrite* rewrite) EXCLUSIVE_LOCKS_REQUIRED(mutex_);
 
+  // Returns the amount a single request for rewrite should add to its
+  // priority, based on its estimated cost.
+  int64 RequestWeight(const Rewrite* rewrite) EXCLUSIVE_LOCKS_REQUIRED(mutex_);
+
+  // Returns the priority a rewrite entering queue_ for the first time starts
+  // with. This decreases over time, which lets rewrites that have been queued
+  // for a while overtake newer ones.
+  int64 InitialPriority() const;
+
+  // Returns the filter type of key, as described above, or the empty string if
+  // it doesn't have one.
+  static StringPiece FilterType(const GoogleString& key);
+
   // Save the Rewrite so it may be retried later. The Rewrite may later be
   // discarded if the queue fills up.
   void SaveRewriteForRetry(Rewrite* rewrite) EXCLUSIVE_LOCKS_REQUIRED(mutex_);
@@ -186,7 +237,12 @@ class PopularityContestScheduleRewriteController
   // quickly discard the oldest items, if we need to.
   PriorityQueue<Rewrite*> retry_queue_ GUARDED_BY(mutex_);
 
+  // Moving average of the cost of each filter type.
+  CostMap filter_cost_us_ GUARDED_BY(mutex_);
+
   Timer* timer_;
+  // Reference point for InitialPriority, to keep priorities small.
+  const int64 start_ms_;
 
   int running_rewrites_ GUARDED_BY(mutex_);
   const int max_running_rewrites_;
@@ -201,6 +257,8 @@ class PopularityContestScheduleRewriteController
   UpDownCounter* queue_size_;
   UpDownCounter* num_rewrites_running_;
   UpDownCounter* num_rewrites_awaiting_retry_;
+  TimedVariable* num_requests_cost_penalized_;
+  TimedVariable* rewrite_run_time_ms_;
 
   friend class PopularityContestScheduleRewriteControllerTest;
 
@@ -0,0 +1,247 @@
+/*
+ * Licensed to the Apache Software Foundation (ASF) under one
+ * or more contributor license agreements.  See the NOTICE file
+ * distributed with this work for additional information
+ * regarding copyright ownership.  The ASF licenses this file
+ * to you under the Apache License, Version 2.0 (the
+ * "License"); you may not use this file except in compliance
+ * with the License.  You may obtain a copy of the License at
+ * 
+ *   http://www.apache.org/licenses/LICENSE-2.0
+ * 
+ * Unless required by applicable law or agreed to in writing,
+ * software distributed under the License is distributed on an
+ * "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY
+ * KIND, either express or implied.  See the License for the
+ * specific language governing permissions and limitations
+ * under the License.
+ */
+
+#include "pagespeed/controller/remote_schedule_rewrite_controller.h"
+
+#include <utility>
+
+#include "base/logging.h"
+#include "pagespeed/controller/central_controller_rpc_server.h"
+#include "pagespeed/controller/schedule_rewrite_rpc_context.h"
+#include "pagespeed/kernel/base/thread.h"
+
+namespace net_instaweb {
+
+class RemoteScheduleRewriteController::ClientThread
+    : public ThreadSystem::Thread {
+ public:
+  explicit ClientThread(ThreadSystem* thread_system)
+      : Thread(thread_system, "cluster_peer_client", ThreadSystem::kJoinable) {}
+
+  ~ClientThread() override {
+    queue_.Shutdown();
+    if (this->Started()) {
+      this->Join();
+    }
+  }
+
+  ::grpc::CompletionQueue* queue() { return &queue_; }
+
+ private:
+  void Run() override { CentralControllerRpcServer::MainLoop(&queue_); }
+
+  ::grpc::CompletionQueue queue_;
+
+  DISALLOW_COPY_AND_ASSIGN(ClientThread);
+};
+
+class RemoteScheduleRewriteController::ForwardedCallback
+    : public ScheduleRewriteCallback {
+ public:
+  ForwardedCallback(RemoteScheduleRewriteController* controller,
+                    const GoogleString& key, Function* callback,
+                    Sequence* sequence)
+      : ScheduleRewriteCallback(key, sequence),
+        controller_(controller),
+        callback_(callback),
+        rpc_context_(nullptr) {}
+  ~ForwardedCallback() override {}
+
+  // Only valid while the callback is pending in the controller.
+  ScheduleRewriteRpcContext* rpc_context() { return rpc_context_; }
+  void set_rpc_context(ScheduleRewriteRpcContext* context) {
+    rpc_context_ = context;
+  }
+
+  Function* callback() { return callback_; }
+
+ private:
+  void RunImpl(std::unique_ptr<ScheduleRewriteContext>* context) override {
+    controller_->RewriteStarted(this, context);
+  }
+
+  void CancelImpl() override { controller_->RewriteRejected(this); }
+
+  RemoteScheduleRewriteController* controller_;
+  Function* callback_;
+  ScheduleRewriteRpcContext* rpc_context_;
+
+  DISALLOW_COPY_AND_ASSIGN(ForwardedCallback);
+};
+
+RemoteScheduleRewriteController::RemoteScheduleRewriteController(
+    const GoogleString& address, ThreadSystem* thread_system,
+    MessageHandler* handler)
+    : address_(address),
+      thread_system_(thread_system),
+      handler_(handler),
+      mutex_(thread_system->NewMutex()),
+      shut_down_(false),
+      sequence_(nullptr) {}
+
+RemoteScheduleRewriteController::~RemoteScheduleRewriteController() {
+  ShutDown();
+  // Shutting down the queue delivers the cancellations issued by ShutDown to
+  // the sequence, and shutting down the worker then runs them.
+  std::unique_ptr<ClientThread> client_thread;
+  std::unique_ptr<QueuedWorkerPool> worker;
+  {
+    ScopedMutex lock(mutex_.get());
+    client_thread = std::move(client_thread_);
+    worker = std::move(worker_);
+  }
+  client_thread.reset();
+  if (worker != nullptr) {
+    worker->ShutDown();
+  }
+}
+
+bool RemoteScheduleRewriteController::ConnectLocked() {
+  if (channel_ != nullptr) {
+    return true;
+  }
+  std::unique_ptr<ClientThread> thread(new ClientThread(thread_system_));
+  if (!thread->Start()) {
+    PS_LOG_ERROR(handler_, "Couldn't start thread for talking to peer %s",
+                 address_.c_str());
+    return false;
+  }
+  client_thread_ = std::move(thread);
+  worker_.reset(new QueuedWorkerPool(1, "cluster_peer", thread_system_));
+  sequence_ = worker_->NewSequence();
+  channel_ =
+      ::grpc::CreateChannel(address_, ::grpc::InsecureChannelCredentials());
+  stub_ = CentralControllerRpcService::NewStub(channel_);
+  return true;
+}
+
+bool RemoteScheduleRewriteController::IsReachable() {
+  ScopedMutex lock(mutex_.get());
+  if (shut_down_ || !ConnectLocked()) {
+    return false;
+  }
+  // Passing true asks the channel to (re)connect if it's idle, so a peer that
+  // comes back is noticed by later calls.
+  // Only a connected channel counts: an idle or connecting one may never get
+  // anywhere, and requests sent over it would wait on the connection timeout
+  // rather than running locally.
+  return channel_->GetState(true) == GRPC_CHANNEL_READY;
+}
+
+void RemoteScheduleRewriteController::ScheduleRewrite(const GoogleString& key,
+                                                      Function* callback) {
+  ScopedMutex lock(mutex_.get());
+  if (shut_down_ || !ConnectLocked()) {
+    lock.Release();
+    callback->CallCancel();
+    return;
+  }
+  ForwardedCallback* forwarded =
+      new ForwardedCallback(this, key, callback, sequence_);
+  // The decision can't be delivered until we release the lock, so it's safe
+  // to register the callback after starting the RPC. The context is owned by
+  // the callback.
+  ScheduleRewriteRpcContext* context = new ScheduleRewriteRpcContext(
+      stub_.get(), client_thread_->queue(), thread_system_, handler_,
+      forwarded, true /* forwarded */);
+  forwarded->set_rpc_context(context);
+  pending_.insert(forwarded);
+}
+
+void RemoteScheduleRewriteController::RewriteStarted(
+    ForwardedCallback* callback,
+    std::unique_ptr<ScheduleRewriteContext>* context) {
+  bool accepted = false;
+  {
+    ScopedMutex lock(mutex_.get());
+    pending_.erase(callback);
+    if (!shut_down_) {
+      // The peer shouldn't allow two rewrites of the same key at once, but if
+      // it does we'd have no way to report on the second one.
+      accepted =
+          running_.try_emplace(callback->key(), std::move(*context)).second;
+    }
+  }
+  if (accepted) {
+    callback->callback()->CallRun();
+  } else {
+    // try_emplace leaves the context alone when it fails. Let the peer know
+    // this rewrite won't happen, so it can be retried.
+    (*context)->MarkFailed();
+    callback->callback()->CallCancel();
+  }
+}
+
+void RemoteScheduleRewriteController::RewriteRejected(
+    ForwardedCallback* callback) {
+  {
+    ScopedMutex lock(mutex_.get());
+    pending_.erase(callback);
+  }
+  callback->callback()->CallCancel();
+}
+
+std::unique_ptr<ScheduleRewriteContext>
+RemoteScheduleRewriteController::TakeContext(const GoogleString& key) {
+  std::unique_ptr<ScheduleRewriteContext> context;
+  ScopedMutex lock(mutex_.get());
+  ContextMap::iterator iter = running_.find(key);
+  if (iter != running_.end()) {
+    context = std::move(iter->second);
+    running_.erase(iter);
+  }
+  return context;
+}
+
+void RemoteScheduleRewriteController::NotifyRewriteComplete(
+    const GoogleString& key) {
+  std::unique_ptr<ScheduleRewriteContext> context = TakeContext(key);
+  if (context != nullptr) {
+    context->MarkSucceeded();
+  }
+}
+
+void RemoteScheduleRewriteController::NotifyRewriteFailed(
+    const GoogleString& key) {
+  std::unique_ptr<ScheduleRewriteContext> context = TakeContext(key);
+  if (context != nullptr) {
+    context->MarkFailed();
+  }
+}
+
+void RemoteScheduleRewriteController::ShutDown() {
+  ContextMap running;
+  {
+    ScopedMutex lock(mutex_.get());
+    if (shut_down_) {
+      return;
+    }
+    shut_down_ = true;
+    for (ForwardedCallback* callback : pending_) {
+      callback->rpc_context()->TryCancel();
+    }
+    running.swap(running_);
+  }
+  // Let the peer know these won't be finished, so it can retry them.
+  for (auto& entry : running) {
+    entry.second->MarkFailed();
+  }
+}
+
+}  // namespace net_instaweb
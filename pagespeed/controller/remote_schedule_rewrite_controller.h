@@ -0,0 +1,110 @@
+/*
+ * Licensed to the Apache Software Foundation (ASF) under one
+ * or more contributor license agreements.  See the NOTICE file
+ * distributed with this work for additional information
+ * regarding copyright ownership.  The ASF licenses this file
+ * to you under the Apache License, Version 2.0 (the
+ * "License"); you may not use this file except in compliance
+ * with the License.  You may obtain a copy of the License at
+ * 
+ *   http://www.apache.org/licenses/LICENSE-2.0
+ * 
+ * Unless required by applicable law or agreed to in writing,
+ * software distributed under the License is distributed on an
+ * "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY
+ * KIND, either express or implied.  See the License for the
+ * specific language governing permissions and limitations
+ * under the License.
+ */
+
+#ifndef PAGESPEED_CONTROLLER_REMOTE_SCHEDULE_REWRITE_CONTROLLER_H_
+#define PAGESPEED_CONTROLLER_REMOTE_SCHEDULE_REWRITE_CONTROLLER_H_
+
+#include <memory>
+#include <unordered_map>
+#include <unordered_set>
+
+#include "pagespeed/controller/clustered_schedule_rewrite_controller.h"
+#include "pagespeed/controller/controller.grpc.pb.h"
+#include "pagespeed/controller/schedule_rewrite_callback.h"
+#include "pagespeed/kernel/base/abstract_mutex.h"
+#include "pagespeed/kernel/base/basictypes.h"
+#include "pagespeed/kernel/base/function.h"
+#include "pagespeed/kernel/base/message_handler.h"
+#include "pagespeed/kernel/base/string.h"
+#include "pagespeed/kernel/base/thread_annotations.h"
+#include "pagespeed/kernel/base/thread_system.h"
+#include "pagespeed/kernel/thread/queued_worker_pool.h"
+#include "pagespeed/kernel/util/grpc.h"
+
+namespace net_instaweb {
+
+// ClusteredScheduleRewriteController::Peer that forwards requests over gRPC to
+// the CentralControllerRpcServer on another node. Requests are flagged as
+// forwarded, so the peer schedules them itself rather than routing them on.
+//
+// Nothing is started until the first request, since controllers are built
+// before the controller process is forked.
+class RemoteScheduleRewriteController
+    : public ClusteredScheduleRewriteController::Peer {
+ public:
+  // address is passed to grpc::CreateChannel, eg: "10.0.0.2:9000".
+  RemoteScheduleRewriteController(const GoogleString& address,
+                                  ThreadSystem* thread_system,
+                                  MessageHandler* handler);
+  ~RemoteScheduleRewriteController() override;
+
+  // ClusteredScheduleRewriteController::Peer interface.
+  bool IsReachable() override;
+  void ScheduleRewrite(const GoogleString& key, Function* callback) override;
+  void NotifyRewriteComplete(const GoogleString& key) override;
+  void NotifyRewriteFailed(const GoogleString& key) override;
+  void ShutDown() override;
+
+ private:
+  class ClientThread;
+  class ForwardedCallback;
+
+  typedef std::unordered_map<GoogleString,
+                             std::unique_ptr<ScheduleRewriteContext>>
+      ContextMap;
+
+  // Creates the channel and the threads, if that hasn't happened yet.
+  // Returns false if that failed.
+  bool ConnectLocked() EXCLUSIVE_LOCKS_REQUIRED(mutex_);
+
+  // Called by ForwardedCallback once the peer has made its decision.
+  void RewriteStarted(ForwardedCallback* callback,
+                      std::unique_ptr<ScheduleRewriteContext>* context);
+  void RewriteRejected(ForwardedCallback* callback);
+
+  std::unique_ptr<ScheduleRewriteContext> TakeContext(const GoogleString& key);
+
+  const GoogleString address_;
+  ThreadSystem* thread_system_;
+  MessageHandler* handler_;
+
+  std::unique_ptr<AbstractMutex> mutex_;
+  bool shut_down_ GUARDED_BY(mutex_);
+  std::shared_ptr<::grpc::Channel> channel_ GUARDED_BY(mutex_);
+  std::unique_ptr<CentralControllerRpcService::Stub> stub_ GUARDED_BY(mutex_);
+  std::unique_ptr<ClientThread> client_thread_ GUARDED_BY(mutex_);
+  // Runs the callbacks, so that they don't block the gRPC thread.
+  std::unique_ptr<QueuedWorkerPool> worker_ GUARDED_BY(mutex_);
+  QueuedWorkerPool::Sequence* sequence_ GUARDED_BY(mutex_);
+
+  // Requests awaiting the peer's decision, so they can be canceled on
+  // shutdown.
+  std::unordered_set<ForwardedCallback*> pending_ GUARDED_BY(mutex_);
+  // Rewrites the peer has allowed to run, which are reported back to it from
+  // NotifyRewriteComplete and NotifyRewriteFailed. Keyed by rewrite key, since
+  // that's all the notifications carry; a second grant for a key that's
+  // already running is failed back to the peer and its callback canceled.
+  ContextMap running_ GUARDED_BY(mutex_);
+
+  DISALLOW_COPY_AND_ASSIGN(RemoteScheduleRewriteController);
+};
+
+}  // namespace net_instaweb
+
+#endif  // PAGESPEED_CONTROLLER_REMOTE_SCHEDULE_REWRITE_CONTROLLER_H_
@@ -169,6 +169,16 @@ class RequestResultRpcClient {
     rpc->rw()->Write(response, rpc->CallbackForAsyncCleanup());
   }
 
+  // Cancels the RPC if it hasn't been detached by SendResultToServer or by
+  // the server's decision to reject the request. A pending decision will
+  // then be reported to the callback as a Cancel.
+  void TryCancel() {
+    ScopedMutex lock(mutex_.get());
+    if (rpc_ != nullptr) {
+      rpc_->context()->TryCancel();
+    }
+  }
+
  private:
   // Delegate for the client to call AsyncFoo for the appropriate RPC on the
   // stub.
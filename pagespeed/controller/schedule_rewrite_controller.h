@@ -41,6 +41,15 @@ class ScheduleRewriteController {
   // rewriting.
   virtual void ScheduleRewrite(const GoogleString& key, Function* callback) = 0;
 
+  // Called instead of ScheduleRewrite for requests that the controller on
+  // another node has already routed to this one (see
+  // ClusteredScheduleRewriteController). Such requests must not be routed
+  // again. Default implementation is the same as ScheduleRewrite.
+  virtual void ScheduleForwardedRewrite(const GoogleString& key,
+                                        Function* callback) {
+    ScheduleRewrite(key, callback);
+  }
+
   // Inform controller that the rewrite has been completed. Should only be
   // called if Run() was invoked on callback above. Controller implemenations
   // may wish to behave differently depending on success or failure of the
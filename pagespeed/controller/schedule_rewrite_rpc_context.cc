@@ -39,9 +39,11 @@ class ScheduleRewriteRpcContext::ScheduleRewriteRequestResultRpcClient
   ScheduleRewriteRequestResultRpcClient(
       const GoogleString& key, CentralControllerRpcService::StubInterface* stub,
       ::grpc::CompletionQueue* queue, ThreadSystem* thread_system,
-      MessageHandler* handler, ScheduleRewriteCallback* callback)
+      MessageHandler* handler, ScheduleRewriteCallback* callback,
+      bool forwarded)
       : RequestResultRpcClient(queue, thread_system, handler, callback),
-        key_(key) {
+        key_(key),
+        forwarded_(forwarded) {
     // Nothing will happen until a call to Start() is made. We don't do it here
     // because the wrapper needs to call SetTransactionContext first.
   }
@@ -70,17 +72,29 @@ class ScheduleRewriteRpcContext::ScheduleRewriteRequestResultRpcClient
  private:
   void PopulateServerRequest(ScheduleRewriteRequest* request) override {
     request->set_key(key_);
+    if (forwarded_) {
+      request->set_forwarded(true);
+    }
   }
 
   const GoogleString key_;
+  const bool forwarded_;
 };
 
 ScheduleRewriteRpcContext::ScheduleRewriteRpcContext(
     CentralControllerRpcService::StubInterface* stub,
     ::grpc::CompletionQueue* queue, ThreadSystem* thread_system,
     MessageHandler* handler, ScheduleRewriteCallback* callback)
+    : ScheduleRewriteRpcContext(stub, queue, thread_system, handler, callback,
+                                false /* forwarded */) {}
+
+ScheduleRewriteRpcContext::ScheduleRewriteRpcContext(
+    CentralControllerRpcService::StubInterface* stub,
+    ::grpc::CompletionQueue* queue, ThreadSystem* thread_system,
+    MessageHandler* handler, ScheduleRewriteCallback* callback, bool forwarded)
     : client_(new ScheduleRewriteRequestResultRpcClient(
-          callback->key(), stub, queue, thread_system, handler, callback)) {
+          callback->key(), stub, queue, thread_system, handler, callback,
+          forwarded)) {
   // SetTransactionContext takes ownership of "this".
   callback->SetTransactionContext(this);
   client_->Start(stub);
@@ -88,5 +102,6 @@ ScheduleRewriteRpcContext::ScheduleRewriteRpcContext(
 
 void ScheduleRewriteRpcContext::MarkSucceeded() { client_->MarkSucceeded(); }
 void ScheduleRewriteRpcContext::MarkFailed() { client_->MarkFailed(); }
+void ScheduleRewriteRpcContext::TryCancel() { client_->TryCancel(); }
 
 }  // namespace net_instaweb
@@ -41,10 +41,21 @@ class ScheduleRewriteRpcContext : public ScheduleRewriteContext {
                             ThreadSystem* thread_system,
                             MessageHandler* handler,
                             ScheduleRewriteCallback* callback);
+  // As above, but flags the request as forwarded from the controller on
+  // another node when forwarded is true.
+  ScheduleRewriteRpcContext(CentralControllerRpcService::StubInterface* stub,
+                            ::grpc::CompletionQueue* queue,
+                            ThreadSystem* thread_system,
+                            MessageHandler* handler,
+                            ScheduleRewriteCallback* callback, bool forwarded);
 
   void MarkSucceeded() override;
   void MarkFailed() override;
 
+  // Abandons the RPC if it is still in progress. If the server hasn't made a
+  // decision yet, the callback will be canceled.
+  void TryCancel();
+
  private:
   class ScheduleRewriteRequestResultRpcClient;
 
@@ -45,7 +45,11 @@ void ScheduleRewriteRpcHandler::HandleClientRequest(
     return;
   }
   key_ = req.key();
-  controller()->ScheduleRewrite(key_, callback);
+  if (req.forwarded()) {
+    controller()->ScheduleForwardedRewrite(key_, callback);
+  } else {
+    controller()->ScheduleRewrite(key_, callback);
+  }
 }
 
 void ScheduleRewriteRpcHandler::HandleClientResult(
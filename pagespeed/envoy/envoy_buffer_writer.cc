@@ -0,0 +1,61 @@
+/*
+ * Licensed to the Apache Software Foundation (ASF) under one
+ * or more contributor license agreements.  See the NOTICE file
+ * distributed with this work for additional information
+ * regarding copyright ownership.  The ASF licenses this file
+ * to you under the Apache License, Version 2.0 (the
+ * "License"); you may not use this file except in compliance
+ * with the License.  You may obtain a copy of the License at
+ * 
+ *   http://www.apache.org/licenses/LICENSE-2.0
+ * 
+ * Unless required by applicable law or agreed to in writing,
+ * software distributed under the License is distributed on an
+ * "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY
+ * KIND, either express or implied.  See the License for the
+ * specific language governing permissions and limitations
+ * under the License.
+ */
+
+#include "pagespeed/envoy/envoy_buffer_writer.h"
+
+#include "pagespeed/kernel/html/html_parse.h"
+
+namespace net_instaweb {
+
+EnvoyBufferWriter::~EnvoyBufferWriter() {}
+
+bool EnvoyBufferWriter::Write(const StringPiece& str, MessageHandler*) {
+  if (!str.empty()) {
+    buffer_->add(str.data(), str.size());
+  }
+  return true;
+}
+
+bool EnvoyBufferWriter::Flush(MessageHandler*) { return true; }
+
+bool EnvoyBufferWriter::WriteSlices(const Envoy::Buffer::Instance& data,
+                                    Writer* writer, MessageHandler* handler) {
+  for (const Envoy::Buffer::RawSlice& slice : data.getRawSlices()) {
+    if (slice.len_ == 0) {
+      continue;
+    }
+    if (!writer->Write(
+            StringPiece(static_cast<const char*>(slice.mem_), slice.len_),
+            handler)) {
+      return false;
+    }
+  }
+  return true;
+}
+
+void EnvoyBufferWriter::ParseSlices(const Envoy::Buffer::Instance& data,
+                                    HtmlParse* parser) {
+  for (const Envoy::Buffer::RawSlice& slice : data.getRawSlices()) {
+    if (slice.len_ != 0) {
+      parser->ParseText(static_cast<const char*>(slice.mem_), slice.len_);
+    }
+  }
+}
+
+}  // namespace net_instaweb
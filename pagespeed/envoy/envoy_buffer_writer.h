@@ -0,0 +1,60 @@
+/*
+ * Licensed to the Apache Software Foundation (ASF) under one
+ * or more contributor license agreements.  See the NOTICE file
+ * distributed with this work for additional information
+ * regarding copyright ownership.  The ASF licenses this file
+ * to you under the Apache License, Version 2.0 (the
+ * "License"); you may not use this file except in compliance
+ * with the License.  You may obtain a copy of the License at
+ * 
+ *   http://www.apache.org/licenses/LICENSE-2.0
+ * 
+ * Unless required by applicable law or agreed to in writing,
+ * software distributed under the License is distributed on an
+ * "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY
+ * KIND, either express or implied.  See the License for the
+ * specific language governing permissions and limitations
+ * under the License.
+ */
+
+#pragma once
+
+#include "envoy/buffer/buffer.h"
+#include "pagespeed/kernel/base/basictypes.h"
+#include "pagespeed/kernel/base/string_util.h"
+#include "pagespeed/kernel/base/writer.h"
+
+namespace net_instaweb {
+
+class HtmlParse;
+class MessageHandler;
+
+// Writer implementation which appends its output to an Envoy buffer, so that
+// rewritten bytes can be handed to the encoder callbacks without first being
+// collected into a GoogleString.
+class EnvoyBufferWriter : public Writer {
+ public:
+  explicit EnvoyBufferWriter(Envoy::Buffer::Instance* buffer)
+      : buffer_(buffer) {}
+  ~EnvoyBufferWriter() override;
+
+  bool Write(const StringPiece& str, MessageHandler* handler) override;
+  bool Flush(MessageHandler* handler) override;
+
+  // Passes each slice of data to writer in order, without linearizing or
+  // copying the buffer.  Returns false as soon as a Write fails.
+  static bool WriteSlices(const Envoy::Buffer::Instance& data, Writer* writer,
+                          MessageHandler* handler);
+
+  // Feeds each slice of data to the parser via ParseText, without linearizing
+  // or copying the buffer.
+  static void ParseSlices(const Envoy::Buffer::Instance& data,
+                          HtmlParse* parser);
+
+ private:
+  Envoy::Buffer::Instance* buffer_;
+
+  DISALLOW_COPY_AND_ASSIGN(EnvoyBufferWriter);
+};
+
+}  // namespace net_instaweb
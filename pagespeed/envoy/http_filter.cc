@@ -19,6 +19,8 @@
 #include "net/instaweb/rewriter/public/static_asset_manager.h"
 #include "net/instaweb/util/public/fallback_property_page.h"
 #include "pagespeed/automatic/proxy_fetch.h"
+#include "pagespeed/envoy/envoy_buffer_writer.h"
+#include "pagespeed/kernel/base/function.h"
 #include "pagespeed/kernel/base/google_message_handler.h"
 #include "pagespeed/kernel/base/null_message_handler.h"
 #include "pagespeed/kernel/base/posix_timer.h"
@@ -30,6 +32,7 @@
 #include "pagespeed/kernel/html/html_keywords.h"
 #include "pagespeed/kernel/http/content_type.h"
 #include "pagespeed/kernel/http/google_url.h"
+#include "pagespeed/kernel/http/http_names.h"
 #include "pagespeed/kernel/http/query_params.h"
 #include "pagespeed/kernel/thread/pthread_shared_mem.h"
 #include "pagespeed/kernel/util/gzip_inflater.h"
@@ -44,6 +47,38 @@
 namespace Envoy {
 namespace Http {
 
+namespace {
+
+// Invoked by the html RewriteDriver, possibly on a rewrite thread, when a
+// flush window has been written out.  Bounces back to the Envoy worker
+// before touching the filter.  The reference held on the filter keeps its
+// output buffer alive if the stream is reset while rewrites are pending.
+class HtmlFlushDone : public net_instaweb::Function {
+ public:
+  HtmlFlushDone(std::shared_ptr<HttpPageSpeedDecoderFilter> filter,
+                Event::Dispatcher* dispatcher, bool end_stream)
+      : filter_(std::move(filter)),
+        dispatcher_(dispatcher),
+        end_stream_(end_stream) {}
+
+ protected:
+  void Run() override {
+    std::shared_ptr<HttpPageSpeedDecoderFilter> filter = std::move(filter_);
+    bool end_stream = end_stream_;
+    dispatcher_->post(
+        [filter, end_stream]() { filter->htmlFlushDone(end_stream); });
+  }
+
+  void Cancel() override { Run(); }
+
+ private:
+  std::shared_ptr<HttpPageSpeedDecoderFilter> filter_;
+  Event::Dispatcher* dispatcher_;
+  bool end_stream_;
+};
+
+}  // namespace
+
 HttpPageSpeedDecoderFilterConfig::HttpPageSpeedDecoderFilterConfig(
     const pagespeed::Decoder& proto_config)
     : key_(proto_config.key()), val_(proto_config.val()) {}
@@ -68,7 +103,19 @@ HttpPageSpeedDecoderFilter::~HttpPageSpeedDecoderFilter() {
   }
 }
 
-void HttpPageSpeedDecoderFilter::onDestroy() {}
+void HttpPageSpeedDecoderFilter::onDestroy() {
+  stream_destroyed_ = true;
+  if (html_driver_ != nullptr) {
+    // Nothing more will be sent downstream, but the driver still has to
+    // finish its parse to be released.  If a flush is in flight,
+    // htmlFlushDone() takes care of that.
+    html_pending_input_.drain(html_pending_input_.length());
+    html_end_stream_ = true;
+    if (!html_flush_in_progress_) {
+      parseHtmlPendingInput();
+    }
+  }
+}
 
 const LowerCaseString HttpPageSpeedDecoderFilter::headerKey() const {
   return LowerCaseString(config_->key());
@@ -150,7 +197,7 @@ void HttpPageSpeedDecoderFilter::prepareForIproRecording() {
 }
 
 void HttpPageSpeedDecoderFilter::sendReply(
-    net_instaweb::ResponseHeaders* response_headers, std::string body) {
+    net_instaweb::ResponseHeaders* response_headers, absl::string_view body) {
   CHECK(response_headers != nullptr);
 
   std::function<void(Http::HeaderMap&)> modify_headers =
@@ -172,14 +219,23 @@ void HttpPageSpeedDecoderFilter::sendReply(
 
 FilterHeadersStatus HttpPageSpeedDecoderFilter::encodeHeaders(
     ResponseHeaderMap& headers, bool end_stream) {
-  if (end_stream || !recorder_) {
+  if (end_stream) {
     return FilterHeadersStatus::Continue;
   }
 
-  if (recorder_ != nullptr) {
-    response_headers_ =
-        net_instaweb::HeaderUtils::toPageSpeedResponseHeaders(headers);
-    // std::cerr << response_headers_->ToString() << std::endl;
+  response_headers_ =
+      net_instaweb::HeaderUtils::toPageSpeedResponseHeaders(headers);
+  // std::cerr << response_headers_->ToString() << std::endl;
+  if (response_headers_->IsHtmlLike()) {
+    if (recorder_ != nullptr) {
+      // Html is not an in-place resource; rewrite it as it streams by
+      // instead of recording it.
+      recorder_->Fail();
+      recorder_->DoneAndSetHeaders(response_headers_.get(), false);
+      recorder_ = nullptr;
+    }
+    startHtmlRewrite(headers);
+  } else if (recorder_ != nullptr) {
     recorder_->ConsiderResponseHeaders(
         net_instaweb::InPlaceResourceRecorder::kPreliminaryHeaders,
         response_headers_.get());
@@ -189,13 +245,25 @@ FilterHeadersStatus HttpPageSpeedDecoderFilter::encodeHeaders(
 
 FilterDataStatus HttpPageSpeedDecoderFilter::encodeData(Buffer::Instance& data,
                                                         bool end_stream) {
+  if (html_driver_ != nullptr) {
+    // Moving the slices over is free; the bytes are handed to the parser
+    // straight from them and released once parsed.
+    html_pending_input_.move(data);
+    html_end_stream_ = html_end_stream_ || end_stream;
+    if (!html_flush_in_progress_) {
+      parseHtmlPendingInput();
+    }
+    // Rewritten output is injected from htmlFlushDone().
+    return FilterDataStatus::StopIterationNoBuffer;
+  }
+
   if (recorder_ != nullptr) {
     // XXX(oschaaf): update s-max-age
     // ResponseHeaders::ApplySMaxAge(s_maxage_sec,
     //                            existing_cache_control,
     //                            &updated_cache_control)
-    // XXX(oschaaf): can we get a string view?
-    recorder_->Write(data.toString(), recorder_->handler());
+    net_instaweb::EnvoyBufferWriter::WriteSlices(data, recorder_,
+                                                 recorder_->handler());
     if (end_stream) {
       recorder_->DoneAndSetHeaders(response_headers_.get(), true);
       recorder_ = nullptr;
@@ -205,5 +273,80 @@ FilterDataStatus HttpPageSpeedDecoderFilter::encodeData(Buffer::Instance& data,
   return FilterDataStatus::Continue;
 };
 
+void HttpPageSpeedDecoderFilter::startHtmlRewrite(ResponseHeaderMap& headers) {
+  if (rewrite_driver_ == nullptr || options_ == nullptr ||
+      !options_->enabled()) {
+    return;
+  }
+  // Compressed responses are passed through untouched.
+  if (response_headers_->Has(net_instaweb::HttpAttributes::kContentEncoding)) {
+    return;
+  }
+
+  const net_instaweb::ContentType* content_type =
+      response_headers_->DetermineContentType();
+  DCHECK(content_type != nullptr);
+
+  net_instaweb::RequestContextPtr request_context(
+      server_context_->NewRequestContext());
+  request_context->set_options(options_->ComputeHttpOptions());
+  html_driver_ = server_context_->NewRewriteDriver(request_context);
+  html_driver_->SetRequestHeaders(*base_fetch_->request_headers());
+  html_driver_->set_response_headers_ptr(response_headers_.get());
+  html_writer_ =
+      std::make_unique<net_instaweb::EnvoyBufferWriter>(&html_output_);
+  html_driver_->SetWriter(html_writer_.get());
+  if (!html_driver_->StartParseWithType(pristine_url_->Spec(),
+                                        *content_type)) {
+    html_driver_->Cleanup();
+    html_driver_ = nullptr;
+    return;
+  }
+
+  // The rewritten body length is unknown until the parse finishes.
+  headers.removeContentLength();
+  dispatcher_ = &encoder_callbacks_->dispatcher();
+}
+
+void HttpPageSpeedDecoderFilter::parseHtmlPendingInput() {
+  CHECK(html_driver_ != nullptr);
+  CHECK(!html_flush_in_progress_);
+  html_flush_in_progress_ = true;
+  net_instaweb::EnvoyBufferWriter::ParseSlices(html_pending_input_,
+                                               html_driver_);
+  html_pending_input_.drain(html_pending_input_.length());
+
+  bool end_stream = html_end_stream_;
+  net_instaweb::Function* done =
+      new HtmlFlushDone(shared_from_this(), dispatcher_, end_stream);
+  if (end_stream) {
+    // The driver releases itself once the parse is finished.
+    html_driver_->FinishParseAsync(done);
+  } else {
+    html_driver_->FlushAsync(done);
+  }
+}
+
+void HttpPageSpeedDecoderFilter::htmlFlushDone(bool end_stream) {
+  html_flush_in_progress_ = false;
+  if (end_stream) {
+    html_driver_ = nullptr;
+  }
+
+  if (stream_destroyed_) {
+    html_output_.drain(html_output_.length());
+  } else if (html_output_.length() > 0 || end_stream) {
+    encoder_callbacks_->injectEncodedDataToFilterChain(html_output_,
+                                                       end_stream);
+    html_output_.drain(html_output_.length());
+  }
+
+  // Pick up whatever arrived while the flush was in progress.
+  if (html_driver_ != nullptr &&
+      (html_pending_input_.length() > 0 || html_end_stream_)) {
+    parseHtmlPendingInput();
+  }
+}
+
 }  // namespace Http
 }  // namespace Envoy
@@ -2,10 +2,12 @@
 
 #include <string>
 
+#include "common/buffer/buffer_impl.h"
 #include "envoy/server/filter_config.h"
 #include "net/instaweb/rewriter/public/rewrite_driver.h"
 #include "net/instaweb/rewriter/public/rewrite_stats.h"
 #include "pagespeed/envoy/envoy_base_fetch.h"
+#include "pagespeed/envoy/envoy_buffer_writer.h"
 #include "pagespeed/envoy/envoy_server_context.h"
 #include "pagespeed/envoy/header_utils.h"
 #include "pagespeed/envoy/http_filter.pb.h"
@@ -31,7 +33,9 @@ class HttpPageSpeedDecoderFilterConfig {
 typedef std::shared_ptr<HttpPageSpeedDecoderFilterConfig>
     HttpPageSpeedDecoderFilterConfigSharedPtr;
 
-class HttpPageSpeedDecoderFilter : public StreamFilter {
+class HttpPageSpeedDecoderFilter
+    : public StreamFilter,
+      public std::enable_shared_from_this<HttpPageSpeedDecoderFilter> {
  public:
   HttpPageSpeedDecoderFilter(HttpPageSpeedDecoderFilterConfigSharedPtr,
                              net_instaweb::EnvoyServerContext*);
@@ -73,7 +77,10 @@ class HttpPageSpeedDecoderFilter : public StreamFilter {
   // HttpPageSpeedDecoderFilter
   void prepareForIproRecording();
   void sendReply(net_instaweb::ResponseHeaders* response_headers,
-                 std::string body);
+                 absl::string_view body);
+  // Called on the worker thread once the html rewrite driver has finished
+  // a flush window (or the whole document, when end_stream is set).
+  void htmlFlushDone(bool end_stream);
 
   StreamDecoderFilterCallbacks* decoderCallbacks() {
     return decoder_callbacks_;
@@ -97,6 +104,24 @@ class HttpPageSpeedDecoderFilter : public StreamFilter {
   net_instaweb::GoogleMessageHandler message_handler_;
   std::unique_ptr<net_instaweb::ResponseHeaders> response_headers_;
   std::unique_ptr<net_instaweb::GoogleUrl> pristine_url_;
+
+  // Streaming html rewriting.  Response body slices are moved (not copied)
+  // into html_pending_input_ and fed to html_driver_ via ParseText; the
+  // driver's output accumulates in html_output_ until the flush completes,
+  // at which point it is injected back into the encoder filter chain.
+  // html_output_ is written from rewrite threads only while
+  // html_flush_in_progress_ is set; everything else runs on the worker.
+  void startHtmlRewrite(ResponseHeaderMap& headers);
+  void parseHtmlPendingInput();
+
+  net_instaweb::RewriteDriver* html_driver_{nullptr};
+  std::unique_ptr<net_instaweb::EnvoyBufferWriter> html_writer_;
+  Buffer::OwnedImpl html_pending_input_;
+  Buffer::OwnedImpl html_output_;
+  Event::Dispatcher* dispatcher_{nullptr};
+  bool html_flush_in_progress_{false};
+  bool html_end_stream_{false};
+  bool stream_destroyed_{false};
 };
 
 }  // namespace Http
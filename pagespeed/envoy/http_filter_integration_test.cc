@@ -53,4 +53,38 @@ TEST_P(HttpFilterPageSpeedIntegrationTest, Test1) {
 
   codec_client->close();
 }
+
+// Html responses are streamed through the rewrite driver chunk by chunk.
+TEST_P(HttpFilterPageSpeedIntegrationTest, StreamsHtml) {
+  Envoy::Http::TestRequestHeaderMapImpl headers{
+      {":method", "GET"}, {":path", "/page.html"}, {":authority", "host"}};
+
+  IntegrationCodecClientPtr codec_client;
+  FakeHttpConnectionPtr fake_upstream_connection;
+  FakeStreamPtr request_stream;
+
+  codec_client = makeHttpConnection(lookupPort("http"));
+  auto response = codec_client->makeHeaderOnlyRequest(headers);
+  ASSERT_TRUE(fake_upstreams_[0]->waitForHttpConnection(
+      *dispatcher_, fake_upstream_connection, std::chrono::milliseconds(1000)));
+  ASSERT_TRUE(
+      fake_upstream_connection->waitForNewStream(*dispatcher_, request_stream));
+  ASSERT_TRUE(request_stream->waitForEndStream(*dispatcher_));
+
+  request_stream->encodeHeaders(
+      Envoy::Http::TestResponseHeaderMapImpl{{":status", "200"},
+                                             {"content-type", "text/html"},
+                                             {"content-length", "45"}},
+      false);
+  request_stream->encodeData("<html><head></head><body>", false);
+  request_stream->encodeData("streamed</body></html>", true);
+  response->waitForEndStream();
+
+  EXPECT_TRUE(response->complete());
+  EXPECT_EQ("200", response->headers().getStatusValue());
+  EXPECT_EQ(nullptr, response->headers().ContentLength());
+  EXPECT_THAT(response->body(), testing::HasSubstr("<body>streamed</body>"));
+
+  codec_client->close();
+}
 }  // namespace Envoy
@@ -0,0 +1,70 @@
+/*
+ * Licensed to the Apache Software Foundation (ASF) under one
+ * or more contributor license agreements.  See the NOTICE file
+ * distributed with this work for additional information
+ * regarding copyright ownership.  The ASF licenses this file
+ * to you under the Apache License, Version 2.0 (the
+ * "License"); you may not use this file except in compliance
+ * with the License.  You may obtain a copy of the License at
+ * 
+ *   http://www.apache.org/licenses/LICENSE-2.0
+ * 
+ * Unless required by applicable law or agreed to in writing,
+ * software distributed under the License is distributed on an
+ * "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY
+ * KIND, either express or implied.  See the License for the
+ * specific language governing permissions and limitations
+ * under the License.
+ */
+
+#include "pagespeed/kernel/base/coalescing_writer.h"
+
+#include "base/logging.h"
+#include "pagespeed/kernel/base/string_util.h"
+#include "pagespeed/kernel/base/writer.h"
+
+namespace net_instaweb {
+
+class MessageHandler;
+
+CoalescingWriter::CoalescingWriter(Writer* writer, int buffer_size)
+    : writer_(writer), buffer_size_(buffer_size) {
+  buffer_.reserve(buffer_size_);
+}
+
+CoalescingWriter::~CoalescingWriter() {}
+
+bool CoalescingWriter::Write(const StringPiece& str,
+                             MessageHandler* handler) {
+  if (buffer_.size() + str.size() <= static_cast<size_t>(buffer_size_)) {
+    str.AppendToString(&buffer_);
+    return true;
+  }
+  bool ret = Drain(handler);
+  if (str.size() >= static_cast<size_t>(buffer_size_)) {
+    // Large enough to be worth a call of its own; don't copy it.
+    ret &= writer_->Write(str, handler);
+  } else {
+    str.AppendToString(&buffer_);
+  }
+  return ret;
+}
+
+bool CoalescingWriter::Flush(MessageHandler* handler) {
+  bool ret = Drain(handler);
+  ret &= writer_->Flush(handler);
+  return ret;
+}
+
+bool CoalescingWriter::Drain(MessageHandler* handler) {
+  if (buffer_.empty()) {
+    return true;
+  }
+  DCHECK(writer_ != nullptr);
+  bool ret = writer_->Write(buffer_, handler);
+  // clear() keeps the capacity, so the buffer is allocated only once.
+  buffer_.clear();
+  return ret;
+}
+
+}  // namespace net_instaweb
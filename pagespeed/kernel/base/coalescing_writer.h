@@ -0,0 +1,78 @@
+/*
+ * Licensed to the Apache Software Foundation (ASF) under one
+ * or more contributor license agreements.  See the NOTICE file
+ * distributed with this work for additional information
+ * regarding copyright ownership.  The ASF licenses this file
+ * to you under the Apache License, Version 2.0 (the
+ * "License"); you may not use this file except in compliance
+ * with the License.  You may obtain a copy of the License at
+ * 
+ *   http://www.apache.org/licenses/LICENSE-2.0
+ * 
+ * Unless required by applicable law or agreed to in writing,
+ * software distributed under the License is distributed on an
+ * "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY
+ * KIND, either express or implied.  See the License for the
+ * specific language governing permissions and limitations
+ * under the License.
+ */
+
+#ifndef PAGESPEED_KERNEL_BASE_COALESCING_WRITER_H_
+#define PAGESPEED_KERNEL_BASE_COALESCING_WRITER_H_
+
+#include "pagespeed/kernel/base/basictypes.h"
+#include "pagespeed/kernel/base/string.h"
+#include "pagespeed/kernel/base/string_util.h"
+#include "pagespeed/kernel/base/writer.h"
+
+namespace net_instaweb {
+
+class MessageHandler;
+
+// Wraps another writer, gathering the many small writes a serializer makes
+// (a ">", a quote, an attribute name) into one buffer that is handed over
+// as a single Write when it fills up or the stream is flushed.  Writes at
+// least as large as the buffer are passed straight through without being
+// copied, after any bytes already buffered.
+//
+// Write only reports failures of the wrapped writer for the bytes it hands
+// over during that call; failures for buffered bytes surface on the Write
+// or Flush that drains them.
+class CoalescingWriter : public Writer {
+ public:
+  static const int kDefaultBufferSize = 8192;
+
+  // This does NOT take ownership of writer, which may be null as long as
+  // set_writer is called before anything is drained.
+  CoalescingWriter(Writer* writer, int buffer_size);
+  ~CoalescingWriter() override;
+
+  bool Write(const StringPiece& str, MessageHandler* handler) override;
+
+  // Hands over any buffered bytes, then flushes the wrapped writer.
+  bool Flush(MessageHandler* handler) override;
+
+  // Hands over any buffered bytes without flushing the wrapped writer.
+  bool Drain(MessageHandler* handler);
+
+  // Discards any buffered bytes.
+  void Clear() { buffer_.clear(); }
+
+  // Changes the wrapped writer.  Callers should Drain first if the bytes
+  // buffered so far belong to the old one.
+  void set_writer(Writer* writer) { writer_ = writer; }
+  Writer* writer() const { return writer_; }
+
+  int buffered_bytes() const { return buffer_.size(); }
+
+ private:
+  Writer* writer_;
+  const int buffer_size_;
+  GoogleString buffer_;
+
+  DISALLOW_COPY_AND_ASSIGN(CoalescingWriter);
+};
+
+}  // namespace net_instaweb
+
+#endif  // PAGESPEED_KERNEL_BASE_COALESCING_WRITER_H_
@@ -102,6 +102,11 @@ class FileSystem {
     virtual bool ReadFile(GoogleString* buf, int64 max_file_size,
                           MessageHandler* handler) = 0;
 
+    // Hints that the whole file will be read soon, so the system may start
+    // reading it in the background.  Callers reading several files can hint
+    // all of them first to have their reads outstanding at once.
+    virtual void ReadAhead(MessageHandler* handler) {}
+
    protected:
     friend class FileSystem;
     ~InputFile() override;
@@ -59,37 +59,44 @@ int64 UpDownCounter::SetReturningPreviousValue(int64 value) {
 MutexedScalar::~MutexedScalar() {}
 
 int64 MutexedScalar::Get() const {
-  if (mutex() != nullptr) {
-    ScopedMutex hold_lock(mutex());
-    return GetLockHeld();
-  } else {
+  if (mutex() == nullptr) {
     return -1;
+  } else if (LockHeldMethodsAreAtomic()) {
+    return GetLockHeld();
   }
+  ScopedMutex hold_lock(mutex());
+  return GetLockHeld();
 }
 
 void MutexedScalar::Set(int64 new_value) {
-  if (mutex() != nullptr) {
-    ScopedMutex hold_lock(mutex());
+  if (mutex() == nullptr) {
+    return;
+  } else if (LockHeldMethodsAreAtomic()) {
     SetLockHeld(new_value);
+    return;
   }
+  ScopedMutex hold_lock(mutex());
+  SetLockHeld(new_value);
 }
 
 int64 MutexedScalar::SetReturningPreviousValue(int64 new_value) {
-  if (mutex() != nullptr) {
-    ScopedMutex hold_lock(mutex());
-    return SetReturningPreviousValueLockHeld(new_value);
-  } else {
+  if (mutex() == nullptr) {
     return -1;
+  } else if (LockHeldMethodsAreAtomic()) {
+    return SetReturningPreviousValueLockHeld(new_value);
   }
+  ScopedMutex hold_lock(mutex());
+  return SetReturningPreviousValueLockHeld(new_value);
 }
 
 int64 MutexedScalar::AddHelper(int64 delta) {
-  if (mutex() != nullptr) {
-    ScopedMutex hold_lock(mutex());
-    return AddLockHeld(delta);
-  } else {
+  if (mutex() == nullptr) {
     return -1;
+  } else if (LockHeldMethodsAreAtomic()) {
+    return AddLockHeld(delta);
   }
+  ScopedMutex hold_lock(mutex());
+  return AddLockHeld(delta);
 }
 
 void MutexedScalar::SetLockHeld(int64 new_value) {
@@ -131,9 +131,16 @@ class MutexedScalar {
   virtual int64 SetReturningPreviousValueLockHeld(int64 value) = 0;
 
   // These are implemented based on GetLockHeld() and
-  // SetReturningPreviousLockHeld().
+  // SetReturningPreviousLockHeld().  Subclasses with an atomic add may
+  // override AddLockHeld().
   void SetLockHeld(int64 value);
-  int64 AddLockHeld(int64 delta);
+  virtual int64 AddLockHeld(int64 delta);
+
+  // Subclasses whose *LockHeld() methods are atomic on their own may return
+  // true, so that Get(), Set(), etc. call them without taking mutex().
+  // mutex() must still be non-NULL, and still serializes longer sequences
+  // such as those in StatisticsLogger.
+  virtual bool LockHeldMethodsAreAtomic() const { return false; }
 };
 
 class Histogram {
@@ -31,6 +31,7 @@
 #include <windows.h>
 #else
 #include <dirent.h>
+#include <fcntl.h>
 #include <unistd.h>
 #endif  // WIN32
 
@@ -132,6 +133,13 @@ class StdioInputFile : public FileSystem::InputFile {
     return ret;
   }
 
+  void ReadAhead(MessageHandler* message_handler) override {
+#ifdef POSIX_FADV_WILLNEED
+    // This is only a hint, so failures are not worth reporting.
+    posix_fadvise(fileno(file_helper_.file_), 0, 0, POSIX_FADV_WILLNEED);
+#endif
+  }
+
   int Read(char* buf, int size, MessageHandler* message_handler) override {
     file_helper_.StartTimer();
     int ret = fread(buf, 1, size, file_helper_.file_);
@@ -165,6 +165,21 @@ bool CacheBatcher::CanQueueCallback() const {
   return !shutdown_ && num_pending_gets_ < options_.max_pending_gets;
 }
 
+bool CacheBatcher::JoinInFlight(const GoogleString& key, Callback* callback) {
+  // This ignores the pending limit: a lookup of the key is already under way,
+  // so the callback costs nothing more than a slot in its vector, whereas
+  // issuing the key a second time would leave two lookups fighting over one
+  // in_flight_ entry.
+  auto iter = in_flight_.find(key);
+  if (iter == in_flight_.end()) {
+    return false;
+  }
+  iter->second.push_back(callback);
+  ++num_pending_gets_;
+  coalesced_gets_->Add(1);
+  return true;
+}
+
 void CacheBatcher::Get(const GoogleString& key, Callback* callback) {
   bool immediate = false;
   bool drop_get = false;
@@ -174,16 +189,10 @@ void CacheBatcher::Get(const GoogleString& key, Callback* callback) {
     // Determine if a lookup of this key is already in flight (and this callback
     // should be added to the list of in-flight callbacks under that key), can
     // be issued immediately, should be "queued", or should be dropped.
-    bool can_queue = CanQueueCallback();
-    if (can_queue) {
-      auto iter = in_flight_.find(key);
-      if (iter != in_flight_.end()) {
-        iter->second.push_back(callback);
-        ++num_pending_gets_;
-        coalesced_gets_->Add(1);
-        return;
-      }
+    if (JoinInFlight(key, callback)) {
+      return;
     }
+    bool can_queue = CanQueueCallback();
     if (CanIssueGet()) {
       immediate = true;
       ++num_in_flight_groups_;
@@ -208,6 +217,57 @@ void CacheBatcher::Get(const GoogleString& key, Callback* callback) {
   }
 }
 
+void CacheBatcher::MultiGet(MultiGetRequest* request) {
+  MultiGetRequest* issue = nullptr;
+  MultiGetRequest dropped;
+  {
+    ScopedMutex mutex(mutex_.get());
+
+    // Decided once for the whole request, so that it counts as one lookup.
+    bool immediate = CanIssueGet();
+    CallbackMap batch;
+    for (const KeyCallback& key_callback : *request) {
+      const GoogleString& key = key_callback.key;
+      if (JoinInFlight(key, key_callback.callback)) {
+        continue;
+      }
+      bool can_queue = CanQueueCallback();
+      if (immediate) {
+        std::vector<Callback*>& callbacks = batch[key];
+        if (!callbacks.empty()) {
+          coalesced_gets_->Add(1);
+        }
+        callbacks.push_back(key_callback.callback);
+        ++num_pending_gets_;
+      } else if (can_queue) {
+        queued_[key].push_back(key_callback.callback);
+        queued_gets_->Add(1);
+        ++num_pending_gets_;
+      } else {
+        dropped.push_back(key_callback);
+      }
+    }
+    if (!batch.empty()) {
+      ++num_in_flight_groups_;
+      last_batch_size_ = batch.size();
+      num_in_flight_keys_ += batch.size();
+      issue = ConvertMapToRequest(batch);
+      for (auto& pair : batch) {
+        in_flight_.emplace(pair.first, std::move(pair.second));
+      }
+    }
+  }
+  delete request;
+  if (issue != nullptr) {
+    cache_->MultiGet(issue);
+  }
+  for (const KeyCallback& key_callback : dropped) {
+    ValidateAndReportResult(key_callback.key, CacheInterface::kNotFound,
+                            key_callback.callback);
+    dropped_gets_->Add(1);
+  }
+}
+
 void CacheBatcher::GroupComplete() {
   MultiGetRequest* request = nullptr;
   {
@@ -93,6 +93,12 @@ class CacheBatcher : public CacheInterface {
   static void InitStats(Statistics* statistics);
 
   void Get(const GoogleString& key, Callback* callback) override;
+
+  // Keys of a MultiGet that are already in flight are coalesced as for Get.
+  // If a lookup can be issued now, the rest are sent as a single MultiGet;
+  // otherwise they are queued for the next batch (or dropped if the queue
+  // is full).
+  void MultiGet(MultiGetRequest* request) override;
   void Put(const GoogleString& key, const SharedString& value) override;
   void Delete(const GoogleString& key) override;
   GoogleString Name() const override;
@@ -113,6 +119,10 @@ class CacheBatcher : public CacheInterface {
 
   bool CanIssueGet() const EXCLUSIVE_LOCKS_REQUIRED(mutex_);
   bool CanQueueCallback() const EXCLUSIVE_LOCKS_REQUIRED(mutex_);
+  // Adds callback to the lookup of key already in flight, if there is one.
+  // Returns false if there isn't.
+  bool JoinInFlight(const GoogleString& key, Callback* callback)
+      EXCLUSIVE_LOCKS_REQUIRED(mutex_);
   void GroupComplete();
 
   MultiGetRequest* ConvertMapToRequest(const CallbackMap& map)
@@ -130,6 +130,14 @@ void CompressedCache::Get(const GoogleString& key, Callback* callback) {
   cache_->Get(key, cb);
 }
 
+void CompressedCache::MultiGet(MultiGetRequest* request) {
+  for (KeyCallback& key_callback : *request) {
+    key_callback.callback =
+        new CompressedCallback(key_callback.callback, corrupt_payloads_);
+  }
+  cache_->MultiGet(request);
+}
+
 void CompressedCache::Put(const GoogleString& key, const SharedString& value) {
   int64 old_size = value.size();
   GoogleString buf;
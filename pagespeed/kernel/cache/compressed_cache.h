@@ -42,6 +42,7 @@ class CompressedCache : public CacheInterface {
   static void InitStats(Statistics* stats);
 
   void Get(const GoogleString& key, Callback* callback) override;
+  void MultiGet(MultiGetRequest* request) override;
   void Put(const GoogleString& key, const SharedString& value) override;
   void Delete(const GoogleString& key) override;
   GoogleString Name() const override { return FormatName(cache_->Name()); }
@@ -42,8 +42,13 @@
 
 namespace net_instaweb {
 
-namespace {  // For structs used only in Clean().
+namespace {
+
+// Upper bound on the files MultiGet holds open while their reads are
+// outstanding.
+const int kMaxReadAheadFiles = 32;
 
+// Used only in Clean().
 struct CompareByAtime {
  public:
   // Sort by ascending atime.
@@ -172,17 +177,62 @@ void FileCache::InitStats(Statistics* statistics) {
 }
 
 void FileCache::Get(const GoogleString& key, Callback* callback) {
+  ReadAndReport(key, OpenFile(key), callback);
+}
+
+void FileCache::MultiGet(MultiGetRequest* request) {
+  // Open a batch of files and hint that each will be read before reading
+  // any of them, so the disk can work on the whole batch at once rather
+  // than serving one blocking read at a time.
+  NullMessageHandler null_handler;
+  std::vector<FileSystem::InputFile*> input_files;
+  for (int start = 0, n = request->size(); start < n;
+       start += kMaxReadAheadFiles) {
+    int end = std::min(n, start + kMaxReadAheadFiles);
+    input_files.clear();
+    for (int i = start; i < end; ++i) {
+      FileSystem::InputFile* input_file = OpenFile((*request)[i].key);
+      if (input_file != nullptr) {
+        input_file->ReadAhead(&null_handler);
+      }
+      input_files.push_back(input_file);
+    }
+    for (int i = start; i < end; ++i) {
+      KeyCallback& key_callback = (*request)[i];
+      ReadAndReport(key_callback.key, input_files[i - start],
+                    key_callback.callback);
+    }
+  }
+  delete request;
+}
+
+FileSystem::InputFile* FileCache::OpenFile(const GoogleString& key) {
   GoogleString filename;
-  bool ret = EncodeFilename(key, &filename);
-  if (ret) {
-    // Suppress read errors.  Note that we want to show Write errors,
-    // as they likely indicate a permissions or disk-space problem
-    // which is best not eaten.  It's cheap enough to construct
-    // a NullMessageHandler on the stack when we want one.
+  if (!EncodeFilename(key, &filename)) {
+    return nullptr;
+  }
+  // Suppress read errors.  Note that we want to show Write errors,
+  // as they likely indicate a permissions or disk-space problem
+  // which is best not eaten.  It's cheap enough to construct
+  // a NullMessageHandler on the stack when we want one.
+  NullMessageHandler null_handler;
+  return file_system_->OpenInputFile(filename.c_str(), &null_handler);
+}
+
+void FileCache::ReadAndReport(const GoogleString& key,
+                              FileSystem::InputFile* input_file,
+                              Callback* callback) {
+  bool ret = false;
+  if (input_file != nullptr) {
     NullMessageHandler null_handler;
     GoogleString buf;
-    ret = file_system_->ReadFile(filename.c_str(), &buf, &null_handler);
-    callback->set_value(SharedString(buf));
+    ret = file_system_->ReadFile(input_file, &buf, &null_handler);
+
+    // Hand the file's buffer over to the SharedString rather than copying
+    // it, which for a large resource would double the cost of the hit.
+    SharedString value;
+    value.SwapWithString(&buf);
+    callback->set_value(value);
   }
   ValidateAndReportResult(key, ret ? kAvailable : kNotFound, callback);
 }
@@ -69,6 +69,7 @@ class FileCache : public CacheInterface {
   static void InitStats(Statistics* statistics);
 
   void Get(const GoogleString& key, Callback* callback) override;
+  void MultiGet(MultiGetRequest* request) override;
   void Put(const GoogleString& key, const SharedString& value) override;
   void Delete(const GoogleString& key) override;
   void set_worker(SlowWorker* worker) { worker_ = worker; }
@@ -132,6 +133,14 @@ class FileCache : public CacheInterface {
 
   bool EncodeFilename(const GoogleString& key, GoogleString* filename);
 
+  // Opens the file for key, returning nullptr if it isn't in the cache.
+  FileSystem::InputFile* OpenFile(const GoogleString& key);
+
+  // Reads and closes input_file, which may be nullptr, and reports the
+  // result for key to callback.
+  void ReadAndReport(const GoogleString& key, FileSystem::InputFile* input_file,
+                     Callback* callback);
+
   const GoogleString path_;
   FileSystem* file_system_;
   SlowWorker* worker_;
@@ -0,0 +1,688 @@
+/*
+ * Licensed to the Apache Software Foundation (ASF) under one
+ * or more contributor license agreements.  See the NOTICE file
+ * distributed with this work for additional information
+ * regarding copyright ownership.  The ASF licenses this file
+ * to you under the Apache License, Version 2.0 (the
+ * "License"); you may not use this file except in compliance
+ * with the License.  You may obtain a copy of the License at
+ * 
+ *   http://www.apache.org/licenses/LICENSE-2.0
+ * 
+ * Unless required by applicable law or agreed to in writing,
+ * software distributed under the License is distributed on an
+ * "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY
+ * KIND, either express or implied.  See the License for the
+ * specific language governing permissions and limitations
+ * under the License.
+ */
+
+#include "pagespeed/kernel/cache/log_structured_cache.h"
+
+#include <dirent.h>
+#include <fcntl.h>
+#include <sys/stat.h>
+#include <sys/types.h>
+#include <unistd.h>
+
+#include <cerrno>
+#include <cstring>
+#include <vector>
+
+#ifdef USE_SYSTEM_ZLIB
+#include "zconf.h"  // NOLINT
+#include "zlib.h"   // NOLINT
+#else
+#include "external/envoy/bazel/foreign_cc/zlib/include/zconf.h"
+#include "external/envoy/bazel/foreign_cc/zlib/include/zlib.h"
+#endif
+#include "pagespeed/kernel/base/function.h"
+#include "pagespeed/kernel/base/message_handler.h"
+#include "pagespeed/kernel/base/shared_string.h"
+#include "pagespeed/kernel/base/statistics.h"
+#include "pagespeed/kernel/base/thread_system.h"
+#include "pagespeed/kernel/thread/slow_worker.h"
+
+namespace net_instaweb {
+
+namespace {
+
+// Each record is laid out as follows, with integers little-endian:
+//   crc32 of the rest of the record   4 bytes
+//   kRecordMagic                      4 bytes
+//   key size                          4 bytes
+//   value size, or kDeletedValueSize  4 bytes
+//   key
+//   value
+const int kCrcBytes = 4;
+const int kHeaderBytes = 16;
+const uint32 kRecordMagic = 0x4c535043;
+const uint32 kDeletedValueSize = 0xffffffff;
+
+const char kSegmentSuffix[] = ".seg";
+
+void AppendUint32(uint32 x, GoogleString* out) {
+  for (int i = 0; i < 4; ++i) {
+    out->push_back(static_cast<char>((x >> (8 * i)) & 0xff));
+  }
+}
+
+uint32 ReadUint32(const char* p) {
+  uint32 x = 0;
+  for (int i = 3; i >= 0; --i) {
+    x = (x << 8) | static_cast<uint8>(p[i]);
+  }
+  return x;
+}
+
+uint32 Crc(const char* data, int64 size) {
+  return crc32(crc32(0L, Z_NULL, 0), reinterpret_cast<const Bytef*>(data),
+               size);
+}
+
+void EncodeRecord(StringPiece key, StringPiece value, bool is_delete,
+                  GoogleString* record) {
+  record->clear();
+  record->reserve(kHeaderBytes + key.size() + value.size());
+  AppendUint32(0, record);  // Filled in below.
+  AppendUint32(kRecordMagic, record);
+  AppendUint32(key.size(), record);
+  AppendUint32(is_delete ? kDeletedValueSize : value.size(), record);
+  key.AppendToString(record);
+  value.AppendToString(record);
+  GoogleString crc;
+  AppendUint32(Crc(record->data() + kCrcBytes, record->size() - kCrcBytes),
+               &crc);
+  record->replace(0, kCrcBytes, crc);
+}
+
+// Parses the record at the start of data.  Returns its size, or 0 if data
+// does not start with a complete and intact record.
+int64 ParseRecord(StringPiece data, StringPiece* key, StringPiece* value,
+                  bool* is_delete) {
+  if (data.size() < static_cast<size_t>(kHeaderBytes)) {
+    return 0;
+  }
+  const char* p = data.data();
+  if (ReadUint32(p + 4) != kRecordMagic) {
+    return 0;
+  }
+  int64 key_size = ReadUint32(p + 8);
+  uint32 value_size = ReadUint32(p + 12);
+  *is_delete = (value_size == kDeletedValueSize);
+  int64 size = kHeaderBytes + key_size + (*is_delete ? 0 : value_size);
+  if ((size > static_cast<int64>(data.size())) ||
+      (ReadUint32(p) != Crc(p + kCrcBytes, size - kCrcBytes))) {
+    return 0;
+  }
+  *key = StringPiece(p + kHeaderBytes, key_size);
+  *value = StringPiece(p + kHeaderBytes + key_size,
+                       size - kHeaderBytes - key_size);
+  return size;
+}
+
+bool WriteFully(int fd, StringPiece data, int64 offset) {
+  while (!data.empty()) {
+    ssize_t n = pwrite(fd, data.data(), data.size(), offset);
+    if (n < 0) {
+      if (errno == EINTR) {
+        continue;
+      }
+      return false;
+    }
+    data.remove_prefix(n);
+    offset += n;
+  }
+  return true;
+}
+
+bool ReadFully(int fd, int64 offset, int64 size, GoogleString* out) {
+  out->resize(size);
+  char* p = &(*out)[0];
+  while (size > 0) {
+    ssize_t n = pread(fd, p, size, offset);
+    if (n < 0) {
+      if (errno == EINTR) {
+        continue;
+      }
+      return false;
+    } else if (n == 0) {
+      return false;
+    }
+    p += n;
+    size -= n;
+    offset += n;
+  }
+  return true;
+}
+
+// Like mkdir -p.
+bool MakeDirs(const GoogleString& path) {
+  for (size_t pos = path.find('/', 1); pos != GoogleString::npos;
+       pos = path.find('/', pos + 1)) {
+    mkdir(path.substr(0, pos).c_str(), 0755);
+  }
+  mkdir(path.c_str(), 0755);
+  struct stat statbuf;
+  return (stat(path.c_str(), &statbuf) == 0) && S_ISDIR(statbuf.st_mode);
+}
+
+}  // namespace
+
+const char LogStructuredCache::kCompactions[] =
+    "log_structured_cache_compactions";
+const char LogStructuredCache::kEvictions[] = "log_structured_cache_evictions";
+const char LogStructuredCache::kRecoveryTruncations[] =
+    "log_structured_cache_recovery_truncations";
+const char LogStructuredCache::kWriteErrors[] =
+    "log_structured_cache_write_errors";
+
+// A segment file, kept open for reading while any Get is using it, even once
+// it has been deleted.  size and live_bytes are guarded by the cache's mutex.
+class LogStructuredCache::Segment : public RefCounted<Segment> {
+ public:
+  Segment(int64 id, const GoogleString& filename, int fd)
+      : id_(id), filename_(filename), fd_(fd), size_(0), live_bytes_(0) {}
+  ~Segment() { close(fd_); }
+
+  int64 id() const { return id_; }
+  const GoogleString& filename() const { return filename_; }
+  int fd() const { return fd_; }
+
+  // Bytes written to the file.
+  int64 size() const { return size_; }
+  void set_size(int64 x) { size_ = x; }
+
+  // Bytes of records the index still points to.
+  int64 live_bytes() const { return live_bytes_; }
+  void add_live_bytes(int64 x) { live_bytes_ += x; }
+
+ private:
+  const int64 id_;
+  const GoogleString filename_;
+  const int fd_;
+  int64 size_;
+  int64 live_bytes_;
+
+  DISALLOW_COPY_AND_ASSIGN(Segment);
+};
+
+class LogStructuredCache::MaintenanceFunction : public Function {
+ public:
+  explicit MaintenanceFunction(LogStructuredCache* cache) : cache_(cache) {}
+  ~MaintenanceFunction() override {}
+  void Run() override { cache_->RunMaintenance(); }
+
+ private:
+  LogStructuredCache* cache_;
+
+  DISALLOW_COPY_AND_ASSIGN(MaintenanceFunction);
+};
+
+LogStructuredCache::LogStructuredCache(
+    const GoogleString& path, int64 segment_size_bytes, int64 max_size_bytes,
+    ThreadSystem* thread_system, SlowWorker* worker, Statistics* stats,
+    MessageHandler* handler)
+    : path_(path),
+      segment_size_bytes_(segment_size_bytes),
+      max_size_bytes_(max_size_bytes),
+      worker_(worker),
+      message_handler_(handler),
+      mutex_(thread_system->NewMutex()),
+      total_bytes_(0),
+      initialized_(false),
+      shut_down_(false),
+      compactions_(stats->GetVariable(kCompactions)),
+      evictions_(stats->GetVariable(kEvictions)),
+      recovery_truncations_(stats->GetVariable(kRecoveryTruncations)),
+      write_errors_(stats->GetVariable(kWriteErrors)) {}
+
+LogStructuredCache::~LogStructuredCache() {
+  ScopedMutex lock(mutex_.get());
+  FlushLockHeld();
+}
+
+void LogStructuredCache::InitStats(Statistics* statistics) {
+  statistics->AddVariable(kCompactions);
+  statistics->AddVariable(kEvictions);
+  statistics->AddVariable(kRecoveryTruncations);
+  statistics->AddVariable(kWriteErrors);
+}
+
+bool LogStructuredCache::Initialize() {
+  if (!MakeDirs(path_)) {
+    message_handler_->Message(kError, "Unable to create cache directory %s",
+                              path_.c_str());
+    return false;
+  }
+  DIR* dir = opendir(path_.c_str());
+  if (dir == nullptr) {
+    message_handler_->Message(kError, "Unable to list cache directory %s: %s",
+                              path_.c_str(), strerror(errno));
+    return false;
+  }
+  std::vector<int64> ids;
+  for (struct dirent* entry = readdir(dir); entry != nullptr;
+       entry = readdir(dir)) {
+    StringPiece name(entry->d_name);
+    int64 id;
+    if (EndsWith(name, kSegmentSuffix)) {
+      name.remove_suffix(STATIC_STRLEN(kSegmentSuffix));
+      if (StringToInt64(name, &id) && (id >= 0)) {
+        ids.push_back(id);
+      }
+    }
+  }
+  closedir(dir);
+
+  ScopedMutex lock(mutex_.get());
+  initialized_ = true;
+  for (int64 id : ids) {
+    SegmentPtr segment = OpenSegment(id, false);
+    if (segment.get() != nullptr) {
+      segments_[id] = segment;
+    }
+  }
+  // Replay the segments oldest first, so later records win.
+  for (auto& id_segment : segments_) {
+    RecoverSegmentLockHeld(id_segment.second.get());
+  }
+  if (!segments_.empty() &&
+      (segments_.rbegin()->second->size() < segment_size_bytes_)) {
+    active_ = segments_.rbegin()->second;
+  } else {
+    StartSegmentLockHeld();
+  }
+  return active_.get() != nullptr;
+}
+
+GoogleString LogStructuredCache::SegmentFilename(int64 id) const {
+  return StrCat(path_, "/", Integer64ToString(id), kSegmentSuffix);
+}
+
+LogStructuredCache::SegmentPtr LogStructuredCache::OpenSegment(int64 id,
+                                                               bool create) {
+  GoogleString filename = SegmentFilename(id);
+  int flags = create ? (O_RDWR | O_CREAT | O_TRUNC) : O_RDWR;
+  int fd = open(filename.c_str(), flags, 0644);
+  if (fd < 0) {
+    message_handler_->Message(kError, "Unable to open cache segment %s: %s",
+                              filename.c_str(), strerror(errno));
+    return SegmentPtr();
+  }
+  return SegmentPtr(new Segment(id, filename, fd));
+}
+
+void LogStructuredCache::RecoverSegmentLockHeld(Segment* segment) {
+  struct stat statbuf;
+  GoogleString contents;
+  if ((fstat(segment->fd(), &statbuf) != 0) ||
+      !ReadFully(segment->fd(), 0, statbuf.st_size, &contents)) {
+    contents.clear();
+  }
+  int64 offset = 0;
+  StringPiece key, value;
+  bool is_delete;
+  for (int64 size; (size = ParseRecord(StringPiece(contents).substr(offset),
+                                       &key, &value, &is_delete)) > 0;
+       offset += size) {
+    GoogleString key_string(key.data(), key.size());
+    EraseLocationLockHeld(key_string);
+    if (!is_delete) {
+      Location location = {segment->id(), offset, size};
+      index_[key_string] = location;
+      segment->add_live_bytes(size);
+    }
+  }
+  if (offset != static_cast<int64>(contents.size())) {
+    // Most likely the process died part-way through a write.  Cut it off so
+    // that new records follow the last good one.
+    message_handler_->Message(
+        kWarning, "Truncating cache segment %s from %d to %d bytes",
+        segment->filename().c_str(), static_cast<int>(contents.size()),
+        static_cast<int>(offset));
+    if (ftruncate(segment->fd(), offset) != 0) {
+      write_errors_->Add(1);
+    }
+    recovery_truncations_->Add(1);
+  }
+  segment->set_size(offset);
+  total_bytes_ += offset;
+}
+
+void LogStructuredCache::Get(const GoogleString& key, Callback* callback) {
+  GoogleString record;
+  SegmentPtr segment;
+  Location location;
+  bool found = false;
+  {
+    ScopedMutex lock(mutex_.get());
+    Index::const_iterator p = index_.find(key);
+    if (!shut_down_ && (p != index_.end())) {
+      found = true;
+      location = p->second;
+      // Without an active segment nothing is buffered, so the record is in
+      // a segment on disk.
+      if ((active_.get() != nullptr) &&
+          (location.segment_id == active_->id()) &&
+          (location.offset >= active_->size())) {
+        record = write_buffer_.substr(location.offset - active_->size(),
+                                      location.size);
+      } else {
+        segment = segments_[location.segment_id];
+      }
+    }
+  }
+  // The callback may use the cache again, so it's called without the lock.
+  if (!found) {
+    ValidateAndReportResult(key, kNotFound, callback);
+    return;
+  }
+
+  // Segments are never rewritten in place, so the read can be done without
+  // the lock.
+  if ((segment.get() != nullptr) &&
+      !ReadFully(segment->fd(), location.offset, location.size, &record)) {
+    record.clear();
+  }
+  StringPiece record_key, record_value;
+  bool is_delete;
+  if ((ParseRecord(record, &record_key, &record_value, &is_delete) == 0) ||
+      is_delete || (record_key != key)) {
+    ValidateAndReportResult(key, kNotFound, callback);
+    return;
+  }
+
+  // Share the record's storage rather than copying the value out of it.
+  int value_offset = record_value.data() - record.data();
+  SharedString value;
+  value.SwapWithString(&record);
+  value.RemovePrefix(value_offset);
+  callback->set_value(value);
+  ValidateAndReportResult(key, kAvailable, callback);
+}
+
+void LogStructuredCache::Put(const GoogleString& key,
+                             const SharedString& value) {
+  GoogleString record;
+  EncodeRecord(key, value.Value(), false, &record);
+  if (static_cast<int64>(record.size()) > segment_size_bytes_) {
+    // It would never fit; treat it like any other write we couldn't make.
+    Delete(key);
+    return;
+  }
+  bool segment_filled;
+  {
+    ScopedMutex lock(mutex_.get());
+    segment_filled = AppendRecordLockHeld(key, record, false);
+  }
+  if (segment_filled) {
+    ScheduleMaintenance();
+  }
+}
+
+void LogStructuredCache::Delete(const GoogleString& key) {
+  GoogleString record;
+  EncodeRecord(key, StringPiece(), true, &record);
+  bool segment_filled;
+  {
+    ScopedMutex lock(mutex_.get());
+    // Written even if the key isn't indexed: after a failed write an older
+    // value for it may still be on disk, and would come back on restart.
+    segment_filled = AppendRecordLockHeld(key, record, true);
+  }
+  if (segment_filled) {
+    ScheduleMaintenance();
+  }
+}
+
+bool LogStructuredCache::AppendRecordLockHeld(const GoogleString& key,
+                                              StringPiece record,
+                                              bool is_delete) {
+  if (shut_down_ || !initialized_) {
+    return false;
+  }
+  int64 size = record.size();
+  bool segment_filled = false;
+  if ((active_.get() == nullptr) ||
+      (active_->size() + static_cast<int64>(write_buffer_.size()) + size >
+       segment_size_bytes_)) {
+    // Without an active segment, starting one failed earlier, e.g. on EMFILE
+    // or ENOSPC, which may since have cleared.
+    StartSegmentLockHeld();
+    if (active_.get() == nullptr) {
+      return false;
+    }
+    segment_filled = true;
+  }
+  EraseLocationLockHeld(key);
+  if (!is_delete) {
+    Location location = {active_->id(),
+                         active_->size() +
+                             static_cast<int64>(write_buffer_.size()),
+                         size};
+    index_[key] = location;
+    active_->add_live_bytes(size);
+  }
+  record.AppendToString(&write_buffer_);
+  total_bytes_ += size;
+  if (write_buffer_.size() >= static_cast<size_t>(kWriteBufferBytes)) {
+    FlushLockHeld();
+  }
+  return segment_filled;
+}
+
+void LogStructuredCache::EraseLocationLockHeld(const GoogleString& key) {
+  Index::iterator p = index_.find(key);
+  if (p != index_.end()) {
+    std::map<int64, SegmentPtr>::iterator segment =
+        segments_.find(p->second.segment_id);
+    if (segment != segments_.end()) {
+      segment->second->add_live_bytes(-p->second.size);
+    }
+    index_.erase(p);
+  }
+}
+
+void LogStructuredCache::Flush() {
+  ScopedMutex lock(mutex_.get());
+  FlushLockHeld();
+}
+
+void LogStructuredCache::FlushLockHeld() {
+  if (write_buffer_.empty() || (active_.get() == nullptr)) {
+    return;
+  }
+  if (WriteFully(active_->fd(), write_buffer_, active_->size())) {
+    active_->set_size(active_->size() + write_buffer_.size());
+  } else {
+    message_handler_->Message(kError, "Unable to write cache segment %s: %s",
+                              active_->filename().c_str(), strerror(errno));
+    write_errors_->Add(1);
+    total_bytes_ -= write_buffer_.size();
+    // Forget the entries that were only in the buffer.
+    for (Index::iterator p = index_.begin(); p != index_.end();) {
+      if ((p->second.segment_id == active_->id()) &&
+          (p->second.offset >= active_->size())) {
+        active_->add_live_bytes(-p->second.size);
+        p = index_.erase(p);
+      } else {
+        ++p;
+      }
+    }
+  }
+  write_buffer_.clear();
+}
+
+void LogStructuredCache::StartSegmentLockHeld() {
+  FlushLockHeld();
+  int64 id = segments_.empty() ? 0 : (segments_.rbegin()->first + 1);
+  active_ = OpenSegment(id, true);
+  if (active_.get() != nullptr) {
+    segments_[id] = active_;
+  }
+}
+
+void LogStructuredCache::RemoveSegmentLockHeld(Segment* segment) {
+  if (segment->live_bytes() > 0) {
+    for (Index::iterator p = index_.begin(); p != index_.end();) {
+      if (p->second.segment_id == segment->id()) {
+        p = index_.erase(p);
+      } else {
+        ++p;
+      }
+    }
+  }
+  total_bytes_ -= segment->size();
+  unlink(segment->filename().c_str());
+  // Get may still hold a reference; the file is closed when it lets go.
+  segments_.erase(segment->id());
+}
+
+bool LogStructuredCache::SyncSegments(
+    const std::vector<SegmentPtr>& segments) {
+  bool ret = true;
+  for (int i = 0, n = segments.size(); i < n; ++i) {
+    if (fdatasync(segments[i]->fd()) != 0) {
+      message_handler_->Message(kError, "Unable to sync cache segment %s: %s",
+                                segments[i]->filename().c_str(),
+                                strerror(errno));
+      write_errors_->Add(1);
+      ret = false;
+    }
+  }
+  return ret;
+}
+
+void LogStructuredCache::ScheduleMaintenance() {
+  if (worker_ != nullptr) {
+    worker_->RunIfNotBusy(new MaintenanceFunction(this));
+  } else {
+    RunMaintenance();
+  }
+}
+
+void LogStructuredCache::RunMaintenance() {
+  // Only the oldest segment is ever evicted or compacted.  Deletes within it
+  // can then be dropped, as the values they deleted can only be in it too.
+  while (true) {
+    SegmentPtr oldest;
+    {
+      ScopedMutex lock(mutex_.get());
+      if (shut_down_ || (segments_.size() < 2)) {
+        return;
+      }
+      oldest = segments_.begin()->second;
+      if (total_bytes_ > max_size_bytes_) {
+        RemoveSegmentLockHeld(oldest.get());
+        evictions_->Add(1);
+        continue;
+      }
+      if (oldest->live_bytes() * 2 >= oldest->size()) {
+        return;
+      }
+    }
+
+    // The oldest segment is no longer written to, so it can be read without
+    // the lock.
+    GoogleString contents;
+    if (!ReadFully(oldest->fd(), 0, oldest->size(), &contents)) {
+      contents.clear();
+    }
+
+    // Copy the live records forward a write buffer's worth at a time, so
+    // that Gets and Puts get a turn between batches.  Copies go to the
+    // newest segment, and to any started while copying.
+    int64 first_copy_id = -1;
+    int64 offset = 0;
+    bool copied_all = false;
+    bool abandoned = false;
+    while (!copied_all && !abandoned) {
+      ScopedMutex lock(mutex_.get());
+      if (shut_down_ || (segments_.find(oldest->id()) == segments_.end())) {
+        abandoned = true;
+        break;
+      }
+      if (first_copy_id < 0) {
+        first_copy_id = segments_.rbegin()->first;
+      }
+      const int64 batch_end = offset + kWriteBufferBytes;
+      StringPiece key, value;
+      bool is_delete;
+      while (offset < batch_end) {
+        int64 size = ParseRecord(StringPiece(contents).substr(offset), &key,
+                                 &value, &is_delete);
+        if (size == 0) {
+          copied_all = true;
+          break;
+        }
+        GoogleString key_string(key.data(), key.size());
+        Index::const_iterator p = index_.find(key_string);
+        if (!is_delete && (p != index_.end()) &&
+            (p->second.segment_id == oldest->id()) &&
+            (p->second.offset == offset)) {
+          AppendRecordLockHeld(key_string,
+                               StringPiece(contents.data() + offset, size),
+                               false);
+        }
+        offset += size;
+      }
+    }
+    if (abandoned) {
+      continue;
+    }
+
+    // Get the copies onto disk before the originals go, so that losing
+    // power can't lose entries that had already been written.  Syncing can
+    // take a while, so it's done without the lock, holding references to the
+    // segments instead.
+    std::vector<SegmentPtr> copy_segments;
+    {
+      ScopedMutex lock(mutex_.get());
+      if (shut_down_ || (segments_.find(oldest->id()) == segments_.end())) {
+        continue;
+      }
+      FlushLockHeld();
+      for (std::map<int64, SegmentPtr>::iterator p =
+               segments_.lower_bound(first_copy_id);
+           p != segments_.end(); ++p) {
+        copy_segments.push_back(p->second);
+      }
+    }
+    if (!SyncSegments(copy_segments)) {
+      // Keep the originals.  They're no longer indexed, so the next
+      // maintenance will find nothing to copy and retry the sync.
+      return;
+    }
+
+    ScopedMutex lock(mutex_.get());
+    if (shut_down_ || (segments_.find(oldest->id()) == segments_.end())) {
+      continue;
+    }
+    RemoveSegmentLockHeld(oldest.get());
+    compactions_->Add(1);
+  }
+}
+
+bool LogStructuredCache::IsHealthy() const {
+  ScopedMutex lock(mutex_.get());
+  return !shut_down_ && (active_.get() != nullptr);
+}
+
+void LogStructuredCache::ShutDown() {
+  ScopedMutex lock(mutex_.get());
+  FlushLockHeld();
+  shut_down_ = true;
+}
+
+int LogStructuredCache::num_entries() {
+  ScopedMutex lock(mutex_.get());
+  return index_.size();
+}
+
+int64 LogStructuredCache::size_bytes() {
+  ScopedMutex lock(mutex_.get());
+  return total_bytes_;
+}
+
+}  // namespace net_instaweb
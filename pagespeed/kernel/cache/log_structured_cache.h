@@ -0,0 +1,198 @@
+/*
+ * Licensed to the Apache Software Foundation (ASF) under one
+ * or more contributor license agreements.  See the NOTICE file
+ * distributed with this work for additional information
+ * regarding copyright ownership.  The ASF licenses this file
+ * to you under the Apache License, Version 2.0 (the
+ * "License"); you may not use this file except in compliance
+ * with the License.  You may obtain a copy of the License at
+ * 
+ *   http://www.apache.org/licenses/LICENSE-2.0
+ * 
+ * Unless required by applicable law or agreed to in writing,
+ * software distributed under the License is distributed on an
+ * "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY
+ * KIND, either express or implied.  See the License for the
+ * specific language governing permissions and limitations
+ * under the License.
+ */
+
+#ifndef PAGESPEED_KERNEL_CACHE_LOG_STRUCTURED_CACHE_H_
+#define PAGESPEED_KERNEL_CACHE_LOG_STRUCTURED_CACHE_H_
+
+#include <map>
+#include <memory>
+#include <unordered_map>
+#include <vector>
+
+#include "pagespeed/kernel/base/abstract_mutex.h"
+#include "pagespeed/kernel/base/basictypes.h"
+#include "pagespeed/kernel/base/cache_interface.h"
+#include "pagespeed/kernel/base/ref_counted_ptr.h"
+#include "pagespeed/kernel/base/string.h"
+#include "pagespeed/kernel/base/string_util.h"
+#include "pagespeed/kernel/base/thread_annotations.h"
+
+namespace net_instaweb {
+
+class MessageHandler;
+class SharedString;
+class SlowWorker;
+class Statistics;
+class ThreadSystem;
+class Variable;
+
+// Disk cache that appends entries to a few large segment files, rather than
+// writing a file per entry as FileCache does, so that small entries cost
+// neither an inode nor a rename each.
+//
+// An in-memory index maps every key to its latest record.  Initialize()
+// rebuilds it by scanning the segments in the order they were written.
+// Records are checksummed, so a write torn by a crash is detected and the
+// segment is truncated to the records before it.
+//
+// Puts and Deletes are coalesced in memory, where Gets can see them, and
+// written to the newest segment once kWriteBufferBytes have accumulated.
+// When a segment fills up the next one is started, and the oldest segment
+// is evicted if the cache is over max_size_bytes, or compacted, by copying
+// its live entries forward, if most of it has been overwritten.  That runs
+// on worker when there is one, and otherwise in the Put that filled the
+// segment.  The worker must be stopped before the cache is deleted.
+// Compaction syncs the copies before deleting the segment they came from;
+// other writes aren't synced, so only a process crash, not a power loss, is
+// sure to keep the entries written before it.
+//
+// The index belongs to one process, so unlike with FileCache a cache
+// directory must not be shared by several processes.  POSIX only.
+class LogStructuredCache : public CacheInterface {
+ public:
+  // Bytes of Puts and Deletes held in memory before they are written out.
+  static const int kWriteBufferBytes = 64 * 1024;
+
+  LogStructuredCache(const GoogleString& path, int64 segment_size_bytes,
+                     int64 max_size_bytes, ThreadSystem* thread_system,
+                     SlowWorker* worker, Statistics* stats,
+                     MessageHandler* handler);
+  ~LogStructuredCache() override;
+
+  static void InitStats(Statistics* statistics);
+
+  // Creates path if needed and rebuilds the index from the segments in it.
+  // Returns false if the directory can't be used, in which case the cache
+  // stays empty and unhealthy.  If only starting a segment failed, writes
+  // keep trying to.
+  bool Initialize() LOCKS_EXCLUDED(mutex_);
+
+  void Get(const GoogleString& key, Callback* callback) override
+      LOCKS_EXCLUDED(mutex_);
+  void Put(const GoogleString& key, const SharedString& value) override
+      LOCKS_EXCLUDED(mutex_);
+  void Delete(const GoogleString& key) override LOCKS_EXCLUDED(mutex_);
+
+  static GoogleString FormatName() { return "LogStructuredCache"; }
+  GoogleString Name() const override { return FormatName(); }
+
+  bool IsBlocking() const override { return true; }
+  bool IsHealthy() const override LOCKS_EXCLUDED(mutex_);
+  void ShutDown() override LOCKS_EXCLUDED(mutex_);
+
+  // Writes out any coalesced Puts and Deletes.
+  void Flush() LOCKS_EXCLUDED(mutex_);
+
+  // Number of keys in the index, and bytes in segments including those not
+  // yet written out.
+  int num_entries() LOCKS_EXCLUDED(mutex_);
+  int64 size_bytes() LOCKS_EXCLUDED(mutex_);
+
+  const GoogleString& path() const { return path_; }
+
+  // Variable names.
+  // Segments whose live entries were copied forward so they could be deleted.
+  static const char kCompactions[];
+  // Segments deleted, with their entries, to stay within max_size_bytes.
+  static const char kEvictions[];
+  // Segments cut short by Initialize() at a torn or corrupt record.
+  static const char kRecoveryTruncations[];
+  static const char kWriteErrors[];
+
+ private:
+  class MaintenanceFunction;
+  class Segment;
+  typedef RefCountedPtr<Segment> SegmentPtr;
+
+  // Where the latest record for a key is.
+  struct Location {
+    int64 segment_id;
+    int64 offset;
+    int64 size;
+  };
+  typedef std::unordered_map<GoogleString, Location> Index;
+
+  // Adds record for key, with the given value unless is_delete, to the write
+  // buffer and the index.  Returns true if a segment was filled, so that
+  // RunMaintenance should be called once the lock is released.
+  bool AppendRecordLockHeld(const GoogleString& key, StringPiece record,
+                            bool is_delete) EXCLUSIVE_LOCKS_REQUIRED(mutex_);
+
+  // Removes key from the index, if present, crediting its segment.
+  void EraseLocationLockHeld(const GoogleString& key)
+      EXCLUSIVE_LOCKS_REQUIRED(mutex_);
+
+  void FlushLockHeld() EXCLUSIVE_LOCKS_REQUIRED(mutex_);
+
+  // Flushes the active segment and starts a new one.  Leaves active_ null if
+  // the file can't be created, in which case the next write tries again.
+  void StartSegmentLockHeld() EXCLUSIVE_LOCKS_REQUIRED(mutex_);
+
+  // Opens the segment file for id, creating it if create is true.
+  SegmentPtr OpenSegment(int64 id, bool create);
+
+  // Reads segment, truncating it after its last valid record, and applies
+  // its records to the index.
+  void RecoverSegmentLockHeld(Segment* segment)
+      EXCLUSIVE_LOCKS_REQUIRED(mutex_);
+
+  // Forgets segment and everything the index has in it, and deletes its file.
+  void RemoveSegmentLockHeld(Segment* segment)
+      EXCLUSIVE_LOCKS_REQUIRED(mutex_);
+
+  // Syncs segments to disk.  Returns false if any couldn't be synced.
+  bool SyncSegments(const std::vector<SegmentPtr>& segments)
+      LOCKS_EXCLUDED(mutex_);
+
+  // Evicts or compacts the oldest segments until neither is called for.
+  void RunMaintenance() LOCKS_EXCLUDED(mutex_);
+  void ScheduleMaintenance() LOCKS_EXCLUDED(mutex_);
+
+  GoogleString SegmentFilename(int64 id) const;
+
+  const GoogleString path_;
+  const int64 segment_size_bytes_;
+  const int64 max_size_bytes_;
+  SlowWorker* worker_;
+  MessageHandler* message_handler_;
+  std::unique_ptr<AbstractMutex> mutex_;
+
+  // Segments by id, which increases with age; the last one is active_.
+  std::map<int64, SegmentPtr> segments_ GUARDED_BY(mutex_);
+  SegmentPtr active_ GUARDED_BY(mutex_);
+  // Records not yet written to active_, which start at its size.
+  GoogleString write_buffer_ GUARDED_BY(mutex_);
+  Index index_ GUARDED_BY(mutex_);
+  int64 total_bytes_ GUARDED_BY(mutex_);
+  // Set once Initialize has read the segments in path_, after which new ones
+  // can be started without clobbering them.
+  bool initialized_ GUARDED_BY(mutex_);
+  bool shut_down_ GUARDED_BY(mutex_);
+
+  Variable* compactions_;
+  Variable* evictions_;
+  Variable* recovery_truncations_;
+  Variable* write_errors_;
+
+  DISALLOW_COPY_AND_ASSIGN(LogStructuredCache);
+};
+
+}  // namespace net_instaweb
+
+#endif  // PAGESPEED_KERNEL_CACHE_LOG_STRUCTURED_CACHE_H_
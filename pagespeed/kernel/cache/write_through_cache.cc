@@ -20,7 +20,9 @@
 #include "pagespeed/kernel/cache/write_through_cache.h"
 
 #include <cstddef>
+#include <vector>
 
+#include "pagespeed/kernel/base/atomic_int32.h"
 #include "pagespeed/kernel/base/shared_string.h"
 #include "pagespeed/kernel/base/string.h"
 #include "pagespeed/kernel/cache/cache_interface.h"
@@ -39,6 +41,8 @@ void WriteThroughCache::PutInCache1(const GoogleString& key,
   }
 }
 
+class WriteThroughMultiGet;
+
 class WriteThroughCallback : public CacheInterface::Callback {
  public:
   WriteThroughCallback(WriteThroughCache* wtc, const GoogleString& key,
@@ -46,7 +50,21 @@ class WriteThroughCallback : public CacheInterface::Callback {
       : write_through_cache_(wtc),
         key_(key),
         callback_(callback),
-        trying_cache2_(false) {}
+        trying_cache2_(false),
+        multi_get_(nullptr),
+        index_(0) {}
+
+  // Used for the lookups of a MultiGet, where cache1 misses are collected
+  // by multi_get and looked up in cache2 together.
+  WriteThroughCallback(WriteThroughCache* wtc, const GoogleString& key,
+                       CacheInterface::Callback* callback,
+                       WriteThroughMultiGet* multi_get, int index)
+      : write_through_cache_(wtc),
+        key_(key),
+        callback_(callback),
+        trying_cache2_(false),
+        multi_get_(multi_get),
+        index_(index) {}
 
   bool ValidateCandidate(const GoogleString& key,
                          CacheInterface::KeyState state) override {
@@ -54,28 +72,84 @@ class WriteThroughCallback : public CacheInterface::Callback {
     return callback_->DelegatedValidateCandidate(key, state);
   }
 
-  void Done(CacheInterface::KeyState state) override {
-    if (state == CacheInterface::kAvailable) {
-      if (trying_cache2_) {
-        write_through_cache_->PutInCache1(key_, value());
+  void Done(CacheInterface::KeyState state) override;
+
+  WriteThroughCache* write_through_cache_;
+  GoogleString key_;
+  CacheInterface::Callback* callback_;
+  bool trying_cache2_;
+  WriteThroughMultiGet* multi_get_;
+  int index_;
+};
+
+// Tracks the cache1 lookups of a MultiGet.  Each cache1 miss parks its
+// callback in its own slot; whichever lookup finishes last sends all the
+// parked ones to cache2 as one MultiGet and deletes this.
+class WriteThroughMultiGet {
+ public:
+  WriteThroughMultiGet(WriteThroughCache* wtc, int num_keys)
+      : write_through_cache_(wtc),
+        misses_(num_keys, nullptr),
+        num_outstanding_(num_keys) {}
+
+  void Miss(WriteThroughCallback* callback) {
+    misses_[callback->index_] = callback;
+    Release();
+  }
+
+  void Release() {
+    if (num_outstanding_.BarrierIncrement(-1) != 0) {
+      return;
+    }
+    CacheInterface::MultiGetRequest* request =
+        new CacheInterface::MultiGetRequest;
+    for (WriteThroughCallback* callback : misses_) {
+      if (callback != nullptr) {
+        request->push_back(CacheInterface::KeyCallback(callback->key_,
+                                                       callback));
       }
-      callback_->DelegatedDone(state);
-      delete this;
-    } else if (trying_cache2_) {
-      callback_->DelegatedDone(state);
-      delete this;
+    }
+    CacheInterface* cache2 = write_through_cache_->cache2();
+    delete this;
+    if (request->empty()) {
+      delete request;
     } else {
-      trying_cache2_ = true;
-      write_through_cache_->cache2()->Get(key_, this);
+      cache2->MultiGet(request);
     }
   }
 
+ private:
   WriteThroughCache* write_through_cache_;
-  GoogleString key_;
-  CacheInterface::Callback* callback_;
-  bool trying_cache2_;
+  std::vector<WriteThroughCallback*> misses_;
+  AtomicInt32 num_outstanding_;
+
+  DISALLOW_COPY_AND_ASSIGN(WriteThroughMultiGet);
 };
 
+void WriteThroughCallback::Done(CacheInterface::KeyState state) {
+  if (state == CacheInterface::kAvailable) {
+    if (trying_cache2_) {
+      write_through_cache_->PutInCache1(key_, value());
+    }
+    WriteThroughMultiGet* multi_get = trying_cache2_ ? nullptr : multi_get_;
+    callback_->DelegatedDone(state);
+    delete this;
+    if (multi_get != nullptr) {
+      multi_get->Release();
+    }
+  } else if (trying_cache2_) {
+    callback_->DelegatedDone(state);
+    delete this;
+  } else {
+    trying_cache2_ = true;
+    if (multi_get_ != nullptr) {
+      multi_get_->Miss(this);
+    } else {
+      write_through_cache_->cache2()->Get(key_, this);
+    }
+  }
+}
+
 GoogleString WriteThroughCache::FormatName(StringPiece cache1,
                                            StringPiece cache2) {
   return StrCat("WriteThroughCache(l1=", cache1, ",l2=", cache2, ")");
@@ -85,6 +159,21 @@ void WriteThroughCache::Get(const GoogleString& key, Callback* callback) {
   cache1_->Get(key, new WriteThroughCallback(this, key, callback));
 }
 
+void WriteThroughCache::MultiGet(MultiGetRequest* request) {
+  if (request->empty()) {
+    delete request;
+    return;
+  }
+  WriteThroughMultiGet* multi_get =
+      new WriteThroughMultiGet(this, request->size());
+  for (int i = 0, n = request->size(); i < n; ++i) {
+    KeyCallback& key_callback = (*request)[i];
+    key_callback.callback = new WriteThroughCallback(
+        this, key_callback.key, key_callback.callback, multi_get, i);
+  }
+  cache1_->MultiGet(request);
+}
+
 void WriteThroughCache::Put(const GoogleString& key,
                             const SharedString& value) {
   PutInCache1(key, value);
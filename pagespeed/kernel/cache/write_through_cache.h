@@ -42,6 +42,11 @@ class WriteThroughCache : public CacheInterface {
   ~WriteThroughCache() override;
 
   void Get(const GoogleString& key, Callback* callback) override;
+
+  // Looks all the keys up in cache1 with a single MultiGet, then looks the
+  // ones it missed up in cache2 with another, so that batching done by the
+  // caller survives down to cache2.
+  void MultiGet(MultiGetRequest* request) override;
   void Put(const GoogleString& key, const SharedString& value) override;
   void Delete(const GoogleString& key) override;
 
@@ -76,6 +81,7 @@ class WriteThroughCache : public CacheInterface {
  private:
   void PutInCache1(const GoogleString& key, const SharedString& value);
   friend class WriteThroughCallback;
+  friend class WriteThroughMultiGet;
 
   CacheInterface* cache1_;
   CacheInterface* cache2_;
@@ -20,6 +20,8 @@
 #include "pagespeed/kernel/html/html_element.h"
 
 #include <cstdio>
+#include <cstring>
+#include <new>
 
 #include "base/logging.h"
 #include "pagespeed/kernel/base/scoped_ptr.h"
@@ -174,33 +176,48 @@ GoogleString HtmlElement::ToString() const {
 void HtmlElement::DebugPrint() const { puts(ToString().c_str()); }
 
 void HtmlElement::AddAttribute(const Attribute& src_attr) {
-  Attribute* attr = new Attribute(src_attr.name(), src_attr.escaped_value(),
-                                  src_attr.quote_style());
+  Attribute* attr = Attribute::New(src_attr.name(), src_attr.escaped_value(),
+                                   src_attr.quote_style());
   if (src_attr.decoded_value_computed_) {
+    if (src_attr.decoded_value_ == src_attr.escaped_value_) {
+      attr->decoded_value_ = attr->escaped_value_;
+    } else {
+      Attribute::CopyValue(src_attr.decoded_value_, &attr->decoded_storage_);
+      attr->decoded_value_ = attr->decoded_storage_.get();
+    }
     attr->decoded_value_computed_ = true;
     attr->decoding_error_ = src_attr.decoding_error_;
-    Attribute::CopyValue(src_attr.decoded_value_.get(), &attr->decoded_value_);
   }
+  attr->owner_ = data_.get();
   data_->attributes_.Append(attr);
+  data_->ForgetStartTag();
 }
 
 void HtmlElement::AddAttribute(const HtmlName& name,
                                const StringPiece& decoded_value,
                                QuoteStyle quote_style) {
   GoogleString buf;
-  Attribute* attr = new Attribute(
-      name, HtmlKeywords::Escape(decoded_value, &buf), quote_style);
+  StringPiece escaped_value = HtmlKeywords::Escape(decoded_value, &buf);
+  Attribute* attr = Attribute::New(name, escaped_value, quote_style);
+  if (escaped_value == decoded_value) {
+    attr->decoded_value_ = attr->escaped_value_;
+  } else {
+    Attribute::CopyValue(decoded_value, &attr->decoded_storage_);
+    attr->decoded_value_ = attr->decoded_storage_.get();
+  }
   attr->decoded_value_computed_ = true;
-  attr->decoding_error_ = false;
-  Attribute::CopyValue(decoded_value, &attr->decoded_value_);
+  attr->owner_ = data_.get();
   data_->attributes_.Append(attr);
+  data_->ForgetStartTag();
 }
 
 void HtmlElement::AddEscapedAttribute(const HtmlName& name,
                                       const StringPiece& escaped_value,
                                       QuoteStyle quote_style) {
-  Attribute* attr = new Attribute(name, escaped_value, quote_style);
+  Attribute* attr = Attribute::New(name, escaped_value, quote_style);
+  attr->owner_ = data_.get();
   data_->attributes_.Append(attr);
+  data_->ForgetStartTag();
 }
 
 void HtmlElement::Attribute::CopyValue(const StringPiece& src,
@@ -218,48 +235,73 @@ void HtmlElement::Attribute::CopyValue(const StringPiece& src,
 }
 
 HtmlElement::Attribute::Attribute(const HtmlName& name,
-                                  const StringPiece& escaped_value,
                                   QuoteStyle quote_style)
     : name_(name),
       quote_style_(quote_style),
       decoding_error_(false),
-      decoded_value_computed_(false) {
-  CopyValue(escaped_value, &escaped_value_);
+      decoded_value_computed_(false),
+      owner_(nullptr),
+      escaped_value_(nullptr),
+      decoded_value_(nullptr) {}
+
+HtmlElement::Attribute* HtmlElement::Attribute::New(
+    const HtmlName& name, const StringPiece& escaped_value,
+    QuoteStyle quote_style) {
+  size_t size = sizeof(Attribute);
+  if (escaped_value.data() != nullptr) {
+    size += escaped_value.size() + 1;
+  }
+  Attribute* attr = new (::operator new(size)) Attribute(name, quote_style);
+  if (escaped_value.data() != nullptr) {
+    char* buf = reinterpret_cast<char*>(attr + 1);
+    memcpy(buf, escaped_value.data(), escaped_value.size());
+    buf[escaped_value.size()] = '\0';
+    attr->escaped_value_ = buf;
+  }
+  return attr;
+}
+
+void HtmlElement::Attribute::ReplaceValues(const StringPiece& escaped_value,
+                                           const StringPiece* decoded_value) {
+  scoped_array<char> escaped_storage;
+  CopyValue(escaped_value, &escaped_storage);
+  scoped_array<char> decoded_storage;
+  const char* decoded = nullptr;
+  if (decoded_value != nullptr) {
+    if (*decoded_value == escaped_value) {
+      decoded = escaped_storage.get();
+    } else {
+      CopyValue(*decoded_value, &decoded_storage);
+      decoded = decoded_storage.get();
+    }
+  }
+  escaped_storage_.swap(escaped_storage);
+  decoded_storage_.swap(decoded_storage);
+  escaped_value_ = escaped_storage_.get();
+  decoded_value_ = decoded;
+  decoding_error_ = false;
+  decoded_value_computed_ = (decoded_value != nullptr);
 }
 
 // Modify value of attribute (eg to rewrite dest of src or href).
 // As with the constructor, copies the string in, so caller retains
-// ownership of value.
+// ownership of value.  The value may point into this attribute's own
+// current value.
 void HtmlElement::Attribute::SetValue(const StringPiece& decoded_value) {
   GoogleString buf;
-  // Note that we execute the lines in this order in case value
-  // is a substring of value_.  This copies the value just prior
-  // to deallocation of the old value_.
-  const char* escaped_chars = escaped_value_.get();
-  DCHECK(decoded_value.data() + decoded_value.size() < escaped_chars ||
-         escaped_chars + strlen(escaped_chars) < decoded_value.data())
-      << "Setting unescaped value from substring of escaped value.";
-  CopyValue(HtmlKeywords::Escape(decoded_value, &buf), &escaped_value_);
-  CopyValue(decoded_value, &decoded_value_);
+  ReplaceValues(HtmlKeywords::Escape(decoded_value, &buf), &decoded_value);
+  Modified();
 }
 
 void HtmlElement::Attribute::SetEscapedValue(const StringPiece& escaped_value) {
-  GoogleString buf;
-  // Note that we execute the lines in this order in case value
-  // is a substring of value_.  This copies the value just prior
-  // to deallocation of the old value_.
-  const char* value_chars = decoded_value_.get();
-  if (value_chars != nullptr) {
-    DCHECK(value_chars + strlen(value_chars) < escaped_value.data() ||
-           escaped_value.data() + escaped_value.size() < value_chars)
-        << "Setting escaped value from substring of unescaped value.";
-  }
-
-  decoded_value_.reset();
-  decoding_error_ = false;
-  decoded_value_computed_ = false;
+  ReplaceValues(escaped_value, nullptr);
+  Modified();
+}
 
-  CopyValue(escaped_value, &escaped_value_);
+void HtmlElement::Attribute::Modified() {
+  if (owner_ != nullptr) {
+    owner_->ForgetStartTag();
+  }
 }
 
 const char* HtmlElement::Attribute::quote_str() const {
@@ -277,8 +319,15 @@ const char* HtmlElement::Attribute::quote_str() const {
 void HtmlElement::Attribute::ComputeDecodedValue() const {
   GoogleString buf;
   StringPiece unescaped_value =
-      HtmlKeywords::Unescape(escaped_value_.get(), &buf, &decoding_error_);
-  CopyValue(unescaped_value, &decoded_value_);
+      HtmlKeywords::Unescape(escaped_value_, &buf, &decoding_error_);
+  if (unescaped_value.data() == escaped_value_) {
+    // Nothing needed unescaping.
+    decoded_storage_.reset();
+    decoded_value_ = escaped_value_;
+  } else {
+    CopyValue(unescaped_value, &decoded_storage_);
+    decoded_value_ = decoded_storage_.get();
+  }
   decoded_value_computed_ = true;
 }
 
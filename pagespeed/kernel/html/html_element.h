@@ -22,6 +22,7 @@
 
 #include "pagespeed/kernel/base/basictypes.h"
 #include "pagespeed/kernel/base/inline_slist.h"
+#include "pagespeed/kernel/base/ref_counted_ptr.h"
 #include "pagespeed/kernel/base/scoped_ptr.h"
 #include "pagespeed/kernel/base/string.h"
 #include "pagespeed/kernel/base/string_util.h"
@@ -41,6 +42,9 @@ namespace net_instaweb {
 // After that, the only method it's legal to do is to call is
 // HtmlParse::IsRewriteable(), which will return false.
 class HtmlElement : public HtmlNode {
+ private:
+  struct Data;
+
  public:
   // Tags can be closed in three ways: implicitly (e.g. <img ..>),
   // briefly (e.g. <br/>), or explicitly (<a...>...</a>).  The
@@ -60,6 +64,23 @@ class HtmlElement : public HtmlNode {
   // Various ways things can be quoted (or not)
   enum QuoteStyle { NO_QUOTE, SINGLE_QUOTE, DOUBLE_QUOTE };
 
+  // A chunk of HTML source as handed to the lexer, kept alive by the
+  // elements whose original_start_tag() points into it.
+  class SourceChunk : public RefCounted<SourceChunk> {
+   public:
+    explicit SourceChunk(StringPiece text) { text.CopyToString(&text_); }
+    StringPiece text() const { return text_; }
+
+   private:
+    REFCOUNT_FRIEND_DECLARATION(SourceChunk);
+    ~SourceChunk() {}
+
+    GoogleString text_;
+
+    DISALLOW_COPY_AND_ASSIGN(SourceChunk);
+  };
+  typedef RefCountedPtr<SourceChunk> SourceChunkPtr;
+
   class Attribute : public InlineSListElement<Attribute> {
    public:
     // A large quantity of HTML in the wild has attributes that are
@@ -81,11 +102,14 @@ class HtmlElement : public HtmlNode {
     HtmlName::Keyword keyword() const { return name_.keyword(); }
 
     HtmlName name() const { return name_; }
-    void set_name(const HtmlName& name) { name_ = name; }
+    void set_name(const HtmlName& name) {
+      name_ = name;
+      Modified();
+    }
 
     // Returns the value in its original directly from the HTML source.
     // This may have HTML escapes in it, such as "&amp;".
-    const char* escaped_value() const { return escaped_value_.get(); }
+    const char* escaped_value() const { return escaped_value_; }
 
     // The result of DecodedValueOrNull() is still owned by this, and
     // will be invalidated by a subsequent call to SetValue().
@@ -116,7 +140,7 @@ class HtmlElement : public HtmlNode {
       if (!decoded_value_computed_) {
         ComputeDecodedValue();
       }
-      return decoded_value_.get();
+      return decoded_value_;
     }
 
     void set_decoding_error(bool x) { decoding_error_ = x; }
@@ -161,16 +185,39 @@ class HtmlElement : public HtmlNode {
 
     void set_quote_style(QuoteStyle new_quote_style) {
       quote_style_ = new_quote_style;
+      Modified();
     }
 
+    ~Attribute() { Modified(); }
+
     friend class HtmlElement;
 
+    // Attributes are allocated by New, so the matching deallocation is the
+    // plain one, whatever size the compiler thinks the object has.
+    static void operator delete(void* ptr) { ::operator delete(ptr); }
+
    private:
     void ComputeDecodedValue() const;
 
-    // This should only be called from AddAttribute
-    Attribute(const HtmlName& name, const StringPiece& escaped_value,
-              QuoteStyle quote_style);
+    // Tells the owning element that its original start tag is stale.
+    void Modified();
+
+    // This should only be called from New.
+    Attribute(const HtmlName& name, QuoteStyle quote_style);
+
+    // Creates an attribute whose escaped value is stored in the same
+    // allocation as the attribute itself, so the lexer, which makes one of
+    // these for every attribute it sees, only allocates once for each.
+    static Attribute* New(const HtmlName& name,
+                          const StringPiece& escaped_value,
+                          QuoteStyle quote_style);
+
+    // Sets escaped_value_ and decoded_value_ from new values, either of which
+    // may be null.  The old values are released only after the new ones have
+    // been copied, so the arguments may point into them.  When the two are
+    // the same bytes they share one buffer.
+    void ReplaceValues(const StringPiece& escaped_value,
+                       const StringPiece* decoded_value);
 
     static inline void CopyValue(const StringPiece& src,
                                  scoped_array<char>* dst);
@@ -180,6 +227,11 @@ class HtmlElement : public HtmlNode {
     mutable bool decoding_error_;
     mutable bool decoded_value_computed_;
 
+    // The data of the element whose attribute list holds this, or null.
+    // Any change that would alter how this attribute serializes, including
+    // its deletion, forgets the element's original start tag through it.
+    Data* owner_;
+
     // Attribute value represented as ascii and
     // HTML-escape-sequences, typically parsed directly from an HTML
     // file.  This is the canonical representation, and it can handle
@@ -188,7 +240,11 @@ class HtmlElement : public HtmlNode {
     // Note that it is acceptable to have 8-bit characters in escape
     // sequences (typically iso8859).  However we will not be able to
     // decode such attributes.
-    scoped_array<char> escaped_value_;
+    //
+    // This points at the bytes allocated after the attribute by New, or at
+    // escaped_storage_ once the value has been changed.
+    const char* escaped_value_;
+    scoped_array<char> escaped_storage_;
 
     // An 8-bit representation of the escaped_value.  Escape sequences
     // that contain character-codes >= 256 are not decoded, and will
@@ -206,7 +262,11 @@ class HtmlElement : public HtmlNode {
     // Note that we do not decode non-ASCII characters but we can
     // represent them in escaped_value_.  We can get 8-bit characters
     // into decoded_value_ via &#129; etc.
-    mutable scoped_array<char> decoded_value_;
+    //
+    // Most values contain no escapes at all, in which case this points at
+    // escaped_value_ rather than at a copy in decoded_storage_.
+    mutable const char* decoded_value_;
+    mutable scoped_array<char> decoded_storage_;
 
     DISALLOW_COPY_AND_ASSIGN(Attribute);
   };
@@ -322,7 +382,10 @@ class HtmlElement : public HtmlNode {
   // Changing that tag of an element should only occur if the caller knows
   // that the old attributes make sense for the new tag.  E.g. a div could
   // be changed to a span.
-  void set_name(const HtmlName& new_tag) { data_->name_ = new_tag; }
+  void set_name(const HtmlName& new_tag) {
+    data_->name_ = new_tag;
+    data_->ForgetStartTag();
+  }
 
   const AttributeList& attributes() const { return data_->attributes_; }
   AttributeList* mutable_attributes() { return &data_->attributes_; }
@@ -341,6 +404,14 @@ class HtmlElement : public HtmlNode {
   int begin_line_number() const { return data_->begin_line_number_; }
   int end_line_number() const { return data_->end_line_number_; }
 
+  // Returns the start tag, up to but not including its closing '>' or '/>',
+  // exactly as it appeared in the HTML source.  This is only available when
+  // the lexer found those bytes to be what serializing the element's name
+  // and attributes would produce, and neither has changed since; otherwise
+  // an empty StringPiece is returned.  HtmlWriterFilter uses this to copy
+  // untouched tags out verbatim.
+  StringPiece original_start_tag() const { return data_->start_tag_; }
+
  protected:
   void SynthesizeEvents(const HtmlEventListIterator& iter,
                         HtmlEventList* queue) override;
@@ -376,7 +447,21 @@ class HtmlElement : public HtmlNode {
     unsigned end_line_number_ : 24;
     Style style_ : 8;
 
+    void ForgetStartTag() {
+      start_tag_source_.clear();
+      start_tag_ = StringPiece();
+    }
+
     HtmlName name_;
+
+    // See original_start_tag().  start_tag_ points into start_tag_source_.
+    // Both are forgotten when the element is renamed, gains an attribute,
+    // or has one changed or deleted.  They're declared ahead of
+    // attributes_ so that they outlive the attributes' destructors, which
+    // forget them too.
+    SourceChunkPtr start_tag_source_;
+    StringPiece start_tag_;
+
     AttributeList attributes_;
     HtmlEventListIterator begin_;
     HtmlEventListIterator end_;
@@ -389,6 +474,14 @@ class HtmlElement : public HtmlNode {
   void set_end(const HtmlEventListIterator& end) { data_->end_ = end; }
 
   void set_begin_line_number(int line) { data_->begin_line_number_ = line; }
+
+  // Called by the lexer once the element's attributes are complete.
+  // start_tag must point into source.
+  void set_original_start_tag(const SourceChunkPtr& source,
+                              StringPiece start_tag) {
+    data_->start_tag_source_ = source;
+    data_->start_tag_ = start_tag;
+  }
   void set_end_line_number(int line) { data_->end_line_number_ = line; }
 
   // construct via HtmlParse::NewElement
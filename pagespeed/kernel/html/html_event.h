@@ -31,7 +31,8 @@ namespace net_instaweb {
 
 class HtmlEvent {
  public:
-  explicit HtmlEvent(int line_number) : line_number_(line_number) {}
+  explicit HtmlEvent(int line_number)
+      : line_number_(line_number), lexed_ahead_(false) {}
   virtual ~HtmlEvent();
   virtual void Run(HtmlFilter* filter) = 0;
   virtual GoogleString ToString() const = 0;
@@ -51,8 +52,14 @@ class HtmlEvent {
 
   int line_number() const { return line_number_; }
 
+  // True while the event is held back by HtmlParse::BeginParseAhead, and so
+  // is not part of the event window being flushed.
+  bool lexed_ahead() const { return lexed_ahead_; }
+  void set_lexed_ahead(bool x) { lexed_ahead_ = x; }
+
  private:
   int line_number_;
+  bool lexed_ahead_;
 
   DISALLOW_COPY_AND_ASSIGN(HtmlEvent);
 };
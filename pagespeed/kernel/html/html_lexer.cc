@@ -116,6 +116,15 @@ void CheckKeywordSetOrdering(const HtmlName::Keyword* keywords, int num) {
 }
 #endif
 
+// Removes prefix from the start of *str if it is there.
+bool ConsumePrefix(StringPiece prefix, StringPiece* str) {
+  if (!str->starts_with(prefix)) {
+    return false;
+  }
+  str->remove_prefix(prefix.size());
+  return true;
+}
+
 bool IsInSet(const HtmlName::Keyword* keywords, int num,
              HtmlName::Keyword keyword) {
   const HtmlName::Keyword* end = keywords + num;
@@ -139,6 +148,7 @@ HtmlLexer::HtmlLexer(HtmlParse* html_parse)
       attr_quote_(HtmlElement::NO_QUOTE),
       has_attr_value_(false),
       element_(nullptr),
+      input_pos_(0),
       line_(1),
       tag_start_line_(-1),
       script_html_comment_(false),
@@ -663,6 +673,7 @@ void HtmlLexer::EmitTagOpen(bool allow_implicit_close) {
 
   DCHECK(element_ != nullptr);
   DCHECK(token_.empty());
+  RecordOriginalStartTag();
   HtmlName next_tag = element_->name();
 
   // Look for elements that are implicitly closed by an open for this type.
@@ -715,6 +726,52 @@ void HtmlLexer::EmitTagOpen(bool allow_implicit_close) {
   element_ = nullptr;
 }
 
+// literal_ holds the tag from its '<' through the closing '>'.  Most tags
+// in the wild are written exactly the way HtmlWriterFilter would write
+// them: single spaces between attributes and nothing around the '='.  For
+// those we point the element at the tag's bytes in the input so the writer
+// can copy them out in one piece.  The input is copied into input_chunk_ at
+// most once per Parse() call, and only if some tag in it qualifies.  Tags
+// without attributes are cheap to rewrite and not worth the reference, and
+// tags split across Parse() calls aren't contiguous in any one input.
+void HtmlLexer::RecordOriginalStartTag() {
+  const HtmlElement::AttributeList& attrs = element_->attributes();
+  const int tag_start = input_pos_ + 1 - static_cast<int>(literal_.size());
+  if (attrs.IsEmpty() || input_.data() == nullptr || tag_start < 0) {
+    return;
+  }
+  StringPiece rest(literal_);
+  if (!ConsumePrefix("<", &rest) ||
+      !ConsumePrefix(element_->name_str(), &rest)) {
+    return;
+  }
+  for (HtmlElement::AttributeConstIterator i(attrs.begin()); i != attrs.end();
+       ++i) {
+    const HtmlElement::Attribute& attribute = *i;
+    if (!ConsumePrefix(" ", &rest) ||
+        !ConsumePrefix(attribute.name_str(), &rest)) {
+      return;
+    }
+    const char* value = attribute.escaped_value();
+    if (value != nullptr) {
+      StringPiece quote(attribute.quote_str());
+      if (!ConsumePrefix("=", &rest) || !ConsumePrefix(quote, &rest) ||
+          !ConsumePrefix(value, &rest) || !ConsumePrefix(quote, &rest)) {
+        return;
+      }
+    }
+  }
+  // Every byte lexed goes onto the end of literal_, so a tag that started
+  // in this input is its suffix up to the current character.
+  DCHECK_EQ(StringPiece(literal_), input_.substr(tag_start, literal_.size()));
+  if (input_chunk_.get() == nullptr) {
+    input_chunk_.reset(new HtmlElement::SourceChunk(input_));
+  }
+  element_->set_original_start_tag(
+      input_chunk_, input_chunk_->text().substr(
+                        tag_start, literal_.size() - rest.size()));
+}
+
 void HtmlLexer::EmitTagBriefClose() {
   if (!discard_until_start_state_for_error_recovery_) {
     HtmlElement* element = PopElement();
@@ -1010,12 +1067,13 @@ void HtmlLexer::Parse(const char* text, int size) {
   // TODO(nikhilmadan): Protect against an unbounded sequence of bytes within an
   // element, probably by just aborting the parse completely.
 
-  for (int i = 0; i < size; ++i) {
+  input_ = StringPiece(text, size);
+  for (input_pos_ = 0; input_pos_ < size; ++input_pos_) {
     if (skip_parsing_) {
-      // Return without doing anything if skip_parsing_ is true.
-      return;
+      // Stop without doing anything if skip_parsing_ is true.
+      break;
     }
-    char c = text[i];
+    char c = text[input_pos_];
     if (c == '\n') {
       ++line_;
     }
@@ -1126,6 +1184,10 @@ void HtmlLexer::Parse(const char* text, int size) {
         break;
     }
   }
+  // The caller may free text once we return.  Elements that point into it
+  // hold their own reference to input_chunk_.
+  input_ = StringPiece();
+  input_chunk_.clear();
 }
 
 // The HTML-input sloppiness in these three methods is applied independent
@@ -141,6 +141,9 @@ class HtmlLexer {
   void EmitComment();
   void EmitLiteral();
   void EmitTagOpen(bool allow_implicit_close);  // expects element_ != NULL.
+  // Points element_ at its start tag in the input if serializing it would
+  // reproduce literal_ verbatim.  See HtmlElement::original_start_tag().
+  void RecordOriginalStartTag();
   void EmitTagClose(HtmlElement::Style style);
   void EmitTagBriefClose();
   void EmitDirective();
@@ -227,6 +230,11 @@ class HtmlLexer {
   HtmlElement::QuoteStyle attr_quote_;  // quote used to delimit attribute
   bool has_attr_value_;                 // distinguishes <a n=> from <a n>
   HtmlElement* element_;  // current element; used to collect attributes
+  StringPiece input_;     // text passed to the current Parse() call
+  int input_pos_;         // index in input_ of the character being lexed
+  // A copy of input_, made the first time a start tag needs to point into
+  // it.  See RecordOriginalStartTag().
+  HtmlElement::SourceChunkPtr input_chunk_;
   int line_;
   int tag_start_line_;  // line at which we last transitioned to TAG state
   GoogleString id_;
@@ -21,6 +21,7 @@
 
 #include <list>
 #include <new>
+#include <utility>
 #include <vector>
 
 #include "base/logging.h"
@@ -63,6 +64,7 @@ HtmlParse::HtmlParse(MessageHandler* message_handler)
       running_filters_(false),
       buffer_events_(false),
       parse_start_time_us_(0),
+      parse_ahead_(false),
       timer_(nullptr),
       current_filter_(nullptr),
       dynamically_disabled_filter_list_(nullptr) {
@@ -73,6 +75,7 @@ HtmlParse::HtmlParse(MessageHandler* message_handler)
 HtmlParse::~HtmlParse() {
   delete lexer_;
   STLDeleteElements(&queue_);
+  STLDeleteElements(&parse_ahead_queue_);
   STLDeleteElements(&event_listeners_);
   ClearElements();
 }
@@ -82,7 +85,7 @@ void HtmlParse::AddFilter(HtmlFilter* html_filter) {
 }
 
 HtmlEventListIterator HtmlParse::Last() {
-  HtmlEventListIterator p = queue_.end();
+  HtmlEventListIterator p = ParseQueue()->end();
   --p;
   return p;
 }
@@ -110,9 +113,16 @@ void HtmlParse::CheckParentFromAddEvent(HtmlEvent* event) {
 
 void HtmlParse::AddEvent(HtmlEvent* event) {
   CheckParentFromAddEvent(event);
-  queue_.push_back(event);
-  need_sanity_check_ = true;
-  need_coalesce_characters_ = true;
+  if (parse_ahead_) {
+    // EndParseAhead raises the flags below once these events join queue_;
+    // raising them now would re-run the checks in the window being flushed.
+    event->set_lexed_ahead(true);
+    parse_ahead_queue_.push_back(event);
+  } else {
+    queue_.push_back(event);
+    need_sanity_check_ = true;
+    need_coalesce_characters_ = true;
+  }
 
   // If this is a leaf-node event, we need to set the iterator of the
   // corresponding leaf node to point to this event's position in the queue.
@@ -123,7 +133,9 @@ void HtmlParse::AddEvent(HtmlEvent* event) {
   HtmlLeafNode* leaf = event->GetLeafNode();
   if (leaf != nullptr) {
     leaf->set_iter(Last());
-    message_handler_->Check(IsRewritable(leaf), "!IsRewritable(leaf)");
+    // Leaves lexed ahead only become rewritable at EndParseAhead.
+    message_handler_->Check(parse_ahead_ || IsRewritable(leaf),
+                            "!IsRewritable(leaf)");
   }
   if (!event_listeners_.empty()) {
     running_filters_ = true;
@@ -245,6 +257,8 @@ bool HtmlParse::StartParseId(const StringPiece& url, const StringPiece& id,
   delayed_start_literal_.reset();
   determine_filter_behavior_called_ = false;
   buffer_events_ = false;
+  DCHECK(!parse_ahead_);
+  parse_ahead_ = false;
 
   // Paranoid debug-checking and unconditional clearing of state variables.
   DCHECK(!skip_increment_);
@@ -297,6 +311,34 @@ void HtmlParse::ShowProgress(const char* message) {
   }
 }
 
+void HtmlParse::BeginParseAhead() {
+  DCHECK(!parse_ahead_);
+  DCHECK(!running_filters_);
+  parse_ahead_ = true;
+}
+
+void HtmlParse::EndParseAhead() {
+  DCHECK(parse_ahead_);
+  DCHECK(!running_filters_);
+  parse_ahead_ = false;
+  if (parse_ahead_queue_.empty()) {
+    DCHECK(parse_ahead_ends_.empty());
+    return;
+  }
+
+  for (HtmlEvent* event : parse_ahead_queue_) {
+    event->set_lexed_ahead(false);
+  }
+  // splice keeps the iterators held by the nodes valid.
+  queue_.splice(queue_.end(), parse_ahead_queue_);
+  for (int i = 0, n = parse_ahead_ends_.size(); i < n; ++i) {
+    parse_ahead_ends_[i].first->set_end(parse_ahead_ends_[i].second);
+  }
+  parse_ahead_ends_.clear();
+  need_sanity_check_ = true;
+  need_coalesce_characters_ = true;
+}
+
 void HtmlParse::FinishParse() {
   BeginFinishParse();
   Flush();
@@ -305,6 +347,7 @@ void HtmlParse::FinishParse() {
 
 void HtmlParse::BeginFinishParse() {
   DCHECK(url_valid_) << "Invalid to call FinishParse on invalid input";
+  DCHECK(!parse_ahead_) << "EndParseAhead must precede FinishParse";
   if (url_valid_) {
     lexer_->FinishParse();
     DCHECK(delayed_start_literal_.get() == nullptr);
@@ -456,8 +499,21 @@ void HtmlParse::DelayLiteralTag() {
     // tag.  We are not going to process this within the current
     // flush window, but instead wait till the EndElement arrives
     // from the lexer.
-    delayed_start_literal_.reset(event);
-    queue_.erase(current_);
+    bool closed_ahead = false;
+    for (int i = 0, n = parse_ahead_ends_.size(); i < n; ++i) {
+      closed_ahead |= (parse_ahead_ends_[i].first == element);
+    }
+    if (closed_ahead) {
+      // The EndElement has been lexed ahead of this flush already, so move
+      // the start to the front of the held events, where CloseElement would
+      // have put it.
+      event->set_lexed_ahead(true);
+      parse_ahead_queue_.splice(parse_ahead_queue_.begin(), queue_, current_);
+      element->set_begin(parse_ahead_queue_.begin());
+    } else {
+      delayed_start_literal_.reset(event);
+      queue_.erase(current_);
+    }
   }
   current_ = queue_.end();
 }
@@ -1016,7 +1072,8 @@ bool HtmlParse::CanAppendChild(const HtmlNode* node) const {
 }
 
 bool HtmlParse::IsInEventWindow(const HtmlEventListIterator& iter) const {
-  return iter != queue_.end();
+  // Iterators into parse_ahead_queue_ are not queue_.end() either.
+  return (iter != queue_.end()) && !(*iter)->lexed_ahead();
 }
 
 void HtmlParse::ClearElements() {
@@ -1145,7 +1202,9 @@ void HtmlParse::CloseElement(HtmlElement* element, HtmlElement::Style style,
     HtmlElement* element = delayed_start_literal_->GetElementIfStartEvent();
     DCHECK(element != nullptr);
     bool insert_at_begin = true;
-    if (!queue_.empty()) {
+    HtmlEventList* queue = ParseQueue();
+    delayed_start_literal_->set_lexed_ahead(parse_ahead_);
+    if (!queue->empty()) {
       // We have been holding back "<script>" until the lexer tells us the
       // tag is closed here.  But we want to insert the <script> tag *before*
       // the previous characters block, if any.
@@ -1155,15 +1214,15 @@ void HtmlParse::CloseElement(HtmlElement* element, HtmlElement::Style style,
       // in the debug filter, we must put the <script> after that, so
       // walk back from current, past the Character block, if any.  We
       // don't expect anything other than a Character block here.
-      HtmlEventListIterator p = queue_.end();
+      HtmlEventListIterator p = queue->end();
       --p;
       HtmlEvent* event = *p;
       HtmlCharactersNode* node = event->GetCharactersNode();
       if (node != nullptr) {
-        if (p != queue_.begin()) {
+        if (p != queue->begin()) {
           --p;
           element->set_begin(
-              queue_.insert(p, delayed_start_literal_.release()));
+              queue->insert(p, delayed_start_literal_.release()));
           insert_at_begin = false;
         }
       } else {
@@ -1180,8 +1239,8 @@ void HtmlParse::CloseElement(HtmlElement* element, HtmlElement::Style style,
       }
     }
     if (insert_at_begin) {
-      queue_.push_front(delayed_start_literal_.release());
-      element->set_begin(queue_.begin());
+      queue->push_front(delayed_start_literal_.release());
+      element->set_begin(queue->begin());
     }
     DCHECK(delayed_start_literal_.get() == nullptr);
   }
@@ -1192,7 +1251,13 @@ void HtmlParse::CloseElement(HtmlElement* element, HtmlElement::Style style,
     element->set_style(style);
   }
   AddEvent(end_event);
-  element->set_end(Last());
+  if (parse_ahead_) {
+    // Leave the element unclosed, and thus unrewritable, in the flush window
+    // that EndParseAhead has yet to append this event to.
+    parse_ahead_ends_.push_back(std::make_pair(element, Last()));
+  } else {
+    element->set_end(Last());
+  }
   element->set_end_line_number(line_number);
 }
 
@@ -157,6 +157,22 @@ class HtmlParse {
   // currently active filters are completed.
   virtual void Flush();
 
+  // Parse-ahead lets the caller lex more input while the events of the
+  // current flush window are still being processed asynchronously, e.g.
+  // while RewriteDriver::FlushAsync waits for rewrites to complete.  Text
+  // passed to ParseText between BeginParseAhead and EndParseAhead is queued
+  // on a separate list that the filters don't see, and elements it closes
+  // keep looking unclosed until EndParseAhead, so the window being flushed
+  // is rewritten exactly as if that text had not arrived yet.
+  //
+  // A Flush issued meanwhile covers only the events queued before
+  // BeginParseAhead.  EndParseAhead appends the held events to the event
+  // queue for the next Flush, and must precede FinishParse.  Both must be
+  // called from the thread running the filters, never from within a filter.
+  void BeginParseAhead();
+  void EndParseAhead();
+  bool parsing_ahead() const { return parse_ahead_; }
+
   // Finish a chunked parsing session.  This also induces a Flush.
   //
   // It is invalid to call FinishParse when the StartParse* routines returned
@@ -579,6 +595,7 @@ class HtmlParse {
   // called, and so during event-buffering mode, filters should not
   // be accessed.
   void set_buffer_events(bool x) { buffer_events_ = x; }
+  bool buffer_events() const { return buffer_events_; }
 
   // Disables any filter in this->filters_ whose GetScriptUsage() is
   // HtmlFilter::kWillInjectScripts.
@@ -589,7 +606,11 @@ class HtmlParse {
 
  private:
   void ApplyFilterHelper(HtmlFilter* filter);
-  HtmlEventListIterator Last();  // Last element in queue
+  HtmlEventListIterator Last();  // Last element in ParseQueue()
+  // Returns the list that lexed events are appended to.
+  HtmlEventList* ParseQueue() {
+    return parse_ahead_ ? &parse_ahead_queue_ : &queue_;
+  }
   bool IsInEventWindow(const HtmlEventListIterator& iter) const;
   void InsertNodeBeforeEvent(const HtmlEventListIterator& event,
                              HtmlNode* new_node);
@@ -656,6 +677,13 @@ class HtmlParse {
   bool buffer_events_;
   int64 parse_start_time_us_;
   std::unique_ptr<HtmlEvent> delayed_start_literal_;
+
+  // Events lexed since BeginParseAhead, and the end events of the elements
+  // they close, which are applied to the elements by EndParseAhead.
+  bool parse_ahead_;
+  HtmlEventList parse_ahead_queue_;
+  std::vector<std::pair<HtmlElement*, HtmlEventListIterator>>
+      parse_ahead_ends_;
   Timer* timer_;
   HtmlFilter* current_filter_;  // Filter currently running in ApplyFilter
 
@@ -35,7 +35,7 @@ static const int kDefaultMaxColumn = -1;
 
 HtmlWriterFilter::HtmlWriterFilter(HtmlParse* html_parse)
     : html_parse_(html_parse),
-      writer_(nullptr),
+      coalescing_writer_(nullptr, CoalescingWriter::kDefaultBufferSize),
       max_column_(kDefaultMaxColumn),
       case_fold_(false) {
   Clear();
@@ -43,7 +43,14 @@ HtmlWriterFilter::HtmlWriterFilter(HtmlParse* html_parse)
 
 HtmlWriterFilter::~HtmlWriterFilter() {}
 
+void HtmlWriterFilter::set_writer(Writer* writer) {
+  coalescing_writer_.Clear();
+  coalescing_writer_.set_writer(writer);
+}
+
 void HtmlWriterFilter::Clear() {
+  // Anything left over is from a document that was never flushed.
+  coalescing_writer_.Clear();
   lazy_close_element_ = nullptr;
   column_ = 0;
   write_errors_ = 0;
@@ -52,7 +59,7 @@ void HtmlWriterFilter::Clear() {
 void HtmlWriterFilter::TerminateLazyCloseElement() {
   if (lazy_close_element_ != nullptr) {
     lazy_close_element_ = nullptr;
-    if (!writer_->Write(">", html_parse_->message_handler())) {
+    if (!coalescing_writer_.Write(">", html_parse_->message_handler())) {
       ++write_errors_;
     }
     ++column_;
@@ -70,7 +77,7 @@ void HtmlWriterFilter::EmitBytes(const StringPiece& str) {
       break;
     }
   }
-  if (!writer_->Write(str, html_parse_->message_handler())) {
+  if (!coalescing_writer_.Write(str, html_parse_->message_handler())) {
     ++write_errors_;
   }
 }
@@ -85,11 +92,7 @@ void HtmlWriterFilter::EmitName(const HtmlName& name) {
   }
 }
 
-void HtmlWriterFilter::StartElement(HtmlElement* element) {
-  HtmlElement::Style element_style = GetElementStyle(element);
-  if (element_style == HtmlElement::INVISIBLE) {
-    return;
-  }
+void HtmlWriterFilter::EmitStartTag(HtmlElement* element) {
   EmitBytes("<");
   EmitName(element->name());
 
@@ -118,6 +121,21 @@ void HtmlWriterFilter::StartElement(HtmlElement* element) {
       EmitBytes(quote);
     }
   }
+}
+
+void HtmlWriterFilter::StartElement(HtmlElement* element) {
+  HtmlElement::Style element_style = GetElementStyle(element);
+  if (element_style == HtmlElement::INVISIBLE) {
+    return;
+  }
+  // A tag no filter has touched is copied out as it appeared in the source,
+  // unless we've been asked to reformat it.
+  StringPiece original_start_tag = element->original_start_tag();
+  if (!original_start_tag.empty() && !case_fold_ && (max_column_ <= 0)) {
+    EmitBytes(original_start_tag);
+  } else {
+    EmitStartTag(element);
+  }
 
   // Attempt to briefly terminate any legal tag that was explicitly terminated
   // in the input.  Note that a rewrite pass might have injected events
@@ -245,7 +263,7 @@ void HtmlWriterFilter::EndDocument() {
 }
 
 void HtmlWriterFilter::Flush() {
-  if (!writer_->Flush(html_parse_->message_handler())) {
+  if (!coalescing_writer_.Flush(html_parse_->message_handler())) {
     ++write_errors_;
   }
 }
@@ -21,6 +21,7 @@
 #define PAGESPEED_KERNEL_HTML_HTML_WRITER_FILTER_H_
 
 #include "pagespeed/kernel/base/basictypes.h"
+#include "pagespeed/kernel/base/coalescing_writer.h"
 #include "pagespeed/kernel/base/string.h"
 #include "pagespeed/kernel/base/string_util.h"
 #include "pagespeed/kernel/html/html_element.h"
@@ -33,12 +34,16 @@ namespace net_instaweb {
 class HtmlParse;
 class Writer;
 
-// Filter that serializes HTML to a Writer stream.
+// Filter that serializes HTML to a Writer stream.  Output is gathered into
+// large chunks so that the writer sees a handful of Write calls per flush
+// window rather than one per token.
 class HtmlWriterFilter : public HtmlFilter {
  public:
   explicit HtmlWriterFilter(HtmlParse* html_parse);
 
-  void set_writer(Writer* writer) { writer_ = writer; }
+  // Output not yet handed to the previous writer is dropped, so the writer
+  // should only be changed between documents or right after a Flush.
+  void set_writer(Writer* writer);
   ~HtmlWriterFilter() override;
 
   void StartDocument() override;
@@ -65,7 +70,9 @@ class HtmlWriterFilter : public HtmlFilter {
   // Clear various variables for rewriting a new html file.
   virtual void Clear();
 
-  Writer* writer() { return writer_; }
+  // Subclasses must write through this rather than the writer passed to
+  // set_writer, so that their output stays in order with ours.
+  Writer* writer() { return &coalescing_writer_; }
 
   // Terminates the current lazy close element if it is not already terminated.
   void TerminateLazyCloseElement();
@@ -77,6 +84,9 @@ class HtmlWriterFilter : public HtmlFilter {
   // caller-specified option.
   void EmitName(const HtmlName& name);
 
+  // Serializes "<", the element name and its attributes.
+  void EmitStartTag(HtmlElement* element);
+
   HtmlElement::Style GetElementStyle(HtmlElement* element);
 
   // Escapes arbitrary text as HTML, e.g. turning & into &amp;.  If quoteChar
@@ -84,7 +94,7 @@ class HtmlWriterFilter : public HtmlFilter {
   void EncodeBytes(const GoogleString& val, int quoteChar);
 
   HtmlParse* html_parse_;
-  Writer* writer_;
+  CoalescingWriter coalescing_writer_;
 
   // Helps writer exploit shortcuts like <img .../> rather than writing
   // <img ...></img>.  At the end of StartElement, we defer writing the ">"
@@ -0,0 +1,313 @@
+/*
+ * Licensed to the Apache Software Foundation (ASF) under one
+ * or more contributor license agreements.  See the NOTICE file
+ * distributed with this work for additional information
+ * regarding copyright ownership.  The ASF licenses this file
+ * to you under the Apache License, Version 2.0 (the
+ * "License"); you may not use this file except in compliance
+ * with the License.  You may obtain a copy of the License at
+ * 
+ *   http://www.apache.org/licenses/LICENSE-2.0
+ * 
+ * Unless required by applicable law or agreed to in writing,
+ * software distributed under the License is distributed on an
+ * "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY
+ * KIND, either express or implied.  See the License for the
+ * specific language governing permissions and limitations
+ * under the License.
+ */
+
+#include "pagespeed/kernel/http/header_block.h"
+
+#include <vector>
+
+#include "base/logging.h"
+#include "pagespeed/kernel/base/string_hash.h"
+#include "pagespeed/kernel/http/headers.h"
+#include "pagespeed/kernel/http/request_headers.h"
+#include "pagespeed/kernel/http/response_headers.h"
+
+namespace net_instaweb {
+
+class HeaderBlock::Rep : public RefCounted<HeaderBlock::Rep> {
+ public:
+  // A [offset, offset + size) range of storage_.
+  struct Span {
+    uint32 offset;
+    uint32 size;
+  };
+
+  struct Attribute {
+    Span name;
+    Span value;
+  };
+
+  // One entry per distinct case-folded name.  The (comma-split) values for
+  // the name are values_[first_value, first_value + num_values).  Empty
+  // slots have attribute == kEmptySlot.
+  struct Slot {
+    uint32 hash;
+    int attribute;
+    uint32 first_value;
+    uint32 num_values;
+  };
+
+  static const int kEmptySlot = -1;
+
+  template <class Proto>
+  Rep(const Headers<Proto>& headers, int status_code,
+      StringPiece reason_phrase)
+      : status_code_(status_code),
+        major_version_(headers.major_version()),
+        minor_version_(headers.minor_version()),
+        num_names_(0) {
+    int num_attributes = headers.NumAttributes();
+    size_t total_size = reason_phrase.size();
+    for (int i = 0; i < num_attributes; ++i) {
+      total_size += headers.Name(i).size() + headers.Value(i).size();
+    }
+
+    // All the bytes go into one allocation; everything else refers to them
+    // by offset.
+    storage_.reserve(total_size);
+    reason_phrase_ = Append(reason_phrase);
+    attributes_.reserve(num_attributes);
+    for (int i = 0; i < num_attributes; ++i) {
+      Attribute attribute;
+      attribute.name = Append(headers.Name(i));
+      attribute.value = Append(headers.Value(i));
+      attributes_.push_back(attribute);
+    }
+    BuildIndex();
+  }
+
+  StringPiece Get(const Span& span) const {
+    return StringPiece(storage_.data() + span.offset, span.size);
+  }
+
+  const Slot* FindSlot(StringPiece name) const {
+    if (index_.empty()) {
+      return nullptr;
+    }
+    uint32 hash = HashString<CaseFold, uint32>(name.data(), name.size());
+    uint32 mask = index_.size() - 1;
+    for (uint32 i = hash & mask;; i = (i + 1) & mask) {
+      const Slot& slot = index_[i];
+      if (slot.attribute == kEmptySlot) {
+        return nullptr;
+      }
+      if (slot.hash == hash &&
+          StringCaseEqual(Get(attributes_[slot.attribute].name), name)) {
+        return &slot;
+      }
+    }
+  }
+
+  int status_code_;
+  int major_version_;
+  int minor_version_;
+  int num_names_;
+  Span reason_phrase_;
+  GoogleString storage_;
+  std::vector<Attribute> attributes_;
+  std::vector<Span> values_;
+  std::vector<Slot> index_;
+
+ private:
+  Span Append(StringPiece str) {
+    Span span;
+    span.offset = storage_.size();
+    span.size = str.size();
+    storage_.append(str.data(), str.size());
+    return span;
+  }
+
+  // Returns the slot for the name of attributes_[attribute], claiming an
+  // empty one if this is the first attribute with that name.
+  Slot* InsertSlot(int attribute) {
+    StringPiece name = Get(attributes_[attribute].name);
+    uint32 hash = HashString<CaseFold, uint32>(name.data(), name.size());
+    uint32 mask = index_.size() - 1;
+    for (uint32 i = hash & mask;; i = (i + 1) & mask) {
+      Slot* slot = &index_[i];
+      if (slot->attribute == kEmptySlot) {
+        slot->hash = hash;
+        slot->attribute = attribute;
+        ++num_names_;
+        return slot;
+      }
+      if (slot->hash == hash &&
+          StringCaseEqual(Get(attributes_[slot->attribute].name), name)) {
+        return slot;
+      }
+    }
+  }
+
+  void BuildIndex() {
+    int num_attributes = attributes_.size();
+    if (num_attributes == 0) {
+      return;
+    }
+
+    // Keep the load factor at or below 1/2 so probe sequences stay short.
+    uint32 num_slots = 4;
+    while (num_slots < 2 * static_cast<uint32>(num_attributes)) {
+      num_slots *= 2;
+    }
+    Slot empty = {0, kEmptySlot, 0, 0};
+    index_.assign(num_slots, empty);
+
+    // First pass: find each attribute's slot and count its values.
+    std::vector<Slot*> slots(num_attributes);
+    StringPieceVector split;
+    for (int i = 0; i < num_attributes; ++i) {
+      slots[i] = InsertSlot(i);
+      split.clear();
+      SplitHeaderValues(Get(attributes_[i].name), Get(attributes_[i].value),
+                        &split);
+      slots[i]->num_values += split.size();
+    }
+
+    // Lay the values for each name out contiguously.
+    uint32 num_values = 0;
+    for (Slot& slot : index_) {
+      slot.first_value = num_values;
+      num_values += slot.num_values;
+    }
+    values_.resize(num_values);
+
+    // Second pass: fill in the values, in attribute order within each name.
+    // The split pieces all point into storage_.
+    std::vector<uint32> filled(num_slots, 0);
+    for (int i = 0; i < num_attributes; ++i) {
+      split.clear();
+      SplitHeaderValues(Get(attributes_[i].name), Get(attributes_[i].value),
+                        &split);
+      Slot* slot = slots[i];
+      uint32& next = filled[slot - &index_[0]];
+      for (StringPiece piece : split) {
+        Span* span = &values_[slot->first_value + next++];
+        span->offset = piece.data() - storage_.data();
+        span->size = piece.size();
+      }
+    }
+  }
+
+  DISALLOW_COPY_AND_ASSIGN(Rep);
+};
+
+HeaderBlock::HeaderBlock() {}
+
+HeaderBlock::HeaderBlock(const RequestHeaders& headers)
+    : rep_(new Rep(headers, 0, StringPiece())) {}
+
+HeaderBlock::HeaderBlock(const ResponseHeaders& headers)
+    : rep_(new Rep(headers, headers.status_code(),
+                   headers.reason_phrase())) {}
+
+HeaderBlock::HeaderBlock(const HeaderBlock& src) : rep_(src.rep_) {}
+
+HeaderBlock& HeaderBlock::operator=(const HeaderBlock& src) {
+  rep_ = src.rep_;
+  return *this;
+}
+
+HeaderBlock::~HeaderBlock() {}
+
+void HeaderBlock::CopyToResponseHeaders(ResponseHeaders* headers) const {
+  headers->Clear();
+  if (rep_.get() == nullptr) {
+    return;
+  }
+  headers->set_major_version(rep_->major_version_);
+  headers->set_minor_version(rep_->minor_version_);
+  if (rep_->status_code_ != 0) {
+    headers->set_status_code(rep_->status_code_);
+    headers->set_reason_phrase(reason_phrase());
+  }
+  for (const Rep::Attribute& attribute : rep_->attributes_) {
+    headers->Add(rep_->Get(attribute.name), rep_->Get(attribute.value));
+  }
+}
+
+int HeaderBlock::status_code() const {
+  return (rep_.get() == nullptr) ? 0 : rep_->status_code_;
+}
+
+StringPiece HeaderBlock::reason_phrase() const {
+  return (rep_.get() == nullptr) ? StringPiece()
+                                 : rep_->Get(rep_->reason_phrase_);
+}
+
+int HeaderBlock::major_version() const {
+  return (rep_.get() == nullptr) ? 0 : rep_->major_version_;
+}
+
+int HeaderBlock::minor_version() const {
+  return (rep_.get() == nullptr) ? 0 : rep_->minor_version_;
+}
+
+int HeaderBlock::NumAttributes() const {
+  return (rep_.get() == nullptr) ? 0 : rep_->attributes_.size();
+}
+
+StringPiece HeaderBlock::Name(int i) const {
+  return rep_->Get(rep_->attributes_[i].name);
+}
+
+StringPiece HeaderBlock::Value(int i) const {
+  return rep_->Get(rep_->attributes_[i].value);
+}
+
+int HeaderBlock::NumAttributeNames() const {
+  return (rep_.get() == nullptr) ? 0 : rep_->num_names_;
+}
+
+bool HeaderBlock::Lookup(StringPiece name, StringPieceVector* values) const {
+  values->clear();
+  if (rep_.get() == nullptr) {
+    return false;
+  }
+  const Rep::Slot* slot = rep_->FindSlot(name);
+  if (slot == nullptr) {
+    return false;
+  }
+  values->reserve(slot->num_values);
+  for (uint32 i = 0; i < slot->num_values; ++i) {
+    values->push_back(rep_->Get(rep_->values_[slot->first_value + i]));
+  }
+  return true;
+}
+
+bool HeaderBlock::Lookup1(StringPiece name, StringPiece* value) const {
+  if (rep_.get() == nullptr) {
+    return false;
+  }
+  const Rep::Slot* slot = rep_->FindSlot(name);
+  if (slot == nullptr || slot->num_values != 1) {
+    return false;
+  }
+  *value = rep_->Get(rep_->values_[slot->first_value]);
+  return true;
+}
+
+bool HeaderBlock::Has(StringPiece name) const {
+  return (rep_.get() != nullptr) && (rep_->FindSlot(name) != nullptr);
+}
+
+bool HeaderBlock::HasValue(StringPiece name, StringPiece value) const {
+  if (rep_.get() == nullptr) {
+    return false;
+  }
+  const Rep::Slot* slot = rep_->FindSlot(name);
+  if (slot != nullptr) {
+    for (uint32 i = 0; i < slot->num_values; ++i) {
+      if (rep_->Get(rep_->values_[slot->first_value + i]) == value) {
+        return true;
+      }
+    }
+  }
+  return false;
+}
+
+}  // namespace net_instaweb
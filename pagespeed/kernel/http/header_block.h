@@ -0,0 +1,99 @@
+/*
+ * Licensed to the Apache Software Foundation (ASF) under one
+ * or more contributor license agreements.  See the NOTICE file
+ * distributed with this work for additional information
+ * regarding copyright ownership.  The ASF licenses this file
+ * to you under the Apache License, Version 2.0 (the
+ * "License"); you may not use this file except in compliance
+ * with the License.  You may obtain a copy of the License at
+ * 
+ *   http://www.apache.org/licenses/LICENSE-2.0
+ * 
+ * Unless required by applicable law or agreed to in writing,
+ * software distributed under the License is distributed on an
+ * "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY
+ * KIND, either express or implied.  See the License for the
+ * specific language governing permissions and limitations
+ * under the License.
+ */
+
+#ifndef PAGESPEED_KERNEL_HTTP_HEADER_BLOCK_H_
+#define PAGESPEED_KERNEL_HTTP_HEADER_BLOCK_H_
+
+#include "pagespeed/kernel/base/basictypes.h"
+#include "pagespeed/kernel/base/ref_counted_ptr.h"
+#include "pagespeed/kernel/base/string.h"
+#include "pagespeed/kernel/base/string_util.h"
+
+namespace net_instaweb {
+
+class RequestHeaders;
+class ResponseHeaders;
+
+// An immutable, pre-parsed snapshot of a set of HTTP headers, for handing
+// the same headers to several owners without serializing, re-parsing or
+// rebuilding them each time.  Currently only FetchCoalescer uses it, to
+// share a leader's response headers with its followers; HTTPValue,
+// AsyncFetch and friends still carry their own ResponseHeaders.
+//
+// All names and values are held in a single reference-counted block, so
+// copying a HeaderBlock costs one atomic increment.  The lookup index is a
+// small open-addressing table over the case-folded header names, built once
+// when the block is created.  Unlike Headers<Proto>::Lookup, which lazily
+// builds its map, every accessor here is truly const and it is safe to share
+// a HeaderBlock, or copies of it, between threads.
+class HeaderBlock {
+ public:
+  // Constructs an empty block, with no attributes and a zero status code.
+  HeaderBlock();
+  explicit HeaderBlock(const RequestHeaders& headers);
+  explicit HeaderBlock(const ResponseHeaders& headers);
+  HeaderBlock(const HeaderBlock& src);
+  HeaderBlock& operator=(const HeaderBlock& src);
+  ~HeaderBlock();
+
+  // Replaces the contents of headers with this block.  The caller is
+  // responsible for calling ComputeCaching() if needed.
+  void CopyToResponseHeaders(ResponseHeaders* headers) const;
+
+  bool empty() const { return NumAttributes() == 0; }
+  int status_code() const;
+  StringPiece reason_phrase() const;
+  int major_version() const;
+  int minor_version() const;
+
+  // Raw access to the attribute name/value pairs, in their original order.
+  // The returned StringPieces remain valid as long as any HeaderBlock
+  // sharing this storage is alive.
+  int NumAttributes() const;
+  StringPiece Name(int i) const;
+  StringPiece Value(int i) const;
+
+  // Number of distinct (case-insensitive) attribute names.
+  int NumAttributeNames() const;
+
+  // These behave like their Headers<Proto> counterparts, including the
+  // splitting of comma-separated fields such as Cache-Control into
+  // multiple values, but are thread-safe.
+  bool Lookup(StringPiece name, StringPieceVector* values) const;
+  bool Has(StringPiece name) const;
+  bool HasValue(StringPiece name, StringPiece value) const;
+
+  // Looks up a single attribute value.  Returns false if the attribute is
+  // not found, or if more than one value is found.
+  bool Lookup1(StringPiece name, StringPiece* value) const;
+
+  // Returns true if both blocks share the same storage.
+  bool SharesStorageWith(const HeaderBlock& other) const {
+    return rep_.get() == other.rep_.get();
+  }
+
+ private:
+  class Rep;
+
+  RefCountedPtr<Rep> rep_;
+};
+
+}  // namespace net_instaweb
+
+#endif  // PAGESPEED_KERNEL_HTTP_HEADER_BLOCK_H_
@@ -303,11 +303,10 @@ bool IsCommaSeparatedField(const StringPiece& name) {
   }
 }
 
-// Takes a potentially comma-separated value list, and splits it into
-// a vector.  If the value is not comma-separatable, 'values' is
-// populated with the single value.
-void SplitValues(StringPiece name, StringPiece comma_separated_values,
-                 StringPieceVector* values) {
+}  // namespace
+
+void SplitHeaderValues(StringPiece name, StringPiece comma_separated_values,
+                       StringPieceVector* values) {
   if (IsCommaSeparatedField(name)) {
     SplitStringPieceToVector(comma_separated_values, ",", values, true);
     if (values->empty()) {
@@ -322,8 +321,6 @@ void SplitValues(StringPiece name, StringPiece comma_separated_values,
   }
 }
 
-}  // namespace
-
 template <class Proto>
 void Headers<Proto>::Add(const StringPiece& name, const StringPiece& value) {
   NameValue* name_value = proto_->add_header();
@@ -338,7 +335,7 @@ void Headers<Proto>::AddToMap(const StringPiece& name,
                               const StringPiece& value) const {
   if (map_.get() != nullptr) {
     StringPieceVector split;
-    SplitValues(name, value, &split);
+    SplitHeaderValues(name, value, &split);
     for (int i = 0, n = split.size(); i < n; ++i) {
       map_->Add(name, split[i]);
     }
@@ -552,7 +549,7 @@ bool Headers<Proto>::RemoveIfNotIn(const Headers& keep) {
     bool needed = false;
     if (!keep_value_bag.empty()) {
       StringPieceVector this_values;
-      SplitValues(name, Value(a), &this_values);
+      SplitHeaderValues(name, Value(a), &this_values);
       bool partial = false;
       int out = 0;
       for (int in = 0, nv = this_values.size(); in < nv; ++in) {
@@ -36,6 +36,12 @@ class NameValue;
 class StringMultiMapInsensitive;
 class Writer;
 
+// Takes a potentially comma-separated header value list, and splits it into
+// a vector.  If the header is not one that is ordinarily comma-separated
+// (Cache-Control, Vary, etc.), 'values' is populated with the single value.
+void SplitHeaderValues(StringPiece name, StringPiece comma_separated_values,
+                       StringPieceVector* values);
+
 // Read/write API for HTTP headers (shared base class)
 template <class Proto>
 class Headers {
@@ -19,15 +19,19 @@
 
 #include "pagespeed/kernel/http/user_agent_matcher.h"
 
+#include <algorithm>
 #include <map>
 #include <memory>
 #include <utility>
 
+#include "pagespeed/kernel/base/abstract_mutex.h"
 #include "pagespeed/kernel/base/basictypes.h"
 #include "pagespeed/kernel/base/fast_wildcard_group.h"
 #include "pagespeed/kernel/base/scoped_ptr.h"
 #include "pagespeed/kernel/base/string.h"
+#include "pagespeed/kernel/base/string_hash.h"
 #include "pagespeed/kernel/base/string_util.h"
+#include "pagespeed/kernel/base/thread_system.h"
 #include "pagespeed/kernel/util/re2.h"
 
 namespace net_instaweb {
@@ -287,10 +291,15 @@ const Dimension kKnownScreenDimensions[] = {
     {"Xoom", 800, 1280},         {"XT907", 540, 960},
 };
 
+// The classification cache is split into this many independently locked
+// shards, so that request threads rarely contend.
+const int kNumCacheShards = 16;
+
 }  // namespace
 
 UserAgentMatcher::UserAgentMatcher()
-    : chrome_version_pattern_(kChromeVersionPattern) {
+    : chrome_version_pattern_(kChromeVersionPattern),
+      max_entries_per_shard_(0) {
   // Initialize FastWildcardGroup for image inlining allowlist & blockedlist.
   for (int i = 0, n = arraysize(kImageInliningAllowlist); i < n; ++i) {
     supports_image_inlining_.Allow(kImageInliningAllowlist[i]);
@@ -385,7 +394,173 @@ UserAgentMatcher::UserAgentMatcher()
 
 UserAgentMatcher::~UserAgentMatcher() {}
 
+void UserAgentMatcher::EnableClassificationCache(ThreadSystem* thread_system,
+                                                 int max_entries) {
+  DCHECK(cache_shards_.empty());
+  DCHECK_LT(0, max_entries);
+  cache_shards_.resize(kNumCacheShards);
+  for (CacheShard& shard : cache_shards_) {
+    shard.mutex.reset(thread_system->NewMutex());
+  }
+  max_entries_per_shard_ =
+      std::max(1, (max_entries + kNumCacheShards - 1) / kNumCacheShards);
+}
+
+UserAgentMatcher::Classification::Classification()
+    : capabilities_(0),
+      device_type_(kDesktop),
+      chrome_major_(-1),
+      chrome_minor_(-1),
+      chrome_build_(-1),
+      chrome_patch_(-1) {}
+
+bool UserAgentMatcher::Classification::SupportsJsDefer(
+    bool allow_mobile) const {
+  // As in UserAgentMatcher::SupportsJsDefer.
+  if (device_type_ != kDesktop) {
+    return allow_mobile && Has(kDeferJsMobileAllowed);
+  }
+  return Has(kDeferJsAllowed);
+}
+
+bool UserAgentMatcher::Classification::GetChromeBuildNumber(int* major,
+                                                            int* minor,
+                                                            int* build,
+                                                            int* patch) const {
+  if (!Has(kHasChromeBuildNumber)) {
+    return false;
+  }
+  *major = chrome_major_;
+  *minor = chrome_minor_;
+  *build = chrome_build_;
+  *patch = chrome_patch_;
+  return true;
+}
+
+void UserAgentMatcher::Classify(StringPiece user_agent,
+                                Classification* classification) const {
+  if (!Lookup(user_agent, classification)) {
+    ClassifyUncached(user_agent, classification);
+  }
+}
+
+void UserAgentMatcher::ClassifyUncached(StringPiece user_agent,
+                                        Classification* classification) const {
+  uint32 capabilities = 0;
+  if (ie_user_agents_.Match(user_agent, false)) {
+    capabilities |= Classification::kIsIe;
+  }
+  if (SupportsImageInlining(user_agent)) {
+    capabilities |= Classification::kSupportsImageInlining;
+  }
+  if (supports_lazyload_images_.Match(user_agent, true)) {
+    capabilities |= Classification::kSupportsLazyloadImages;
+  }
+  if (user_agent.empty() || defer_js_allowlist_.Match(user_agent, false)) {
+    capabilities |= Classification::kDeferJsAllowed;
+  }
+  if (defer_js_mobile_allowlist_.Match(user_agent, false)) {
+    capabilities |= Classification::kDeferJsMobileAllowed;
+  }
+  if (legacy_webp_.Match(user_agent, false)) {
+    capabilities |= Classification::kLegacyWebp;
+  }
+  if (supports_webp_lossless_alpha_.Match(user_agent, false)) {
+    capabilities |= Classification::kSupportsWebpLosslessAlpha;
+  }
+  if (supports_webp_animated_.Match(user_agent, false)) {
+    capabilities |= Classification::kSupportsWebpAnimated;
+  }
+  if (supports_dns_prefetch_.Match(user_agent, false)) {
+    capabilities |= Classification::kSupportsDnsPrefetch;
+  }
+  if (IsAndroidUserAgent(user_agent)) {
+    capabilities |= Classification::kIsAndroid;
+  }
+  if (IsiOSUserAgent(user_agent)) {
+    capabilities |= Classification::kIsiOS;
+  }
+  if (mobilization_user_agents_.Match(user_agent, false)) {
+    capabilities |= Classification::kSupportsMobilization;
+  }
+  classification->chrome_major_ = -1;
+  classification->chrome_minor_ = -1;
+  classification->chrome_build_ = -1;
+  classification->chrome_patch_ = -1;
+  if (GetChromeBuildNumber(user_agent, &classification->chrome_major_,
+                           &classification->chrome_minor_,
+                           &classification->chrome_build_,
+                           &classification->chrome_patch_)) {
+    capabilities |= Classification::kHasChromeBuildNumber;
+  }
+  classification->capabilities_ = capabilities;
+  classification->device_type_ = GetDeviceTypeForUA(user_agent);
+}
+
+bool UserAgentMatcher::Lookup(StringPiece user_agent,
+                              Classification* classification) const {
+  if (cache_shards_.empty()) {
+    return false;
+  }
+  const size_t hash =
+      HashString<CasePreserve, size_t>(user_agent.data(), user_agent.size());
+  CacheShard& shard = cache_shards_[hash % cache_shards_.size()];
+  {
+    ScopedMutex lock(shard.mutex.get());
+    auto iter = shard.index.find(hash);
+    if (iter != shard.index.end()) {
+      CacheEntry& entry = shard.entries[iter->second];
+      if (entry.user_agent == user_agent) {
+        entry.referenced = true;
+        *classification = entry.classification;
+        return true;
+      }
+    }
+  }
+  // Classify outside the lock; if two threads race on the same new user
+  // agent, they'll both compute the same answer.
+  ClassifyUncached(user_agent, classification);
+  ScopedMutex lock(shard.mutex.get());
+  InsertLockHeld(user_agent, hash, *classification, &shard);
+  return true;
+}
+
+void UserAgentMatcher::InsertLockHeld(StringPiece user_agent, size_t hash,
+                                      const Classification& classification,
+                                      CacheShard* shard) const {
+  size_t slot;
+  auto iter = shard->index.find(hash);
+  if (iter != shard->index.end()) {
+    // A racing thread got here first, or another user agent with the same
+    // hash is in the way; either way, reuse its entry.
+    slot = iter->second;
+  } else if (shard->entries.size() < max_entries_per_shard_) {
+    slot = shard->entries.size();
+    shard->entries.emplace_back();
+    shard->index[hash] = slot;
+  } else {
+    // Terminates within two sweeps, as the first clears every bit.
+    while (shard->entries[shard->clock_hand].referenced) {
+      shard->entries[shard->clock_hand].referenced = false;
+      shard->clock_hand = (shard->clock_hand + 1) % shard->entries.size();
+    }
+    slot = shard->clock_hand;
+    shard->clock_hand = (shard->clock_hand + 1) % shard->entries.size();
+    shard->index.erase(shard->entries[slot].hash);
+    shard->index[hash] = slot;
+  }
+  CacheEntry& entry = shard->entries[slot];
+  user_agent.CopyToString(&entry.user_agent);
+  entry.hash = hash;
+  entry.referenced = false;
+  entry.classification = classification;
+}
+
 bool UserAgentMatcher::IsIe(const StringPiece& user_agent) const {
+  Classification classification;
+  if (Lookup(user_agent, &classification)) {
+    return classification.IsIe();
+  }
   return ie_user_agents_.Match(user_agent, false);
 }
 
@@ -393,6 +568,8 @@ bool UserAgentMatcher::IsIe9(const StringPiece& user_agent) const {
   return user_agent.find(" MSIE 9.") != GoogleString::npos;
 }
 
+// The virtual methods below don't consult the cache: ClassifyUncached calls
+// them to fill it in.
 bool UserAgentMatcher::SupportsImageInlining(
     const StringPiece& user_agent) const {
   if (user_agent.empty()) {
@@ -402,16 +579,28 @@ bool UserAgentMatcher::SupportsImageInlining(
 }
 
 bool UserAgentMatcher::SupportsLazyloadImages(StringPiece user_agent) const {
+  Classification classification;
+  if (Lookup(user_agent, &classification)) {
+    return classification.SupportsLazyloadImages();
+  }
   return supports_lazyload_images_.Match(user_agent, true);
 }
 
 bool UserAgentMatcher::SupportsDnsPrefetch(
     const StringPiece& user_agent) const {
+  Classification classification;
+  if (Lookup(user_agent, &classification)) {
+    return classification.SupportsDnsPrefetch();
+  }
   return supports_dns_prefetch_.Match(user_agent, false);
 }
 
 bool UserAgentMatcher::SupportsJsDefer(const StringPiece& user_agent,
                                        bool allow_mobile) const {
+  Classification classification;
+  if (Lookup(user_agent, &classification)) {
+    return classification.SupportsJsDefer(allow_mobile);
+  }
   // TODO(ksimbili): Use IsMobileRequest?
   if (GetDeviceTypeForUA(user_agent) != kDesktop) {
     // TODO(ksimbili): IsMobileUserAgent returns true for tablets too.
@@ -422,16 +611,28 @@ bool UserAgentMatcher::SupportsJsDefer(const StringPiece& user_agent,
 }
 
 bool UserAgentMatcher::LegacyWebp(const StringPiece& user_agent) const {
+  Classification classification;
+  if (Lookup(user_agent, &classification)) {
+    return classification.LegacyWebp();
+  }
   return legacy_webp_.Match(user_agent, false);
 }
 
 bool UserAgentMatcher::SupportsWebpLosslessAlpha(
     const StringPiece& user_agent) const {
+  Classification classification;
+  if (Lookup(user_agent, &classification)) {
+    return classification.SupportsWebpLosslessAlpha();
+  }
   return supports_webp_lossless_alpha_.Match(user_agent, false);
 }
 
 bool UserAgentMatcher::SupportsWebpAnimated(
     const StringPiece& user_agent) const {
+  Classification classification;
+  if (Lookup(user_agent, &classification)) {
+    return classification.SupportsWebpAnimated();
+  }
   return supports_webp_animated_.Match(user_agent, false);
 }
 
@@ -559,6 +760,10 @@ bool UserAgentMatcher::UserAgentExceedsChromeBuildAndPatch(
 }
 
 bool UserAgentMatcher::SupportsMobilization(StringPiece user_agent) const {
+  Classification classification;
+  if (Lookup(user_agent, &classification)) {
+    return classification.SupportsMobilization();
+  }
   return mobilization_user_agents_.Match(user_agent, false);
 }
 
@@ -21,8 +21,11 @@
 #define PAGESPEED_KERNEL_HTTP_USER_AGENT_MATCHER_H_
 
 #include <map>
+#include <unordered_map>
 #include <utility>
+#include <vector>
 
+#include "pagespeed/kernel/base/abstract_mutex.h"
 #include "pagespeed/kernel/base/basictypes.h"
 #include "pagespeed/kernel/base/fast_wildcard_group.h"
 #include "pagespeed/kernel/base/scoped_ptr.h"
@@ -37,6 +40,7 @@ using std::pair;
 namespace net_instaweb {
 
 class RequestHeaders;
+class ThreadSystem;
 
 // This class contains various user agent based checks.  Currently all of these
 // are based on simple wildcard based allow- and blocked-lists.
@@ -60,9 +64,86 @@ class UserAgentMatcher {
     kEndOfDeviceType
   };
 
+  // Default number of user agents whose classification is cached by
+  // EnableClassificationCache.  Real traffic has a few thousand distinct user
+  // agent strings.
+  static const int kDefaultClassificationCacheSize = 4096;
+
+  // Everything the matcher knows about one user agent string, found in a
+  // single pass over all the matchers.  Code that asks several questions
+  // about the same user agent, like DeviceProperties does for a request,
+  // should get one of these from Classify() and ask it instead.
+  class Classification {
+   public:
+    Classification();
+
+    bool IsIe() const { return Has(kIsIe); }
+    bool SupportsImageInlining() const { return Has(kSupportsImageInlining); }
+    bool SupportsLazyloadImages() const {
+      return Has(kSupportsLazyloadImages);
+    }
+    bool SupportsJsDefer(bool allow_mobile) const;
+    bool LegacyWebp() const { return Has(kLegacyWebp); }
+    bool SupportsWebpLosslessAlpha() const {
+      return Has(kSupportsWebpLosslessAlpha);
+    }
+    bool SupportsWebpAnimated() const { return Has(kSupportsWebpAnimated); }
+    bool SupportsDnsPrefetch() const { return Has(kSupportsDnsPrefetch); }
+    bool IsAndroidUserAgent() const { return Has(kIsAndroid); }
+    bool IsiOSUserAgent() const { return Has(kIsiOS); }
+    bool SupportsMobilization() const { return Has(kSupportsMobilization); }
+    DeviceType device_type() const { return device_type_; }
+    bool GetChromeBuildNumber(int* major, int* minor, int* build,
+                              int* patch) const;
+
+   private:
+    friend class UserAgentMatcher;
+
+    // Bits in capabilities_.
+    enum Capability {
+      kIsIe = 1 << 0,
+      kSupportsImageInlining = 1 << 1,
+      kSupportsLazyloadImages = 1 << 2,
+      kDeferJsAllowed = 1 << 3,
+      kDeferJsMobileAllowed = 1 << 4,
+      kLegacyWebp = 1 << 5,
+      kSupportsWebpLosslessAlpha = 1 << 6,
+      kSupportsWebpAnimated = 1 << 7,
+      kSupportsDnsPrefetch = 1 << 8,
+      kIsAndroid = 1 << 9,
+      kIsiOS = 1 << 10,
+      kSupportsMobilization = 1 << 11,
+      kHasChromeBuildNumber = 1 << 12,
+    };
+
+    bool Has(Capability capability) const {
+      return (capabilities_ & capability) != 0;
+    }
+
+    uint32 capabilities_;
+    DeviceType device_type_;
+    int chrome_major_;
+    int chrome_minor_;
+    int chrome_build_;
+    int chrome_patch_;
+  };
+
   UserAgentMatcher();
   virtual ~UserAgentMatcher();
 
+  // Caches the result of classifying up to max_entries user agent strings,
+  // so that each distinct user agent is run through the wildcard and regex
+  // matchers only once, in a single pass that answers every question below;
+  // after that each question is a hash lookup.  Must be called before the
+  // matcher is shared between threads.
+  void EnableClassificationCache(ThreadSystem* thread_system, int max_entries);
+
+  // Answers every question about user_agent at once, from the
+  // classification cache if it is enabled.  The answers that have virtual
+  // methods below come from those methods, so overrides are honored; since
+  // they may be cached, overrides must depend only on the user agent.
+  void Classify(StringPiece user_agent, Classification* classification) const;
+
   // Before calling IsIe, ask if you're doing the right thing: are you doing
   // something that will mess up IE 11 in standards mode?  Are you in a position
   // where you can't tell what compatibility mode IE 11 is in?  Right now we use
@@ -139,6 +220,42 @@ class UserAgentMatcher {
   bool SupportsMobilization(StringPiece user_agent) const;
 
  private:
+  // One shard of the classification cache, keyed by hash of the user agent.
+  // We keep the user agent itself to detect collisions.  When a shard fills
+  // up, an entry is evicted with the CLOCK algorithm: the hand sweeps over
+  // entries, sparing (and clearing the bit of) each one used since it last
+  // passed, and evicts the first one that wasn't.
+  struct CacheEntry {
+    GoogleString user_agent;
+    size_t hash;
+    bool referenced;
+    Classification classification;
+  };
+  struct CacheShard {
+    CacheShard() : clock_hand(0) {}
+
+    std::unique_ptr<AbstractMutex> mutex;
+    std::vector<CacheEntry> entries;
+    // Maps a user agent's hash to its index in entries.
+    std::unordered_map<size_t, size_t> index;
+    size_t clock_hand;
+  };
+
+  // Runs all the matchers over user_agent, calling the virtual methods for
+  // the answers they provide.
+  void ClassifyUncached(StringPiece user_agent,
+                        Classification* classification) const;
+
+  // Adds a classification to shard, evicting an entry if it is full.
+  void InsertLockHeld(StringPiece user_agent, size_t hash,
+                      const Classification& classification,
+                      CacheShard* shard) const;
+
+  // If the classification cache is enabled, fills in *classification (from
+  // the cache if possible) and returns true; otherwise returns false, and the
+  // caller should answer its question directly.
+  bool Lookup(StringPiece user_agent, Classification* classification) const;
+
   FastWildcardGroup supports_image_inlining_;
   FastWildcardGroup supports_lazyload_images_;
   FastWildcardGroup defer_js_allowlist_;
@@ -156,6 +273,10 @@ class UserAgentMatcher {
   std::unique_ptr<RE2> known_devices_pattern_;
   mutable map<GoogleString, pair<int, int> > screen_dimensions_map_;
 
+  // Empty unless the cache is enabled.
+  mutable std::vector<CacheShard> cache_shards_;
+  size_t max_entries_per_shard_;
+
   DISALLOW_COPY_AND_ASSIGN(UserAgentMatcher);
 };
 
@@ -22,7 +22,9 @@
 #include <algorithm>
 #include <cmath>
 #include <cstdlib>
+#include <cstring>
 #include <memory>
+#include <vector>
 
 #include "base/logging.h"
 #include "pagespeed/kernel/base/message_handler.h"
@@ -52,6 +54,10 @@ const float kHistogramThreshold = 0.01;
 // or a completely opaque alpha channel.
 const float kPhotoMetricThreshold = 16;
 
+// Number of consecutive rows in each of the bands that IsPhoto() analyzes
+// when an image is too large to analyze in full.
+const int kPhotoSampleBandRows = 32;
+
 template <class T>
 inline T AbsDif(T v1, T v2) {
   return (v1 >= v2 ? v1 - v2 : v2 - v1);
@@ -61,88 +67,173 @@ inline T AbsDif(T v1, T v2) {
 
 namespace image_compression {
 
-// Compute the gradient by Sobel filter. The kernels in the x and y
+namespace {
+
+// Computes the luminance of one row of pixels, which is the gray value
+// itself, or the sum of the red, green, and blue channels. Each channel count
+// has its own loop, with a constant stride, so that the compiler can
+// vectorize it.
+void ComputeLuminance(const uint8_t* pixels, int width, int num_channels,
+                      int32_t* luminance) {
+  switch (num_channels) {
+    case 1:
+      for (int x = 0; x < width; ++x) {
+        luminance[x] = pixels[x];
+      }
+      break;
+    case 3:
+      for (int x = 0; x < width; ++x) {
+        luminance[x] = static_cast<int32_t>(pixels[3 * x]) +
+                       static_cast<int32_t>(pixels[3 * x + 1]) +
+                       static_cast<int32_t>(pixels[3 * x + 2]);
+      }
+      break;
+    default:
+      for (int x = 0; x < width; ++x) {
+        luminance[x] = static_cast<int32_t>(pixels[4 * x]) +
+                       static_cast<int32_t>(pixels[4 * x + 1]) +
+                       static_cast<int32_t>(pixels[4 * x + 2]);
+      }
+      break;
+  }
+}
+
+// Computes the gradient of one row by Sobel filter, from the luminance of the
+// row and of the rows above and below it. The kernels in the x and y
 // directions, respectively, are given by:
 //   [  1  2  1 ]        [ 1 0 -1 ]
 //   [  0  0  0 ]        [ 2 0 -2 ]
 //   [ -1 -2 -1 ]        [ 1 0 -1 ]
-template <class T>
-void ComputeGradientFromLuminance(const T* luminance, int width, int height,
-                                  int elements_per_line, float norm_factor,
-                                  uint8_t* gradient) {
-  memset(gradient, 0, width * height * sizeof(gradient[0]));
-  norm_factor *= 0.25;  // Remove the magnification factor of Sobel filter (4).
-  for (int y = 1; y < height - 1; ++y) {
-    int in_idx = y * elements_per_line + 1;
-    int out_idx = y * width + 1;
-    for (int x = 1; x < width - 1; ++x, ++in_idx, ++out_idx) {
-      int32_t dif_y =
-          static_cast<int32_t>(luminance[in_idx - elements_per_line - 1]) +
-          (static_cast<int32_t>(luminance[in_idx - elements_per_line]) << 1) +
-          static_cast<int32_t>(luminance[in_idx - elements_per_line + 1]) -
-          static_cast<int32_t>(luminance[in_idx + elements_per_line - 1]) -
-          (static_cast<int32_t>(luminance[in_idx + elements_per_line]) << 1) -
-          static_cast<int32_t>(luminance[in_idx + elements_per_line + 1]);
-
-      int32_t dif_x =
-          static_cast<int32_t>(luminance[in_idx - 1 - elements_per_line]) +
-          (static_cast<int32_t>(luminance[in_idx - 1]) << 1) +
-          static_cast<int32_t>(luminance[in_idx - 1 + elements_per_line]) -
-          static_cast<int32_t>(luminance[in_idx + 1 - elements_per_line]) -
-          (static_cast<int32_t>(luminance[in_idx + 1]) << 1) -
-          static_cast<int32_t>(luminance[in_idx + 1 + elements_per_line]);
-
-      // The results of "dif_x * dif_x + dif_y * dif_y" will not overflow
-      // because the data in dif_x and dif_y have at most 12 bits.
-      float dif2 = static_cast<float>(dif_x * dif_x + dif_y * dif_y);
-      float dif = std::sqrt(dif2) * norm_factor + 0.5f;
-      gradient[out_idx] = static_cast<uint8_t>(std::min(255.0f, dif));
-    }
+// The first and last pixels of the row are set to zero. The squared magnitudes
+// are computed in a separate pass from the square roots, so that the integer
+// arithmetic, which dominates, can be vectorized.
+void ComputeGradientRow(const int32_t* above, const int32_t* row,
+                        const int32_t* below, int width, float norm_factor,
+                        int32_t* magnitude2, uint8_t* gradient) {
+  for (int x = 1; x < width - 1; ++x) {
+    const int32_t dif_y = above[x - 1] + (above[x] << 1) + above[x + 1] -
+                          below[x - 1] - (below[x] << 1) - below[x + 1];
+    const int32_t dif_x = above[x - 1] + (row[x - 1] << 1) + below[x - 1] -
+                          above[x + 1] - (row[x + 1] << 1) - below[x + 1];
+    // The results will not overflow because dif_x and dif_y have at most
+    // 12 bits.
+    magnitude2[x] = dif_x * dif_x + dif_y * dif_y;
   }
-}
 
-bool SobelGradient(const uint8_t* image, int width, int height,
-                   int bytes_per_line, PixelFormat pixel_format,
-                   MessageHandler* handler, uint8_t* gradient) {
-  if (width < 3 || height < 3 ||
-      (pixel_format != GRAY_8 && pixel_format != RGB_888 &&
-       pixel_format != RGBA_8888)) {
-    return false;
+  gradient[0] = 0;
+  for (int x = 1; x < width - 1; ++x) {
+    float dif =
+        std::sqrt(static_cast<float>(magnitude2[x])) * norm_factor + 0.5f;
+    gradient[x] = static_cast<uint8_t>(std::min(255.0f, dif));
   }
+  gradient[width - 1] = 0;
+}
 
-  if (pixel_format == GRAY_8) {
-    const float norm_factor = 1.0f;
-    ComputeGradientFromLuminance(image, width, height, bytes_per_line,
-                                 norm_factor, gradient);
-  } else {
-    int32_t* luminance =
-        static_cast<int32_t*>(malloc(width * height * sizeof(int32_t)));
-    if (luminance == nullptr) {
+// Computes the Sobel gradient of an image one row at a time, keeping only the
+// luminance of the last three rows. This lets the image be analyzed while it
+// is being decoded, without copying it.
+class RowGradient {
+ public:
+  RowGradient(int width, PixelFormat pixel_format, MessageHandler* handler)
+      : width_(width),
+        num_channels_(GetNumChannelsFromPixelFormat(pixel_format, handler)),
+        // Remove the magnification factor of Sobel filter (4), and for color
+        // images the factor from adding up the channels (3).
+        norm_factor_((num_channels_ == 1 ? 1.0f : 1.0f / 3.0f) * 0.25f),
+        luminance_(3 * width),
+        magnitude2_(width),
+        num_rows_(0) {}
+
+  // Forgets the previous rows, so that the next row is treated as the top of
+  // the image.
+  void Restart() { num_rows_ = 0; }
+
+  // Adds the next row of pixels. Once there are three rows, computes the
+  // gradient of the middle one into "gradient" and returns true.
+  bool AddRow(const uint8_t* pixels, uint8_t* gradient) {
+    ComputeLuminance(pixels, width_, num_channels_, Luminance(num_rows_));
+    ++num_rows_;
+    if (num_rows_ < 3) {
       return false;
     }
+    ComputeGradientRow(Luminance(num_rows_ - 3), Luminance(num_rows_ - 2),
+                       Luminance(num_rows_ - 1), width_, norm_factor_,
+                       &magnitude2_[0], gradient);
+    return true;
+  }
 
-    const int num_channels =
-        GetNumChannelsFromPixelFormat(pixel_format, handler);
+ private:
+  int32_t* Luminance(int row) { return &luminance_[(row % 3) * width_]; }
+
+  const int width_;
+  const int num_channels_;
+  const float norm_factor_;
+  std::vector<int32_t> luminance_;
+  std::vector<int32_t> magnitude2_;
+  int num_rows_;
+
+  DISALLOW_COPY_AND_ASSIGN(RowGradient);
+};
+
+// Histogram with integer bins. Consecutive pixels are often in the same bin,
+// so they are counted in alternating copies of the histogram, which lets the
+// increments run without waiting for each other; the copies are added up
+// by Get().
+class IntHistogram {
+ public:
+  static const int kNumCopies = 4;
+
+  IntHistogram() { memset(bins_, 0, sizeof(bins_)); }
+
+  void Add(const uint8_t* values, int num_values) {
+    int i = 0;
+    for (; i + kNumCopies <= num_values; i += kNumCopies) {
+      ++bins_[0][values[i]];
+      ++bins_[1][values[i + 1]];
+      ++bins_[2][values[i + 2]];
+      ++bins_[3][values[i + 3]];
+    }
+    for (; i < num_values; ++i) {
+      ++bins_[0][values[i]];
+    }
+  }
 
-    // Compute the luminance which is simply the average of R, G, and B
-    // after applying the normalization factor.
-    int32_t* out_pixel = luminance;
-    for (int y = 0; y < height; ++y) {
-      const uint8_t* in_channel = image + y * bytes_per_line;
-      for (int x = 0; x < width; ++x) {
-        *out_pixel = static_cast<int32_t>(in_channel[0]) +
-                     static_cast<int32_t>(in_channel[1]) +
-                     static_cast<int32_t>(in_channel[2]);
-        ++out_pixel;
-        in_channel += num_channels;
-      }
+  void Get(float* hist) const {
+    for (int i = 0; i < kNumColorHistogramBins; ++i) {
+      hist[i] = static_cast<float>(bins_[0][i] + bins_[1][i] + bins_[2][i] +
+                                   bins_[3][i]);
     }
+  }
+
+ private:
+  uint32_t bins_[kNumCopies][kNumColorHistogramBins];
+
+  DISALLOW_COPY_AND_ASSIGN(IntHistogram);
+};
+
+bool IsSupportedForGradient(int width, int height, PixelFormat pixel_format) {
+  return width >= 3 && height >= 3 &&
+         (pixel_format == GRAY_8 || pixel_format == RGB_888 ||
+          pixel_format == RGBA_8888);
+}
+
+}  // namespace
+
+bool SobelGradient(const uint8_t* image, int width, int height,
+                   int bytes_per_line, PixelFormat pixel_format,
+                   MessageHandler* handler, uint8_t* gradient) {
+  if (!IsSupportedForGradient(width, height, pixel_format)) {
+    return false;
+  }
 
-    const float norm_factor = 1.0f / 3.0f;
-    ComputeGradientFromLuminance(luminance, width, height, width, norm_factor,
-                                 gradient);
-    free(luminance);
+  // Each row of the image completes the gradient of the row above it.
+  memset(gradient, 0, width * sizeof(gradient[0]));
+  RowGradient row_gradient(width, pixel_format, handler);
+  for (int y = 0; y < height; ++y) {
+    row_gradient.AddRow(image + y * bytes_per_line,
+                        gradient + std::max(y - 1, 0) * width);
   }
+  memset(gradient + (height - 1) * width, 0, width * sizeof(gradient[0]));
   return true;
 }
 
@@ -150,20 +241,12 @@ void Histogram(const uint8_t* image, int width, int height, int bytes_per_line,
                int x0, int y0, float* hist) {
   DCHECK(bytes_per_line >= width);
 
-  uint32_t hist_int[kNumColorHistogramBins];
-  memset(hist_int, 0, kNumColorHistogramBins * sizeof(hist_int[0]));
-
   // Aggregate the histogram.
+  IntHistogram hist_int;
   for (int y = y0; y < y0 + height; ++y) {
-    int i = y * bytes_per_line + x0;
-    for (int x = 0; x < width; ++x, ++i) {
-      ++hist_int[image[i]];
-    }
-  }
-
-  for (int i = 0; i < kNumColorHistogramBins; ++i) {
-    hist[i] = static_cast<float>(hist_int[i]);
+    hist_int.Add(image + y * bytes_per_line + x0, width);
   }
+  hist_int.Get(hist);
 }
 
 float WidestPeakWidth(const float* hist, float threshold) {
@@ -197,27 +280,33 @@ float PhotoMetric(const uint8_t* image, int width, int height,
                   MessageHandler* handler) {
   const float KMinMetric = 0;
 
-  uint8_t* gradient =
-      static_cast<uint8_t*>(malloc(width * height * sizeof(uint8_t)));
-  if (gradient == nullptr) {
-    return KMinMetric;
-  }
-
-  if (!SobelGradient(image, width, height, bytes_per_line, pixel_format,
-                     handler, gradient)) {
+  if (!IsSupportedForGradient(width, height, pixel_format)) {
     // Conservatively assume that the image is computer generated graphics if we
     // cannot compute its gradient.
-    free(gradient);
     return KMinMetric;
   }
 
+  // The histogram excludes the gradient of the border pixels, which is zero.
+  RowGradient row_gradient(width, pixel_format, handler);
+  std::vector<uint8_t> gradient(width);
+  IntHistogram hist_int;
+  for (int y = 0; y < height; ++y) {
+    if (row_gradient.AddRow(image + y * bytes_per_line, &gradient[0])) {
+      hist_int.Add(&gradient[1], width - 2);
+    }
+  }
+
   float hist[kNumColorHistogramBins];
-  Histogram(gradient, width - 2, height - 2, width, 1, 1, hist);
-  free(gradient);
+  hist_int.Get(hist);
   return WidestPeakWidth(hist, threshold);
 }
 
 bool IsPhoto(ScanlineReaderInterface* reader, MessageHandler* handler) {
+  return IsPhoto(reader, kIsPhotoMaxAnalyzedPixels, handler);
+}
+
+bool IsPhoto(ScanlineReaderInterface* reader, int64 max_analyzed_pixels,
+             MessageHandler* handler) {
   // Pretend that the image is not a photo if we cannot process it.
   bool kDefaultReturnValue = false;
 
@@ -233,29 +322,51 @@ bool IsPhoto(ScanlineReaderInterface* reader, MessageHandler* handler) {
   const int width = reader->GetImageWidth();
   const int height = reader->GetImageHeight();
   const PixelFormat pixel_format = reader->GetPixelFormat();
-  const int bytes_per_line =
-      width * GetNumChannelsFromPixelFormat(pixel_format, handler);
-
-  uint8_t* image =
-      static_cast<uint8_t*>(malloc(bytes_per_line * height * sizeof(uint8_t)));
-  if (image == nullptr) {
+  if (!IsSupportedForGradient(width, height, pixel_format)) {
     return kDefaultReturnValue;
   }
 
+  // For a large image, only bands of kPhotoSampleBandRows rows, spread evenly
+  // over the image, are analyzed. Every row still has to be decoded, but the
+  // gradient is only computed for about max_analyzed_pixels pixels. Since the
+  // metric only depends on the shape of the histogram, not on its total, the
+  // decisions match those for the full image except for images that are
+  // right at the threshold.
+  const int64 num_pixels = static_cast<int64>(width) * height;
+  const bool sample = (max_analyzed_pixels > 0 &&
+                       num_pixels > max_analyzed_pixels);
+  int band_spacing = height;
+  if (sample) {
+    band_spacing = std::min<int64>(
+        height, kPhotoSampleBandRows * num_pixels / max_analyzed_pixels);
+  }
+
+  RowGradient row_gradient(width, pixel_format, handler);
+  std::vector<uint8_t> gradient(width);
+  IntHistogram hist_int;
   for (int y = 0; y < height; ++y) {
     uint8_t* scanline = nullptr;
     if (!reader->HasMoreScanLines() ||
         !reader->ReadNextScanline(reinterpret_cast<void**>(&scanline))) {
-      free(image);
       return kDefaultReturnValue;
     }
-    memcpy(image + y * bytes_per_line, scanline, bytes_per_line);
+    if (sample) {
+      const int row_in_band = y % band_spacing;
+      if (row_in_band >= kPhotoSampleBandRows) {
+        continue;
+      }
+      if (row_in_band == 0) {
+        row_gradient.Restart();
+      }
+    }
+    if (row_gradient.AddRow(scanline, &gradient[0])) {
+      hist_int.Add(&gradient[1], width - 2);
+    }
   }
 
-  float metric = PhotoMetric(image, width, height, bytes_per_line, pixel_format,
-                             kHistogramThreshold, handler);
-  free(image);
-  return metric >= kPhotoMetricThreshold;
+  float hist[kNumColorHistogramBins];
+  hist_int.Get(hist);
+  return WidestPeakWidth(hist, kHistogramThreshold) >= kPhotoMetricThreshold;
 }
 
 bool AnalyzeImage(ImageFormat image_type, const void* image_buffer,
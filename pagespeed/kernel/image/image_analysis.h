@@ -77,11 +77,23 @@ float PhotoMetric(const uint8_t* image, int width, int height,
 // equal to (max(hist) * threshold).
 float WidestPeakWidth(const float* hist, float threshold);
 
+// Images with more pixels than this are sub-sampled by IsPhoto().
+const int64 kIsPhotoMaxAnalyzedPixels = 1 << 20;
+
 // Returns true if the image looks like a photo, or false if it looks like
 // computer generated graphics. The reader must be initialized with the image
-// to be processed.
+// to be processed. Images larger than kIsPhotoMaxAnalyzedPixels are
+// sub-sampled.
 bool IsPhoto(ScanlineReaderInterface* reader, MessageHandler* handler);
 
+// Like IsPhoto() above, but if the image has more than max_analyzed_pixels
+// pixels, only evenly spaced bands of rows which add up to about that many
+// pixels are analyzed. This gives the same answer as analyzing the whole
+// image, except for images which are very close to the threshold. The whole
+// image is analyzed if max_analyzed_pixels is 0.
+bool IsPhoto(ScanlineReaderInterface* reader, int64 max_analyzed_pixels,
+             MessageHandler* handler);
+
 // Return key information of the image. For the information which you do not
 // need, set the arguments to NULL so they will not be computed.
 //
@@ -236,6 +236,45 @@ ScanlineStatus JpegScanlineReader::InitializeWithStatus(const void* image_data,
   return ScanlineStatus(SCANLINE_STATUS_SUCCESS);
 }
 
+ScanlineStatus JpegScanlineReader::SetMinimumOutputSize(size_t min_width,
+                                                        size_t min_height) {
+  if (!was_initialized_ || row_ != 0) {
+    return PS_LOGGED_STATUS(PS_LOG_DFATAL, message_handler_,
+                            SCANLINE_STATUS_INVOCATION_ERROR,
+                            SCANLINE_JPEGREADER,
+                            "The reader was not initialized or has already "
+                            "started decoding.");
+  }
+
+  if (setjmp(jpeg_env_->jmp_buf_env_)) {
+    Reset();
+    return PS_LOGGED_STATUS(PS_LOG_INFO, message_handler_,
+                            SCANLINE_STATUS_INTERNAL_ERROR, SCANLINE_JPEGREADER,
+                            "libjpeg failed to compute the scaled size.");
+  }
+
+  // libjpeg rounds scaled dimensions up, and so do we.
+  jpeg_decompress_struct* jpeg_decompress = &(jpeg_env_->jpeg_decompress_);
+  const size_t image_width = jpeg_decompress->image_width;
+  const size_t image_height = jpeg_decompress->image_height;
+  unsigned int scale_denom = 1;
+  for (unsigned int denom = 8; denom > 1; denom /= 2) {
+    if ((image_width + denom - 1) / denom >= min_width &&
+        (image_height + denom - 1) / denom >= min_height) {
+      scale_denom = denom;
+      break;
+    }
+  }
+
+  jpeg_decompress->scale_num = 1;
+  jpeg_decompress->scale_denom = scale_denom;
+  jpeg_calc_output_dimensions(jpeg_decompress);
+  width_ = jpeg_decompress->output_width;
+  height_ = jpeg_decompress->output_height;
+  bytes_per_row_ = (pixel_format_ == GRAY_8 ? 1 : 3) * width_;
+  return ScanlineStatus(SCANLINE_STATUS_SUCCESS);
+}
+
 ScanlineStatus JpegScanlineReader::ReadNextScanlineWithStatus(
     void** out_scanline_bytes) {
   if (!was_initialized_ || !HasMoreScanLines()) {
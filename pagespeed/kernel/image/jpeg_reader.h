@@ -99,6 +99,16 @@ class JpegScanlineReader : public ScanlineReaderInterface {
   size_t GetImageWidth() override { return width_; }
   bool IsProgressive() override { return is_progressive_; }
 
+  // Asks libjpeg to decode the image at 1/2, 1/4 or 1/8 of its size, picking
+  // the smallest scale which is still at least min_width x min_height.
+  // Scaling in the DCT domain skips most of the inverse transform and color
+  // conversion work, so it is much cheaper than decoding at full size when
+  // the caller is going to shrink the image anyway. The dimensions returned
+  // by GetImageWidth() and GetImageHeight() change to the scaled ones. Does
+  // nothing if no smaller scale is large enough. Must be called after
+  // initialization and before the first scanline is read.
+  ScanlineStatus SetMinimumOutputSize(size_t min_width, size_t min_height);
+
  private:
   JpegEnv* jpeg_env_;              // State of libjpeg
   unsigned char* row_pointer_[1];  // Pointer for a row buffer
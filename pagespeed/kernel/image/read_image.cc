@@ -118,6 +118,22 @@ ScanlineReaderInterface* CreateScanlineReader(ImageFormat image_type,
   return status->Success() ? reader.release() : nullptr;
 }
 
+ScanlineReaderInterface* CreateScanlineReaderForSize(ImageFormat image_type,
+                                                     const void* image_buffer,
+                                                     size_t buffer_length,
+                                                     size_t min_width,
+                                                     size_t min_height,
+                                                     MessageHandler* handler) {
+  ScanlineStatus status;
+  std::unique_ptr<ScanlineReaderInterface> reader(CreateScanlineReader(
+      image_type, image_buffer, buffer_length, handler, &status));
+  if (reader != nullptr && image_type == IMAGE_JPEG) {
+    status = static_cast<JpegScanlineReader*>(reader.get())
+                 ->SetMinimumOutputSize(min_width, min_height);
+  }
+  return status.Success() ? reader.release() : nullptr;
+}
+
 // Forward declaration.
 MultipleFrameWriter* InstantiateImageFrameWriter(ImageFormat image_type,
                                                  MessageHandler* handler,
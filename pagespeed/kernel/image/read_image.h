@@ -65,6 +65,18 @@ inline ScanlineReaderInterface* CreateScanlineReader(ImageFormat image_type,
                               &status);
 }
 
+// Like CreateScanlineReader(), but for callers which only need the image to
+// be at least min_width x min_height, e.g., because they are going to shrink
+// it. Formats which can be decoded at reduced size more cheaply than at full
+// size (currently IMAGE_JPEG) return a reader for a smaller image which is
+// still at least that large. Other formats are read at full size.
+ScanlineReaderInterface* CreateScanlineReaderForSize(ImageFormat image_type,
+                                                     const void* image_buffer,
+                                                     size_t buffer_length,
+                                                     size_t min_width,
+                                                     size_t min_height,
+                                                     MessageHandler* handler);
+
 // Returns a scanline image writer. The following formats are
 // supported: IMAGE_PNG, IMAGE_JPEG, and IMAGE_WEBP. This function
 // also calls the InitWithStatus() and InitializeWriteWithStatus()
@@ -0,0 +1,193 @@
+/*
+ * Licensed to the Apache Software Foundation (ASF) under one
+ * or more contributor license agreements.  See the NOTICE file
+ * distributed with this work for additional information
+ * regarding copyright ownership.  The ASF licenses this file
+ * to you under the Apache License, Version 2.0 (the
+ * "License"); you may not use this file except in compliance
+ * with the License.  You may obtain a copy of the License at
+ * 
+ *   http://www.apache.org/licenses/LICENSE-2.0
+ * 
+ * Unless required by applicable law or agreed to in writing,
+ * software distributed under the License is distributed on an
+ * "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY
+ * KIND, either express or implied.  See the License for the
+ * specific language governing permissions and limitations
+ * under the License.
+ */
+
+#include "pagespeed/kernel/image/resampling_pyramid.h"
+
+#include <cstring>
+#include <memory>
+
+#include "pagespeed/kernel/base/message_handler.h"
+#include "pagespeed/kernel/image/scanline_status.h"
+
+namespace pagespeed {
+
+namespace image_compression {
+
+// Serves the scanlines of one level of the pyramid straight out of memory.
+class ResamplingPyramid::LevelReader : public ScanlineReaderInterface {
+ public:
+  LevelReader(const Level& level, size_t bytes_per_pixel,
+              PixelFormat pixel_format, bool is_progressive,
+              MessageHandler* handler)
+      : level_(level),
+        bytes_per_row_(level.width * bytes_per_pixel),
+        pixel_format_(pixel_format),
+        is_progressive_(is_progressive),
+        handler_(handler),
+        row_(0) {}
+  ~LevelReader() override {}
+
+  bool Reset() override {
+    row_ = 0;
+    return true;
+  }
+
+  size_t GetBytesPerScanline() override { return bytes_per_row_; }
+
+  bool HasMoreScanLines() override { return row_ < level_.height; }
+
+  ScanlineStatus InitializeWithStatus(const void* image_buffer,
+                                      size_t buffer_length) override {
+    return PS_LOGGED_STATUS(PS_LOG_DFATAL, handler_,
+                            SCANLINE_STATUS_INVOCATION_ERROR, SCANLINE_UTIL,
+                            "unexpected call to InitializeWithStatus()");
+  }
+
+  ScanlineStatus ReadNextScanlineWithStatus(
+      void** out_scanline_bytes) override {
+    if (!HasMoreScanLines()) {
+      return PS_LOGGED_STATUS(PS_LOG_DFATAL, handler_,
+                              SCANLINE_STATUS_INVOCATION_ERROR, SCANLINE_UTIL,
+                              "no more scanlines in the pyramid level");
+    }
+    // The consumer only reads the scanline, so handing out a pointer into
+    // the shared level is safe.
+    *out_scanline_bytes =
+        const_cast<char*>(level_.pixels.data() + row_ * bytes_per_row_);
+    ++row_;
+    return ScanlineStatus(SCANLINE_STATUS_SUCCESS);
+  }
+
+  size_t GetImageHeight() override { return level_.height; }
+  size_t GetImageWidth() override { return level_.width; }
+  PixelFormat GetPixelFormat() override { return pixel_format_; }
+  bool IsProgressive() override { return is_progressive_; }
+
+ private:
+  const Level& level_;
+  const size_t bytes_per_row_;
+  const PixelFormat pixel_format_;
+  const bool is_progressive_;
+  MessageHandler* handler_;
+  size_t row_;
+
+  DISALLOW_COPY_AND_ASSIGN(LevelReader);
+};
+
+ResamplingPyramid::ResamplingPyramid(PixelFormat pixel_format,
+                                     bool is_progressive)
+    : pixel_format_(pixel_format),
+      bytes_per_pixel_(GetBytesPerPixel(pixel_format)),
+      is_progressive_(is_progressive) {}
+
+ResamplingPyramid::~ResamplingPyramid() {}
+
+ResamplingPyramid* ResamplingPyramid::Create(ScanlineReaderInterface* reader,
+                                             MessageHandler* handler) {
+  const size_t width = reader->GetImageWidth();
+  const size_t height = reader->GetImageHeight();
+  if (width == 0 || height == 0) {
+    return nullptr;
+  }
+  std::unique_ptr<ResamplingPyramid> pyramid(
+      new ResamplingPyramid(reader->GetPixelFormat(), reader->IsProgressive()));
+  const size_t bytes_per_row = width * pyramid->bytes_per_pixel_;
+  if (pyramid->bytes_per_pixel_ == 0 ||
+      reader->GetBytesPerScanline() < bytes_per_row) {
+    PS_LOG_INFO(handler, "Cannot build a pyramid for pixel format %s.",
+                GetPixelFormatString(pyramid->pixel_format_));
+    return nullptr;
+  }
+
+  pyramid->levels_.resize(1);
+  Level* level = &pyramid->levels_[0];
+  level->width = width;
+  level->height = height;
+  level->pixels.resize(bytes_per_row * height);
+  char* out = &level->pixels[0];
+  for (size_t row = 0; row < height; ++row) {
+    void* scanline = nullptr;
+    if (!reader->HasMoreScanLines() || !reader->ReadNextScanline(&scanline)) {
+      PS_LOG_INFO(handler, "Failed to read row %zu of %zu.", row, height);
+      return nullptr;
+    }
+    memcpy(out, scanline, bytes_per_row);
+    out += bytes_per_row;
+  }
+
+  while (pyramid->levels_.back().width > 1 &&
+         pyramid->levels_.back().height > 1) {
+    pyramid->AddHalvedLevel();
+  }
+  return pyramid.release();
+}
+
+void ResamplingPyramid::AddHalvedLevel() {
+  levels_.resize(levels_.size() + 1);
+  const Level& in = levels_[levels_.size() - 2];
+  Level* out = &levels_.back();
+  out->width = (in.width + 1) / 2;
+  out->height = (in.height + 1) / 2;
+  out->pixels.resize(out->width * out->height * bytes_per_pixel_);
+
+  const size_t in_row_bytes = in.width * bytes_per_pixel_;
+  const uint8* in_pixels = reinterpret_cast<const uint8*>(in.pixels.data());
+  uint8* out_pixels = reinterpret_cast<uint8*>(&out->pixels[0]);
+  for (size_t y = 0; y < out->height; ++y) {
+    const uint8* row0 = in_pixels + 2 * y * in_row_bytes;
+    // With an odd number of rows the last output row only covers one.
+    const bool has_row1 = (2 * y + 1 < in.height);
+    const uint8* row1 = has_row1 ? row0 + in_row_bytes : row0;
+    for (size_t x = 0; x < out->width; ++x) {
+      const size_t x0 = 2 * x * bytes_per_pixel_;
+      const bool has_col1 = (2 * x + 1 < in.width);
+      const size_t x1 = has_col1 ? x0 + bytes_per_pixel_ : x0;
+      for (size_t c = 0; c < bytes_per_pixel_; ++c) {
+        // Duplicated edge pixels carry the same weight as the others, which
+        // is what averaging over just the pixels that exist works out to.
+        const int sum = row0[x0 + c] + row0[x1 + c] + row1[x0 + c] +
+                        row1[x1 + c];
+        *out_pixels++ = static_cast<uint8>((sum + 2) / 4);
+      }
+    }
+  }
+}
+
+ScanlineReaderInterface* ResamplingPyramid::NewReader(
+    size_t min_width, size_t min_height, MessageHandler* handler) const {
+  size_t i = 0;
+  while (i + 1 < levels_.size() && levels_[i + 1].width >= min_width &&
+         levels_[i + 1].height >= min_height) {
+    ++i;
+  }
+  return new LevelReader(levels_[i], bytes_per_pixel_, pixel_format_,
+                         is_progressive_, handler);
+}
+
+size_t ResamplingPyramid::MemoryUsage() const {
+  size_t bytes = 0;
+  for (const Level& level : levels_) {
+    bytes += level.pixels.size();
+  }
+  return bytes;
+}
+
+}  // namespace image_compression
+
+}  // namespace pagespeed
@@ -0,0 +1,95 @@
+/*
+ * Licensed to the Apache Software Foundation (ASF) under one
+ * or more contributor license agreements.  See the NOTICE file
+ * distributed with this work for additional information
+ * regarding copyright ownership.  The ASF licenses this file
+ * to you under the Apache License, Version 2.0 (the
+ * "License"); you may not use this file except in compliance
+ * with the License.  You may obtain a copy of the License at
+ * 
+ *   http://www.apache.org/licenses/LICENSE-2.0
+ * 
+ * Unless required by applicable law or agreed to in writing,
+ * software distributed under the License is distributed on an
+ * "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY
+ * KIND, either express or implied.  See the License for the
+ * specific language governing permissions and limitations
+ * under the License.
+ */
+
+#ifndef PAGESPEED_KERNEL_IMAGE_RESAMPLING_PYRAMID_H_
+#define PAGESPEED_KERNEL_IMAGE_RESAMPLING_PYRAMID_H_
+
+#include <cstddef>
+#include <vector>
+
+#include "pagespeed/kernel/base/basictypes.h"
+#include "pagespeed/kernel/base/message_handler.h"
+#include "pagespeed/kernel/base/string.h"
+#include "pagespeed/kernel/image/image_util.h"
+#include "pagespeed/kernel/image/scanline_interface.h"
+
+namespace pagespeed {
+
+namespace image_compression {
+
+using net_instaweb::MessageHandler;
+
+// A decoded image together with copies of it at half, quarter, ... the size,
+// each computed by averaging 2x2 blocks of the level above. This lets one
+// decode serve requests for many output sizes: each size is produced by
+// running ScanlineResizer over the smallest level that is at least as large,
+// rather than over a fresh decode of the original.
+//
+// A ResamplingPyramid is immutable once created, so any number of readers may
+// use it concurrently.
+class ResamplingPyramid {
+ public:
+  // Reads every scanline from reader, which must be initialized, and builds
+  // the smaller levels. Returns nullptr if reading fails.
+  static ResamplingPyramid* Create(ScanlineReaderInterface* reader,
+                                   MessageHandler* handler);
+  ~ResamplingPyramid();
+
+  size_t width() const { return levels_[0].width; }
+  size_t height() const { return levels_[0].height; }
+  PixelFormat pixel_format() const { return pixel_format_; }
+  bool is_progressive() const { return is_progressive_; }
+  int num_levels() const { return levels_.size(); }
+
+  // Returns an initialized reader for the smallest level whose dimensions are
+  // both at least min_width x min_height; the full size image if there is
+  // none. The pyramid must outlive the reader.
+  ScanlineReaderInterface* NewReader(size_t min_width, size_t min_height,
+                                     MessageHandler* handler) const;
+
+  // Number of bytes of pixel data held, across all levels.
+  size_t MemoryUsage() const;
+
+ private:
+  struct Level {
+    size_t width;
+    size_t height;
+    GoogleString pixels;  // Rows of width * bytes_per_pixel_ bytes.
+  };
+
+  class LevelReader;
+
+  ResamplingPyramid(PixelFormat pixel_format, bool is_progressive);
+
+  // Appends a level half the size of the last one, rounding up.
+  void AddHalvedLevel();
+
+  const PixelFormat pixel_format_;
+  const size_t bytes_per_pixel_;
+  const bool is_progressive_;
+  std::vector<Level> levels_;
+
+  DISALLOW_COPY_AND_ASSIGN(ResamplingPyramid);
+};
+
+}  // namespace image_compression
+
+}  // namespace pagespeed
+
+#endif  // PAGESPEED_KERNEL_IMAGE_RESAMPLING_PYRAMID_H_
@@ -147,11 +147,14 @@
 
 #include "pagespeed/kernel/js/js_tokenizer.h"
 
+#include <algorithm>
 #include <cstddef>
+#include <cstring>
 #include <vector>
 
 #include "base/logging.h"
 //#include "strings/stringpiece_utils.h"
+#include "pagespeed/kernel/base/basictypes.h"
 #include "pagespeed/kernel/base/string.h"
 #include "pagespeed/kernel/base/string_util.h"
 #include "pagespeed/kernel/js/js_keywords.h"
@@ -301,6 +304,408 @@ const char* const kLineContinuationRegex =
     "(in|instanceof)($|[^$_\\p{Lu}\\p{Ll}\\p{Lt}\\p{Lm}\\p{Lo}\\p{Nl}\\p{Mn}"
     "\\p{Mc}\\p{Nd}\\p{Pc}\xE2\x80\x8C\xE2\x80\x8D\\\\])";
 
+// The RE2 patterns above are the reference definition of each kind of token,
+// but matching them is slow, and the tokenizer is very hot under load.  Since
+// most JS files are plain ASCII, the hand-written scanners below handle the
+// ASCII cases directly, driven by a per-byte character class table.  Each one
+// returns the length of the token at the start of its input, or 0 if the
+// corresponding pattern would not match there.  A scanner that runs into a
+// byte it doesn't handle (typically a non-ASCII byte) instead returns
+// kNeedsRegex, and the caller falls back to the RE2 pattern.  These scanners
+// must agree exactly with the patterns; js_tokenizer_test.cc checks this.
+const int kNeedsRegex = -1;
+
+enum CharClass {
+  kIdentStartClass = 1 << 0,  // [A-Za-z$_\\]
+  kIdentPartClass = 1 << 1,   // [A-Za-z0-9$_\\]
+  kWordClass = 1 << 2,        // [A-Za-z0-9$_]
+  kDigitClass = 1 << 3,       // [0-9]
+  kHexDigitClass = 1 << 4,    // [0-9A-Fa-f]
+  kOctalDigitClass = 1 << 5,  // [0-7]
+  kSpaceClass = 1 << 6,       // [ \t\f\v]
+  kLinebreakClass = 1 << 7,   // [\r\n]
+};
+
+struct CharClassTable {
+  unsigned char classes[256];
+};
+
+constexpr CharClassTable MakeCharClassTable() {
+  CharClassTable table = {};
+  for (int ch = 0; ch < 0x80; ++ch) {
+    const bool digit = ('0' <= ch && ch <= '9');
+    const bool alpha = ('a' <= ch && ch <= 'z') || ('A' <= ch && ch <= 'Z');
+    const bool word = alpha || digit || ch == '$' || ch == '_';
+    int classes = 0;
+    if (word) {
+      classes |= kWordClass | kIdentPartClass;
+      if (!digit) {
+        classes |= kIdentStartClass;
+      }
+    }
+    if (ch == '\\') {
+      classes |= kIdentStartClass | kIdentPartClass;
+    }
+    if (digit) {
+      classes |= kDigitClass | kHexDigitClass;
+      if (ch <= '7') {
+        classes |= kOctalDigitClass;
+      }
+    }
+    if (('a' <= ch && ch <= 'f') || ('A' <= ch && ch <= 'F')) {
+      classes |= kHexDigitClass;
+    }
+    if (ch == ' ' || ch == '\t' || ch == '\f' || ch == '\v') {
+      classes |= kSpaceClass;
+    }
+    if (ch == '\n' || ch == '\r') {
+      classes |= kLinebreakClass;
+    }
+    table.classes[ch] = classes;
+  }
+  // Bytes 0x80 and up belong to no class; callers check for them explicitly.
+  return table;
+}
+
+constexpr CharClassTable kCharClassTable = MakeCharClassTable();
+
+inline bool HasClass(char ch, int char_class) {
+  return (kCharClassTable.classes[static_cast<unsigned char>(ch)] &
+          char_class) != 0;
+}
+
+inline bool IsAscii(char ch) { return static_cast<unsigned char>(ch) < 0x80; }
+
+// Helpers for skipping over ordinary bytes eight at a time.  HasByte returns
+// nonzero iff any byte of word equals ch.
+const uint64 kLowBits = 0x0101010101010101ULL;
+const uint64 kHighBits = 0x8080808080808080ULL;
+const uint64 kEightSpaces = 0x2020202020202020ULL;
+
+inline uint64 LoadWord(const char* data) {
+  uint64 word;
+  memcpy(&word, data, sizeof(word));
+  return word;
+}
+
+inline uint64 HasByte(uint64 word, unsigned char ch) {
+  const uint64 diff = word ^ (kLowBits * ch);
+  return (diff - kLowBits) & ~diff & kHighBits;
+}
+
+// Returns the index of the first byte at or after index that is not in the
+// given character class.
+inline int SkipCharClass(const char* data, int size, int index,
+                         int char_class) {
+  while (index < size && HasClass(data[index], char_class)) {
+    ++index;
+  }
+  return index;
+}
+
+// True if data (of the given size) begins with a \uXXXX escape.
+inline bool IsUnicodeEscape(const char* data, int size) {
+  return (size >= 6 && data[0] == '\\' && data[1] == 'u' &&
+          HasClass(data[2], kHexDigitClass) &&
+          HasClass(data[3], kHexDigitClass) &&
+          HasClass(data[4], kHexDigitClass) &&
+          HasClass(data[5], kHexDigitClass));
+}
+
+// Matches a line comment, stopping before (and returning the length up to)
+// the linebreak that ends it, like kLineCommentRegex.  Never needs RE2: the
+// only non-ASCII linebreaks are U+2028 and U+2029, which we find bytewise.
+int ScanLineComment(StringPiece input) {
+  const char* data = input.data();
+  const int size = input.size();
+  int index = (data[0] == '/' ? 2 : data[0] == '<' ? 4 : 3);
+  while (true) {
+    while (index + 8 <= size) {
+      const uint64 word = LoadWord(data + index);
+      if ((HasByte(word, '\n') | HasByte(word, '\r') | HasByte(word, 0xE2)) !=
+          0) {
+        break;
+      }
+      index += 8;
+    }
+    if (index >= size) {
+      return size;
+    }
+    const char ch = data[index];
+    if (ch == '\n' || ch == '\r') {
+      return index;
+    }
+    if (ch == '\xE2' && index + 2 < size && data[index + 1] == '\x80' &&
+        (data[index + 2] == '\xA8' || data[index + 2] == '\xA9')) {
+      return index;
+    }
+    ++index;
+  }
+}
+
+// Matches kNumericLiteralPosixRegex, which is leftmost-longest, so we compute
+// the longest of the hex, octal, and decimal alternatives.  The caller
+// guarantees that the input starts with a digit, or with a period followed by
+// a digit.  Never needs RE2, since numbers are pure ASCII.
+int ScanNumericLiteral(StringPiece input) {
+  const char* data = input.data();
+  const int size = input.size();
+  int longest = 0;
+  if (data[0] == '0') {
+    if (size > 1 && (data[1] == 'x' || data[1] == 'X')) {
+      const int end = SkipCharClass(data, size, 2, kHexDigitClass);
+      if (end > 2) {
+        longest = end;
+      }
+    }
+    const int end = SkipCharClass(data, size, 1, kOctalDigitClass);
+    if (end > 1) {
+      longest = std::max(longest, end);
+    }
+  }
+  int index;
+  if (data[0] == '.') {
+    index = SkipCharClass(data, size, 1, kDigitClass);
+    if (index == 1) {
+      return longest;
+    }
+  } else {
+    index = SkipCharClass(data, size, 1, kDigitClass);
+    if (data[0] == '0') {
+      // A leading zero can only continue as a decimal literal if the digits
+      // after it include an 8 or a 9.
+      bool has_non_octal = false;
+      for (int i = 1; i < index; ++i) {
+        has_non_octal |= !HasClass(data[i], kOctalDigitClass);
+      }
+      if (!has_non_octal) {
+        index = 1;
+      }
+    }
+    if (index < size && data[index] == '.') {
+      index = SkipCharClass(data, size, index + 1, kDigitClass);
+    }
+  }
+  if (index < size && (data[index] == 'e' || data[index] == 'E')) {
+    int exponent = index + 1;
+    if (exponent < size && (data[exponent] == '+' || data[exponent] == '-')) {
+      ++exponent;
+    }
+    const int end = SkipCharClass(data, size, exponent, kDigitClass);
+    if (end > exponent) {
+      index = end;
+    }
+  }
+  return std::max(longest, index);
+}
+
+// Matches kOperatorRegex, whose alternatives are leftmost-first.  Never needs
+// RE2, since operators are pure ASCII.
+int ScanOperator(StringPiece input) {
+  const char* data = input.data();
+  const int size = input.size();
+  const char ch = data[0];
+  const char next = (size > 1 ? data[1] : '\0');
+  switch (ch) {
+    case '&':
+    case '|':
+    case '+':
+    case '-':
+      return (next == ch || next == '=') ? 2 : 1;
+    case '*':
+    case '/':
+    case '%':
+    case '^':
+      return next == '=' ? 2 : 1;
+    case '~':
+      return 1;
+    case '!':
+    case '=': {
+      int index = 1;
+      while (index < 3 && index < size && data[index] == '=') {
+        ++index;
+      }
+      return index;
+    }
+    case '<':
+    case '>': {
+      const int max_repeat = (ch == '<' ? 2 : 3);
+      int index = 1;
+      while (index < max_repeat && index < size && data[index] == ch) {
+        ++index;
+      }
+      if (index < size && data[index] == '=') {
+        ++index;
+      }
+      return index;
+    }
+    default:
+      return 0;
+  }
+}
+
+// Matches kRegexLiteralRegex for ASCII input.
+int ScanRegexLiteral(StringPiece input) {
+  const char* data = input.data();
+  const int size = input.size();
+  bool in_class = false;
+  int index = 1;
+  while (true) {
+    if (index >= size) {
+      return 0;
+    }
+    const char ch = data[index];
+    if (!IsAscii(ch)) {
+      return kNeedsRegex;
+    } else if (HasClass(ch, kLinebreakClass)) {
+      return 0;
+    } else if (ch == '\\') {
+      if (index + 1 >= size || HasClass(data[index + 1], kLinebreakClass)) {
+        return 0;
+      } else if (!IsAscii(data[index + 1])) {
+        return kNeedsRegex;
+      }
+      index += 2;
+    } else if (in_class) {
+      in_class = (ch != ']');
+      ++index;
+    } else if (ch == '[') {
+      in_class = true;
+      ++index;
+    } else if (ch == '/') {
+      break;
+    } else {
+      ++index;
+    }
+  }
+  if (index == 1) {
+    return 0;  // The body of a regex literal may not be empty.
+  }
+  ++index;  // Skip the closing slash, then any flags.
+  while (index < size) {
+    const char ch = data[index];
+    if (!IsAscii(ch)) {
+      return kNeedsRegex;
+    } else if (HasClass(ch, kWordClass)) {
+      ++index;
+    } else if (IsUnicodeEscape(data + index, size - index)) {
+      index += 6;
+    } else {
+      break;
+    }
+  }
+  return index;
+}
+
+// Matches kStringLiteralRegex for ASCII input, returning 0 (rather than a
+// match ending in a linebreak) for a string with an unescaped linebreak.  We
+// leave unterminated strings to RE2, since the non-greedy pattern backtracks
+// in ways that are not worth duplicating here when it hits end-of-input.
+int ScanStringLiteral(StringPiece input) {
+  const char* data = input.data();
+  const int size = input.size();
+  const char quote = data[0];
+  int index = 1;
+  while (true) {
+    while (index + 8 <= size) {
+      const uint64 word = LoadWord(data + index);
+      if (((word & kHighBits) | HasByte(word, quote) | HasByte(word, '\\') |
+           HasByte(word, '\n') | HasByte(word, '\r')) != 0) {
+        break;
+      }
+      index += 8;
+    }
+    if (index >= size) {
+      return kNeedsRegex;
+    }
+    const char ch = data[index];
+    if (ch == quote) {
+      return index + 1;
+    } else if (HasClass(ch, kLinebreakClass)) {
+      return 0;
+    } else if (!IsAscii(ch)) {
+      return kNeedsRegex;
+    } else if (ch == '\\') {
+      if (index + 1 >= size || !IsAscii(data[index + 1])) {
+        return kNeedsRegex;
+      }
+      // An escaped \r\n or \n\r counts as a single escaped linebreak.
+      const char next = data[index + 1];
+      if (index + 2 < size && HasClass(next, kLinebreakClass) &&
+          HasClass(data[index + 2], kLinebreakClass) &&
+          data[index + 2] != next) {
+        index += 3;
+      } else {
+        index += 2;
+      }
+    } else {
+      ++index;
+    }
+  }
+}
+
+// Returns 1 if kLineContinuationRegex matches the start of the input, 0 if
+// it does not, or kNeedsRegex.
+int ScanLineContinuation(StringPiece input) {
+  const char* data = input.data();
+  const int size = input.size();
+  switch (data[0]) {
+    case '=':
+    case '(':
+    case '*':
+    case '/':
+    case '%':
+    case '^':
+    case '&':
+    case '|':
+    case '<':
+    case '>':
+    case '?':
+    case ':':
+    case ',':
+    case '.':
+      return 1;
+    case '!':
+      return (size > 1 && data[1] == '=') ? 1 : 0;
+    case '+':
+    case '-':
+      if (size == 1) {
+        return 1;
+      } else if (!IsAscii(data[1])) {
+        return kNeedsRegex;
+      }
+      return data[1] != data[0] ? 1 : 0;
+    default:
+      break;
+  }
+  // The in and instanceof operators must not be followed by an identifier
+  // character (which includes backslash, for \uXXXX escapes).
+  for (StringPiece keyword : {StringPiece("in"), StringPiece("instanceof")}) {
+    if (!strings::StartsWith(input, keyword)) {
+      return 0;
+    }
+    const int end = keyword.size();
+    if (end == size) {
+      return 1;
+    } else if (!IsAscii(data[end])) {
+      return kNeedsRegex;
+    } else if (!HasClass(data[end], kIdentPartClass)) {
+      return 1;
+    }
+  }
+  return 0;
+}
+
+// Returns the length of the match of pattern at the start of input, or 0 if
+// it doesn't match.
+int RegexMatchLength(const RE2& pattern, StringPiece input) {
+  Re2StringPiece unconsumed = StringPieceToRe2(input);
+  if (!RE2::Consume(&unconsumed, pattern)) {
+    return 0;
+  }
+  return input.size() - unconsumed.size();
+}
+
 }  // namespace
 
 JsTokenizer::JsTokenizer(const JsTokenizerPatterns* patterns, StringPiece input)
@@ -308,7 +713,8 @@ JsTokenizer::JsTokenizer(const JsTokenizerPatterns* patterns, StringPiece input)
       input_(input),
       json_step_(kJsonStart),
       start_of_line_(true),
-      error_(false) {
+      error_(false),
+      use_regexes_(false) {
   parse_stack_.push_back(kStartOfInput);
 }
 
@@ -616,6 +1022,9 @@ JsKeywords::Type JsTokenizer::ConsumeBlockComment(StringPiece* token_out) {
 }
 
 JsKeywords::Type JsTokenizer::ConsumeLineComment(StringPiece* token_out) {
+  if (!use_regexes_) {
+    return Emit(JsKeywords::kComment, ScanLineComment(input_), token_out);
+  }
   Re2StringPiece unconsumed = StringPieceToRe2(input_);
   Re2StringPiece linebreak;
   if (!RE2::Consume(&unconsumed, patterns_->line_comment_pattern, &linebreak)) {
@@ -749,17 +1158,14 @@ bool JsTokenizer::TryConsumeIdentifierOrKeyword(JsKeywords::Type* type_out,
     const unsigned char first = input_[0];
     if (first >= 0x80) {
       use_regex = true;
-    } else if (('a' <= first && first <= 'z') || first == '_' ||
-               ('A' <= first && first <= 'Z') || first == '$' ||
-               first == '\\') {
+    } else if (HasClass(first, kIdentStartClass)) {
       int size = input_.size();
       for (index = 1; index < size; ++index) {
-        const unsigned char ch = input_[index];
-        if (ch >= 0x80) {
+        const char ch = input_[index];
+        if (!IsAscii(ch)) {
           use_regex = true;
           break;
-        } else if (!net_instaweb::IsAsciiAlphaNumeric(ch) && ch != '_' &&
-                   ch != '$' && ch != '\\') {
+        } else if (!HasClass(ch, kIdentPartClass)) {
           break;
         }
       }
@@ -899,27 +1305,30 @@ bool JsTokenizer::TryConsumeIdentifierOrKeyword(JsKeywords::Type* type_out,
 
 JsKeywords::Type JsTokenizer::ConsumeNumber(StringPiece* token_out) {
   DCHECK(!input_.empty());
-  Re2StringPiece unconsumed = StringPieceToRe2(input_);
-  if (!RE2::Consume(&unconsumed, patterns_->numeric_literal_pattern)) {
+  const int size =
+      (use_regexes_
+           ? RegexMatchLength(patterns_->numeric_literal_pattern, input_)
+           : ScanNumericLiteral(input_));
+  if (size == 0) {
     // We only call ConsumeNumber when we're sure we're looking at a numeric
     // literal, so this ought not happen even for pathalogical input.
     LOG(DFATAL) << "Failed to match number pattern: " << input_.substr(0, 50);
     return Error(token_out);
   }
   PushExpression();
-  return Emit(JsKeywords::kNumber, input_.size() - unconsumed.size(),
-              token_out);
+  return Emit(JsKeywords::kNumber, size, token_out);
 }
 
 JsKeywords::Type JsTokenizer::ConsumeOperator(StringPiece* token_out) {
   DCHECK(!input_.empty());
-  Re2StringPiece unconsumed = StringPieceToRe2(input_);
-  if (!RE2::Consume(&unconsumed, patterns_->operator_pattern)) {
+  const int size =
+      (use_regexes_ ? RegexMatchLength(patterns_->operator_pattern, input_)
+                    : ScanOperator(input_));
+  if (size == 0) {
     // Unrecognized character:
     return Error(token_out);
   }
-  const JsKeywords::Type type =
-      Emit(JsKeywords::kOperator, input_.size() - unconsumed.size(), token_out);
+  const JsKeywords::Type type = Emit(JsKeywords::kOperator, size, token_out);
   const StringPiece token = *token_out;
   // Is this a postfix operator?  We treat those differently than prefix or
   // unary operators.
@@ -960,13 +1369,16 @@ JsKeywords::Type JsTokenizer::ConsumeQuestionMark(StringPiece* token_out) {
 JsKeywords::Type JsTokenizer::ConsumeRegex(StringPiece* token_out) {
   DCHECK(!input_.empty());
   DCHECK_EQ('/', input_[0]);
-  Re2StringPiece unconsumed = StringPieceToRe2(input_);
-  if (!RE2::Consume(&unconsumed, patterns_->regex_literal_pattern)) {
+  int size = (use_regexes_ ? kNeedsRegex : ScanRegexLiteral(input_));
+  if (size == kNeedsRegex) {
+    size = RegexMatchLength(patterns_->regex_literal_pattern, input_);
+  }
+  if (size == 0) {
     // EOF or a linebreak in the regex will cause an error.
     return Error(token_out);
   }
   PushExpression();
-  return Emit(JsKeywords::kRegex, input_.size() - unconsumed.size(), token_out);
+  return Emit(JsKeywords::kRegex, size, token_out);
 }
 
 JsKeywords::Type JsTokenizer::ConsumeSemicolon(StringPiece* token_out) {
@@ -1043,15 +1455,20 @@ JsKeywords::Type JsTokenizer::ConsumeSlash(StringPiece* token_out) {
 JsKeywords::Type JsTokenizer::ConsumeString(StringPiece* token_out) {
   DCHECK(!input_.empty());
   DCHECK(input_[0] == '"' || input_[0] == '\'');
-  Re2StringPiece unconsumed = StringPieceToRe2(input_);
-  if (!RE2::Consume(&unconsumed, patterns_->string_literal_pattern) ||
-      input_[input_.size() - unconsumed.size() - 1] != input_[0]) {
+  int size = (use_regexes_ ? kNeedsRegex : ScanStringLiteral(input_));
+  if (size == kNeedsRegex) {
+    size = RegexMatchLength(patterns_->string_literal_pattern, input_);
+    // The pattern also matches up to an unescaped linebreak; reject that.
+    if (size > 0 && input_[size - 1] != input_[0]) {
+      size = 0;
+    }
+  }
+  if (size == 0) {
     // EOF or an unescaped linebreak in the string will cause an error.
     return Error(token_out);
   }
   PushExpression();
-  return Emit(JsKeywords::kStringLiteral, input_.size() - unconsumed.size(),
-              token_out);
+  return Emit(JsKeywords::kStringLiteral, size, token_out);
 }
 
 bool JsTokenizer::TryConsumeWhitespace(bool allow_semicolon_insertion,
@@ -1065,16 +1482,25 @@ bool JsTokenizer::TryConsumeWhitespace(bool allow_semicolon_insertion,
   bool has_linebreak = false;
   bool use_regex = false;
   int token_size = 0, size = input_.size();
-  for (; token_size < size; ++token_size) {
-    const unsigned char ch = input_[token_size];
-    if (ch >= 0x80) {
+  const char* data = input_.data();
+  while (token_size < size) {
+    // Indentation tends to come in long runs of spaces; skip those a word at
+    // a time.
+    if (token_size + 8 <= size &&
+        LoadWord(data + token_size) == kEightSpaces) {
+      token_size += 8;
+      continue;
+    }
+    const char ch = data[token_size];
+    if (!IsAscii(ch)) {
       use_regex = true;
       break;
-    } else if (ch == '\n' || ch == '\r') {
+    } else if (HasClass(ch, kLinebreakClass)) {
       has_linebreak = true;
-    } else if (ch != ' ' && ch != '\t' && ch != '\f' && ch != '\v') {
+    } else if (!HasClass(ch, kSpaceClass)) {
       break;
     }
+    ++token_size;
   }
   if (use_regex) {
     Re2StringPiece unconsumed = StringPieceToRe2(input_);
@@ -1260,8 +1686,13 @@ bool JsTokenizer::TryInsertLinebreakSemicolon() {
       // Semicolon insertion will not happen after an expression if the next
       // token could continue the statement.
       {
-        Re2StringPiece unconsumed = StringPieceToRe2(input_);
-        if (RE2::Consume(&unconsumed, patterns_->line_continuation_pattern)) {
+        int continues =
+            (use_regexes_ ? kNeedsRegex : ScanLineContinuation(input_));
+        if (continues == kNeedsRegex) {
+          continues = RegexMatchLength(patterns_->line_continuation_pattern,
+                                       input_);
+        }
+        if (continues != 0) {
           return false;
         }
       }
@@ -86,6 +86,14 @@ class JsTokenizer {
   // Return a string representing the current parse stack, for testing only.
   GoogleString ParseStackForTest() const;
 
+  // For testing only: if true, match numbers, operators, strings, regex
+  // literals, line comments, and line continuations with the RE2 patterns in
+  // JsTokenizerPatterns, rather than with the hand-written scanners that are
+  // normally used for ASCII input, so that the two can be compared.
+  void set_use_regexes_for_test(bool use_regexes) {
+    use_regexes_ = use_regexes;
+  }
+
  private:
   // An entry in the parse stack.  This does not fully capture the grammar of
   // JavaScript -- far from it -- rather, it is just barely nuanced enough to
@@ -183,6 +191,7 @@ class JsTokenizer {
   JsonStep json_step_;
   bool start_of_line_;  // No non-whitespace/comment tokens on this line yet.
   bool error_;
+  bool use_regexes_;  // See set_use_regexes_for_test().
 
   DISALLOW_COPY_AND_ASSIGN(JsTokenizer);
 };
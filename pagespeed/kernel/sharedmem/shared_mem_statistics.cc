@@ -20,10 +20,12 @@
 #include "pagespeed/kernel/sharedmem/shared_mem_statistics.h"
 
 #include <algorithm>
+#include <atomic>
 #include <cmath>
 #include <cstddef>
 #include <limits>
 #include <memory>
+#include <new>
 
 #include "base/logging.h"
 #include "pagespeed/kernel/base/abstract_mutex.h"
@@ -56,9 +58,20 @@ const char kStatisticsObjName[] = "statistics";
 // statistics.
 const char kTimestampVariable[] = "timestamp_";
 
+// Variables are padded out to whole cache lines so that counters bumped by
+// different processes on different cores don't false-share.
+const size_t kCacheLineSize = 64;
+
+typedef std::atomic<int64> AtomicInt64;
+
+// Atomics in shared memory only work across processes if they're lock-free.
+static_assert(AtomicInt64::is_always_lock_free,
+              "SharedMemVariable needs lock-free 64-bit atomics");
+
 }  // namespace
 
-// Our shared memory storage format is an array of (mutex, int64).
+// Our shared memory storage format is an array of (int64, mutex), each padded
+// to a multiple of kCacheLineSize.
 SharedMemVariable::SharedMemVariable(StringPiece name, Statistics* stats)
     : name_(name.as_string()), value_ptr_(nullptr) {}
 
@@ -90,29 +103,51 @@ SharedMemStatistics::Hist* SharedMemStatistics::NewHistogram(StringPiece name) {
   return new Hist(name, this);
 }
 
-int64 SharedMemVariable::GetLockHeld() const { return *value_ptr_; }
+int64 SharedMemVariable::GetLockHeld() const {
+  return value_ptr_->load(std::memory_order_relaxed);
+}
 
 int64 SharedMemVariable::SetReturningPreviousValueLockHeld(int64 new_value) {
-  int64 previous_value = *value_ptr_;
-  *value_ptr_ = new_value;
-  return previous_value;
+  return value_ptr_->exchange(new_value);
+}
+
+int64 SharedMemVariable::AddLockHeld(int64 delta) {
+  return value_ptr_->fetch_add(delta, std::memory_order_relaxed) + delta;
+}
+
+size_t SharedMemVariable::AllocationSize(AbstractSharedMem* shm_runtime) {
+  const size_t size = sizeof(AtomicInt64) + shm_runtime->SharedMutexSize();
+  return (size + kCacheLineSize - 1) / kCacheLineSize * kCacheLineSize;
+}
+
+bool SharedMemVariable::InitializeAt(AbstractSharedMemSegment* segment,
+                                     size_t offset,
+                                     MessageHandler* message_handler) {
+  new (const_cast<char*>(segment->Base() + offset)) AtomicInt64(0);
+  return segment->InitializeSharedMutex(offset + sizeof(AtomicInt64),
+                                        message_handler);
 }
 
 void SharedMemVariable::AttachTo(AbstractSharedMemSegment* segment,
                                  size_t offset,
                                  MessageHandler* message_handler) {
-  mutex_.reset(segment->AttachToSharedMutex(offset));
+  mutex_.reset(segment->AttachToSharedMutex(offset + sizeof(AtomicInt64)));
   if (mutex_.get() == nullptr) {
     message_handler->Message(
         kError, "Unable to attach to mutex for statistics variable %s",
         name_.c_str());
+    value_ptr_ = nullptr;
+    return;
   }
 
-  value_ptr_ = reinterpret_cast<volatile int64*>(segment->Base() + offset +
-                                                 segment->SharedMutexSize());
+  value_ptr_ = reinterpret_cast<AtomicInt64*>(
+      const_cast<char*>(segment->Base() + offset));
 }
 
-void SharedMemVariable::Reset() { mutex_.reset(); }
+void SharedMemVariable::Reset() {
+  mutex_.reset();
+  value_ptr_ = nullptr;
+}
 
 AbstractMutex* SharedMemVariable::mutex() const { return mutex_.get(); }
 
@@ -472,7 +507,8 @@ bool SharedMemStatistics::InitMutexes(size_t per_var,
   size_t pos = 0;
   for (size_t i = 0; i < variables_size(); ++i, pos += per_var) {
     Variable* var = variables(i);
-    if (!segment_->InitializeSharedMutex(pos, message_handler)) {
+    if (!SharedMemVariable::InitializeAt(segment_.get(), pos,
+                                         message_handler)) {
       message_handler->Message(
           kError, "Unable to create mutex for statistics variable %s",
           var->GetName().as_string().c_str());
@@ -481,7 +517,8 @@ bool SharedMemStatistics::InitMutexes(size_t per_var,
   }
   for (size_t i = 0; i < up_down_size(); ++i, pos += per_var) {
     UpDownCounter* var = up_downs(i);
-    if (!segment_->InitializeSharedMutex(pos, message_handler)) {
+    if (!SharedMemVariable::InitializeAt(segment_.get(), pos,
+                                         message_handler)) {
       message_handler->Message(
           kError, "Unable to create mutex for statistics variable %s",
           var->GetName().as_string().c_str());
@@ -506,7 +543,7 @@ bool SharedMemStatistics::Init(bool parent, MessageHandler* message_handler) {
   frozen_ = true;
 
   // Compute size of shared memory
-  size_t per_var = shm_runtime_->SharedMutexSize() + sizeof(int64);
+  size_t per_var = SharedMemVariable::AllocationSize(shm_runtime_);
   size_t total = (variables_size() + up_down_size()) * per_var;
   for (size_t i = 0; i < histograms_size(); ++i) {
     SharedMemHistogram* hist = histograms(i);
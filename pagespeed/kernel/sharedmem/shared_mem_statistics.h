@@ -20,6 +20,7 @@
 #ifndef PAGESPEED_KERNEL_SHAREDMEM_SHARED_MEM_STATISTICS_H_
 #define PAGESPEED_KERNEL_SHAREDMEM_SHARED_MEM_STATISTICS_H_
 
+#include <atomic>
 #include <cstddef>
 
 #include "pagespeed/kernel/base/abstract_mutex.h"
@@ -40,10 +41,12 @@ class Timer;
 
 // An implementation of Statistics using our shared memory infrastructure.
 // These statistics will be shared amongst all processes and threads
-// spawned by our host.  Note that we will be obtaining a per-variable mutex for
-// every read and write to these variables.  Since this may be expensive,
-// we may need each thread to keep a local cache and infrequently write
-// through to this Statistics object.  TODO(abliss): actually do this.
+// spawned by our host.  Variables are lock-free 64-bit atomics, each on its
+// own cache line, so bumping a hot counter costs one uncontended atomic add
+// and never false-shares with its neighbors.  Each variable still has a
+// shared mutex, but it is only taken by code that needs to serialize a
+// read-modify-write sequence across processes (see StatisticsLogger).
+// Histograms are still updated under their mutex.
 //
 // Because we must allocate shared memory segments and mutexes before any child
 // processes and threads are created, all AddVariable calls must be done in
@@ -62,10 +65,18 @@ class SharedMemVariable : public MutexedScalar {
   ~SharedMemVariable() override {}
   virtual StringPiece GetName() const { return name_; }
 
+  // Bytes of shared memory used by each variable, which is a whole number of
+  // cache lines.
+  static size_t AllocationSize(AbstractSharedMem* shm_runtime);
+
  protected:
   AbstractMutex* mutex() const override;
   int64 GetLockHeld() const override;
   int64 SetReturningPreviousValueLockHeld(int64 value) override;
+  int64 AddLockHeld(int64 delta) override;
+  // The value is a lock-free atomic, so plain reads and writes don't need
+  // mutex(); it only serializes StatisticsLogger's read-check-write.
+  bool LockHeldMethodsAreAtomic() const override { return true; }
 
  private:
   friend class SharedMemStatistics;
@@ -73,6 +84,11 @@ class SharedMemVariable : public MutexedScalar {
 
   explicit SharedMemVariable(const StringPiece& name);
 
+  // Constructs the value and mutex at offset; called once, in the root
+  // process.
+  static bool InitializeAt(AbstractSharedMemSegment* segment, size_t offset,
+                           MessageHandler* message_handler);
+
   void AttachTo(AbstractSharedMemSegment* segment_, size_t offset,
                 MessageHandler* message_handler);
 
@@ -83,11 +99,13 @@ class SharedMemVariable : public MutexedScalar {
   // The name of this variable.
   const GoogleString name_;
 
-  // Lock protecting us. NULL if for some reason initialization failed.
+  // Lock for read-modify-write sequences; plain reads and writes don't need
+  // it. NULL if for some reason initialization failed.
   std::unique_ptr<AbstractMutex> mutex_;
 
-  // The data...
-  volatile int64* value_ptr_;
+  // The data, at the start of our cache line.  NULL if for some reason
+  // initialization failed.
+  std::atomic<int64>* value_ptr_;
 
   DISALLOW_COPY_AND_ASSIGN(SharedMemVariable);
 };
@@ -225,7 +243,7 @@ class SharedMemStatistics
   Hist* NewHistogram(StringPiece name) override;
 
  private:
-  // Create mutexes in the segment, with per_var bytes being used,
+  // Create values and mutexes in the segment, with per_var bytes being used,
   // counting the mutex, for each variable.
   bool InitMutexes(size_t per_var, MessageHandler* message_handler);
 
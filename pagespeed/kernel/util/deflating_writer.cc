@@ -0,0 +1,131 @@
+/*
+ * Licensed to the Apache Software Foundation (ASF) under one
+ * or more contributor license agreements.  See the NOTICE file
+ * distributed with this work for additional information
+ * regarding copyright ownership.  The ASF licenses this file
+ * to you under the Apache License, Version 2.0 (the
+ * "License"); you may not use this file except in compliance
+ * with the License.  You may obtain a copy of the License at
+ * 
+ *   http://www.apache.org/licenses/LICENSE-2.0
+ * 
+ * Unless required by applicable law or agreed to in writing,
+ * software distributed under the License is distributed on an
+ * "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY
+ * KIND, either express or implied.  See the License for the
+ * specific language governing permissions and limitations
+ * under the License.
+ */
+
+#include "pagespeed/kernel/util/deflating_writer.h"
+
+#include <cstddef>
+
+#include "base/logging.h"
+#ifdef USE_SYSTEM_ZLIB
+#include "zconf.h"  // NOLINT
+#include "zlib.h"   // NOLINT
+#else
+#include "external/envoy/bazel/foreign_cc/zlib/include/zconf.h"
+#include "external/envoy/bazel/foreign_cc/zlib/include/zlib.h"
+#endif
+#include "pagespeed/kernel/base/stack_buffer.h"
+
+namespace net_instaweb {
+
+DeflatingWriter::DeflatingWriter(GzipInflater::InflateType format,
+                                 int compression_level, Writer* writer)
+    : zlib_(new z_stream),
+      writer_(writer),
+      unflushed_(false),
+      finished_(false),
+      error_(false) {
+  if (compression_level < 1 || compression_level > 9) {
+    compression_level = Z_DEFAULT_COMPRESSION;
+  }
+  zlib_->zalloc = Z_NULL;
+  zlib_->zfree = Z_NULL;
+  zlib_->opaque = Z_NULL;
+  // Adding 16 to the window bits asks zlib for a gzip header and trailer.
+  int window_bits = (format == GzipInflater::kGzip) ? 16 + MAX_WBITS
+                                                      : MAX_WBITS;
+  if (deflateInit2(zlib_, compression_level, Z_DEFLATED, window_bits, 8,
+                   Z_DEFAULT_STRATEGY) != Z_OK) {
+    LOG(DFATAL) << "deflateInit2 failed";
+    delete zlib_;
+    zlib_ = nullptr;
+    error_ = true;
+  }
+}
+
+DeflatingWriter::~DeflatingWriter() {
+  if (zlib_ != nullptr) {
+    deflateEnd(zlib_);
+    delete zlib_;
+  }
+}
+
+bool DeflatingWriter::Write(const StringPiece& str, MessageHandler* handler) {
+  DCHECK(!finished_);
+  if (error_ || finished_) {
+    return false;
+  }
+  if (str.empty()) {
+    return true;
+  }
+  unflushed_ = true;
+  return Deflate(str.data(), str.size(), Z_NO_FLUSH, handler);
+}
+
+bool DeflatingWriter::Flush(MessageHandler* handler) {
+  if (error_ || finished_) {
+    return !error_;
+  }
+  if (unflushed_) {
+    unflushed_ = false;
+    if (!Deflate(nullptr, 0, Z_SYNC_FLUSH, handler)) {
+      return false;
+    }
+  }
+  return writer_->Flush(handler);
+}
+
+bool DeflatingWriter::Finish(MessageHandler* handler) {
+  if (error_ || finished_) {
+    return !error_;
+  }
+  finished_ = true;
+  bool ret = Deflate(nullptr, 0, Z_FINISH, handler);
+  deflateEnd(zlib_);
+  delete zlib_;
+  zlib_ = nullptr;
+  return ret;
+}
+
+bool DeflatingWriter::Deflate(const char* in, size_t size, int flush_mode,
+                              MessageHandler* handler) {
+  char out[kStackBufferSize];
+  zlib_->next_in = reinterpret_cast<Bytef*>(const_cast<char*>(in));
+  zlib_->avail_in = size;
+
+  // Run deflate until it stops filling the output buffer, which means it
+  // has consumed all the input and emitted whatever flush_mode requires.
+  do {
+    zlib_->next_out = reinterpret_cast<Bytef*>(out);
+    zlib_->avail_out = sizeof(out);
+    int ret = deflate(zlib_, flush_mode);
+    if (ret == Z_STREAM_ERROR) {
+      error_ = true;
+      return false;
+    }
+    size_t have = sizeof(out) - zlib_->avail_out;
+    if ((have != 0) && !writer_->Write(StringPiece(out, have), handler)) {
+      error_ = true;
+      return false;
+    }
+  } while (zlib_->avail_out == 0);
+  DCHECK_EQ(0U, zlib_->avail_in);
+  return true;
+}
+
+}  // namespace net_instaweb
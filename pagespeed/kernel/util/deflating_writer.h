@@ -0,0 +1,80 @@
+/*
+ * Licensed to the Apache Software Foundation (ASF) under one
+ * or more contributor license agreements.  See the NOTICE file
+ * distributed with this work for additional information
+ * regarding copyright ownership.  The ASF licenses this file
+ * to you under the Apache License, Version 2.0 (the
+ * "License"); you may not use this file except in compliance
+ * with the License.  You may obtain a copy of the License at
+ * 
+ *   http://www.apache.org/licenses/LICENSE-2.0
+ * 
+ * Unless required by applicable law or agreed to in writing,
+ * software distributed under the License is distributed on an
+ * "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY
+ * KIND, either express or implied.  See the License for the
+ * specific language governing permissions and limitations
+ * under the License.
+ */
+
+#ifndef PAGESPEED_KERNEL_UTIL_DEFLATING_WRITER_H_
+#define PAGESPEED_KERNEL_UTIL_DEFLATING_WRITER_H_
+
+#include "pagespeed/kernel/base/basictypes.h"
+#include "pagespeed/kernel/base/string_util.h"
+#include "pagespeed/kernel/base/writer.h"
+#include "pagespeed/kernel/util/gzip_inflater.h"
+
+typedef struct z_stream_s z_stream;
+
+namespace net_instaweb {
+
+class MessageHandler;
+
+// Writer that gzip- or deflate-compresses a stream as it is written, passing
+// compressed bytes on to another Writer as soon as zlib produces them.  It
+// never holds more than zlib's own window, so it can sit at the end of a
+// streaming rewrite without buffering the response.
+//
+// Flush() ends the current deflate block with a sync flush, so everything
+// written so far can be decoded by the client, and then flushes the
+// downstream writer.  Finish() must be called once at the end of the stream
+// to write the trailer.
+class DeflatingWriter : public Writer {
+ public:
+  // compression_level is 1 (fastest) through 9 (smallest); any other value
+  // selects zlib's default.  Does not take ownership of writer.
+  DeflatingWriter(GzipInflater::InflateType format, int compression_level,
+                  Writer* writer);
+  ~DeflatingWriter() override;
+
+  bool Write(const StringPiece& str, MessageHandler* handler) override;
+  bool Flush(MessageHandler* handler) override;
+
+  // Completes the compressed stream.  Write and Flush must not be called
+  // afterwards.  Returns false on error.
+  bool Finish(MessageHandler* handler);
+
+  bool finished() const { return finished_; }
+  bool error() const { return error_; }
+
+ private:
+  // Runs deflate over [in, in + size) with the given zlib flush mode,
+  // writing all output produced to writer_.
+  bool Deflate(const char* in, size_t size, int flush_mode,
+               MessageHandler* handler);
+
+  z_stream* zlib_;
+  Writer* writer_;
+  // True if bytes were written since the last Flush, so a sync flush has
+  // something to complete.
+  bool unflushed_;
+  bool finished_;
+  bool error_;
+
+  DISALLOW_COPY_AND_ASSIGN(DeflatingWriter);
+};
+
+}  // namespace net_instaweb
+
+#endif  // PAGESPEED_KERNEL_UTIL_DEFLATING_WRITER_H_
@@ -0,0 +1,445 @@
+/*
+ * Licensed to the Apache Software Foundation (ASF) under one
+ * or more contributor license agreements.  See the NOTICE file
+ * distributed with this work for additional information
+ * regarding copyright ownership.  The ASF licenses this file
+ * to you under the Apache License, Version 2.0 (the
+ * "License"); you may not use this file except in compliance
+ * with the License.  You may obtain a copy of the License at
+ * 
+ *   http://www.apache.org/licenses/LICENSE-2.0
+ * 
+ * Unless required by applicable law or agreed to in writing,
+ * software distributed under the License is distributed on an
+ * "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY
+ * KIND, either express or implied.  See the License for the
+ * specific language governing permissions and limitations
+ * under the License.
+ */
+
+#include "pagespeed/kernel/util/file_mtime_cache.h"
+
+#include <limits.h>
+#include <poll.h>
+#include <unistd.h>
+
+#if defined(__linux)
+#include <sys/inotify.h>
+#endif
+
+#include <cerrno>
+#include <cstring>
+
+#include "base/logging.h"
+#include "pagespeed/kernel/base/file_system.h"
+#include "pagespeed/kernel/base/message_handler.h"
+#include "pagespeed/kernel/base/thread.h"
+#include "pagespeed/kernel/base/timer.h"
+
+namespace net_instaweb {
+
+namespace {
+
+#if defined(__linux)
+// Events on a watched directory, or on an entry in it, that can change the
+// answer to a Mtime() query for a file in it.
+const uint32 kWatchMask = IN_ATTRIB | IN_CLOSE_WRITE | IN_CREATE | IN_DELETE |
+                          IN_DELETE_SELF | IN_MODIFY | IN_MOVE_SELF |
+                          IN_MOVED_FROM | IN_MOVED_TO;
+
+// Room for a decent batch of events, each of which may carry a full name.
+const int kEventBufferSize = 16 * (sizeof(struct inotify_event) + NAME_MAX + 1);
+#endif
+
+// Only absolute paths without "//", "." or ".." components are cached, so that
+// every file has exactly one key and its directory can be found by trimming.
+bool IsCanonicalAbsolutePath(StringPiece path) {
+  if (path.empty() || path[0] != '/' || path[path.size() - 1] == '/') {
+    return false;
+  }
+  StringPieceVector components;
+  SplitStringPieceToVector(path.substr(1), "/", &components,
+                           false /* omit_empty_strings */);
+  for (int i = 0, n = components.size(); i < n; ++i) {
+    if (components[i].empty() || components[i] == "." ||
+        components[i] == "..") {
+      return false;
+    }
+  }
+  return true;
+}
+
+// Returns the directory holding a canonical absolute path.
+GoogleString DirectoryOf(StringPiece path) {
+  size_t slash = path.rfind('/');
+  return (slash == 0) ? GoogleString("/") : path.substr(0, slash).as_string();
+}
+
+}  // namespace
+
+const int64 FileMtimeCache::kDefaultFallbackTtlMs = Timer::kSecondMs;
+
+// Sleeps in poll() until the inotify descriptor has events to apply, or
+// until Stop() closes the write end of its pipe.
+class FileMtimeCache::EventThread : public ThreadSystem::Thread {
+ public:
+  EventThread(FileMtimeCache* cache, ThreadSystem* thread_system)
+      : Thread(thread_system, "mtime watcher", ThreadSystem::kJoinable),
+        cache_(cache),
+        stop_read_fd_(-1),
+        stop_write_fd_(-1) {}
+
+  ~EventThread() override {
+    if (stop_read_fd_ >= 0) {
+      close(stop_read_fd_);
+    }
+    if (stop_write_fd_ >= 0) {
+      close(stop_write_fd_);
+    }
+  }
+
+  bool StartWatching() {
+    int fds[2];
+    if (pipe(fds) < 0) {
+      return false;
+    }
+    stop_read_fd_ = fds[0];
+    stop_write_fd_ = fds[1];
+    return Start();
+  }
+
+  // Blocks until the thread has exited.
+  void Stop() {
+    if (stop_write_fd_ >= 0) {
+      close(stop_write_fd_);
+      stop_write_fd_ = -1;
+    }
+    Join();
+  }
+
+  void Run() override {
+    struct pollfd fds[2];
+    memset(&fds, 0, sizeof(fds));
+    fds[0].fd = cache_->inotify_fd_;
+    fds[0].events = POLLIN;
+    fds[1].fd = stop_read_fd_;
+    fds[1].events = POLLIN;
+
+    for (;;) {
+      int nready = poll(fds, arraysize(fds), -1 /* infinite timeout */);
+      if (nready < 0 && errno != EINTR) {
+        LOG(DFATAL) << "FileMtimeCache: poll failed: " << strerror(errno);
+        return;
+      }
+      if (fds[1].revents != 0) {
+        return;
+      }
+      if (fds[0].revents != 0) {
+        cache_->ApplyPendingEvents();
+      }
+    }
+  }
+
+ private:
+  FileMtimeCache* cache_;
+  int stop_read_fd_;
+  int stop_write_fd_;
+
+  DISALLOW_COPY_AND_ASSIGN(EventThread);
+};
+
+FileMtimeCache::FileMtimeCache(FileSystem* file_system,
+                               ThreadSystem* thread_system, Timer* timer,
+                               int64 fallback_ttl_ms, MessageHandler* handler)
+    : file_system_(file_system),
+      thread_system_(thread_system),
+      timer_(timer),
+      fallback_ttl_ms_(fallback_ttl_ms),
+      handler_(handler),
+      inotify_fd_(-1),
+      mutex_(thread_system->NewMutex()),
+      enabled_(false),
+      reported_watch_limit_(false),
+      generation_(0) {}
+
+FileMtimeCache::~FileMtimeCache() { ShutDown(); }
+
+bool FileMtimeCache::InitInotify() {
+  DCHECK_LT(inotify_fd_, 0) << "FileMtimeCache started twice";
+#if defined(__linux)
+  inotify_fd_ = inotify_init1(IN_NONBLOCK | IN_CLOEXEC);
+  if (inotify_fd_ < 0) {
+    handler_->Message(kWarning,
+                      "Could not watch LoadFromFile mtimes with inotify (%s); "
+                      "caching them for %d ms instead",
+                      strerror(errno), static_cast<int>(fallback_ttl_ms_));
+    return false;
+  }
+  return true;
+#else
+  handler_->Message(kInfo,
+                    "inotify is not available on this platform; caching "
+                    "LoadFromFile mtimes for %d ms",
+                    static_cast<int>(fallback_ttl_ms_));
+  return false;
+#endif
+}
+
+bool FileMtimeCache::Start() {
+  bool watching = InitInotify();
+  if (watching) {
+    event_thread_.reset(new EventThread(this, thread_system_));
+    if (!event_thread_->StartWatching()) {
+      // Without the thread nothing would ever invalidate watched entries, so
+      // fall back to expiring them.
+      handler_->Message(kWarning,
+                        "Could not start the LoadFromFile mtime watcher; "
+                        "caching mtimes for %d ms instead",
+                        static_cast<int>(fallback_ttl_ms_));
+      event_thread_.reset();
+      close(inotify_fd_);
+      inotify_fd_ = -1;
+      watching = false;
+    }
+  }
+  ScopedMutex lock(mutex_.get());
+  enabled_ = true;
+  return watching;
+}
+
+bool FileMtimeCache::StartWithoutThreadForTesting() {
+  bool watching = InitInotify();
+  ScopedMutex lock(mutex_.get());
+  enabled_ = true;
+  return watching;
+}
+
+void FileMtimeCache::ShutDown() {
+  {
+    ScopedMutex lock(mutex_.get());
+    enabled_ = false;
+    entries_.clear();
+    watches_.clear();
+    watch_paths_.clear();
+  }
+  if (event_thread_ != nullptr) {
+    event_thread_->Stop();
+    event_thread_.reset();
+  }
+  // Closing the descriptor removes all of its watches.
+  if (inotify_fd_ >= 0) {
+    close(inotify_fd_);
+    inotify_fd_ = -1;
+  }
+}
+
+bool FileMtimeCache::Mtime(StringPiece path, int64* timestamp_sec,
+                           MessageHandler* handler) {
+  if (!IsCanonicalAbsolutePath(path)) {
+    return file_system_->Mtime(path, timestamp_sec, handler);
+  }
+  GoogleString key = path.as_string();
+  GoogleString dir = DirectoryOf(path);
+  int64 now_ms = timer_->NowMs();
+  bool cacheable;
+  bool watched = false;
+  int64 generation = 0;
+  {
+    ScopedMutex lock(mutex_.get());
+    cacheable = enabled_;
+    if (cacheable) {
+      EntryMap::iterator p = entries_.find(key);
+      if (p != entries_.end()) {
+        const Entry& entry = p->second;
+        if (entry.watched || now_ms < entry.expiration_ms) {
+          *timestamp_sec = entry.mtime_sec;
+          return true;
+        }
+        entries_.erase(p);
+      }
+      // Watch before stat'ing, so that any change made after the stat is
+      // reported to us.
+      watched = (inotify_fd_ >= 0) && AddWatchLocked(dir);
+      generation = generation_;
+    }
+  }
+
+  if (!file_system_->Mtime(path, timestamp_sec, handler)) {
+    return false;
+  }
+  if (!cacheable || (!watched && fallback_ttl_ms_ <= 0)) {
+    return true;
+  }
+
+  ScopedMutex lock(mutex_.get());
+  // If an event for the directory arrived since we looked, it may have been
+  // for this file and reported a change our stat didn't see, so don't trust
+  // the result.  Events elsewhere don't matter.
+  if (!enabled_ || (watched && !WatchQuietSinceLocked(dir, generation))) {
+    return true;
+  }
+  Entry& entry = entries_[key];
+  entry.mtime_sec = *timestamp_sec;
+  entry.watched = watched;
+  entry.expiration_ms = watched ? 0 : now_ms + fallback_ttl_ms_;
+  return true;
+}
+
+bool FileMtimeCache::AddWatchLocked(const GoogleString& path) {
+  if (watches_.find(path) != watches_.end()) {
+    return true;
+  }
+#if defined(__linux)
+  int wd = inotify_add_watch(inotify_fd_, path.c_str(), kWatchMask);
+  if (wd < 0) {
+    if (errno == ENOSPC && !reported_watch_limit_) {
+      reported_watch_limit_ = true;
+      handler_->Message(kWarning,
+                        "Ran out of inotify watches at %s; caching further "
+                        "LoadFromFile mtimes for %d ms only.  Consider "
+                        "raising fs.inotify.max_user_watches.",
+                        path.c_str(), static_cast<int>(fallback_ttl_ms_));
+    }
+    return false;
+  }
+  watches_[path] = wd;
+  // Two paths can name the same inode, e.g. through a symlink, in which case
+  // the kernel hands back the same descriptor for both.
+  WatchedInode& inode = watch_paths_[wd];
+  inode.paths.push_back(path);
+  // Nothing looked up before the watch existed can be trusted.
+  inode.event_generation = ++generation_;
+  return true;
+#else
+  return false;
+#endif
+}
+
+bool FileMtimeCache::WatchQuietSinceLocked(const GoogleString& dir,
+                                           int64 generation) const {
+  WatchMap::const_iterator w = watches_.find(dir);
+  if (w == watches_.end()) {
+    return false;
+  }
+  WatchPathMap::const_iterator p = watch_paths_.find(w->second);
+  return ((p != watch_paths_.end()) &&
+          (p->second.event_generation <= generation));
+}
+
+void FileMtimeCache::InvalidateLocked(const GoogleString& path) {
+  if (path == "/") {
+    entries_.clear();
+  } else {
+    GoogleString prefix = StrCat(path, "/");
+    entries_.erase(path);
+    EntryMap::iterator p = entries_.lower_bound(prefix);
+    while (p != entries_.end() && StringPiece(p->first).starts_with(prefix)) {
+      entries_.erase(p++);
+    }
+    // If a directory was replaced, the watches below it are on the old one.
+    WatchMap::iterator w = watches_.lower_bound(prefix);
+    while (w != watches_.end() && StringPiece(w->first).starts_with(prefix)) {
+      RemoveWatchLocked(w->first, w->second);
+      watches_.erase(w++);
+    }
+  }
+  WatchMap::iterator w = watches_.find(path);
+  if (w != watches_.end()) {
+    RemoveWatchLocked(w->first, w->second);
+    watches_.erase(w);
+  }
+}
+
+void FileMtimeCache::RemoveWatchLocked(const GoogleString& path, int wd) {
+  WatchPathMap::iterator p = watch_paths_.find(wd);
+  if (p == watch_paths_.end()) {
+    return;
+  }
+  std::vector<GoogleString>& paths = p->second.paths;
+  for (int i = 0, n = paths.size(); i < n; ++i) {
+    if (paths[i] == path) {
+      paths.erase(paths.begin() + i);
+      break;
+    }
+  }
+  if (paths.empty()) {
+#if defined(__linux)
+    // The resulting IN_IGNORED is dropped since wd is no longer known.
+    inotify_rm_watch(inotify_fd_, wd);
+#endif
+    watch_paths_.erase(p);
+  }
+}
+
+void FileMtimeCache::ApplyPendingEvents() {
+#if defined(__linux)
+  if (inotify_fd_ < 0) {
+    return;
+  }
+  alignas(struct inotify_event) char buf[kEventBufferSize];
+  for (;;) {
+    ssize_t len = read(inotify_fd_, buf, sizeof(buf));
+    if (len < 0 && errno == EINTR) {
+      continue;
+    }
+    if (len <= 0) {
+      return;  // EAGAIN: the queue is drained.
+    }
+    ScopedMutex lock(mutex_.get());
+    ApplyEventsLocked(buf, len);
+  }
+#endif
+}
+
+#if defined(__linux)
+void FileMtimeCache::ApplyEventsLocked(const char* buf, ssize_t len) {
+  const char* end = buf + len;
+  while (buf < end) {
+    const struct inotify_event* event =
+        reinterpret_cast<const struct inotify_event*>(buf);
+    buf += sizeof(struct inotify_event) + event->len;
+
+    if ((event->mask & IN_Q_OVERFLOW) != 0) {
+      // Events were lost, so nothing we have can be trusted.  The watches
+      // themselves are still in place.
+      entries_.clear();
+      ++generation_;
+      for (auto& wd_and_inode : watch_paths_) {
+        wd_and_inode.second.event_generation = generation_;
+      }
+      continue;
+    }
+    WatchPathMap::iterator p = watch_paths_.find(event->wd);
+    if (p == watch_paths_.end()) {
+      continue;  // Already invalidated.
+    }
+    p->second.event_generation = ++generation_;
+    // Copied because invalidation may remove the watch.
+    std::vector<GoogleString> paths(p->second.paths);
+    for (int i = 0, n = paths.size(); i < n; ++i) {
+      if (event->len == 0) {
+        // Something happened to the watched path itself.
+        InvalidateLocked(paths[i]);
+      } else {
+        // Something happened to an entry in a watched directory.  name is
+        // NUL-padded.
+        StringPiece dir =
+            (paths[i] == "/") ? StringPiece() : StringPiece(paths[i]);
+        InvalidateLocked(StrCat(dir, "/", event->name));
+      }
+    }
+  }
+}
+#endif
+
+int FileMtimeCache::num_cached_entries() const {
+  ScopedMutex lock(mutex_.get());
+  return entries_.size();
+}
+
+int FileMtimeCache::num_watches() const {
+  ScopedMutex lock(mutex_.get());
+  return watches_.size();
+}
+
+}  // namespace net_instaweb
@@ -0,0 +1,166 @@
+/*
+ * Licensed to the Apache Software Foundation (ASF) under one
+ * or more contributor license agreements.  See the NOTICE file
+ * distributed with this work for additional information
+ * regarding copyright ownership.  The ASF licenses this file
+ * to you under the Apache License, Version 2.0 (the
+ * "License"); you may not use this file except in compliance
+ * with the License.  You may obtain a copy of the License at
+ * 
+ *   http://www.apache.org/licenses/LICENSE-2.0
+ * 
+ * Unless required by applicable law or agreed to in writing,
+ * software distributed under the License is distributed on an
+ * "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY
+ * KIND, either express or implied.  See the License for the
+ * specific language governing permissions and limitations
+ * under the License.
+ */
+
+#ifndef PAGESPEED_KERNEL_UTIL_FILE_MTIME_CACHE_H_
+#define PAGESPEED_KERNEL_UTIL_FILE_MTIME_CACHE_H_
+
+#include <map>
+#include <memory>
+#include <unordered_map>
+#include <vector>
+
+#include "pagespeed/kernel/base/abstract_mutex.h"
+#include "pagespeed/kernel/base/basictypes.h"
+#include "pagespeed/kernel/base/string.h"
+#include "pagespeed/kernel/base/string_util.h"
+#include "pagespeed/kernel/base/thread_annotations.h"
+#include "pagespeed/kernel/base/thread_system.h"
+
+namespace net_instaweb {
+
+class FileSystem;
+class MessageHandler;
+class Timer;
+
+// Remembers the modification times of files read via LoadFromFile, so that
+// revalidating a cached rewrite doesn't have to stat() every input on every
+// request.
+//
+// The directory holding each cached file is watched with inotify.  A
+// background thread applies the resulting events, dropping the entries they
+// affect, so modifying, replacing or deleting the file, or moving or deleting
+// its directory, makes the next lookup stat the file again.  Changes further
+// up the path, such as swapping a symlink to a grandparent directory, are not
+// seen.  When a watch can't be added (for example because the per-user watch
+// limit has been reached), or inotify isn't available at all, as on non-Linux
+// systems, the mtime is instead remembered for fallback_ttl_ms.  If the
+// kernel's event queue overflows every entry is dropped, since events for
+// them may have been lost.
+//
+// Lookups that can't be answered from memory, relative paths, and paths that
+// aren't in canonical form are passed through to the underlying FileSystem.
+// Failed lookups are never cached.
+//
+// All methods are thread-safe.
+class FileMtimeCache {
+ public:
+  // How long to trust an mtime that isn't covered by a watch.
+  static const int64 kDefaultFallbackTtlMs;
+
+  // Does not take ownership of any of the arguments.  No watching happens
+  // until Start() is called; until then lookups go straight to file_system.
+  FileMtimeCache(FileSystem* file_system, ThreadSystem* thread_system,
+                 Timer* timer, int64 fallback_ttl_ms, MessageHandler* handler);
+  ~FileMtimeCache();
+
+  // Sets up inotify and starts the thread that applies its events.  Returns
+  // false if that failed, in which case mtimes are only cached for
+  // fallback_ttl_ms.  Must only be called once, in a process that is allowed
+  // to start threads.
+  bool Start();
+
+  // Stops the event thread and stops caching; subsequent lookups go straight
+  // to the file system.  Called automatically on destruction.
+  void ShutDown();
+
+  // Drop-in replacement for FileSystem::Mtime.
+  bool Mtime(StringPiece path, int64* timestamp_sec, MessageHandler* handler);
+
+  // Reads and applies any queued inotify events without blocking.  This is
+  // what the event thread does when the inotify descriptor becomes readable;
+  // tests call it directly so they can observe invalidations deterministically.
+  void ApplyPendingEvents();
+
+  // Sets up inotify without starting the event thread, so that tests control
+  // when events are applied via ApplyPendingEvents().
+  bool StartWithoutThreadForTesting();
+
+  int num_cached_entries() const;
+  int num_watches() const;
+
+ private:
+  class EventThread;
+
+  struct Entry {
+    int64 mtime_sec;
+    // Entries covered by a watch never expire; others are re-stat'ed after
+    // this time.
+    bool watched;
+    int64 expiration_ms;
+  };
+  // The paths watched through one inotify descriptor.
+  struct WatchedInode {
+    std::vector<GoogleString> paths;
+    // The value of generation_ when the watch was added or last had an
+    // event.
+    int64 event_generation;
+  };
+  typedef std::map<GoogleString, Entry> EntryMap;
+  typedef std::map<GoogleString, int> WatchMap;
+  typedef std::unordered_map<int, WatchedInode> WatchPathMap;
+
+  bool InitInotify();
+
+  // Makes sure the directory path is watched.  Returns false if the watch
+  // could not be added.
+  bool AddWatchLocked(const GoogleString& path)
+      EXCLUSIVE_LOCKS_REQUIRED(mutex_);
+
+  // Whether dir is still watched, and has had no event since generation_
+  // was generation.
+  bool WatchQuietSinceLocked(const GoogleString& dir, int64 generation) const
+      EXCLUSIVE_LOCKS_REQUIRED(mutex_);
+
+  // Forgets cached mtimes and watches for path and, if it is a directory,
+  // everything below it.
+  void InvalidateLocked(const GoogleString& path)
+      EXCLUSIVE_LOCKS_REQUIRED(mutex_);
+  void RemoveWatchLocked(const GoogleString& path, int wd)
+      EXCLUSIVE_LOCKS_REQUIRED(mutex_);
+
+  void ApplyEventsLocked(const char* buf, ssize_t len)
+      EXCLUSIVE_LOCKS_REQUIRED(mutex_);
+
+  FileSystem* file_system_;
+  ThreadSystem* thread_system_;
+  Timer* timer_;
+  const int64 fallback_ttl_ms_;
+  MessageHandler* handler_;
+
+  // Set before the event thread starts and closed after it has been joined.
+  int inotify_fd_;
+  std::unique_ptr<AbstractMutex> mutex_;
+  bool enabled_ GUARDED_BY(mutex_);
+  bool reported_watch_limit_ GUARDED_BY(mutex_);
+  // Bumped whenever a watch is added or has an event, so that a lookup
+  // racing with an event for its directory doesn't cache the mtime it read
+  // before the event was seen.
+  int64 generation_ GUARDED_BY(mutex_);
+  EntryMap entries_ GUARDED_BY(mutex_);
+  WatchMap watches_ GUARDED_BY(mutex_);
+  WatchPathMap watch_paths_ GUARDED_BY(mutex_);
+
+  std::unique_ptr<EventThread> event_thread_;
+
+  DISALLOW_COPY_AND_ASSIGN(FileMtimeCache);
+};
+
+}  // namespace net_instaweb
+
+#endif  // PAGESPEED_KERNEL_UTIL_FILE_MTIME_CACHE_H_
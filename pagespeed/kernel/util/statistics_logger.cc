@@ -19,7 +19,9 @@
 
 #include "pagespeed/kernel/util/statistics_logger.h"
 
+#include <algorithm>
 #include <cstddef>
+#include <cstring>
 #include <map>
 #include <memory>
 #include <set>
@@ -31,7 +33,6 @@
 #include "pagespeed/kernel/base/basictypes.h"
 #include "pagespeed/kernel/base/escaping.h"
 #include "pagespeed/kernel/base/file_system.h"
-#include "pagespeed/kernel/base/file_writer.h"
 #include "pagespeed/kernel/base/message_handler.h"
 #include "pagespeed/kernel/base/statistics.h"
 #include "pagespeed/kernel/base/string.h"
@@ -209,6 +210,9 @@ const char* const kGraphsVars[] = {
     "redis_blocking_deletes",
 };
 
+// First line of binary logfiles.
+const char kBinaryLogfileMagic[] = "pagespeed-statistics-log-v1\n";
+
 }  // namespace
 
 StatisticsLogger::StatisticsLogger(int64 update_interval_ms,
@@ -243,6 +247,13 @@ void StatisticsLogger::Init() {
   for (int i = 0, n = arraysize(kGraphsVars); i < n; ++i) {
     AddVariable(kGraphsVars[i]);
   }
+
+  StringVector var_names;
+  for (VariableMap::const_iterator iter = variables_to_log_.begin();
+       iter != variables_to_log_.end(); ++iter) {
+    var_names.push_back(iter->first.as_string());
+  }
+  logfile_header_ = StatisticsLogfileIndex::Header(var_names);
 }
 
 void StatisticsLogger::InitStatsForTest() {
@@ -281,13 +292,23 @@ void StatisticsLogger::UpdateAndDumpIfRequired() {
       // It's possible we'll need to do some of the following here for
       // cross-process consistency:
       // - flush the logfile before unlock to force out buffered data
+      GoogleString data;
+      if (!LogfileHasCurrentHeader() || !TruncateTornRecord()) {
+        // Start over if there is no logfile yet, or if it was written by a
+        // version of the server that logged different variables, or in the
+        // old text format, or if it can't be repaired after a torn append.
+        if (file_system_->Exists(logfile_name_.c_str(), message_handler_)
+                .is_true()) {
+          file_system_->RemoveFile(logfile_name_.c_str(), message_handler_);
+        }
+        data = logfile_header_;
+      }
+      AppendRecord(current_time_ms, &data);
       FileSystem::OutputFile* statistics_log_file =
           file_system_->OpenOutputFileForAppend(logfile_name_.c_str(),
                                                 message_handler_);
       if (statistics_log_file != nullptr) {
-        FileWriter statistics_writer(statistics_log_file);
-        DumpConsoleVarsToWriter(current_time_ms, &statistics_writer);
-        statistics_writer.Flush(message_handler_);
+        statistics_log_file->Write(data, message_handler_);
         file_system_->Close(statistics_log_file, message_handler_);
 
         // Trim logfile if it's over max size.
@@ -305,35 +326,113 @@ void StatisticsLogger::UpdateAndDumpIfRequired() {
   }
 }
 
-void StatisticsLogger::DumpConsoleVarsToWriter(int64 current_time_ms,
-                                               Writer* writer) {
-  writer->Write(absl::StrFormat("timestamp: %s\n",
-                                Integer64ToString(current_time_ms).c_str()),
-                message_handler_);
-
+void StatisticsLogger::AppendRecord(int64 current_time_ms,
+                                    GoogleString* record) const {
+  record->append(reinterpret_cast<const char*>(&current_time_ms),
+                 sizeof(current_time_ms));
   for (VariableMap::const_iterator iter = variables_to_log_.begin();
        iter != variables_to_log_.end(); ++iter) {
-    StringPiece var_name = iter->first;
     VariableOrCounter var_or_counter = iter->second;
     int64 val = (var_or_counter.first != NULL) ? var_or_counter.first->Get()
                                                : var_or_counter.second->Get();
-    writer->Write(StrCat(var_name, ": ", Integer64ToString(val), "\n"),
-                  message_handler_);
+    record->append(reinterpret_cast<const char*>(&val), sizeof(val));
+  }
+}
+
+bool StatisticsLogger::LogfileHasCurrentHeader() const {
+  int64 size_bytes;
+  const int64 header_size = logfile_header_.size();
+  if (!file_system_->Exists(logfile_name_.c_str(), message_handler_)
+           .is_true() ||
+      !file_system_->Size(logfile_name_, &size_bytes, message_handler_) ||
+      size_bytes < header_size) {
+    return false;
   }
 
-  writer->Flush(message_handler_);
+  // Only the header needs to be read to tell whether it matches.
+  FileSystem::InputFile* log_file =
+      file_system_->OpenInputFile(logfile_name_.c_str(), message_handler_);
+  if (log_file == nullptr) {
+    return false;
+  }
+  GoogleString header(header_size, '\0');
+  int64 header_read = 0;
+  while (header_read < header_size) {
+    int num_read = log_file->Read(&header[header_read],
+                                  header_size - header_read, message_handler_);
+    if (num_read <= 0) {
+      break;
+    }
+    header_read += num_read;
+  }
+  file_system_->Close(log_file, message_handler_);
+  return header_read == header_size && header == logfile_header_;
+}
+
+bool StatisticsLogger::TruncateTornRecord() const {
+  int64 size_bytes;
+  const int64 header_size = logfile_header_.size();
+  const int64 record_size = (variables_to_log_.size() + 1) * sizeof(int64);
+  if (!file_system_->Size(logfile_name_, &size_bytes, message_handler_)) {
+    return false;
+  }
+  if ((size_bytes - header_size) % record_size == 0) {
+    return true;
+  }
+
+  // An append was cut short, e.g. by a crash.  Keep the header and every
+  // whole record, so that the next record starts on a record boundary.
+  GoogleString contents;
+  StatisticsLogfileIndex index;
+  GoogleString temp_filename;
+  return file_system_->ReadFile(logfile_name_.c_str(), &contents,
+                                message_handler_) &&
+         index.Init(contents) &&
+         file_system_->WriteTempFile(
+             StrCat(logfile_name_, ".trim"),
+             StrCat(StringPiece(contents).substr(0, header_size),
+                    index.RecordsFrom(0)),
+             &temp_filename, message_handler_) &&
+         file_system_->RenameFile(temp_filename.c_str(),
+                                  logfile_name_.c_str(), message_handler_);
 }
 
 void StatisticsLogger::TrimLogfileIfNeeded() {
   int64 size_bytes;
-  if (file_system_->Size(logfile_name_, &size_bytes, message_handler_) &&
-      size_bytes > max_logfile_size_kb_ * 1024) {
-    // TODO(sligocki): Rotate a set of logfiles and just delete the
-    // oldest one each time instead of deleting the entire log.
-    // NOTE: Update SharedMemStatisticsTestBase.TestLogfileTrimming when we
-    // make this change so that it correctly tests the total log size.
-    file_system_->RemoveFile(logfile_name_.c_str(), message_handler_);
+  const int64 max_size_bytes = max_logfile_size_kb_ * 1024;
+  if (!file_system_->Size(logfile_name_, &size_bytes, message_handler_) ||
+      size_bytes <= max_size_bytes) {
+    return;
   }
+
+  // Keep the most recent records that fit in half the maximum size, so that
+  // the history shown in the console stays continuous, and trimming is only
+  // needed again once that much more has been logged.
+  GoogleString contents;
+  StatisticsLogfileIndex index;
+  if (file_system_->ReadFile(logfile_name_.c_str(), &contents,
+                             message_handler_) &&
+      index.Init(contents)) {
+    // A torn final record is not part of the header, so measure the header
+    // up to where the first record starts.
+    const int64 header_size = index.RecordsFrom(0).data() - contents.data();
+    const int64 records_to_keep =
+        std::min<int64>(index.num_records(),
+                        (max_size_bytes / 2 - header_size) /
+                            static_cast<int64>(index.record_size()));
+    GoogleString temp_filename;
+    if (records_to_keep > 0 &&
+        file_system_->WriteTempFile(
+            StrCat(logfile_name_, ".trim"),
+            StrCat(StringPiece(contents).substr(0, header_size),
+                   index.RecordsFrom(index.num_records() - records_to_keep)),
+            &temp_filename, message_handler_) &&
+        file_system_->RenameFile(temp_filename.c_str(), logfile_name_.c_str(),
+                                 message_handler_)) {
+      return;
+    }
+  }
+  file_system_->RemoveFile(logfile_name_.c_str(), message_handler_);
 }
 
 void StatisticsLogger::DumpJSON(bool dump_for_graphs,
@@ -341,11 +440,80 @@ void StatisticsLogger::DumpJSON(bool dump_for_graphs,
                                 int64 end_time, int64 granularity_ms,
                                 Writer* writer,
                                 MessageHandler* message_handler) const {
+  GoogleString contents;
+  if (!file_system_->ReadFile(logfile_name_.c_str(), &contents,
+                              message_handler)) {
+    // If logfile_name_ represents a file that doesn't exist, ReadFile
+    // logged an error.  Return an empty json object.
+    writer->Write("{}", message_handler);
+    return;
+  }
+  StatisticsLogfileIndex index;
+  if (!index.Init(contents)) {
+    DumpJSONFromTextLogfile(dump_for_graphs, var_titles, start_time, end_time,
+                            granularity_ms, writer, message_handler);
+    return;
+  }
+
+  VarMap parsed_var_data;
+  std::vector<int64> list_of_timestamps;
+  if (dump_for_graphs) {
+    StringSet graphs_var_titles(kGraphsVars,
+                                kGraphsVars + arraysize(kGraphsVars));
+    ReadDataFromIndex(graphs_var_titles, index, start_time, end_time,
+                      granularity_ms, &list_of_timestamps, &parsed_var_data);
+  } else {
+    ReadDataFromIndex(var_titles, index, start_time, end_time, granularity_ms,
+                      &list_of_timestamps, &parsed_var_data);
+  }
+  PrintJSON(list_of_timestamps, parsed_var_data, writer, message_handler);
+}
+
+void StatisticsLogger::ReadDataFromIndex(const StringSet& var_titles,
+                                         const StatisticsLogfileIndex& index,
+                                         int64 start_time, int64 end_time,
+                                         int64 granularity_ms,
+                                         std::vector<int64>* timestamps,
+                                         VarMap* var_values) const {
+  // Look up the columns once, rather than for every record. Variables that
+  // were not logged get 0 as a place holder, as for the text format.
+  std::vector<std::pair<VariableInfo*, int> > columns;
+  for (StringSet::const_iterator iter = var_titles.begin();
+       iter != var_titles.end(); ++iter) {
+    columns.push_back(
+        std::make_pair(&(*var_values)[*iter], index.FindColumn(*iter)));
+  }
+
+  // Like the text format reader, treat the previous timestamp as 0 to begin
+  // with. Each step jumps straight to the next record that is far enough
+  // from the previous one, so a coarse granularity over a long history only
+  // looks at the records that are returned.
+  int64 next_timestamp = std::max<int64>(start_time, granularity_ms);
+  for (int record = index.FirstRecordAtOrAfter(next_timestamp);
+       record < index.num_records();
+       record = index.FirstRecordAtOrAfter(next_timestamp)) {
+    const int64 timestamp = index.timestamp(record);
+    if (timestamp > end_time) {
+      break;
+    }
+    timestamps->push_back(timestamp);
+    for (int i = 0, n = columns.size(); i < n; ++i) {
+      const int column = columns[i].second;
+      columns[i].first->push_back(
+          column >= 0 ? Integer64ToString(index.value(record, column)) : "0");
+    }
+    // Always move forward, even with a granularity of 0.
+    next_timestamp = std::max(timestamp + granularity_ms, timestamp + 1);
+  }
+}
+
+void StatisticsLogger::DumpJSONFromTextLogfile(
+    bool dump_for_graphs, const StringSet& var_titles, int64 start_time,
+    int64 end_time, int64 granularity_ms, Writer* writer,
+    MessageHandler* message_handler) const {
   FileSystem::InputFile* log_file =
       file_system_->OpenInputFile(logfile_name_.c_str(), message_handler);
   if (log_file == nullptr) {
-    // If logfile_name_ represents a file that doesn't exist, OpenInputFile
-    // logged an error and log_file will be null.  Return an empty json object.
     writer->Write("{}", message_handler);
     return;
   }
@@ -492,6 +660,89 @@ void StatisticsLogger::PrintVarDataAsJSON(const VarMap& parsed_var_data,
   }
 }
 
+StatisticsLogfileIndex::StatisticsLogfileIndex()
+    : num_columns_(0), num_records_(0), record_size_(sizeof(int64)) {}
+
+StatisticsLogfileIndex::~StatisticsLogfileIndex() {}
+
+GoogleString StatisticsLogfileIndex::Header(const StringVector& var_names) {
+  GoogleString header =
+      StrCat(kBinaryLogfileMagic, IntegerToString(var_names.size()), "\n");
+  for (int i = 0, n = var_names.size(); i < n; ++i) {
+    StrAppend(&header, var_names[i], "\n");
+  }
+  return header;
+}
+
+bool StatisticsLogfileIndex::Init(StringPiece contents) {
+  columns_.clear();
+  records_ = StringPiece();
+  num_columns_ = 0;
+  num_records_ = 0;
+  record_size_ = sizeof(int64);
+
+  if (!strings::StartsWith(contents, kBinaryLogfileMagic)) {
+    return false;
+  }
+  size_t pos = STATIC_STRLEN(kBinaryLogfileMagic);
+  size_t end_of_line = contents.find('\n', pos);
+  int num_columns;
+  if (end_of_line == StringPiece::npos ||
+      !StringToInt(contents.substr(pos, end_of_line - pos), &num_columns) ||
+      num_columns < 0) {
+    return false;
+  }
+  pos = end_of_line + 1;
+  for (int column = 0; column < num_columns; ++column) {
+    end_of_line = contents.find('\n', pos);
+    if (end_of_line == StringPiece::npos) {
+      columns_.clear();
+      return false;
+    }
+    columns_[contents.substr(pos, end_of_line - pos)] = column;
+    pos = end_of_line + 1;
+  }
+
+  num_columns_ = num_columns;
+  record_size_ = (num_columns + 1) * sizeof(int64);
+  records_ = contents.substr(pos);
+  num_records_ = records_.size() / record_size_;
+  return true;
+}
+
+int StatisticsLogfileIndex::FindColumn(StringPiece var_name) const {
+  std::map<StringPiece, int>::const_iterator iter = columns_.find(var_name);
+  return (iter == columns_.end()) ? -1 : iter->second;
+}
+
+int StatisticsLogfileIndex::FirstRecordAtOrAfter(int64 timestamp_ms) const {
+  int low = 0;
+  int high = num_records_;
+  while (low < high) {
+    int mid = low + (high - low) / 2;
+    if (timestamp(mid) < timestamp_ms) {
+      low = mid + 1;
+    } else {
+      high = mid;
+    }
+  }
+  return low;
+}
+
+StringPiece StatisticsLogfileIndex::RecordsFrom(int first_record) const {
+  return records_.substr(first_record * record_size_,
+                         (num_records_ - first_record) * record_size_);
+}
+
+int64 StatisticsLogfileIndex::Field(int record, int field) const {
+  // The records aren't necessarily aligned, so copy rather than cast.
+  int64 result;
+  memcpy(&result,
+         records_.data() + record * record_size_ + field * sizeof(result),
+         sizeof(result));
+  return result;
+}
+
 StatisticsLogfileReader::StatisticsLogfileReader(
     FileSystem::InputFile* file, int64 start_time, int64 end_time,
     int64 granularity_ms, MessageHandler* message_handler)
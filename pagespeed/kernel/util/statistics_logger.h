@@ -35,6 +35,7 @@ namespace net_instaweb {
 class MessageHandler;
 class MutexedScalar;
 class Statistics;
+class StatisticsLogfileIndex;
 class StatisticsLogfileReader;
 class Timer;
 class UpDownCounter;
@@ -60,10 +61,13 @@ class StatisticsLogger {
                 Writer* writer, MessageHandler* message_handler) const;
 
   // If it's been longer than kStatisticsDumpIntervalMs, update the
-  // timestamp to now and dump the current state of the Statistics.
+  // timestamp to now and append the current state of the Statistics to the
+  // logfile, as one record of the binary format described at
+  // StatisticsLogfileIndex.
   void UpdateAndDumpIfRequired();
 
-  // Trim file down if it gets above max_logfile_size_kb.
+  // Trim file down if it gets above max_logfile_size_kb, keeping the most
+  // recent records.
   void TrimLogfileIfNeeded();
 
   // Preload all the variables required for statistics logging.  This
@@ -85,9 +89,30 @@ class StatisticsLogger {
   typedef std::pair<Variable*, UpDownCounter*> VariableOrCounter;
   typedef std::map<StringPiece, VariableOrCounter> VariableMap;
 
-  // Export statistics to a writer. Only export stats needed for console.
+  // Appends a binary record of the logged statistics to record.
   // current_time_ms: The time at which the dump was triggered.
-  void DumpConsoleVarsToWriter(int64 current_time_ms, Writer* writer);
+  void AppendRecord(int64 current_time_ms, GoogleString* record) const;
+  // Returns true if the logfile exists and was written with the same set of
+  // variables as this logger, so that records can be appended to it.
+  bool LogfileHasCurrentHeader() const;
+  // Drops a partially written final record from a logfile with the current
+  // header, so that appended records start on a record boundary.  Returns
+  // false if the logfile could not be read or rewritten.
+  bool TruncateTornRecord() const;
+  // Save the variables listed in var_titles to the map, for the records in
+  // index which match the time range and granularity.
+  void ReadDataFromIndex(const StringSet& var_titles,
+                         const StatisticsLogfileIndex& index,
+                         int64 start_time, int64 end_time,
+                         int64 granularity_ms,
+                         std::vector<int64>* list_of_timestamps,
+                         VarMap* var_values) const;
+  // Reads a logfile in the text format used by older versions.
+  void DumpJSONFromTextLogfile(bool dump_for_graphs,
+                               const StringSet& var_titles, int64 start_time,
+                               int64 end_time, int64 granularity_ms,
+                               Writer* writer,
+                               MessageHandler* message_handler) const;
   // Save the variables listed in var_titles to the map.
   void ParseDataFromReader(const StringSet& var_titles,
                            StatisticsLogfileReader* reader,
@@ -130,11 +155,66 @@ class StatisticsLogger {
   const int64 max_logfile_size_kb_;
   GoogleString logfile_name_;
   VariableMap variables_to_log_;
+  // Header for logfiles written with variables_to_log_, set by Init().
+  GoogleString logfile_header_;
 
   DISALLOW_COPY_AND_ASSIGN(StatisticsLogger);
 };
 
-// Handles reading the logfile created by StatisticsLogger.
+// Gives access to the records of a binary logfile written by
+// StatisticsLogger, without parsing or copying them.
+//
+// The logfile starts with a text header: a magic line, the number of logged
+// variables, and the name of each variable on a line of its own, which
+// assigns the variables to columns. It is followed by fixed-width records,
+// in increasing timestamp order, each holding the timestamp followed by the
+// value of each column, as int64s in host byte order.
+class StatisticsLogfileIndex {
+ public:
+  StatisticsLogfileIndex();
+  ~StatisticsLogfileIndex();
+
+  // Returns the header of a logfile recording var_names, in that order.
+  static GoogleString Header(const StringVector& var_names);
+
+  // Indexes the contents of a logfile, which must outlive this object.
+  // Returns false if the contents are not a binary logfile. A partially
+  // written record at the end is ignored.
+  bool Init(StringPiece contents);
+
+  int num_columns() const { return num_columns_; }
+  int num_records() const { return num_records_; }
+  size_t record_size() const { return record_size_; }
+
+  // Returns the column of var_name, or -1 if it was not logged.
+  int FindColumn(StringPiece var_name) const;
+
+  int64 timestamp(int record) const { return Field(record, 0); }
+  int64 value(int record, int column) const {
+    return Field(record, column + 1);
+  }
+
+  // Returns the first record with a timestamp of at least timestamp_ms, or
+  // num_records() if there is none.
+  int FirstRecordAtOrAfter(int64 timestamp_ms) const;
+
+  // Returns the raw bytes of the records starting at first_record.
+  StringPiece RecordsFrom(int first_record) const;
+
+ private:
+  int64 Field(int record, int field) const;
+
+  std::map<StringPiece, int> columns_;
+  StringPiece records_;
+  int num_columns_;
+  int num_records_;
+  size_t record_size_;
+
+  DISALLOW_COPY_AND_ASSIGN(StatisticsLogfileIndex);
+};
+
+// Handles reading the text logfiles created by older versions of
+// StatisticsLogger.
 class StatisticsLogfileReader {
  public:
   StatisticsLogfileReader(FileSystem::InputFile* file, int64 start_time,
@@ -43,8 +43,11 @@
 #include "net/instaweb/util/public/property_cache.h"
 #include "pagespeed/controller/central_controller_rpc_client.h"
 #include "pagespeed/controller/central_controller_rpc_server.h"
+#include "pagespeed/controller/clustered_schedule_rewrite_controller.h"
 #include "pagespeed/controller/popularity_contest_schedule_rewrite_controller.h"
 #include "pagespeed/controller/queued_expensive_operation_controller.h"
+#include "pagespeed/controller/remote_schedule_rewrite_controller.h"
+#include "pagespeed/controller/schedule_rewrite_controller.h"
 #include "pagespeed/kernel/base/abstract_shared_mem.h"
 #include "pagespeed/kernel/base/file_system.h"
 #include "pagespeed/kernel/base/google_message_handler.h"
@@ -63,6 +66,7 @@
 #include "pagespeed/kernel/sharedmem/shared_mem_statistics.h"
 #include "pagespeed/kernel/thread/pthread_shared_mem.h"
 #include "pagespeed/kernel/thread/queued_worker_pool.h"
+#include "pagespeed/kernel/util/file_mtime_cache.h"
 #include "pagespeed/kernel/util/input_file_nonce_generator.h"
 #include "pagespeed/kernel/util/nonce_generator.h"
 #include "pagespeed/system/controller_manager.h"
@@ -207,6 +211,7 @@ void SystemRewriteDriverFactory::InitStats(Statistics* statistics) {
   InPlaceResourceRecorder::InitStats(statistics);
   RateController::InitStats(statistics);
   CentralControllerRpcClient::InitStats(statistics);
+  ClusteredScheduleRewriteController::InitStats(statistics);
 
   statistics->AddVariable(kShutdownCount);
 }
@@ -278,17 +283,51 @@ void SystemRewriteDriverFactory::PrepareControllerProcess() {
 void SystemRewriteDriverFactory::StartController(
     const SystemRewriteOptions& options) {
   if (!options.controller_port().empty()) {
+    ScheduleRewriteController* rewrite_controller =
+        new PopularityContestScheduleRewriteController(
+            thread_system(), statistics(), timer(),
+            options.popularity_contest_max_inflight_requests(),
+            options.popularity_contest_max_queue_size());
+    const GoogleString& cluster_address = options.controller_cluster_address();
+    bool clustered = false;
+    if (!options.controller_cluster_nodes().empty()) {
+      StringPieceVector nodes;
+      SplitStringPieceToVector(options.controller_cluster_nodes(), ",", &nodes,
+                               true /* omit_empty_strings */);
+      ClusteredScheduleRewriteController::PeerMap peers;
+      for (StringPiece node : nodes) {
+        TrimWhitespace(&node);
+        if (node == cluster_address) {
+          clustered = true;
+        } else if (!node.empty() && peers.count(node.as_string()) == 0) {
+          peers[node.as_string()] = new RemoteScheduleRewriteController(
+              node.as_string(), thread_system(), message_handler());
+        }
+      }
+      if (clustered) {
+        rewrite_controller = new ClusteredScheduleRewriteController(
+            cluster_address, peers, rewrite_controller, thread_system(),
+            statistics());
+      } else {
+        message_handler()->Message(
+            kError, "%s must be one of %s, not clustering rewrites.",
+            SystemRewriteOptions::kCentralControllerClusterAddress,
+            SystemRewriteOptions::kCentralControllerClusterNodes);
+        for (const auto& peer : peers) {
+          delete peer.second;
+        }
+      }
+    }
     std::unique_ptr<CentralControllerRpcServer> controller(
         new CentralControllerRpcServer(
             options.controller_port(),
             new QueuedExpensiveOperationController(
                 options.image_max_rewrites_at_once(), thread_system(),
                 statistics()),
-            new PopularityContestScheduleRewriteController(
-                thread_system(), statistics(), timer(),
-                options.popularity_contest_max_inflight_requests(),
-                options.popularity_contest_max_queue_size()),
-            message_handler()));
+            rewrite_controller, message_handler()));
+    if (clustered) {
+      controller->AddListeningAddress(cluster_address);
+    }
     // In the forked process, this call starts a new event loop and never
     // returns.
     ControllerManager::ForkControllerProcess(
@@ -345,6 +384,13 @@ void SystemRewriteDriverFactory::ChildInit() {
 
   caches_->ChildInit();
 
+  if (conf->load_from_file_watch_mtimes()) {
+    file_mtime_cache_ = std::make_unique<FileMtimeCache>(
+        file_system(), thread_system(), timer(),
+        FileMtimeCache::kDefaultFallbackTtlMs, message_handler());
+    file_mtime_cache_->Start();
+  }
+
   // Static asset config is process-global.
   if (conf->has_static_assets_to_cdn()) {
     StaticAssetConfig out_conf;
@@ -360,6 +406,7 @@ void SystemRewriteDriverFactory::ChildInit() {
            e = uninitialized_server_contexts_.end();
        p != e; ++p) {
     SystemServerContext* server_context = *p;
+    server_context->set_file_mtime_cache(file_mtime_cache_.get());
     server_context->ChildInit(this);
   }
   uninitialized_server_contexts_.clear();
@@ -576,6 +623,9 @@ void SystemRewriteDriverFactory::ShutDown() {
   RewriteDriverFactory::ShutDown();
 
   caches_->ShutDown(message_handler());
+  if (file_mtime_cache_ != nullptr) {
+    file_mtime_cache_->ShutDown();
+  }
 
   ShutDownMessageHandlers();
 
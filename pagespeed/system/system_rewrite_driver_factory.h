@@ -40,6 +40,7 @@
 namespace net_instaweb {
 
 class AbstractSharedMem;
+class FileMtimeCache;
 class FileSystem;
 class MessageHandler;
 class NamedLockManager;
@@ -353,6 +354,10 @@ class SystemRewriteDriverFactory : public RewriteDriverFactory {
   // Manages all our caches & lock managers.
   std::unique_ptr<SystemCaches> caches_;
 
+  // Set in children when LoadFromFileWatchMtimes is on; shared by all their
+  // server contexts.
+  std::unique_ptr<FileMtimeCache> file_mtime_cache_;
+
   bool track_original_content_length_;
   bool list_outstanding_urls_on_error_;
 
@@ -46,6 +46,10 @@ const char SystemRewriteOptions::kPopularityContestMaxInFlight[] =
     "ExperimentalPopularityContestMaxInFlight";
 const char SystemRewriteOptions::kPopularityContestMaxQueueSize[] =
     "ExperimentalPopularityContestMaxQueueSize";
+const char SystemRewriteOptions::kCentralControllerClusterNodes[] =
+    "ExperimentalCentralControllerClusterNodes";
+const char SystemRewriteOptions::kCentralControllerClusterAddress[] =
+    "ExperimentalCentralControllerClusterAddress";
 const char SystemRewriteOptions::kStaticAssetCDN[] = "StaticAssetCDN";
 const char SystemRewriteOptions::kRedisServer[] = "RedisServer";
 const char SystemRewriteOptions::kRedisReconnectionDelayMs[] =
@@ -274,12 +278,34 @@ void SystemRewriteOptions::AddProperties() {
       1000, &SystemRewriteOptions::popularity_contest_max_queue_size_, "pcq",
       SystemRewriteOptions::kPopularityContestMaxQueueSize, kProcessScopeStrict,
       "Max number of queued rewrites allowed in the popularity contest", false);
+  AddSystemProperty("", &SystemRewriteOptions::controller_cluster_nodes_,
+                    "cccn",
+                    SystemRewriteOptions::kCentralControllerClusterNodes,
+                    kProcessScopeStrict,
+                    "Comma-separated host:port addresses of the central "
+                    "controllers of all servers sharing rewrites, including "
+                    "this one",
+                    false);
+  AddSystemProperty("", &SystemRewriteOptions::controller_cluster_address_,
+                    "ccca",
+                    SystemRewriteOptions::kCentralControllerClusterAddress,
+                    kProcessScopeStrict,
+                    "This server's entry in the central controller cluster "
+                    "nodes, which its controller also listens on",
+                    false);
   AddSystemProperty(false, &SystemRewriteOptions::disable_loopback_routing_,
                     "adlr", "DangerPermitFetchFromUnknownHosts",
                     kProcessScopeStrict,
                     "Disable security checks that prohibit fetching from "
                     "hostnames mod_pagespeed does not know about",
                     false);
+  AddSystemProperty(false,
+                    &SystemRewriteOptions::load_from_file_watch_mtimes_,
+                    "lfwm", "LoadFromFileWatchMtimes", kProcessScopeStrict,
+                    "Keep LoadFromFile mtimes in memory, using inotify to "
+                    "notice changes, instead of stat'ing inputs on every "
+                    "revalidation",
+                    true);
   AddSystemProperty(false, &SystemRewriteOptions::fetch_with_gzip_, "afg",
                     "FetchWithGzip", kLegacyProcessScope,
                     "Request http content from origin servers using gzip",
@@ -47,6 +47,8 @@ class SystemRewriteOptions : public RewriteOptions {
   static const char kCentralControllerPort[];
   static const char kPopularityContestMaxInFlight[];
   static const char kPopularityContestMaxQueueSize[];
+  static const char kCentralControllerClusterNodes[];
+  static const char kCentralControllerClusterAddress[];
   static const char kStaticAssetCDN[];
   static const char kRedisServer[];
   static const char kRedisReconnectionDelayMs[];
@@ -207,6 +209,12 @@ class SystemRewriteOptions : public RewriteOptions {
   int popularity_contest_max_queue_size() const {
     return popularity_contest_max_queue_size_.value();
   }
+  const GoogleString& controller_cluster_nodes() const {
+    return controller_cluster_nodes_.value();
+  }
+  const GoogleString& controller_cluster_address() const {
+    return controller_cluster_address_.value();
+  }
 
   // Cache flushing configuration.
   void set_cache_flush_poll_interval_sec(int64 num_seconds) {
@@ -243,6 +251,12 @@ class SystemRewriteOptions : public RewriteOptions {
     return disable_loopback_routing_.value();
   }
   bool fetch_with_gzip() const { return fetch_with_gzip_.value(); }
+  bool load_from_file_watch_mtimes() const {
+    return load_from_file_watch_mtimes_.value();
+  }
+  void set_load_from_file_watch_mtimes(bool x) {
+    set_option(x, &load_from_file_watch_mtimes_);
+  }
   int64 ipro_max_response_bytes() const {
     return ipro_max_response_bytes_.value();
   }
@@ -451,6 +465,11 @@ class SystemRewriteOptions : public RewriteOptions {
   // localhost.
   Option<bool> disable_loopback_routing_;
 
+  // If true, each child process keeps the mtimes of LoadFromFile inputs in
+  // memory and watches them with inotify, rather than stat'ing every input
+  // whenever a cached rewrite is revalidated.
+  Option<bool> load_from_file_watch_mtimes_;
+
   // Makes fetches from PSA to origin-server request
   // accept-encoding:gzip, even when used in a context when we want
   // cleartext.  We'll decompress as we read the content if needed.
@@ -459,6 +478,12 @@ class SystemRewriteOptions : public RewriteOptions {
   ControllerPortOption controller_port_;
   Option<int> popularity_contest_max_inflight_requests_;
   Option<int> popularity_contest_max_queue_size_;
+  // Comma-separated addresses of the controllers of every server in a
+  // cluster, and this server's own entry in that list. When both are set,
+  // rewrites are scheduled cluster-wide; see
+  // ClusteredScheduleRewriteController.
+  Option<GoogleString> controller_cluster_nodes_;
+  Option<GoogleString> controller_cluster_address_;
 
   Option<int> memcached_threads_;
   Option<int> memcached_timeout_us_;
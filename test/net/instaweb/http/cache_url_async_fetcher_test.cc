@@ -24,11 +24,13 @@
 
 #include "net/instaweb/http/public/async_fetch.h"
 #include "net/instaweb/http/public/counting_url_async_fetcher.h"
+#include "net/instaweb/http/public/fetch_coalescer.h"
 #include "net/instaweb/http/public/http_cache.h"
 #include "net/instaweb/http/public/http_cache_failure.h"
 #include "net/instaweb/http/public/http_value.h"
 #include "net/instaweb/http/public/logging_proto_impl.h"
 #include "net/instaweb/http/public/request_context.h"
+#include "net/instaweb/http/public/wait_url_async_fetcher.h"
 #include "pagespeed/kernel/base/abstract_mutex.h"  // for ScopedMutex
 #include "pagespeed/kernel/base/function.h"
 #include "pagespeed/kernel/base/message_handler.h"
@@ -431,6 +433,35 @@ class CacheUrlAsyncFetcherTest : public ::testing::Test {
     EXPECT_STREQ(expected_response, fetch_content);
   }
 
+  // Outcome of a fetch started by StartFetch.
+  struct FetchResult {
+    FetchResult() : done(false), success(false), is_cacheable(false) {}
+
+    GoogleString content;
+    bool done;
+    bool success;
+    bool is_cacheable;
+    ResponseHeaders response_headers;
+  };
+
+  // Starts a GET of url through fetcher, without expecting it to finish.
+  void StartFetch(const GoogleString& url, CacheUrlAsyncFetcher* fetcher,
+                  FetchResult* result) {
+    StartFetchWithGzip(url, false, fetcher, result);
+  }
+
+  void StartFetchWithGzip(const GoogleString& url, bool accepts_gzip,
+                          CacheUrlAsyncFetcher* fetcher, FetchResult* result) {
+    RequestContextPtr request_context(new RequestContext(
+        http_options_, thread_system_->NewMutex(), nullptr));
+    request_context->SetAcceptsGzip(accepts_gzip);
+    MockFetch* fetch = new MockFetch(request_context, &result->content,
+                                     &result->done, &result->success,
+                                     &result->is_cacheable);
+    fetch->set_response_headers(&result->response_headers);
+    fetcher->Fetch(url, &handler_, fetch);
+  }
+
   void ClearStats() {
     statistics_.Clear();
     counting_fetcher_.Clear();
@@ -1752,6 +1783,102 @@ TEST_F(CacheUrlAsyncFetcherTest, TestParallelBackgroundFreshenCalls) {
   EXPECT_EQ(0, cache_fetcher_->fallback_responses_served()->Get());
 }
 
+TEST_F(CacheUrlAsyncFetcherTest, ConcurrentMissesShareOneFetch) {
+  FetchCoalescer coalescer(thread_system_.get());
+  WaitUrlAsyncFetcher wait_fetcher(&counting_fetcher_,
+                                   thread_system_->NewMutex());
+  CacheUrlAsyncFetcher fetcher(&mock_hasher_, &lock_manager_,
+                               http_cache_.get(), fragment_,
+                               &mock_async_op_hooks_, &wait_fetcher);
+  fetcher.set_fetch_coalescer(&coalescer);
+  ClearStats();
+
+  FetchResult results[3];
+  for (FetchResult& result : results) {
+    StartFetch(cache_css_url_, &fetcher, &result);
+  }
+  EXPECT_EQ(1, coalescer.num_flights());
+  EXPECT_FALSE(results[2].done);
+
+  wait_fetcher.CallCallbacks();
+  for (const FetchResult& result : results) {
+    EXPECT_TRUE(result.done);
+    EXPECT_TRUE(result.success);
+    EXPECT_EQ(HttpStatus::kOK, result.response_headers.status_code());
+    EXPECT_EQ(cache_body_, result.content);
+  }
+  EXPECT_EQ(1, counting_fetcher_.fetch_count());
+  EXPECT_EQ(3, http_cache_->cache_misses()->Get());
+  EXPECT_EQ(1, http_cache_->cache_inserts()->Get());
+  EXPECT_EQ(0, coalescer.num_flights());
+
+  // Once it's in the cache, it's served from there as usual.
+  FetchResult result;
+  StartFetch(cache_css_url_, &fetcher, &result);
+  EXPECT_TRUE(result.done);
+  EXPECT_EQ(cache_body_, result.content);
+  EXPECT_EQ(1, counting_fetcher_.fetch_count());
+}
+
+TEST_F(CacheUrlAsyncFetcherTest, ConcurrentMissesShareOnlyWithSameGzip) {
+  FetchCoalescer coalescer(thread_system_.get());
+  WaitUrlAsyncFetcher wait_fetcher(&counting_fetcher_,
+                                   thread_system_->NewMutex());
+  CacheUrlAsyncFetcher fetcher(&mock_hasher_, &lock_manager_,
+                               http_cache_.get(), fragment_,
+                               &mock_async_op_hooks_, &wait_fetcher);
+  fetcher.set_fetch_coalescer(&coalescer);
+  ClearStats();
+
+  // The leader's response is replayed verbatim, so only a follower that can
+  // take whatever Content-Encoding it got may share its fetch.
+  FetchResult leader, gzip_follower, plain_follower;
+  StartFetchWithGzip(cache_css_url_, true, &fetcher, &leader);
+  StartFetchWithGzip(cache_css_url_, true, &fetcher, &gzip_follower);
+  StartFetchWithGzip(cache_css_url_, false, &fetcher, &plain_follower);
+  EXPECT_EQ(2, coalescer.num_flights());
+
+  wait_fetcher.CallCallbacks();
+  for (const FetchResult* result :
+       {&leader, &gzip_follower, &plain_follower}) {
+    EXPECT_TRUE(result->done);
+    EXPECT_TRUE(result->success);
+    EXPECT_EQ(cache_body_, result->content);
+  }
+  EXPECT_EQ(2, counting_fetcher_.fetch_count());
+  EXPECT_EQ(0, coalescer.num_flights());
+}
+
+TEST_F(CacheUrlAsyncFetcherTest, ConcurrentMissesOnUncacheableFetchAlone) {
+  FetchCoalescer coalescer(thread_system_.get());
+  WaitUrlAsyncFetcher wait_fetcher(&counting_fetcher_,
+                                   thread_system_->NewMutex());
+  CacheUrlAsyncFetcher fetcher(&mock_hasher_, &lock_manager_,
+                               http_cache_.get(), fragment_,
+                               &mock_async_op_hooks_, &wait_fetcher);
+  fetcher.set_fetch_coalescer(&coalescer);
+  ClearStats();
+
+  FetchResult first, second;
+  StartFetch(nocache_url_, &fetcher, &first);
+  StartFetch(nocache_url_, &fetcher, &second);
+
+  // Since the response can't be cached, it isn't shared either: the second
+  // request only goes to the origin once it learns that.
+  wait_fetcher.CallCallbacks();
+  EXPECT_TRUE(first.done);
+  EXPECT_EQ(nocache_body_, first.content);
+  EXPECT_FALSE(second.done);
+  EXPECT_EQ(0, coalescer.num_flights());
+
+  wait_fetcher.CallCallbacks();
+  EXPECT_TRUE(second.done);
+  EXPECT_TRUE(second.success);
+  EXPECT_EQ(nocache_body_, second.content);
+  EXPECT_EQ(2, counting_fetcher_.fetch_count());
+  EXPECT_EQ(0, http_cache_->cache_inserts()->Get());
+}
+
 }  // namespace
 
 }  // namespace net_instaweb
@@ -0,0 +1,250 @@
+/*
+ * Licensed to the Apache Software Foundation (ASF) under one
+ * or more contributor license agreements.  See the NOTICE file
+ * distributed with this work for additional information
+ * regarding copyright ownership.  The ASF licenses this file
+ * to you under the Apache License, Version 2.0 (the
+ * "License"); you may not use this file except in compliance
+ * with the License.  You may obtain a copy of the License at
+ * 
+ *   http://www.apache.org/licenses/LICENSE-2.0
+ * 
+ * Unless required by applicable law or agreed to in writing,
+ * software distributed under the License is distributed on an
+ * "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY
+ * KIND, either express or implied.  See the License for the
+ * specific language governing permissions and limitations
+ * under the License.
+ */
+
+#include "net/instaweb/http/public/fetch_coalescer.h"
+
+#include <memory>
+
+#include "net/instaweb/http/public/async_fetch.h"
+#include "net/instaweb/http/public/request_context.h"
+#include "pagespeed/kernel/base/basictypes.h"
+#include "pagespeed/kernel/base/function.h"
+#include "pagespeed/kernel/base/null_message_handler.h"
+#include "pagespeed/kernel/base/null_mutex.h"
+#include "pagespeed/kernel/base/string.h"
+#include "pagespeed/kernel/base/string_util.h"
+#include "pagespeed/kernel/base/thread_system.h"
+#include "pagespeed/kernel/http/http_names.h"
+#include "pagespeed/kernel/http/http_options.h"
+#include "pagespeed/kernel/http/response_headers.h"
+#include "pagespeed/kernel/util/platform.h"
+#include "test/pagespeed/kernel/base/gtest.h"
+
+namespace net_instaweb {
+namespace {
+
+const char kKey[] = "http://www.example.com/a.css";
+
+class TestFollower : public FetchCoalescer::Follower {
+ public:
+  TestFollower(StringAsyncFetch* fetch, bool* detached)
+      : fetch_(fetch), detached_(detached) {}
+
+  AsyncFetch* follower_fetch() override { return fetch_; }
+  void Detach() override { *detached_ = true; }
+
+ private:
+  StringAsyncFetch* fetch_;
+  bool* detached_;
+
+  DISALLOW_COPY_AND_ASSIGN(TestFollower);
+};
+
+// Calls a closure from HandleHeadersComplete, to check that followers are
+// not called with any of the coalescer's locks held.
+class ReentrantFetch : public StringAsyncFetch {
+ public:
+  ReentrantFetch(const RequestContextPtr& request_context, Function* callback)
+      : StringAsyncFetch(request_context), callback_(callback) {}
+
+  void HandleHeadersComplete() override {
+    if (callback_ != nullptr) {
+      Function* callback = callback_;
+      callback_ = nullptr;
+      callback->CallRun();
+    }
+  }
+
+ private:
+  Function* callback_;
+
+  DISALLOW_COPY_AND_ASSIGN(ReentrantFetch);
+};
+
+class FetchCoalescerTest : public testing::Test {
+ protected:
+  FetchCoalescerTest()
+      : thread_system_(Platform::CreateThreadSystem()),
+        coalescer_(thread_system_.get()),
+        request_context_(new RequestContext(kDefaultHttpOptionsForTests,
+                                            new NullMutex, nullptr)),
+        fetch1_(request_context_),
+        fetch2_(request_context_),
+        detached1_(false),
+        detached2_(false) {
+    headers_.SetStatusAndReason(HttpStatus::kOK);
+    headers_.Add(HttpAttributes::kContentType, "text/css");
+  }
+
+  // Starts a flight, for which the test plays the leader.
+  FetchCoalescer::Flight* Lead() {
+    return coalescer_.JoinOrLead(kKey, nullptr);
+  }
+
+  // Returns whether fetch was attached to the flight in the air.
+  bool Join(StringAsyncFetch* fetch, bool* detached) {
+    TestFollower* follower = new TestFollower(fetch, detached);
+    if (coalescer_.JoinOrLead(kKey, follower) != nullptr) {
+      delete follower;
+      return false;
+    }
+    return true;
+  }
+
+  // Returns a callback that joins fetch2_, setting *joined if it could.
+  Function* NewJoinSecondCallback(bool* joined) {
+    return MakeFunction(this, &FetchCoalescerTest::JoinSecond, joined);
+  }
+
+  void JoinSecond(bool* joined) { *joined = Join(&fetch2_, &detached2_); }
+
+  std::unique_ptr<ThreadSystem> thread_system_;
+  FetchCoalescer coalescer_;
+  RequestContextPtr request_context_;
+  NullMessageHandler handler_;
+  ResponseHeaders headers_;
+  StringAsyncFetch fetch1_;
+  StringAsyncFetch fetch2_;
+  bool detached1_;
+  bool detached2_;
+};
+
+TEST_F(FetchCoalescerTest, FollowersStreamLeaderResponse) {
+  FetchCoalescer::Flight* flight = Lead();
+  ASSERT_TRUE(flight != nullptr);
+  EXPECT_EQ(1, coalescer_.num_flights());
+
+  // One follower joins before anything has arrived, and one part-way through
+  // the body; both end up with the whole response.
+  EXPECT_TRUE(Join(&fetch1_, &detached1_));
+  flight->HeadersComplete(headers_, true);
+  EXPECT_TRUE(fetch1_.headers_complete());
+  flight->Write("hello ", &handler_);
+  EXPECT_TRUE(Join(&fetch2_, &detached2_));
+  EXPECT_TRUE(fetch2_.headers_complete());
+  EXPECT_EQ(HttpStatus::kOK, fetch2_.response_headers()->status_code());
+  EXPECT_STREQ("text/css", fetch2_.response_headers()->Lookup1(
+                              HttpAttributes::kContentType));
+  EXPECT_EQ("hello ", fetch2_.buffer());
+  flight->Write("world", &handler_);
+  EXPECT_FALSE(fetch1_.done());
+  flight->Done(true);
+
+  EXPECT_EQ(0, coalescer_.num_flights());
+  EXPECT_TRUE(fetch1_.done());
+  EXPECT_TRUE(fetch1_.success());
+  EXPECT_EQ("hello world", fetch1_.buffer());
+  EXPECT_TRUE(fetch2_.done());
+  EXPECT_TRUE(fetch2_.success());
+  EXPECT_EQ("hello world", fetch2_.buffer());
+  EXPECT_FALSE(detached1_);
+  EXPECT_FALSE(detached2_);
+}
+
+TEST_F(FetchCoalescerTest, UnshareableResponseDetachesFollowers) {
+  FetchCoalescer::Flight* flight = Lead();
+  ASSERT_TRUE(flight != nullptr);
+  EXPECT_TRUE(Join(&fetch1_, &detached1_));
+  flight->HeadersComplete(headers_, false);
+  EXPECT_TRUE(detached1_);
+  EXPECT_FALSE(fetch1_.headers_complete());
+
+  // Later requests get a flight of their own.
+  EXPECT_EQ(0, coalescer_.num_flights());
+  FetchCoalescer::Flight* flight2 = Lead();
+  ASSERT_TRUE(flight2 != nullptr);
+
+  flight->Write("private", &handler_);
+  flight->Done(true);
+  EXPECT_EQ("", fetch1_.buffer());
+  flight2->Done(false);
+}
+
+TEST_F(FetchCoalescerTest, FailureBeforeHeadersDetachesFollowers) {
+  FetchCoalescer::Flight* flight = Lead();
+  ASSERT_TRUE(flight != nullptr);
+  EXPECT_TRUE(Join(&fetch1_, &detached1_));
+  flight->Done(false);
+  EXPECT_TRUE(detached1_);
+  EXPECT_FALSE(fetch1_.done());
+  EXPECT_EQ(0, coalescer_.num_flights());
+}
+
+TEST_F(FetchCoalescerTest, FollowerCanJoinFromItsCallback) {
+  FetchCoalescer::Flight* flight = Lead();
+  ASSERT_TRUE(flight != nullptr);
+
+  // When the first follower gets its headers, a second one joins; that
+  // would deadlock if followers were called with a lock held.
+  bool joined = false;
+  ReentrantFetch reentrant_fetch(request_context_,
+                                 NewJoinSecondCallback(&joined));
+  bool reentrant_detached = false;
+  TestFollower* follower =
+      new TestFollower(&reentrant_fetch, &reentrant_detached);
+  ASSERT_TRUE(coalescer_.JoinOrLead(kKey, follower) == nullptr);
+  EXPECT_FALSE(joined);
+
+  flight->HeadersComplete(headers_, true);
+  EXPECT_TRUE(joined);
+  EXPECT_TRUE(fetch2_.headers_complete());
+  flight->Write("body", &handler_);
+  flight->Done(true);
+  EXPECT_EQ("body", reentrant_fetch.buffer());
+  EXPECT_EQ("body", fetch2_.buffer());
+  EXPECT_TRUE(fetch2_.done());
+  EXPECT_FALSE(reentrant_detached);
+  EXPECT_FALSE(detached2_);
+}
+
+TEST_F(FetchCoalescerTest, LargeBodyStopsTakingFollowers) {
+  FetchCoalescer::Flight* flight = Lead();
+  ASSERT_TRUE(flight != nullptr);
+  EXPECT_TRUE(Join(&fetch1_, &detached1_));
+  flight->HeadersComplete(headers_, true);
+  GoogleString chunk(FetchCoalescer::kMaxReplayBytes / 2, 'x');
+  flight->Write(chunk, &handler_);
+  flight->Write(chunk, &handler_);
+
+  // At the limit late followers can still catch up; past it they can't, and
+  // lead a flight of their own.
+  EXPECT_TRUE(Join(&fetch2_, &detached2_));
+  flight->Write("y", &handler_);
+  StringAsyncFetch fetch3(request_context_);
+  bool detached3 = false;
+  TestFollower* follower3 = new TestFollower(&fetch3, &detached3);
+  FetchCoalescer::Flight* flight2 = coalescer_.JoinOrLead(kKey, follower3);
+  ASSERT_TRUE(flight2 != nullptr);
+  delete follower3;
+
+  flight->Write("z", &handler_);
+  flight->Done(true);
+  GoogleString expected = StrCat(chunk, chunk, "yz");
+  EXPECT_EQ(expected, fetch1_.buffer());
+  EXPECT_EQ(expected, fetch2_.buffer());
+  EXPECT_TRUE(fetch2_.done());
+
+  // The old flight landing leaves the new one in the air.
+  EXPECT_EQ(1, coalescer_.num_flights());
+  flight2->Done(false);
+  EXPECT_EQ(0, coalescer_.num_flights());
+}
+
+}  // namespace
+}  // namespace net_instaweb
@@ -447,6 +447,48 @@ TEST_F(CssFilterTestCustomOptions, FallbackWithGzipData) {
   EXPECT_FALSE(out_headers.IsGzipped());
 }
 
+TEST_F(CssFilterTestCustomOptions, CssStreamingRewrite) {
+  options()->set_css_streaming_rewrite(true);
+  options()->EnableFilter(RewriteOptions::kFallbackRewriteCssUrls);
+  CssFilterTest::SetUp();
+  // Minified from the token stream, so the color is left as written.
+  ValidateRewrite("streaming",
+                  ".a { color: #ff0000 ; }\n/* gone */\n.b  .c { margin: 0 }",
+                  ".a{color:#ff0000}.b .c{margin:0}", kExpectSuccess);
+}
+
+TEST_F(CssFilterTestCustomOptions, CssStreamingRewriteFallsBackOnLexError) {
+  options()->set_css_streaming_rewrite(true);
+  options()->EnableFilter(RewriteOptions::kFallbackRewriteCssUrls);
+  CssFilterTest::SetUp();
+  // The tokenizer rejects the unquoted space in url(), but the fallback
+  // scanner still passes the CSS through.
+  static const char kCss[] = ".a { background: url(foo bar.png) }";
+  ValidateRewrite("streaming_lex_error", kCss, kCss, kExpectFallback);
+}
+
+TEST_F(CssFilterTestCustomOptions, CssStreamingRewriteNeedsFallback) {
+  options()->set_css_streaming_rewrite(true);
+  CssFilterTest::SetUp();
+  // Without fallback URL rewriting the CSS goes through the full parser,
+  // which rejects it, rather than being minified from the token stream.
+  ValidateRewriteExternalCss("streaming_no_fallback", "@media }}", "",
+                             kExpectFailure);
+  EXPECT_EQ(1, num_parse_failures_->Get());
+}
+
+TEST_F(CssFilterTestCustomOptions, CssStreamingRewriteNoImprovement) {
+  options()->set_css_streaming_rewrite(true);
+  options()->EnableFilter(RewriteOptions::kFallbackRewriteCssUrls);
+  CssFilterTest::SetUp();
+  options()->ClearSignatureForTesting();
+  options()->set_always_rewrite_css(false);
+  DebugWithMessage("<!--CSS rewrite failed: Cannot improve %url%-->");
+  server_context()->ComputeSignature(options());
+  ValidateRewrite("streaming_no_improvement", ".a{color:red}",
+                  ".a{color:red}", kExpectNoChange);
+}
+
 TEST_F(CssFilterTest, LinkHrefCaseInsensitive) {
   // Make sure we check rel value case insensitively.
   // http://github.com/apache/incubator-pagespeed-mod/issues/354
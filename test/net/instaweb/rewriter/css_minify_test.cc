@@ -19,6 +19,7 @@
 
 #include "net/instaweb/rewriter/public/css_minify.h"
 
+#include "net/instaweb/rewriter/public/css_tag_scanner.h"
 #include "pagespeed/kernel/base/google_message_handler.h"
 #include "pagespeed/kernel/base/scoped_ptr.h"
 #include "pagespeed/kernel/base/string.h"
@@ -287,5 +288,95 @@ TEST_F(CssMinifyTest, CssUnicodeRangeDescriptor) {
                     minified);
 }
 
+class PrefixingTransformer : public CssTagScanner::Transformer {
+ public:
+  TransformStatus Transform(GoogleString* str) override {
+    if (*str == "bad.png") {
+      return kFailure;
+    }
+    str->insert(0, "http://cdn/");
+    return kSuccess;
+  }
+};
+
+TEST_F(CssMinifyTest, StreamingMinifyCollectingUrls) {
+  const char kCss[] =
+      "/* Header */\n"
+      ".a {\n"
+      "  background-color: darkgreen;\n"
+      "  background-image: url( 'foo.png' );\n"
+      "}";
+  GoogleString minified;
+  StringWriter writer(&minified);
+  StringVector urls;
+  CssMinify minify(&writer, &handler_);
+  minify.set_url_collector(&urls);
+  EXPECT_TRUE(minify.MinifyStylesheetStreaming(kCss));
+  ASSERT_EQ(1, urls.size());
+  EXPECT_STREQ("foo.png", urls[0]);
+  // Unlike ParseStylesheet, values are not normalized.
+  EXPECT_STREQ(".a{background-color:darkgreen;background-image:url(foo.png)}",
+               minified);
+}
+
+TEST_F(CssMinifyTest, StreamingMinifyKeepsSignificantSpace) {
+  const char kCss[] =
+      "@media screen and (max-width: 10px) {\n"
+      "  .a  .b , .c/**/.d > p { margin : 0 auto ; width: calc(1px + 2px) }\n"
+      "  i{font:1em/**/serif !important;;}\n"
+      "}\n";
+  GoogleString minified;
+  StringWriter writer(&minified);
+  CssMinify minify(&writer, &handler_);
+  EXPECT_TRUE(minify.MinifyStylesheetStreaming(kCss));
+  EXPECT_STREQ(
+      "@media screen and (max-width:10px){.a .b,.c.d>p{margin:0 auto;"
+      "width:calc(1px + 2px)}i{font:1em/**/serif!important}}",
+      minified);
+}
+
+TEST_F(CssMinifyTest, StreamingMinifySpaceBeforeColon) {
+  // Only in declarations is the space before a ':' redundant.
+  const char kCss[] =
+      "a :hover { color : red }\n"
+      "@media print { p :first-child { margin :0 } }\n"
+      "@font-face { font-family : x }";
+  GoogleString minified;
+  StringWriter writer(&minified);
+  CssMinify minify(&writer, &handler_);
+  EXPECT_TRUE(minify.MinifyStylesheetStreaming(kCss));
+  EXPECT_STREQ(
+      "a :hover{color:red}@media print{p :first-child{margin:0}}"
+      "@font-face{font-family:x}",
+      minified);
+}
+
+TEST_F(CssMinifyTest, StreamingMinifyDropsEmptyDeclarations) {
+  // A ';' at the top level is part of the next rule's prelude, which makes
+  // that rule invalid, so it must survive minification.
+  const char kCss[] = "a { ; b : c ; ; } ; d { e : f ; }";
+  GoogleString minified;
+  StringWriter writer(&minified);
+  CssMinify minify(&writer, &handler_);
+  EXPECT_TRUE(minify.MinifyStylesheetStreaming(kCss));
+  EXPECT_STREQ("a{b:c};d{e:f}", minified);
+}
+
+TEST_F(CssMinifyTest, StreamingMinifyTransformsUrls) {
+  const char kCss[] = "@import 'a.css';\nb { background: URL(x.png) }";
+  GoogleString minified;
+  StringWriter writer(&minified);
+  PrefixingTransformer transformer;
+  CssMinify minify(&writer, &handler_);
+  minify.set_url_transformer(&transformer);
+  EXPECT_TRUE(minify.MinifyStylesheetStreaming(kCss));
+  EXPECT_STREQ(
+      "@import \"http://cdn/a.css\";b{background:url(http://cdn/x.png)}",
+      minified);
+
+  minified.clear();
+  EXPECT_FALSE(minify.MinifyStylesheetStreaming("b{background:url(bad.png)}"));
+}
+
 }  // namespace
 }  // namespace net_instaweb
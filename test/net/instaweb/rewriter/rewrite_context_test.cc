@@ -48,11 +48,13 @@
 #include "pagespeed/kernel/base/charset_util.h"
 #include "pagespeed/kernel/base/named_lock_manager.h"
 #include "pagespeed/kernel/base/scoped_ptr.h"
+#include "pagespeed/kernel/base/shared_string.h"
 #include "pagespeed/kernel/base/statistics.h"
 #include "pagespeed/kernel/base/stl_util.h"
 #include "pagespeed/kernel/base/string.h"
 #include "pagespeed/kernel/base/string_util.h"
 #include "pagespeed/kernel/base/timer.h"
+#include "pagespeed/kernel/cache/cache_interface.h"
 #include "pagespeed/kernel/cache/lru_cache.h"
 #include "pagespeed/kernel/cache/write_through_cache.h"
 #include "pagespeed/kernel/html/html_element.h"
@@ -85,6 +87,43 @@ namespace {
 // from repetitions of the driver's timeout).
 const int64 kRewriteDelayMs = 47;
 
+// Passes everything through to another cache, counting the lookups so tests
+// can see how they were batched.
+class LookupCountingCache : public CacheInterface {
+ public:
+  explicit LookupCountingCache(CacheInterface* cache)
+      : cache_(cache), num_gets_(0), num_multi_gets_(0) {}
+  ~LookupCountingCache() override {}
+
+  void Get(const GoogleString& key, Callback* callback) override {
+    ++num_gets_;
+    cache_->Get(key, callback);
+  }
+  void MultiGet(MultiGetRequest* request) override {
+    ++num_multi_gets_;
+    cache_->MultiGet(request);
+  }
+  void Put(const GoogleString& key, const SharedString& value) override {
+    cache_->Put(key, value);
+  }
+  void Delete(const GoogleString& key) override { cache_->Delete(key); }
+  GoogleString Name() const override { return cache_->Name(); }
+  bool IsBlocking() const override { return cache_->IsBlocking(); }
+  bool IsHealthy() const override { return cache_->IsHealthy(); }
+  void ShutDown() override { cache_->ShutDown(); }
+
+  CacheInterface* cache() { return cache_; }
+  int num_gets() const { return num_gets_; }
+  int num_multi_gets() const { return num_multi_gets_; }
+
+ private:
+  CacheInterface* cache_;
+  int num_gets_;
+  int num_multi_gets_;
+
+  DISALLOW_COPY_AND_ASSIGN(LookupCountingCache);
+};
+
 }  // namespace
 
 class RewriteContextTest : public RewriteContextTestBase {
@@ -303,6 +342,35 @@ TEST_F(RewriteContextTest, TrimOnTheFlyWithVaryCookie) {
   ValidateNoChanges("vary_cookie", input_html);
 }
 
+TEST_F(RewriteContextTest, MetadataLookupsBatchedPerFlushWindow) {
+  InitTrimFilters(kOnTheFlyResource);
+  InitResources();
+  LookupCountingCache counting_cache(server_context()->metadata_cache());
+  server_context()->set_metadata_cache(&counting_cache);
+
+  // A window with a single rewrite has nothing to batch.
+  ValidateExpected("single", CssLinkHref("a.css"),
+                   CssLinkHref(Encode("", "tw", "0", "a.css", "css")));
+  EXPECT_EQ(0, counting_cache.num_multi_gets());
+  EXPECT_EQ(1, counting_cache.num_gets());
+
+  // Otherwise each flush window looks up its rewrites' metadata in one
+  // MultiGet.
+  SetupWriter();
+  rewrite_driver()->StartParse(kTestDomain);
+  rewrite_driver()->ParseText(
+      StrCat(CssLinkHref("a.css"), CssLinkHref("b.css")));
+  rewrite_driver()->Flush();
+  EXPECT_EQ(1, counting_cache.num_multi_gets());
+  rewrite_driver()->ParseText(
+      StrCat(CssLinkHref("d.css"), CssLinkHref("e.css")));
+  rewrite_driver()->FinishParse();
+  EXPECT_EQ(2, counting_cache.num_multi_gets());
+  EXPECT_EQ(1, counting_cache.num_gets());
+
+  server_context()->set_metadata_cache(counting_cache.cache());
+}
+
 TEST_F(RewriteContextTest, UnhealthyCacheNoHtmlRewrites) {
   lru_cache()->set_is_healthy(false);
   InitTrimFilters(kOnTheFlyResource);
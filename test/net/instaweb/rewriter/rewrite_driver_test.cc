@@ -34,6 +34,8 @@
 #include "net/instaweb/rewriter/public/server_context.h"
 #include "net/instaweb/rewriter/public/single_rewrite_context.h"
 #include "net/instaweb/rewriter/public/url_namer.h"
+#include "net/instaweb/util/public/mock_property_page.h"
+#include "net/instaweb/util/public/property_cache.h"
 #include "pagespeed/kernel/base/abstract_mutex.h"
 #include "pagespeed/kernel/base/basictypes.h"
 #include "pagespeed/kernel/base/hasher.h"
@@ -90,6 +92,31 @@ class RewriteDriverTest : public RewriteTestBase {
     return rewrite_driver()->ComputeCurrentFlushWindowRewriteDelayMs();
   }
 
+  // Gives the driver a property page with a dom cohort, holding
+  // learned_rewrite_ms as the flush window rewrite time learned from earlier
+  // responses unless it is empty.
+  PropertyPage* SetupLearnedFlushWindow(StringPiece learned_rewrite_ms) {
+    PropertyCache* pcache = server_context()->page_property_cache();
+    const PropertyCache::Cohort* dom_cohort =
+        SetupCohort(pcache, RewriteDriver::kDomCohort);
+    server_context()->set_dom_cohort(dom_cohort);
+    pcache->set_enabled(true);
+    MockPropertyPage* page = NewMockPage(kTestDomain);
+    pcache->Read(page);
+    if (!learned_rewrite_ms.empty()) {
+      page->UpdateValue(dom_cohort, RewriteDriver::kFlushWindowRewriteMs,
+                        learned_rewrite_ms);
+    }
+    rewrite_driver()->set_property_page(page);
+    return page;
+  }
+
+  StringPiece GetDomCohortValue(PropertyPage* page, StringPiece name) {
+    const PropertyCache::Cohort* dom_cohort = server_context()->dom_cohort();
+    PropertyValue* value = page->GetProperty(dom_cohort, name);
+    return value->has_value() ? value->value() : StringPiece();
+  }
+
   bool IsDone(RewriteDriver::WaitMode wait_mode, bool deadline_reached) {
     ScopedMutex lock(rewrite_driver()->rewrite_mutex());
     return rewrite_driver()->IsDone(wait_mode, deadline_reached);
@@ -825,6 +852,125 @@ TEST_F(RewriteDriverTest, TestComputeCurrentFlushWindowRewriteDelayMs) {
   rewrite_driver()->FinishParse();
 }
 
+// With adaptive_flush_window the per-flush window deadline follows the rewrite
+// time learned from earlier responses, within bounds.
+TEST_F(RewriteDriverTest, AdaptiveFlushWindowUsesLearnedRewriteTime) {
+  options()->set_rewrite_deadline_ms(1000);
+  options()->set_adaptive_flush_window(true);
+  rewrite_driver()->AddFilters();
+  SetupLearnedFlushWindow("400");
+  ASSERT_TRUE(rewrite_driver()->StartParseId(
+      "http://site.com/", "adaptive_flush_window_test", kContentTypeHtml));
+
+  // Half again the learned time, to allow for variation around the average.
+  EXPECT_EQ(600, GetFlushTimeout());
+
+  // The per-page deadline still applies.
+  rewrite_driver()->set_max_page_processing_delay_ms(500);
+  EXPECT_EQ(500, GetFlushTimeout());
+
+  rewrite_driver()->FinishParse();
+}
+
+TEST_F(RewriteDriverTest, AdaptiveFlushWindowIsBounded) {
+  options()->set_rewrite_deadline_ms(1000);
+  options()->set_adaptive_flush_window(true);
+  rewrite_driver()->AddFilters();
+  SetupLearnedFlushWindow("100000");
+  ASSERT_TRUE(rewrite_driver()->StartParseId(
+      "http://site.com/", "adaptive_flush_window_test", kContentTypeHtml));
+  EXPECT_EQ(2000, GetFlushTimeout());
+  rewrite_driver()->FinishParse();
+}
+
+TEST_F(RewriteDriverTest, AdaptiveFlushWindowWithoutHistory) {
+  options()->set_rewrite_deadline_ms(1000);
+  options()->set_adaptive_flush_window(true);
+  rewrite_driver()->AddFilters();
+  SetupLearnedFlushWindow("");
+  ASSERT_TRUE(rewrite_driver()->StartParseId(
+      "http://site.com/", "adaptive_flush_window_test", kContentTypeHtml));
+  EXPECT_EQ(1000, GetFlushTimeout());
+  EXPECT_EQ(4096, rewrite_driver()->FlushWindowBufferLimitBytes(4096));
+  rewrite_driver()->FinishParse();
+}
+
+// The head end and the rewrite time seen by a response are written to the
+// dom cohort for the next one, and the end of the head requests a flush.
+TEST_F(RewriteDriverTest, AdaptiveFlushWindowLearns) {
+  options()->set_adaptive_flush_window(true);
+  AddFilter(RewriteOptions::kExtendCacheCss);
+  SetResponseWithDefaultHeaders("a.css", kContentTypeCss, "a{}", 100);
+  PropertyPage* page = SetupLearnedFlushWindow("400");
+
+  const GoogleString head = StrCat("<head>", CssLinkHref("a.css"), "</head>");
+  ASSERT_TRUE(rewrite_driver()->StartParse(kTestDomain));
+  rewrite_driver()->ParseText(head);
+  EXPECT_TRUE(rewrite_driver()->flush_requested());
+  RewriteStats* stats = server_context()->rewrite_stats();
+  EXPECT_EQ(1, stats->num_head_flushes()->Get());
+  rewrite_driver()->ExecuteFlushIfRequested();
+  rewrite_driver()->ParseText("<body><p>text</p></body>");
+  EXPECT_FALSE(rewrite_driver()->flush_requested());
+  rewrite_driver()->FinishParse();
+
+  EXPECT_EQ(IntegerToString(head.size()),
+            GetDomCohortValue(page, RewriteDriver::kHeadEndBytes));
+  // The rewrite finished without the mock clock moving, so the learned time
+  // moves a quarter of the way from 400ms towards 0.
+  EXPECT_EQ("300",
+            GetDomCohortValue(page, RewriteDriver::kFlushWindowRewriteMs));
+  EXPECT_EQ(1, stats->num_head_flushes()->Get());
+}
+
+// A window that gave up on its rewrites is remembered as having needed twice
+// its deadline, since we can't tell how much longer they would have taken.
+TEST_F(RewriteDriverTest, AdaptiveFlushWindowPenalizesMissedDeadline) {
+  options()->set_rewrite_deadline_ms(1000);
+  options()->set_adaptive_flush_window(true);
+  AddFilter(RewriteOptions::kExtendCacheCss);
+  SetResponseWithDefaultHeaders("a.css", kContentTypeCss, "a{}", 100);
+  SetupWaitFetcher();
+  // Pin the driver so the fetch can be released after FinishParse.
+  rewrite_driver()->AddUserReference();
+  PropertyPage* page = SetupLearnedFlushWindow("");
+
+  ASSERT_TRUE(rewrite_driver()->StartParse(kTestDomain));
+  rewrite_driver()->ParseText(CssLinkHref("a.css"));
+  rewrite_driver()->Flush();
+  rewrite_driver()->FinishParse();
+  RewriteStats* stats = server_context()->rewrite_stats();
+  EXPECT_EQ(1, stats->cached_output_missed_deadline()->Get());
+  EXPECT_EQ("2000",
+            GetDomCohortValue(page, RewriteDriver::kFlushWindowRewriteMs));
+
+  factory()->CallFetcherCallbacksForDriver(rewrite_driver());
+  rewrite_driver()->Cleanup();
+}
+
+// Until the head has been parsed, the first window is cut where the head of
+// the previous response ended.
+TEST_F(RewriteDriverTest, AdaptiveFlushWindowBufferLimitWithHistory) {
+  options()->set_adaptive_flush_window(true);
+  rewrite_driver()->AddFilters();
+  PropertyPage* page = SetupLearnedFlushWindow("");
+  page->UpdateValue(server_context()->dom_cohort(),
+                    RewriteDriver::kHeadEndBytes, "50");
+  ASSERT_TRUE(rewrite_driver()->StartParseId(
+      "http://site.com/", "adaptive_flush_window_test", kContentTypeHtml));
+  EXPECT_EQ(50, rewrite_driver()->FlushWindowBufferLimitBytes(4096));
+  EXPECT_EQ(10, rewrite_driver()->FlushWindowBufferLimitBytes(10));
+
+  rewrite_driver()->ParseText("<head><title>x</title>");  // 22 bytes.
+  EXPECT_EQ(28, rewrite_driver()->FlushWindowBufferLimitBytes(4096));
+
+  // Once the head is seen the configured limit applies again, even though
+  // fewer bytes arrived than last time.
+  rewrite_driver()->ParseText("</head>");
+  EXPECT_EQ(4096, rewrite_driver()->FlushWindowBufferLimitBytes(4096));
+  rewrite_driver()->FinishParse();
+}
+
 // Extension of above with cache invalidation.
 TEST_F(RewriteDriverTest, TestCacheUseOnTheFlyWithInvalidation) {
   AddFilter(RewriteOptions::kExtendCacheCss);
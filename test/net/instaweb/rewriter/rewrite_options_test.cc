@@ -864,6 +864,7 @@ TEST_F(RewriteOptionsTest, LookupOptionByNameTest) {
   const char* const option_names[] = {
       RewriteOptions::kAcceptInvalidSignatures,
       RewriteOptions::kAccessControlAllowOrigins,
+      RewriteOptions::kAdaptiveFlushWindow,
       RewriteOptions::kAddOptionsToUrls,
       RewriteOptions::kAllowLoggingUrlsInLogRecord,
       RewriteOptions::kAllowOptionsToBeSetByCookies,
@@ -887,6 +888,7 @@ TEST_F(RewriteOptionsTest, LookupOptionByNameTest) {
       RewriteOptions::kCssInlineMaxBytes,
       RewriteOptions::kCssOutlineMinBytes,
       RewriteOptions::kCssPreserveURLs,
+      RewriteOptions::kCssStreamingRewrite,
       RewriteOptions::kDefaultCacheHtml,
       RewriteOptions::kDisableBackgroundFetchesForBots,
       RewriteOptions::kDisableRewriteOnNoTransform,
@@ -915,6 +917,7 @@ TEST_F(RewriteOptionsTest, LookupOptionByNameTest) {
       RewriteOptions::kForbidAllDisabledFilters,
       RewriteOptions::kGoogleFontCssInlineMaxBytes,
       RewriteOptions::kHideRefererUsingMeta,
+      RewriteOptions::kHtmlCompressionLevel,
       RewriteOptions::kHttpCacheCompressionLevel,
       RewriteOptions::kHonorCsp,
       RewriteOptions::kIdleFlushTimeMs,
@@ -981,6 +984,7 @@ TEST_F(RewriteOptionsTest, LookupOptionByNameTest) {
       RewriteOptions::kObliviousPagespeedUrls,
       RewriteOptions::kOptionCookiesDurationMs,
       RewriteOptions::kOverrideCachingTtlMs,
+      RewriteOptions::kPipelineHtmlParse,
       RewriteOptions::kPreserveSubresourceHints,
       RewriteOptions::kPreserveUrlRelativity,
       RewriteOptions::kPrivateNotVaryForIE,
@@ -22,23 +22,30 @@
 #include "pagespeed/automatic/proxy_fetch.h"
 
 #include <memory>
+#include <vector>
 
 #include "base/logging.h"
 #include "net/instaweb/http/public/logging_proto_impl.h"
 #include "net/instaweb/http/public/request_context.h"
 #include "net/instaweb/rewriter/public/rewrite_driver.h"
 #include "net/instaweb/rewriter/public/rewrite_options.h"
+#include "net/instaweb/rewriter/public/rewrite_stats.h"
 #include "net/instaweb/rewriter/public/server_context.h"
+#include "net/instaweb/util/public/mock_property_page.h"
+#include "net/instaweb/util/public/property_cache.h"
 #include "pagespeed/kernel/base/abstract_mutex.h"
 #include "pagespeed/kernel/base/function.h"
 #include "pagespeed/kernel/base/message_handler.h"
 #include "pagespeed/kernel/base/null_message_handler.h"
 #include "pagespeed/kernel/base/scoped_ptr.h"
+#include "pagespeed/kernel/base/string.h"
+#include "pagespeed/kernel/base/string_util.h"
 #include "pagespeed/kernel/base/thread_system.h"
 #include "pagespeed/kernel/http/http_names.h"
 #include "pagespeed/kernel/http/request_headers.h"
 #include "pagespeed/kernel/http/response_headers.h"
 #include "pagespeed/kernel/thread/thread_synchronizer.h"
+#include "pagespeed/kernel/util/gzip_inflater.h"
 #include "pagespeed/kernel/util/platform.h"
 #include "pagespeed/opt/logging/log_record.h"
 #include "test/net/instaweb/http/mock_callback.h"
@@ -316,6 +323,46 @@ class FlushLoggingStringAsyncFetch : public StringAsyncFetch {
   DISALLOW_COPY_AND_ASSIGN(FlushLoggingStringAsyncFetch);
 };
 
+// Records how much had been written at each flush, for output that can't
+// have markers spliced into it.
+class FlushRecordingStringAsyncFetch : public StringAsyncFetch {
+ public:
+  explicit FlushRecordingStringAsyncFetch(
+      const RequestContextPtr& request_context)
+      : StringAsyncFetch(request_context) {}
+
+  ~FlushRecordingStringAsyncFetch() override {}
+
+  bool HandleFlush(MessageHandler* handler) override {
+    flush_offsets_.push_back(buffer().size());
+    return true;
+  }
+
+  const std::vector<size_t>& flush_offsets() const { return flush_offsets_; }
+
+ private:
+  std::vector<size_t> flush_offsets_;
+
+  DISALLOW_COPY_AND_ASSIGN(FlushRecordingStringAsyncFetch);
+};
+
+// Inflates as much of gzipped as can be decoded, setting *finished if that
+// reached the end of the gzip stream.
+GoogleString Gunzip(StringPiece gzipped, bool* finished) {
+  GzipInflater inflater(GzipInflater::kGzip);
+  EXPECT_TRUE(inflater.Init());
+  EXPECT_TRUE(inflater.SetInput(gzipped.data(), gzipped.size()));
+  GoogleString out;
+  char buf[1024];
+  int n;
+  while ((n = inflater.InflateBytes(buf, sizeof(buf))) > 0) {
+    out.append(buf, n);
+  }
+  EXPECT_FALSE(inflater.error());
+  *finished = inflater.finished();
+  return out;
+}
+
 }  // namespace
 
 TEST_F(ProxyFetchTest, TestFollowFlushes) {
@@ -379,6 +426,255 @@ TEST_F(ProxyFetchTest, TestFollowFlushes) {
   EXPECT_EQ("<html><d>1</d><d>2</d></html>|Flush|", fetch_off.buffer());
 }
 
+TEST_F(ProxyFetchTest, TestPipelineHtmlParse) {
+  NullMessageHandler handler;
+  RewriteOptions* options = server_context()->global_options();
+  options->ClearSignatureForTesting();
+  options->DisableFilter(RewriteOptions::kAddHead);
+  options->set_pipeline_html_parse(true);
+  options->set_flush_buffer_limit_bytes(10);
+  options->ComputeSignature();
+  StringAsyncFetch fetch(
+      RequestContext::NewTestRequestContext(server_context()->thread_system()));
+  fetch.response_headers()->Add("Content-Type", "text/html");
+  ProxyFetchFactory factory(server_context_);
+  MockProxyFetch* mock_proxy_fetch =
+      new MockProxyFetch(&fetch, &factory, server_context());
+  mock_proxy_fetch->response_headers()->ComputeCaching();
+
+  // Unlike TestFollowFlushes, keep writing while flushes are outstanding, so
+  // that the text is lexed ahead of them and split by the buffer limit.
+  const char* kChunks[] = {"<html><div>1", "</div><p>2</p><scr",
+                           "ipt>a=b;</script>", "<d>3</d></html>"};
+  GoogleString expected;
+  for (const char* chunk : kChunks) {
+    mock_proxy_fetch->Write(chunk, &handler);
+    mock_proxy_fetch->Flush(&handler);
+    StrAppend(&expected, chunk);
+  }
+  EXPECT_TRUE(mock_proxy_fetch->started_parse_);
+
+  mock_proxy_fetch->Done(true);
+  mock_scheduler()->AwaitQuiescence();
+  EXPECT_EQ(0, server_context()->num_active_rewrite_drivers());
+  EXPECT_EQ(expected, fetch.buffer());
+}
+
+TEST_F(ProxyFetchTest, TestPipelineHtmlParseAmp) {
+  NullMessageHandler handler;
+  RewriteOptions* options = server_context()->global_options();
+  options->ClearSignatureForTesting();
+  options->DisableFilter(RewriteOptions::kAddHead);
+  options->EnableFilter(RewriteOptions::kAddInstrumentation);
+  options->set_pipeline_html_parse(true);
+  options->set_flush_buffer_limit_bytes(10);
+  options->ComputeSignature();
+  StringAsyncFetch fetch(
+      RequestContext::NewTestRequestContext(server_context()->thread_system()));
+  fetch.response_headers()->Add("Content-Type", "text/html");
+  ProxyFetchFactory factory(server_context_);
+  MockProxyFetch* mock_proxy_fetch =
+      new MockProxyFetch(&fetch, &factory, server_context());
+  mock_proxy_fetch->response_headers()->ComputeCaching();
+
+  // The doctype leaves AMPness undecided, so <html amp> arrives while events
+  // are still buffered.  It must not be lexed ahead of the first flush, or
+  // the instrumentation script would be disabled half way through rewriting
+  // that window.
+  const char* kChunks[] = {"<!doctype html>  ", "<html amp><head></head>",
+                           "<body>1</body></html>"};
+  GoogleString expected;
+  for (const char* chunk : kChunks) {
+    mock_proxy_fetch->Write(chunk, &handler);
+    mock_proxy_fetch->Flush(&handler);
+    StrAppend(&expected, chunk);
+  }
+
+  mock_proxy_fetch->Done(true);
+  mock_scheduler()->AwaitQuiescence();
+  EXPECT_EQ(0, server_context()->num_active_rewrite_drivers());
+  EXPECT_EQ(expected, fetch.buffer());
+}
+
+// With adaptive_flush_window, the end of the head is flushed as soon as the
+// text holding it is parsed, without waiting for a network flush.
+TEST_F(ProxyFetchTest, TestAdaptiveFlushWindowFlushesHead) {
+  NullMessageHandler handler;
+  RewriteOptions* options = server_context()->global_options();
+  options->ClearSignatureForTesting();
+  options->DisableFilter(RewriteOptions::kAddHead);
+  options->set_adaptive_flush_window(true);
+  options->ComputeSignature();
+  FlushLoggingStringAsyncFetch fetch(
+      RequestContext::NewTestRequestContext(server_context()->thread_system()));
+  fetch.response_headers()->Add("Content-Type", "text/html");
+  ProxyFetchFactory factory(server_context_);
+  MockProxyFetch* mock_proxy_fetch =
+      new MockProxyFetch(&fetch, &factory, server_context());
+  mock_proxy_fetch->response_headers()->ComputeCaching();
+
+  mock_proxy_fetch->Write("<html><head><title>t</title></head>", &handler);
+  mock_scheduler()->AwaitQuiescence();
+  mock_proxy_fetch->Write("<body>b</body></html>", &handler);
+  mock_scheduler()->AwaitQuiescence();
+
+  mock_proxy_fetch->Done(true);
+  mock_scheduler()->AwaitQuiescence();
+  EXPECT_EQ(0, server_context()->num_active_rewrite_drivers());
+  EXPECT_EQ(
+      "<html><head><title>t</title></head>|Flush|<body>b</body></html>|Flush|",
+      fetch.buffer());
+  EXPECT_EQ(1, server_context()->rewrite_stats()->num_head_flushes()->Get());
+}
+
+// Until the head has been parsed, the first window is cut where the head of
+// the previous response for the URL ended.
+TEST_F(ProxyFetchTest, TestAdaptiveFlushWindowLowersFirstBufferLimit) {
+  NullMessageHandler handler;
+  RewriteOptions* options = server_context()->global_options();
+  options->ClearSignatureForTesting();
+  options->DisableFilter(RewriteOptions::kAddHead);
+  options->set_adaptive_flush_window(true);
+  options->set_flush_buffer_limit_bytes(1000);
+  options->ComputeSignature();
+  FlushLoggingStringAsyncFetch fetch(
+      RequestContext::NewTestRequestContext(server_context()->thread_system()));
+  fetch.response_headers()->Add("Content-Type", "text/html");
+  ProxyFetchFactory factory(server_context_);
+  MockProxyFetch* mock_proxy_fetch =
+      new MockProxyFetch(&fetch, &factory, server_context());
+  mock_proxy_fetch->response_headers()->ComputeCaching();
+
+  PropertyCache* pcache = server_context()->page_property_cache();
+  const PropertyCache::Cohort* dom_cohort =
+      SetupCohort(pcache, RewriteDriver::kDomCohort);
+  server_context()->set_dom_cohort(dom_cohort);
+  pcache->set_enabled(true);
+  MockPropertyPage* page = NewMockPage(kTestDomain);
+  pcache->Read(page);
+  page->UpdateValue(dom_cohort, RewriteDriver::kHeadEndBytes, "12");
+  mock_proxy_fetch->driver()->set_property_page(page);
+
+  // Hold the driver's html worker so that both writes are queued by the time
+  // ExecuteQueued first runs, and only the limit can split them.
+  WorkerTestBase::SyncPoint hold(server_context()->thread_system());
+  mock_proxy_fetch->driver()->html_worker()->Add(
+      new WorkerTestBase::WaitRunFunction(&hold));
+  mock_proxy_fetch->Write("<html><head>", &handler);
+  mock_proxy_fetch->Write("<title>t</title></head><body>b</body></html>",
+                          &handler);
+  hold.Notify();
+  mock_scheduler()->AwaitQuiescence();
+
+  mock_proxy_fetch->Done(true);
+  mock_scheduler()->AwaitQuiescence();
+  EXPECT_EQ(0, server_context()->num_active_rewrite_drivers());
+  EXPECT_EQ(
+      "<html><head>|Flush|<title>t</title></head><body>b</body></html>"
+      "|Flush||Flush|",
+      fetch.buffer());
+}
+
+TEST_F(ProxyFetchTest, TestCompressHtml) {
+  NullMessageHandler handler;
+  RewriteOptions* options = server_context()->global_options();
+  options->ClearSignatureForTesting();
+  options->DisableFilter(RewriteOptions::kAddHead);
+  options->set_follow_flushes(true);
+  options->set_html_compression_level(6);
+  options->ComputeSignature();
+  FlushRecordingStringAsyncFetch fetch(
+      RequestContext::NewTestRequestContext(server_context()->thread_system()));
+  fetch.request_headers()->Add(HttpAttributes::kAcceptEncoding, "gzip");
+  fetch.response_headers()->Add("Content-Type", "text/html");
+  ProxyFetchFactory factory(server_context_);
+  MockProxyFetch* mock_proxy_fetch =
+      new MockProxyFetch(&fetch, &factory, server_context());
+  mock_proxy_fetch->response_headers()->ComputeCaching();
+
+  mock_proxy_fetch->Write("<html><d>1</d>", &handler);
+  mock_proxy_fetch->Flush(&handler);
+  mock_scheduler()->AwaitQuiescence();
+  mock_proxy_fetch->Write("<d>2</d></html>", &handler);
+  mock_proxy_fetch->Flush(&handler);
+  mock_scheduler()->AwaitQuiescence();
+  mock_proxy_fetch->Done(true);
+  mock_scheduler()->AwaitQuiescence();
+  EXPECT_EQ(0, server_context()->num_active_rewrite_drivers());
+
+  ResponseHeaders* headers = fetch.response_headers();
+  EXPECT_TRUE(headers->HasValue(HttpAttributes::kContentEncoding,
+                                HttpAttributes::kGzip));
+  EXPECT_TRUE(headers->HasValue(HttpAttributes::kVary,
+                                HttpAttributes::kAcceptEncoding));
+  EXPECT_FALSE(headers->Has(HttpAttributes::kContentLength));
+
+  // Each flush window is sync-flushed, so the client can decode it as soon
+  // as it arrives, but only the end of the response finishes the stream.
+  ASSERT_LE(2U, fetch.flush_offsets().size());
+  bool finished = true;
+  EXPECT_EQ("<html><d>1</d>",
+            Gunzip(StringPiece(fetch.buffer()).substr(
+                       0, fetch.flush_offsets()[0]),
+                   &finished));
+  EXPECT_FALSE(finished);
+  EXPECT_EQ("<html><d>1</d><d>2</d></html>",
+            Gunzip(StringPiece(fetch.buffer()).substr(
+                       0, fetch.flush_offsets()[1]),
+                   &finished));
+  EXPECT_FALSE(finished);
+  EXPECT_EQ("<html><d>1</d><d>2</d></html>", Gunzip(fetch.buffer(), &finished));
+  EXPECT_TRUE(finished);
+}
+
+TEST_F(ProxyFetchTest, TestCompressHtmlNeedsAcceptEncoding) {
+  NullMessageHandler handler;
+  RewriteOptions* options = server_context()->global_options();
+  options->ClearSignatureForTesting();
+  options->DisableFilter(RewriteOptions::kAddHead);
+  options->set_html_compression_level(6);
+  options->ComputeSignature();
+  StringAsyncFetch fetch(
+      RequestContext::NewTestRequestContext(server_context()->thread_system()));
+  fetch.response_headers()->Add("Content-Type", "text/html");
+  ProxyFetchFactory factory(server_context_);
+  MockProxyFetch* mock_proxy_fetch =
+      new MockProxyFetch(&fetch, &factory, server_context());
+  mock_proxy_fetch->response_headers()->ComputeCaching();
+
+  mock_proxy_fetch->Write("<html><d>1</d></html>", &handler);
+  mock_proxy_fetch->Done(true);
+  mock_scheduler()->AwaitQuiescence();
+  EXPECT_FALSE(fetch.response_headers()->Has(HttpAttributes::kContentEncoding));
+  EXPECT_EQ("<html><d>1</d></html>", fetch.buffer());
+}
+
+TEST_F(ProxyFetchTest, TestCompressHtmlSkipsHead) {
+  NullMessageHandler handler;
+  RewriteOptions* options = server_context()->global_options();
+  options->ClearSignatureForTesting();
+  options->DisableFilter(RewriteOptions::kAddHead);
+  options->set_html_compression_level(6);
+  options->ComputeSignature();
+  StringAsyncFetch fetch(
+      RequestContext::NewTestRequestContext(server_context()->thread_system()));
+  fetch.request_headers()->set_method(RequestHeaders::kHead);
+  fetch.request_headers()->Add(HttpAttributes::kAcceptEncoding, "gzip");
+  fetch.response_headers()->Add("Content-Type", "text/html");
+  ProxyFetchFactory factory(server_context_);
+  MockProxyFetch* mock_proxy_fetch =
+      new MockProxyFetch(&fetch, &factory, server_context());
+  mock_proxy_fetch->response_headers()->ComputeCaching();
+
+  // A HEAD response has no body to compress, so it must not advertise, or
+  // carry, a gzip stream.
+  mock_proxy_fetch->Write("<html>", &handler);
+  mock_proxy_fetch->Done(true);
+  mock_scheduler()->AwaitQuiescence();
+  EXPECT_FALSE(fetch.response_headers()->Has(HttpAttributes::kContentEncoding));
+  EXPECT_EQ("<html>", fetch.buffer());
+}
+
 TEST_F(ProxyFetchPropertyCallbackCollectorTest, EmptyCollectorTest) {
   // Test that creating an empty collector works.
   EnableCollectorPrefix();
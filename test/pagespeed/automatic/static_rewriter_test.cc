@@ -0,0 +1,198 @@
+/*
+ * Licensed to the Apache Software Foundation (ASF) under one
+ * or more contributor license agreements.  See the NOTICE file
+ * distributed with this work for additional information
+ * regarding copyright ownership.  The ASF licenses this file
+ * to you under the Apache License, Version 2.0 (the
+ * "License"); you may not use this file except in compliance
+ * with the License.  You may obtain a copy of the License at
+ * 
+ *   http://www.apache.org/licenses/LICENSE-2.0
+ * 
+ * Unless required by applicable law or agreed to in writing,
+ * software distributed under the License is distributed on an
+ * "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY
+ * KIND, either express or implied.  See the License for the
+ * specific language governing permissions and limitations
+ * under the License.
+ */
+
+// Unit-tests for the batch mode of StaticRewriter.
+
+#include "pagespeed/automatic/static_rewriter.h"
+
+#include <algorithm>
+#include <memory>
+
+#include "net/instaweb/rewriter/public/rewrite_driver_factory.h"
+#include "pagespeed/kernel/base/basictypes.h"
+#include "pagespeed/kernel/base/file_system.h"
+#include "pagespeed/kernel/base/string.h"
+#include "pagespeed/kernel/base/string_util.h"
+#include "pagespeed/system/system_rewrite_options.h"
+#include "test/net/instaweb/rewriter/rewrite_test_base.h"
+#include "test/pagespeed/kernel/base/gtest.h"
+
+namespace net_instaweb {
+
+namespace {
+
+const char kBaseUrl[] = "http://example.com/site/";
+
+class StaticRewriterTest : public testing::Test {
+ protected:
+  StaticRewriterTest() {
+    SystemRewriteOptions::Initialize();
+    RewriteDriverFactory::Initialize();
+    static_rewriter_ =
+        std::make_unique<StaticRewriter>(RewriteTestBase::process_context());
+    file_system_ = static_rewriter_->file_system();
+    handler_ = static_rewriter_->message_handler();
+    const testing::TestInfo* test_info =
+        testing::UnitTest::GetInstance()->current_test_info();
+    dir_ = StrCat(GTestTempDir(), "/static_rewriter/", test_info->name());
+    input_dir_ = StrCat(dir_, "/in");
+    output_dir_ = StrCat(dir_, "/out");
+  }
+
+  ~StaticRewriterTest() override {
+    static_rewriter_.reset();
+    RewriteDriverFactory::Terminate();
+    SystemRewriteOptions::Terminate();
+  }
+
+  // Writes contents to name, relative to input_dir_.
+  void WriteInput(const StringPiece& name, const StringPiece& contents) {
+    GoogleString path = StrCat(input_dir_, "/", name);
+    ASSERT_TRUE(file_system_->RecursivelyMakeDir(
+        StringPiece(path).substr(0, path.rfind('/')), handler_));
+    ASSERT_TRUE(file_system_->WriteFile(path.c_str(), contents, handler_));
+  }
+
+  GoogleString ReadOutput(const StringPiece& name) {
+    GoogleString contents;
+    EXPECT_TRUE(file_system_->ReadFile(
+        StrCat(output_dir_, "/", name).c_str(), &contents, handler_));
+    return contents;
+  }
+
+  std::unique_ptr<StaticRewriter> static_rewriter_;
+  FileSystem* file_system_;
+  MessageHandler* handler_;
+  GoogleString dir_;
+  GoogleString input_dir_;
+  GoogleString output_dir_;
+
+ private:
+  DISALLOW_COPY_AND_ASSIGN(StaticRewriterTest);
+};
+
+TEST_F(StaticRewriterTest, FindHtmlFiles) {
+  WriteInput("a.html", "<p>a</p>");
+  WriteInput("b.htm", "<p>b</p>");
+  WriteInput("c.css", "p{}");
+  WriteInput("sub/d.HTML", "<p>d</p>");
+  WriteInput("sub/deeper/e.html", "<p>e</p>");
+  WriteInput("sub/f.txt", "f");
+
+  StringVector html_names;
+  // A trailing slash on the directory doesn't change the relative names.
+  ASSERT_TRUE(static_rewriter_->FindHtmlFiles(StrCat(input_dir_, "/"),
+                                              &html_names));
+  std::sort(html_names.begin(), html_names.end());
+  ASSERT_EQ(4, html_names.size());
+  EXPECT_STREQ("a.html", html_names[0]);
+  EXPECT_STREQ("b.htm", html_names[1]);
+  EXPECT_STREQ("sub/d.HTML", html_names[2]);
+  EXPECT_STREQ("sub/deeper/e.html", html_names[3]);
+
+  EXPECT_FALSE(static_rewriter_->FindHtmlFiles(StrCat(dir_, "/missing"),
+                                               &html_names));
+}
+
+TEST_F(StaticRewriterTest, ReadManifest) {
+  WriteInput("manifest",
+             "# Pages to warm.\n"
+             "index.html\n"
+             "\n"
+             "  about/team.html  \n"
+             "http://example.com/site/blog/post.html\n"
+             "http://example.com/site//news.html\n");
+
+  StringVector html_names;
+  ASSERT_TRUE(static_rewriter_->ReadManifest(StrCat(input_dir_, "/manifest"),
+                                             kBaseUrl, &html_names));
+  ASSERT_EQ(4, html_names.size());
+  EXPECT_STREQ("index.html", html_names[0]);
+  EXPECT_STREQ("about/team.html", html_names[1]);
+  EXPECT_STREQ("blog/post.html", html_names[2]);
+  EXPECT_STREQ("news.html", html_names[3]);
+
+  EXPECT_FALSE(static_rewriter_->ReadManifest(StrCat(dir_, "/missing"),
+                                              kBaseUrl, &html_names));
+  EXPECT_EQ(4, html_names.size());
+}
+
+TEST_F(StaticRewriterTest, ReadManifestSkipsEntriesOutsideOutputDir) {
+  WriteInput("manifest",
+             "/etc/passwd.html\n"
+             "../escape.html\n"
+             "sub/../../escape.html\n"
+             "http://example.com/site/../escape.html\n"
+             "http://example.com/other/page.html\n"
+             "http://evil.com/site/page.html\n"
+             "http://example.com/site/\n"
+             "sub/..page.html\n");
+
+  StringVector html_names;
+  ASSERT_TRUE(static_rewriter_->ReadManifest(StrCat(input_dir_, "/manifest"),
+                                             kBaseUrl, &html_names));
+  ASSERT_EQ(1U, html_names.size());
+  EXPECT_STREQ("sub/..page.html", html_names[0]);
+}
+
+TEST_F(StaticRewriterTest, RewriteBatch) {
+  StringVector html_names;
+  int64 input_bytes = 0;
+  for (const char* name : {"one.html", "two.html", "sub/three.html"}) {
+    GoogleString html = StrCat("<html><body><p>", name, "</p></body></html>\n");
+    WriteInput(name, html);
+    html_names.push_back(name);
+    input_bytes += html.size();
+  }
+
+  StaticRewriter::BatchSummary summary;
+  EXPECT_TRUE(static_rewriter_->RewriteBatch(kBaseUrl, input_dir_,
+                                             output_dir_, html_names,
+                                             2 /* num_threads */, &summary));
+  EXPECT_EQ(3, summary.files_rewritten);
+  EXPECT_EQ(0, summary.files_failed);
+  EXPECT_EQ(input_bytes, summary.html_input_bytes);
+  int64 output_bytes = 0;
+  for (const GoogleString& name : html_names) {
+    GoogleString output = ReadOutput(name);
+    EXPECT_TRUE(output.find(StrCat("<p>", name, "</p>")) != GoogleString::npos)
+        << output;
+    output_bytes += output.size();
+  }
+  EXPECT_EQ(output_bytes, summary.html_output_bytes);
+}
+
+TEST_F(StaticRewriterTest, RewriteBatchCountsFailures) {
+  WriteInput("present.html", "<p>here</p>");
+  StringVector html_names;
+  html_names.push_back("present.html");
+  html_names.push_back("absent.html");
+
+  StaticRewriter::BatchSummary summary;
+  EXPECT_FALSE(static_rewriter_->RewriteBatch(kBaseUrl, input_dir_,
+                                              output_dir_, html_names,
+                                              1 /* num_threads */, &summary));
+  EXPECT_EQ(1, summary.files_rewritten);
+  EXPECT_EQ(1, summary.files_failed);
+  EXPECT_STREQ("<p>here</p>", ReadOutput("present.html"));
+}
+
+}  // namespace
+
+}  // namespace net_instaweb
@@ -0,0 +1,323 @@
+/*
+ * Licensed to the Apache Software Foundation (ASF) under one
+ * or more contributor license agreements.  See the NOTICE file
+ * distributed with this work for additional information
+ * regarding copyright ownership.  The ASF licenses this file
+ * to you under the Apache License, Version 2.0 (the
+ * "License"); you may not use this file except in compliance
+ * with the License.  You may obtain a copy of the License at
+ * 
+ *   http://www.apache.org/licenses/LICENSE-2.0
+ * 
+ * Unless required by applicable law or agreed to in writing,
+ * software distributed under the License is distributed on an
+ * "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY
+ * KIND, either express or implied.  See the License for the
+ * specific language governing permissions and limitations
+ * under the License.
+ */
+
+#include "pagespeed/controller/clustered_schedule_rewrite_controller.h"
+
+#include <memory>
+#include <set>
+#include <utility>
+#include <vector>
+
+#include "pagespeed/controller/consistent_hash_ring.h"
+#include "pagespeed/controller/popularity_contest_schedule_rewrite_controller.h"
+#include "pagespeed/kernel/base/function.h"
+#include "pagespeed/kernel/base/string.h"
+#include "pagespeed/kernel/base/string_util.h"
+#include "pagespeed/kernel/base/thread_system.h"
+#include "pagespeed/kernel/util/platform.h"
+#include "pagespeed/kernel/util/simple_stats.h"
+#include "test/pagespeed/kernel/base/gtest.h"
+#include "test/pagespeed/kernel/base/mock_timer.h"
+
+namespace net_instaweb {
+
+namespace {
+
+const int kNumNodes = 3;
+const char* const kNodeNames[kNumNodes] = {"node0:9000", "node1:9000",
+                                           "node2:9000"};
+const int kMaxRewrites = 10;
+const int kMaxQueueLength = 10;
+
+class TrackCallsFunction : public Function {
+ public:
+  TrackCallsFunction() : run_called_(false), cancel_called_(false) {
+    set_delete_after_callback(false);
+  }
+  ~TrackCallsFunction() override {}
+
+  void Run() override { run_called_ = true; }
+  void Cancel() override { cancel_called_ = true; }
+
+  bool run_called_;
+  bool cancel_called_;
+};
+
+// Stands in for the gRPC connection to another node's controller. If target
+// is null, requests are held until the test decides them.
+class TestPeer : public ClusteredScheduleRewriteController::Peer {
+ public:
+  explicit TestPeer(std::unique_ptr<ClusteredScheduleRewriteController>* target)
+      : target_(target), reachable_(true) {}
+
+  bool IsReachable() override { return reachable_; }
+
+  void ScheduleRewrite(const GoogleString& key, Function* callback) override {
+    if (target_ == nullptr) {
+      held_.push_back(std::make_pair(key, callback));
+    } else {
+      (*target_)->ScheduleForwardedRewrite(key, callback);
+    }
+  }
+
+  void NotifyRewriteComplete(const GoogleString& key) override {
+    notified_.push_back(key);
+    if (target_ != nullptr) {
+      (*target_)->NotifyRewriteComplete(key);
+    }
+  }
+
+  void NotifyRewriteFailed(const GoogleString& key) override {
+    notified_.push_back(key);
+    if (target_ != nullptr) {
+      (*target_)->NotifyRewriteFailed(key);
+    }
+  }
+
+  void set_reachable(bool reachable) { reachable_ = reachable; }
+  std::vector<std::pair<GoogleString, Function*>>* held() { return &held_; }
+  const StringVector& notified() const { return notified_; }
+
+ private:
+  std::unique_ptr<ClusteredScheduleRewriteController>* target_;
+  bool reachable_;
+  std::vector<std::pair<GoogleString, Function*>> held_;
+  StringVector notified_;
+};
+
+}  // namespace
+
+class ClusteredScheduleRewriteControllerTest : public testing::Test {
+ public:
+  ClusteredScheduleRewriteControllerTest()
+      : thread_system_(Platform::CreateThreadSystem()),
+        timer_(thread_system_->NewMutex(), MockTimer::kApr_5_2010_ms) {
+    for (int i = 0; i < kNumNodes; ++i) {
+      ring_.AddNode(kNodeNames[i]);
+      stats_[i] = std::make_unique<SimpleStats>(thread_system_.get());
+      PopularityContestScheduleRewriteController::InitStats(stats_[i].get());
+      ClusteredScheduleRewriteController::InitStats(stats_[i].get());
+    }
+    // Every node's peers deliver straight to the other nodes.
+    for (int i = 0; i < kNumNodes; ++i) {
+      ClusteredScheduleRewriteController::PeerMap peers;
+      for (int j = 0; j < kNumNodes; ++j) {
+        if (j != i) {
+          peers_[i][j] = new TestPeer(&nodes_[j]);
+          peers[kNodeNames[j]] = peers_[i][j];
+        }
+      }
+      nodes_[i] = std::make_unique<ClusteredScheduleRewriteController>(
+          kNodeNames[i], peers, NewLocalController(i), thread_system_.get(),
+          stats_[i].get());
+    }
+  }
+
+ protected:
+  ScheduleRewriteController* NewLocalController(int node) {
+    return new PopularityContestScheduleRewriteController(
+        thread_system_.get(), stats_[node].get(), &timer_, kMaxRewrites,
+        kMaxQueueLength);
+  }
+
+  // Returns a key that is owned by node.
+  GoogleString KeyOwnedBy(int node) {
+    for (int i = 0;; ++i) {
+      GoogleString key = StrCat("key", IntegerToString(i));
+      if (ring_.Owner(key) == kNodeNames[node] && !used_keys_.count(key)) {
+        used_keys_.insert(key);
+        return key;
+      }
+    }
+  }
+
+  int64 TimedVariableTotal(int node, const char* name) {
+    return stats_[node]->GetTimedVariable(name)->Get(TimedVariable::START);
+  }
+
+  int64 LocalRequests(int node) {
+    return TimedVariableTotal(node, PopularityContestScheduleRewriteController::
+                                        kNumRewritesRequested);
+  }
+
+  int64 LocalSuccesses(int node) {
+    return TimedVariableTotal(node, PopularityContestScheduleRewriteController::
+                                        kNumRewritesSucceeded);
+  }
+
+  int64 LocalFailures(int node) {
+    return TimedVariableTotal(
+        node, PopularityContestScheduleRewriteController::kNumRewritesFailed);
+  }
+
+  std::unique_ptr<ThreadSystem> thread_system_;
+  MockTimer timer_;
+  ConsistentHashRing ring_;
+  std::set<GoogleString> used_keys_;
+  std::unique_ptr<SimpleStats> stats_[kNumNodes];
+  // peers_[i][j] is node i's connection to node j. Owned by nodes_[i].
+  TestPeer* peers_[kNumNodes][kNumNodes];
+  std::unique_ptr<ClusteredScheduleRewriteController> nodes_[kNumNodes];
+};
+
+TEST_F(ClusteredScheduleRewriteControllerTest, OwnedKeyScheduledLocally) {
+  GoogleString key = KeyOwnedBy(0);
+  TrackCallsFunction callback;
+  nodes_[0]->ScheduleRewrite(key, &callback);
+  EXPECT_TRUE(callback.run_called_);
+  nodes_[0]->NotifyRewriteComplete(key);
+
+  EXPECT_EQ(1, LocalSuccesses(0));
+  EXPECT_EQ(0, LocalRequests(1));
+  EXPECT_EQ(0, LocalRequests(2));
+  EXPECT_EQ(1, TimedVariableTotal(
+                   0, ClusteredScheduleRewriteController::
+                          kNumRewritesScheduledLocally));
+}
+
+TEST_F(ClusteredScheduleRewriteControllerTest, KeyRunsOnceAcrossCluster) {
+  GoogleString key = KeyOwnedBy(1);
+  TrackCallsFunction callbacks[kNumNodes];
+  for (int i = 0; i < kNumNodes; ++i) {
+    nodes_[i]->ScheduleRewrite(key, &callbacks[i]);
+  }
+  // Only the first request gets to run, and all of them were decided by the
+  // owner.
+  EXPECT_TRUE(callbacks[0].run_called_);
+  EXPECT_TRUE(callbacks[1].cancel_called_);
+  EXPECT_TRUE(callbacks[2].cancel_called_);
+  EXPECT_EQ(0, LocalRequests(0));
+  EXPECT_EQ(3, LocalRequests(1));
+  EXPECT_EQ(0, LocalRequests(2));
+  EXPECT_EQ(1, TimedVariableTotal(0, ClusteredScheduleRewriteController::
+                                         kNumRewritesForwarded));
+
+  // Completion is reported to the owner.
+  nodes_[0]->NotifyRewriteComplete(key);
+  EXPECT_EQ(1, LocalSuccesses(1));
+
+  // Now that it's done, anyone can ask again.
+  TrackCallsFunction again;
+  nodes_[2]->ScheduleRewrite(key, &again);
+  EXPECT_TRUE(again.run_called_);
+  nodes_[2]->NotifyRewriteFailed(key);
+  EXPECT_EQ(1, LocalFailures(1));
+}
+
+TEST_F(ClusteredScheduleRewriteControllerTest, UnreachableOwner) {
+  GoogleString key = KeyOwnedBy(2);
+  peers_[0][2]->set_reachable(false);
+  TrackCallsFunction callback;
+  nodes_[0]->ScheduleRewrite(key, &callback);
+  EXPECT_TRUE(callback.run_called_);
+  EXPECT_EQ(1, LocalRequests(0));
+  EXPECT_EQ(0, LocalRequests(2));
+  EXPECT_EQ(1, TimedVariableTotal(0, ClusteredScheduleRewriteController::
+                                         kNumRewritesPeerUnreachable));
+
+  // The owner coming back doesn't change where the rewrite is reported, or
+  // where further requests for the key go while it's running.
+  peers_[0][2]->set_reachable(true);
+  TrackCallsFunction duplicate;
+  nodes_[0]->ScheduleRewrite(key, &duplicate);
+  EXPECT_TRUE(duplicate.cancel_called_);
+  EXPECT_EQ(2, LocalRequests(0));
+  nodes_[0]->NotifyRewriteComplete(key);
+  EXPECT_EQ(1, LocalSuccesses(0));
+  EXPECT_TRUE(peers_[0][2]->notified().empty());
+
+  // Once it's done, the owner is used again.
+  TrackCallsFunction later;
+  nodes_[0]->ScheduleRewrite(key, &later);
+  EXPECT_TRUE(later.run_called_);
+  EXPECT_EQ(1, LocalRequests(2));
+  nodes_[0]->NotifyRewriteComplete(key);
+  EXPECT_EQ(1, LocalSuccesses(2));
+}
+
+TEST_F(ClusteredScheduleRewriteControllerTest, ForwardedRequestNotForwarded) {
+  // Node 0 has been told that node 1 owns key, but node 1 disagrees; it must
+  // schedule the key itself.
+  GoogleString key = KeyOwnedBy(0);
+  TrackCallsFunction callback;
+  nodes_[1]->ScheduleForwardedRewrite(key, &callback);
+  EXPECT_TRUE(callback.run_called_);
+  EXPECT_EQ(1, LocalRequests(1));
+  EXPECT_EQ(0, LocalRequests(0));
+  nodes_[1]->NotifyRewriteComplete(key);
+  EXPECT_EQ(1, LocalSuccesses(1));
+}
+
+TEST_F(ClusteredScheduleRewriteControllerTest, ForwardedBackIsCanceled) {
+  // A node whose peer holds on to forwarded requests.
+  SimpleStats stats(thread_system_.get());
+  PopularityContestScheduleRewriteController::InitStats(&stats);
+  ClusteredScheduleRewriteController::InitStats(&stats);
+  TestPeer* peer = new TestPeer(nullptr);
+  ClusteredScheduleRewriteController::PeerMap peers;
+  peers[kNodeNames[1]] = peer;
+  ClusteredScheduleRewriteController node(
+      kNodeNames[0], peers,
+      new PopularityContestScheduleRewriteController(
+          thread_system_.get(), &stats, &timer_, kMaxRewrites,
+          kMaxQueueLength),
+      thread_system_.get(), &stats);
+
+  ConsistentHashRing ring;
+  ring.AddNode(kNodeNames[0]);
+  ring.AddNode(kNodeNames[1]);
+  GoogleString key = "key";
+  while (ring.Owner(key) != kNodeNames[1]) {
+    StrAppend(&key, "x");
+  }
+
+  TrackCallsFunction callback;
+  node.ScheduleRewrite(key, &callback);
+  ASSERT_EQ(1, peer->held()->size());
+
+  // The peer thinks we own it and sends it back.
+  TrackCallsFunction bounced;
+  node.ScheduleForwardedRewrite(key, &bounced);
+  EXPECT_TRUE(bounced.cancel_called_);
+  TimedVariable* requested = stats.GetTimedVariable(
+      PopularityContestScheduleRewriteController::kNumRewritesRequested);
+  EXPECT_EQ(0, requested->Get(TimedVariable::START));
+
+  // The peer's decision is passed on, and completion goes back to it.
+  (*peer->held())[0].second->CallRun();
+  EXPECT_TRUE(callback.run_called_);
+  node.NotifyRewriteComplete(key);
+  ASSERT_EQ(1, peer->notified().size());
+  EXPECT_EQ(key, peer->notified()[0]);
+
+  // A rejection by the peer forgets the route, so the next request goes to
+  // the peer again.
+  peer->held()->clear();
+  TrackCallsFunction rejected;
+  node.ScheduleRewrite(key, &rejected);
+  ASSERT_EQ(1, peer->held()->size());
+  (*peer->held())[0].second->CallCancel();
+  EXPECT_TRUE(rejected.cancel_called_);
+  TrackCallsFunction retry;
+  node.ScheduleRewrite(key, &retry);
+  EXPECT_EQ(2, peer->held()->size());
+  (*peer->held())[1].second->CallCancel();
+}
+
+}  // namespace net_instaweb
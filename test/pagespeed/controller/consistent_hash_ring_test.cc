@@ -0,0 +1,102 @@
+/*
+ * Licensed to the Apache Software Foundation (ASF) under one
+ * or more contributor license agreements.  See the NOTICE file
+ * distributed with this work for additional information
+ * regarding copyright ownership.  The ASF licenses this file
+ * to you under the Apache License, Version 2.0 (the
+ * "License"); you may not use this file except in compliance
+ * with the License.  You may obtain a copy of the License at
+ * 
+ *   http://www.apache.org/licenses/LICENSE-2.0
+ * 
+ * Unless required by applicable law or agreed to in writing,
+ * software distributed under the License is distributed on an
+ * "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY
+ * KIND, either express or implied.  See the License for the
+ * specific language governing permissions and limitations
+ * under the License.
+ */
+
+#include "pagespeed/controller/consistent_hash_ring.h"
+
+#include <map>
+
+#include "pagespeed/kernel/base/string.h"
+#include "pagespeed/kernel/base/string_util.h"
+#include "test/pagespeed/kernel/base/gtest.h"
+
+namespace net_instaweb {
+
+namespace {
+
+const int kNumKeys = 30000;
+
+GoogleString Key(int i) { return StrCat("rname/ic_", IntegerToString(i)); }
+
+TEST(ConsistentHashRingTest, OwnerIndependentOfInsertionOrder) {
+  ConsistentHashRing ring1;
+  ring1.AddNode("a:1");
+  ring1.AddNode("b:2");
+  ring1.AddNode("c:3");
+  ConsistentHashRing ring2;
+  ring2.AddNode("c:3");
+  ring2.AddNode("a:1");
+  ring2.AddNode("b:2");
+  for (int i = 0; i < 1000; ++i) {
+    EXPECT_EQ(ring1.Owner(Key(i)), ring2.Owner(Key(i))) << Key(i);
+  }
+}
+
+TEST(ConsistentHashRingTest, SingleNodeOwnsEverything) {
+  ConsistentHashRing ring;
+  ring.AddNode("a:1");
+  ring.AddNode("a:1");
+  EXPECT_EQ(1, ring.num_nodes());
+  for (int i = 0; i < 100; ++i) {
+    EXPECT_EQ("a:1", ring.Owner(Key(i)));
+  }
+}
+
+TEST(ConsistentHashRingTest, KeysSpreadEvenly) {
+  ConsistentHashRing ring;
+  ring.AddNode("a:1");
+  ring.AddNode("b:2");
+  ring.AddNode("c:3");
+  std::map<GoogleString, int> counts;
+  for (int i = 0; i < kNumKeys; ++i) {
+    ++counts[ring.Owner(Key(i))];
+  }
+  ASSERT_EQ(3, counts.size());
+  for (const auto& count : counts) {
+    EXPECT_LT(kNumKeys / 4, count.second) << count.first;
+    EXPECT_GT(kNumKeys * 5 / 12, count.second) << count.first;
+  }
+}
+
+TEST(ConsistentHashRingTest, AddingNodeOnlyMovesKeysToIt) {
+  ConsistentHashRing ring;
+  ring.AddNode("a:1");
+  ring.AddNode("b:2");
+  ring.AddNode("c:3");
+  StringVector owners;
+  for (int i = 0; i < kNumKeys; ++i) {
+    owners.push_back(ring.Owner(Key(i)));
+  }
+
+  ring.AddNode("d:4");
+  int moved = 0;
+  for (int i = 0; i < kNumKeys; ++i) {
+    const GoogleString& owner = ring.Owner(Key(i));
+    if (owner != owners[i]) {
+      EXPECT_EQ("d:4", owner) << Key(i);
+      ++moved;
+    }
+  }
+  // The new node should take about a quarter of the keys.
+  EXPECT_LT(kNumKeys / 6, moved);
+  EXPECT_GT(kNumKeys / 3, moved);
+}
+
+}  // namespace
+
+}  // namespace net_instaweb
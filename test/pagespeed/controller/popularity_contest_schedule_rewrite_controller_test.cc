@@ -1256,5 +1256,103 @@ TEST_F(PopularityContestScheduleRewriteControllerTest, OldRetryTortureTest) {
   }
 }
 
+// Verify that when two rewrites are equally popular, the one that is known to
+// be cheaper runs first, and that the cost is learned per filter type.
+TEST_F(PopularityContestScheduleRewriteControllerTest, CheaperRewriteFirst) {
+  ResetController(1 /* max_rewrites */, kMaxQueueLength);
+
+  // Teach the controller that "ic" rewrites take a while and "cf" ones don't.
+  TrackCallsFunction f_ic;
+  controller_->ScheduleRewrite("rc:rname/ic_1/a.png", &f_ic);
+  EXPECT_THAT(f_ic.run_called_, Eq(true));
+  timer_.AdvanceMs(100);
+  controller_->NotifyRewriteComplete("rc:rname/ic_1/a.png");
+  TrackCallsFunction f_cf;
+  controller_->ScheduleRewrite("rc:rname/cf_1/a.css", &f_cf);
+  EXPECT_THAT(f_cf.run_called_, Eq(true));
+  controller_->NotifyRewriteComplete("rc:rname/cf_1/a.css");
+  EXPECT_THAT(
+      TimedVariableTotal(
+          PopularityContestScheduleRewriteController::kRewriteRunTimeMs),
+      Eq(100));
+
+  // Block the controller, then queue an image rewrite ahead of a CSS one.
+  TrackCallsFunction f_block;
+  controller_->ScheduleRewrite("block", &f_block);
+  EXPECT_THAT(f_block.run_called_, Eq(true));
+  TrackCallsFunction f_png;
+  controller_->ScheduleRewrite("rc:rname/ic_1/b.png", &f_png);
+  TrackCallsFunction f_css;
+  controller_->ScheduleRewrite("rc:rname/cf_1/b.css", &f_css);
+  EXPECT_THAT(
+      TimedVariableTotal(PopularityContestScheduleRewriteController::
+                             kNumRequestsCostPenalized),
+      Eq(1));
+
+  controller_->NotifyRewriteComplete("block");
+  EXPECT_THAT(f_css.run_called_, Eq(true));
+  EXPECT_THAT(f_png.run_called_, Eq(false));
+
+  // A request for an expensive rewrite still counts for something, so enough
+  // of them outweigh a single request for a cheap rewrite.
+  TrackCallsFunction f_css2;
+  controller_->ScheduleRewrite("rc:rname/cf_1/c.css", &f_css2);
+  for (int i = 0; i < 200; ++i) {
+    TrackCallsFunction* f = new TrackCallsFunction;
+    f->set_delete_after_callback(true);
+    controller_->ScheduleRewrite("rc:rname/ic_1/b.png", f);
+  }
+  EXPECT_THAT(f_png.cancel_called_, Eq(true));
+  controller_->NotifyRewriteComplete("rc:rname/cf_1/b.css");
+  EXPECT_THAT(f_css2.run_called_, Eq(false));
+  CheckStats(206 /* total */, 4 /* success */, 0 /* fail */, 0 /* queue_full */,
+             0 /* already_running */, 2 /* queue_size */, 1 /* running */);
+
+  controller_->NotifyRewriteComplete("rc:rname/ic_1/b.png");
+  EXPECT_THAT(f_css2.run_called_, Eq(true));
+  controller_->NotifyRewriteComplete("rc:rname/cf_1/c.css");
+}
+
+// Verify that an expensive rewrite that keeps losing to cheaper ones is
+// eventually run once it has been queued long enough.
+TEST_F(PopularityContestScheduleRewriteControllerTest, AgingPreventsStarvation) {
+  ResetController(1 /* max_rewrites */, kMaxQueueLength);
+
+  // Teach the controller that "ic" rewrites take ten times the minimum cost.
+  TrackCallsFunction f_ic;
+  controller_->ScheduleRewrite("rc:rname/ic_1/a.png", &f_ic);
+  EXPECT_THAT(f_ic.run_called_, Eq(true));
+  timer_.AdvanceMs(10);
+  controller_->NotifyRewriteComplete("rc:rname/ic_1/a.png");
+
+  TrackCallsFunction f_block;
+  controller_->ScheduleRewrite("block", &f_block);
+  EXPECT_THAT(f_block.run_called_, Eq(true));
+
+  // The image has been requested twice, but each request only counts for a
+  // tenth of a request for a cheap rewrite.
+  TrackCallsFunction f_png;
+  controller_->ScheduleRewrite("rc:rname/ic_1/b.png", &f_png);
+  TrackCallsFunction f_png2;
+  controller_->ScheduleRewrite("rc:rname/ic_1/b.png", &f_png2);
+  TrackCallsFunction f1;
+  controller_->ScheduleRewrite("k1", &f1);
+  controller_->NotifyRewriteComplete("block");
+  EXPECT_THAT(f1.run_called_, Eq(true));
+  EXPECT_THAT(f_png2.run_called_, Eq(false));
+
+  // Once it has waited long enough, it beats a fresh cheap rewrite.
+  timer_.AdvanceMs(PopularityContestScheduleRewriteController::kAgingPeriodMs);
+  TrackCallsFunction f2;
+  controller_->ScheduleRewrite("k2", &f2);
+  controller_->NotifyRewriteComplete("k1");
+  EXPECT_THAT(f_png2.run_called_, Eq(true));
+  EXPECT_THAT(f2.run_called_, Eq(false));
+
+  controller_->NotifyRewriteComplete("rc:rname/ic_1/b.png");
+  EXPECT_THAT(f2.run_called_, Eq(true));
+  controller_->NotifyRewriteComplete("k2");
+}
+
 }  // namespace
 }  // namespace net_instaweb
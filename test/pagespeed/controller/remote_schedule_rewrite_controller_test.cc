@@ -0,0 +1,491 @@
+/*
+ * Licensed to the Apache Software Foundation (ASF) under one
+ * or more contributor license agreements.  See the NOTICE file
+ * distributed with this work for additional information
+ * regarding copyright ownership.  The ASF licenses this file
+ * to you under the Apache License, Version 2.0 (the
+ * "License"); you may not use this file except in compliance
+ * with the License.  You may obtain a copy of the License at
+ * 
+ *   http://www.apache.org/licenses/LICENSE-2.0
+ * 
+ * Unless required by applicable law or agreed to in writing,
+ * software distributed under the License is distributed on an
+ * "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY
+ * KIND, either express or implied.  See the License for the
+ * specific language governing permissions and limitations
+ * under the License.
+ */
+
+#include "pagespeed/controller/remote_schedule_rewrite_controller.h"
+
+#include <memory>
+#include <set>
+
+#include "pagespeed/controller/central_controller_rpc_server.h"
+#include "pagespeed/controller/clustered_schedule_rewrite_controller.h"
+#include "pagespeed/controller/consistent_hash_ring.h"
+#include "pagespeed/controller/controller.grpc.pb.h"
+#include "pagespeed/controller/popularity_contest_schedule_rewrite_controller.h"
+#include "pagespeed/controller/schedule_rewrite_controller.h"
+#include "pagespeed/controller/schedule_rewrite_rpc_handler.h"
+#include "pagespeed/kernel/base/abstract_mutex.h"
+#include "pagespeed/kernel/base/condvar.h"
+#include "pagespeed/kernel/base/function.h"
+#include "pagespeed/kernel/base/null_message_handler.h"
+#include "pagespeed/kernel/base/string.h"
+#include "pagespeed/kernel/base/string_util.h"
+#include "pagespeed/kernel/base/thread.h"
+#include "pagespeed/kernel/base/thread_system.h"
+#include "pagespeed/kernel/base/timer.h"
+#include "pagespeed/kernel/util/grpc.h"
+#include "pagespeed/kernel/util/platform.h"
+#include "pagespeed/kernel/util/simple_stats.h"
+#include "test/pagespeed/controller/grpc_server_test.h"
+#include "test/pagespeed/kernel/base/gmock.h"
+#include "test/pagespeed/kernel/base/gtest.h"
+#include "test/pagespeed/kernel/base/mock_timer.h"
+#include "test/pagespeed/kernel/thread/worker_test_base.h"
+
+using testing::ElementsAre;
+
+namespace net_instaweb {
+
+namespace {
+
+const int kNumNodes = 3;
+const int kMaxRewrites = 10;
+const int kMaxQueueLength = 10;
+// How long to wait for a channel to connect, or for a result to arrive at
+// another node, before giving up.
+const int kPollIntervalMs = 10;
+const int kMaxPolls = 500;
+
+// The RemoteScheduleRewriteController runs callbacks on its own thread, so
+// tests wait for the decision.
+class NotifyingFunction : public Function {
+ public:
+  explicit NotifyingFunction(ThreadSystem* thread_system)
+      : sync_(thread_system), run_called_(false), cancel_called_(false) {
+    set_delete_after_callback(false);
+  }
+  ~NotifyingFunction() override {}
+
+  void Run() override {
+    run_called_ = true;
+    sync_.Notify();
+  }
+
+  void Cancel() override {
+    cancel_called_ = true;
+    sync_.Notify();
+  }
+
+  // Blocks until Run or Cancel has been called.
+  void Wait() { sync_.Wait(); }
+
+  bool run_called() const { return run_called_; }
+  bool cancel_called() const { return cancel_called_; }
+
+ private:
+  WorkerTestBase::SyncPoint sync_;
+  bool run_called_;
+  bool cancel_called_;
+
+  DISALLOW_COPY_AND_ASSIGN(NotifyingFunction);
+};
+
+// Server side controller that grants or denies every request, and records
+// everything that reaches it.
+class RecordingController : public ScheduleRewriteController {
+ public:
+  explicit RecordingController(ThreadSystem* thread_system)
+      : mutex_(thread_system->NewMutex()),
+        changed_(mutex_->NewCondvar()),
+        allow_(true) {}
+  ~RecordingController() override {}
+
+  void ScheduleRewrite(const GoogleString& key, Function* callback) override {
+    Decide(StrCat("schedule:", key), callback);
+  }
+
+  void ScheduleForwardedRewrite(const GoogleString& key,
+                                Function* callback) override {
+    Decide(StrCat("forwarded:", key), callback);
+  }
+
+  void NotifyRewriteComplete(const GoogleString& key) override {
+    Record(StrCat("complete:", key));
+  }
+
+  void NotifyRewriteFailed(const GoogleString& key) override {
+    Record(StrCat("failed:", key));
+  }
+
+  void set_allow(bool allow) {
+    ScopedMutex lock(mutex_.get());
+    allow_ = allow;
+  }
+
+  // Blocks until at least num_events have been recorded, and returns them.
+  StringVector WaitForEvents(int num_events) {
+    ScopedMutex lock(mutex_.get());
+    while (static_cast<int>(events_.size()) < num_events) {
+      changed_->Wait();
+    }
+    return events_;
+  }
+
+ private:
+  void Record(const GoogleString& event) {
+    ScopedMutex lock(mutex_.get());
+    events_.push_back(event);
+    changed_->Broadcast();
+  }
+
+  void Decide(const GoogleString& event, Function* callback) {
+    bool allow;
+    {
+      ScopedMutex lock(mutex_.get());
+      allow = allow_;
+    }
+    Record(event);
+    if (allow) {
+      callback->CallRun();
+    } else {
+      callback->CallCancel();
+    }
+  }
+
+  std::unique_ptr<ThreadSystem::CondvarCapableMutex> mutex_;
+  std::unique_ptr<ThreadSystem::Condvar> changed_;
+  bool allow_;
+  StringVector events_;
+};
+
+// Runs the gRPC event loop for one node's server.
+class ServerThread : public ThreadSystem::Thread {
+ public:
+  ServerThread(::grpc::CompletionQueue* queue, ThreadSystem* thread_system)
+      : Thread(thread_system, "cluster_node_server", ThreadSystem::kJoinable),
+        queue_(queue) {}
+  ~ServerThread() override {}
+
+ private:
+  void Run() override { CentralControllerRpcServer::MainLoop(queue_); }
+
+  ::grpc::CompletionQueue* queue_;
+
+  DISALLOW_COPY_AND_ASSIGN(ServerThread);
+};
+
+// Polls peer until its channel has connected. Returns false if that never
+// happens.
+bool WaitUntilReachable(ClusteredScheduleRewriteController::Peer* peer,
+                        Timer* timer) {
+  for (int i = 0; i < kMaxPolls; ++i) {
+    if (peer->IsReachable()) {
+      return true;
+    }
+    timer->SleepMs(kPollIntervalMs);
+  }
+  return false;
+}
+
+}  // namespace
+
+class RemoteScheduleRewriteControllerTest : public GrpcServerTest {
+ public:
+  RemoteScheduleRewriteControllerTest()
+      : timer_(Platform::CreateTimer()), controller_(thread_system_.get()) {}
+
+  void SetUp() override {
+    GrpcServerTest::SetUp();
+    QueueFunctionForServerThread(MakeFunction(
+        this, &RemoteScheduleRewriteControllerTest::StartHandler));
+    remote_ = std::make_unique<RemoteScheduleRewriteController>(
+        ServerAddress(), thread_system_.get(), &handler_);
+  }
+
+  void TearDown() override {
+    // The server's handlers call into controller_, so stop them before it
+    // goes away.
+    remote_.reset();
+    StopServer();
+  }
+
+  void RegisterServices(::grpc::ServerBuilder* builder) override {
+    builder->RegisterService(&service_);
+  }
+
+ protected:
+  // gRPC handlers must be started on the server thread.
+  void StartHandler() {
+    ScheduleRewriteRpcHandler::CreateAndStart(&service_, queue_.get(),
+                                              &controller_);
+  }
+
+  std::unique_ptr<Timer> timer_;
+  NullMessageHandler handler_;
+  CentralControllerRpcService::AsyncService service_;
+  RecordingController controller_;
+  std::unique_ptr<RemoteScheduleRewriteController> remote_;
+};
+
+TEST_F(RemoteScheduleRewriteControllerTest, ReachableOnceConnected) {
+  // The first call only starts connecting, so the peer isn't used yet.
+  EXPECT_FALSE(remote_->IsReachable());
+  EXPECT_TRUE(WaitUntilReachable(remote_.get(), timer_.get()));
+
+  remote_->ShutDown();
+  EXPECT_FALSE(remote_->IsReachable());
+}
+
+TEST_F(RemoteScheduleRewriteControllerTest, NeverReachableWithoutServer) {
+  RemoteScheduleRewriteController nobody(
+      StrCat("unix:", GTestTempDir(), "/nobody.sock"), thread_system_.get(),
+      &handler_);
+  for (int i = 0; i < 20; ++i) {
+    EXPECT_FALSE(nobody.IsReachable());
+    timer_->SleepMs(kPollIntervalMs);
+  }
+}
+
+TEST_F(RemoteScheduleRewriteControllerTest, GrantedRewriteReportsSuccess) {
+  NotifyingFunction callback(thread_system_.get());
+  remote_->ScheduleRewrite("a", &callback);
+  callback.Wait();
+  EXPECT_TRUE(callback.run_called());
+
+  remote_->NotifyRewriteComplete("a");
+  EXPECT_THAT(controller_.WaitForEvents(2),
+              ElementsAre("forwarded:a", "complete:a"));
+}
+
+TEST_F(RemoteScheduleRewriteControllerTest, GrantedRewriteReportsFailure) {
+  NotifyingFunction callback(thread_system_.get());
+  remote_->ScheduleRewrite("a", &callback);
+  callback.Wait();
+  EXPECT_TRUE(callback.run_called());
+
+  remote_->NotifyRewriteFailed("a");
+  EXPECT_THAT(controller_.WaitForEvents(2),
+              ElementsAre("forwarded:a", "failed:a"));
+}
+
+TEST_F(RemoteScheduleRewriteControllerTest, DeniedRewriteIsCanceled) {
+  controller_.set_allow(false);
+  NotifyingFunction callback(thread_system_.get());
+  remote_->ScheduleRewrite("a", &callback);
+  callback.Wait();
+  EXPECT_TRUE(callback.cancel_called());
+  EXPECT_THAT(controller_.WaitForEvents(1), ElementsAre("forwarded:a"));
+}
+
+TEST_F(RemoteScheduleRewriteControllerTest, DuplicateGrantIsFailedBack) {
+  NotifyingFunction first(thread_system_.get());
+  remote_->ScheduleRewrite("a", &first);
+  first.Wait();
+  EXPECT_TRUE(first.run_called());
+
+  // The server shouldn't grant a key twice, but if it does the second grant
+  // is handed back rather than silently dropped.
+  NotifyingFunction second(thread_system_.get());
+  remote_->ScheduleRewrite("a", &second);
+  second.Wait();
+  EXPECT_TRUE(second.cancel_called());
+  EXPECT_THAT(controller_.WaitForEvents(3),
+              ElementsAre("forwarded:a", "forwarded:a", "failed:a"));
+
+  // The first rewrite is still reported.
+  remote_->NotifyRewriteComplete("a");
+  EXPECT_THAT(
+      controller_.WaitForEvents(4),
+      ElementsAre("forwarded:a", "forwarded:a", "failed:a", "complete:a"));
+}
+
+TEST_F(RemoteScheduleRewriteControllerTest, ShutDownFailsRunningRewrites) {
+  NotifyingFunction callback(thread_system_.get());
+  remote_->ScheduleRewrite("a", &callback);
+  callback.Wait();
+  EXPECT_TRUE(callback.run_called());
+
+  remote_->ShutDown();
+  EXPECT_THAT(controller_.WaitForEvents(2),
+              ElementsAre("forwarded:a", "failed:a"));
+
+  // Nothing more is sent once shut down.
+  NotifyingFunction late(thread_system_.get());
+  remote_->ScheduleRewrite("b", &late);
+  late.Wait();
+  EXPECT_TRUE(late.cancel_called());
+}
+
+// Several ClusteredScheduleRewriteControllers talking to each other over real
+// gRPC connections on localhost.
+class LocalhostClusterTest : public testing::Test {
+ public:
+  LocalhostClusterTest()
+      : thread_system_(Platform::CreateThreadSystem()),
+        timer_(Platform::CreateTimer()),
+        mock_timer_(thread_system_->NewMutex(), MockTimer::kApr_5_2010_ms) {}
+
+  void SetUp() override {
+    // Bind all the servers first, since the peers need to know their ports.
+    for (int i = 0; i < kNumNodes; ++i) {
+      ::grpc::ServerBuilder builder;
+      int port = 0;
+      builder.AddListeningPort(
+          "localhost:0", ::grpc::InsecureServerCredentials(), &port);
+      builder.RegisterService(&services_[i]);
+      queues_[i] = builder.AddCompletionQueue();
+      servers_[i] = builder.BuildAndStart();
+      ASSERT_TRUE(servers_[i] != nullptr);
+      ASSERT_GT(port, 0);
+      names_[i] = StrCat("localhost:", IntegerToString(port));
+      ring_.AddNode(names_[i]);
+    }
+    for (int i = 0; i < kNumNodes; ++i) {
+      stats_[i] = std::make_unique<SimpleStats>(thread_system_.get());
+      PopularityContestScheduleRewriteController::InitStats(stats_[i].get());
+      ClusteredScheduleRewriteController::InitStats(stats_[i].get());
+      ClusteredScheduleRewriteController::PeerMap peers;
+      for (int j = 0; j < kNumNodes; ++j) {
+        if (j != i) {
+          peers_[i][j] = new RemoteScheduleRewriteController(
+              names_[j], thread_system_.get(), &handler_);
+          peers[names_[j]] = peers_[i][j];
+        }
+      }
+      nodes_[i] = std::make_unique<ClusteredScheduleRewriteController>(
+          names_[i], peers,
+          new PopularityContestScheduleRewriteController(
+              thread_system_.get(), stats_[i].get(), &mock_timer_,
+              kMaxRewrites, kMaxQueueLength),
+          thread_system_.get(), stats_[i].get());
+      ScheduleRewriteRpcHandler::CreateAndStart(&services_[i], queues_[i].get(),
+                                                nodes_[i].get());
+      threads_[i] = std::make_unique<ServerThread>(queues_[i].get(),
+                                                   thread_system_.get());
+      ASSERT_TRUE(threads_[i]->Start());
+    }
+  }
+
+  void TearDown() override {
+    // The handlers call into the nodes, so stop serving before they go away.
+    for (int i = 0; i < kNumNodes; ++i) {
+      if (servers_[i] == nullptr) {
+        continue;
+      }
+      servers_[i]->Shutdown(gpr_inf_past(GPR_CLOCK_MONOTONIC));
+      queues_[i]->Shutdown();
+      if (threads_[i] != nullptr && threads_[i]->Started()) {
+        threads_[i]->Join();
+      } else {
+        // Nobody is draining the queue, so do it here.
+        CentralControllerRpcServer::MainLoop(queues_[i].get());
+      }
+    }
+    for (int i = 0; i < kNumNodes; ++i) {
+      nodes_[i].reset();
+    }
+  }
+
+ protected:
+  // Peers are only used once connected, so wait for that.
+  void WaitUntilConnected() {
+    for (int i = 0; i < kNumNodes; ++i) {
+      for (int j = 0; j < kNumNodes; ++j) {
+        if (j != i) {
+          ASSERT_TRUE(WaitUntilReachable(peers_[i][j], timer_.get()));
+        }
+      }
+    }
+  }
+
+  // Returns a key that is owned by node.
+  GoogleString KeyOwnedBy(int node) {
+    for (int i = 0;; ++i) {
+      GoogleString key = StrCat("key", IntegerToString(i));
+      if (ring_.Owner(key) == names_[node] && !used_keys_.count(key)) {
+        used_keys_.insert(key);
+        return key;
+      }
+    }
+  }
+
+  int64 TimedVariableTotal(int node, const char* name) {
+    return stats_[node]->GetTimedVariable(name)->Get(TimedVariable::START);
+  }
+
+  int64 LocalRequests(int node) {
+    return TimedVariableTotal(node, PopularityContestScheduleRewriteController::
+                                        kNumRewritesRequested);
+  }
+
+  // Results are reported to the owner asynchronously, so poll for them.
+  bool WaitForTotal(int node, const char* name, int64 expected) {
+    for (int i = 0; i < kMaxPolls; ++i) {
+      if (TimedVariableTotal(node, name) == expected) {
+        return true;
+      }
+      timer_->SleepMs(kPollIntervalMs);
+    }
+    return false;
+  }
+
+  std::unique_ptr<ThreadSystem> thread_system_;
+  std::unique_ptr<Timer> timer_;
+  MockTimer mock_timer_;
+  NullMessageHandler handler_;
+  ConsistentHashRing ring_;
+  std::set<GoogleString> used_keys_;
+  GoogleString names_[kNumNodes];
+  CentralControllerRpcService::AsyncService services_[kNumNodes];
+  std::unique_ptr<::grpc::ServerCompletionQueue> queues_[kNumNodes];
+  std::unique_ptr<::grpc::Server> servers_[kNumNodes];
+  std::unique_ptr<ServerThread> threads_[kNumNodes];
+  std::unique_ptr<SimpleStats> stats_[kNumNodes];
+  // peers_[i][j] is node i's connection to node j. Owned by nodes_[i].
+  RemoteScheduleRewriteController* peers_[kNumNodes][kNumNodes];
+  std::unique_ptr<ClusteredScheduleRewriteController> nodes_[kNumNodes];
+};
+
+TEST_F(LocalhostClusterTest, KeyRunsOnceAcrossCluster) {
+  WaitUntilConnected();
+  GoogleString key = KeyOwnedBy(1);
+
+  NotifyingFunction first(thread_system_.get());
+  nodes_[0]->ScheduleRewrite(key, &first);
+  first.Wait();
+  EXPECT_TRUE(first.run_called());
+
+  // The owner is still running it, so another node is turned away.
+  NotifyingFunction second(thread_system_.get());
+  nodes_[2]->ScheduleRewrite(key, &second);
+  second.Wait();
+  EXPECT_TRUE(second.cancel_called());
+
+  EXPECT_EQ(0, LocalRequests(0));
+  EXPECT_EQ(2, LocalRequests(1));
+  EXPECT_EQ(0, LocalRequests(2));
+  EXPECT_EQ(1, TimedVariableTotal(0, ClusteredScheduleRewriteController::
+                                         kNumRewritesForwarded));
+  EXPECT_EQ(1, TimedVariableTotal(2, ClusteredScheduleRewriteController::
+                                         kNumRewritesForwarded));
+
+  // Completion travels back to the owner, after which the key can run again.
+  nodes_[0]->NotifyRewriteComplete(key);
+  EXPECT_TRUE(WaitForTotal(
+      1, PopularityContestScheduleRewriteController::kNumRewritesSucceeded,
+      1));
+  NotifyingFunction again(thread_system_.get());
+  nodes_[2]->ScheduleRewrite(key, &again);
+  again.Wait();
+  EXPECT_TRUE(again.run_called());
+  nodes_[2]->NotifyRewriteFailed(key);
+  EXPECT_TRUE(WaitForTotal(
+      1, PopularityContestScheduleRewriteController::kNumRewritesFailed, 1));
+}
+
+}  // namespace net_instaweb
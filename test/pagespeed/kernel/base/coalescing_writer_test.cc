@@ -0,0 +1,124 @@
+/*
+ * Licensed to the Apache Software Foundation (ASF) under one
+ * or more contributor license agreements.  See the NOTICE file
+ * distributed with this work for additional information
+ * regarding copyright ownership.  The ASF licenses this file
+ * to you under the Apache License, Version 2.0 (the
+ * "License"); you may not use this file except in compliance
+ * with the License.  You may obtain a copy of the License at
+ * 
+ *   http://www.apache.org/licenses/LICENSE-2.0
+ * 
+ * Unless required by applicable law or agreed to in writing,
+ * software distributed under the License is distributed on an
+ * "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY
+ * KIND, either express or implied.  See the License for the
+ * specific language governing permissions and limitations
+ * under the License.
+ */
+
+#include "pagespeed/kernel/base/coalescing_writer.h"
+
+#include "pagespeed/kernel/base/message_handler.h"
+#include "pagespeed/kernel/base/null_mutex.h"
+#include "pagespeed/kernel/base/string.h"
+#include "pagespeed/kernel/base/string_util.h"
+#include "pagespeed/kernel/base/writer.h"
+#include "test/pagespeed/kernel/base/gtest.h"
+#include "test/pagespeed/kernel/base/mock_message_handler.h"
+
+namespace net_instaweb {
+
+namespace {
+
+// Records writes as W:text| and flushes as F|, failing every call once
+// set_fail() has been called.
+class TracingWriter : public Writer {
+ public:
+  TracingWriter() : fail_(false) {}
+
+  bool Write(const StringPiece& str, MessageHandler* handler) override {
+    StrAppend(&recorded_, "W:", str, "|");
+    return !fail_;
+  }
+
+  bool Flush(MessageHandler* handler) override {
+    recorded_.append("F|");
+    return !fail_;
+  }
+
+  const GoogleString& recorded() const { return recorded_; }
+  void set_fail() { fail_ = true; }
+
+ private:
+  GoogleString recorded_;
+  bool fail_;
+};
+
+class CoalescingWriterTest : public testing::Test {
+ protected:
+  CoalescingWriterTest()
+      : message_handler_(new NullMutex), writer_(&tracer_, 8) {}
+
+  bool Write(StringPiece str) { return writer_.Write(str, &message_handler_); }
+
+  MockMessageHandler message_handler_;
+  TracingWriter tracer_;
+  CoalescingWriter writer_;
+};
+
+TEST_F(CoalescingWriterTest, SmallWritesAreJoined) {
+  EXPECT_TRUE(Write("<a"));
+  EXPECT_TRUE(Write(" "));
+  EXPECT_TRUE(Write("b"));
+  EXPECT_TRUE(Write(">"));
+  EXPECT_EQ("", tracer_.recorded());
+  EXPECT_EQ(5, writer_.buffered_bytes());
+  EXPECT_TRUE(writer_.Flush(&message_handler_));
+  EXPECT_EQ("W:<a b>|F|", tracer_.recorded());
+  EXPECT_EQ(0, writer_.buffered_bytes());
+}
+
+TEST_F(CoalescingWriterTest, FullBufferIsHandedOver) {
+  EXPECT_TRUE(Write("abcde"));
+  EXPECT_TRUE(Write("fgh"));
+  EXPECT_EQ("", tracer_.recorded());
+  EXPECT_TRUE(Write("ij"));
+  EXPECT_EQ("W:abcdefgh|", tracer_.recorded());
+  EXPECT_TRUE(writer_.Drain(&message_handler_));
+  EXPECT_EQ("W:abcdefgh|W:ij|", tracer_.recorded());
+}
+
+TEST_F(CoalescingWriterTest, LargeWritesPassThrough) {
+  EXPECT_TRUE(Write("ab"));
+  EXPECT_TRUE(Write("0123456789"));
+  EXPECT_TRUE(Write("cd"));
+  EXPECT_TRUE(writer_.Flush(&message_handler_));
+  EXPECT_EQ("W:ab|W:0123456789|W:cd|F|", tracer_.recorded());
+}
+
+TEST_F(CoalescingWriterTest, FlushWithNothingBuffered) {
+  EXPECT_TRUE(writer_.Flush(&message_handler_));
+  EXPECT_EQ("F|", tracer_.recorded());
+}
+
+TEST_F(CoalescingWriterTest, ClearDropsBufferedBytes) {
+  EXPECT_TRUE(Write("abc"));
+  writer_.Clear();
+  EXPECT_TRUE(Write("d"));
+  EXPECT_TRUE(writer_.Flush(&message_handler_));
+  EXPECT_EQ("W:d|F|", tracer_.recorded());
+}
+
+TEST_F(CoalescingWriterTest, FailureReportedWhenDrained) {
+  tracer_.set_fail();
+  EXPECT_TRUE(Write("abc"));
+  EXPECT_FALSE(Write("0123456789"));
+  EXPECT_EQ("W:abc|W:0123456789|", tracer_.recorded());
+  EXPECT_TRUE(Write("d"));
+  EXPECT_FALSE(writer_.Flush(&message_handler_));
+}
+
+}  // namespace
+
+}  // namespace net_instaweb
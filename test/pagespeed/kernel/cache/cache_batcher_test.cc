@@ -485,6 +485,85 @@ TEST_F(CacheBatcherTest, CoalesceInFlightGet) {
   EXPECT_EQ(2, lru_cache_->num_hits());
 }
 
+TEST_F(CacheBatcherTest, MultiGetIssuedAsOneBatch) {
+  CacheBatcher::Options options;
+  options.max_parallel_lookups = 1;
+  ChangeBatcherConfig(options, delay_cache_.get());
+  TestMultiGet();
+  EXPECT_EQ(3, LastBatchSize());
+}
+
+TEST_F(CacheBatcherTest, MultiGetQueuedBehindInFlightGet) {
+  CacheBatcher::Options options;
+  options.max_parallel_lookups = 1;
+  ChangeBatcherConfig(options, delay_cache_.get());
+  PopulateCache(3);
+
+  DelayKey("n0");
+  Callback* n0 = InitiateGet("n0");
+
+  // n0 piggybacks on the lookup in flight; n1 and n2 wait for it to finish
+  // and then go out together.
+  Callback* n0_dup = AddCallback();
+  Callback* n1 = AddCallback();
+  Callback* n2 = AddCallback();
+  IssueMultiGet(n0_dup, "n0", n1, "n1", n2, "n2");
+  EXPECT_EQ(1, num_in_flight_keys());
+
+  ReleaseKey("n0");
+  WaitAndCheck(n0, "v0");
+  WaitAndCheck(n0_dup, "v0");
+  WaitAndCheck(n1, "v1");
+  WaitAndCheck(n2, "v2");
+  EXPECT_EQ(2, LastBatchSize());
+  EXPECT_EQ(3, lru_cache_->num_hits());
+}
+
+TEST_F(CacheBatcherTest, MultiGetJoinsInFlightWhenQueueFull) {
+  // There's room for another lookup but not for queueing, so keys that are
+  // already in flight must still be coalesced rather than looked up twice.
+  CacheBatcher::Options options;
+  options.max_parallel_lookups = 2;
+  options.max_pending_gets = 1;
+  ChangeBatcherConfig(options, delay_cache_.get());
+  PopulateCache(3);
+
+  DelayKey("n0");
+  Callback* n0 = InitiateGet("n0");
+
+  Callback* n0_dup = AddCallback();
+  Callback* n1 = AddCallback();
+  Callback* n2 = AddCallback();
+  IssueMultiGet(n0_dup, "n0", n1, "n1", n2, "n2");
+  WaitAndCheck(n1, "v1");
+  WaitAndCheck(n2, "v2");
+  EXPECT_EQ(2, LastBatchSize());
+
+  ReleaseKey("n0");
+  WaitAndCheck(n0, "v0");
+  WaitAndCheck(n0_dup, "v0");
+  EXPECT_EQ(3, lru_cache_->num_hits());
+  EXPECT_EQ(0, statistics_->GetVariable("cache_batcher_dropped_gets")->Get());
+}
+
+TEST_F(CacheBatcherTest, GetJoinsInFlightWhenQueueFull) {
+  CacheBatcher::Options options;
+  options.max_parallel_lookups = 2;
+  options.max_pending_gets = 1;
+  ChangeBatcherConfig(options, delay_cache_.get());
+  PopulateCache(1);
+
+  DelayKey("n0");
+  Callback* n0 = InitiateGet("n0");
+  Callback* n0_dup = InitiateGet("n0");
+  EXPECT_EQ(1, num_in_flight_keys());
+
+  ReleaseKey("n0");
+  WaitAndCheck(n0, "v0");
+  WaitAndCheck(n0_dup, "v0");
+  EXPECT_EQ(1, lru_cache_->num_hits());
+}
+
 TEST_F(CacheBatcherTest, CheckWriteThroughCacheCompatibility) {
   LRUCache small_cache(kMaxSize);
   LRUCache big_cache(kMaxSize);
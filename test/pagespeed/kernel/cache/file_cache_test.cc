@@ -47,6 +47,91 @@
 
 namespace net_instaweb {
 
+// A MemFileSystem that, once checking is enabled, counts the input files read
+// before every file opened so far had been hinted with ReadAhead.
+class ReadAheadCheckingFileSystem : public MemFileSystem {
+ public:
+  ReadAheadCheckingFileSystem(ThreadSystem* thread_system, Timer* timer)
+      : MemFileSystem(thread_system, timer),
+        checking_(false),
+        num_opened_(0),
+        num_read_ahead_(0),
+        num_early_reads_(0) {}
+
+  InputFile* OpenInputFile(const char* filename,
+                           MessageHandler* message_handler) override {
+    InputFile* input_file =
+        MemFileSystem::OpenInputFile(filename, message_handler);
+    if (!checking_ || (input_file == nullptr)) {
+      return input_file;
+    }
+    ++num_opened_;
+    return new CheckingInputFile(this, input_file);
+  }
+
+  // Starts counting from zero.  Only files opened from now on are checked.
+  void StartChecking() {
+    checking_ = true;
+    num_opened_ = 0;
+    num_read_ahead_ = 0;
+    num_early_reads_ = 0;
+  }
+
+  int num_read_ahead() const { return num_read_ahead_; }
+  int num_early_reads() const { return num_early_reads_; }
+
+ private:
+  class CheckingInputFile : public InputFile {
+   public:
+    CheckingInputFile(ReadAheadCheckingFileSystem* file_system,
+                      InputFile* input_file)
+        : file_system_(file_system), input_file_(input_file) {}
+
+    const char* filename() override { return input_file_->filename(); }
+
+    int Read(char* buf, int size, MessageHandler* handler) override {
+      file_system_->CheckRead();
+      return input_file_->Read(buf, size, handler);
+    }
+
+    bool ReadFile(GoogleString* buf, int64 max_file_size,
+                  MessageHandler* handler) override {
+      file_system_->CheckRead();
+      return input_file_->ReadFile(buf, max_file_size, handler);
+    }
+
+    void ReadAhead(MessageHandler* handler) override {
+      ++file_system_->num_read_ahead_;
+      input_file_->ReadAhead(handler);
+    }
+
+   protected:
+    bool Close(MessageHandler* handler) override {
+      return file_system_->Close(input_file_, handler);
+    }
+
+   private:
+    ReadAheadCheckingFileSystem* file_system_;
+    InputFile* input_file_;
+
+    DISALLOW_COPY_AND_ASSIGN(CheckingInputFile);
+  };
+
+  void CheckRead() {
+    if (num_read_ahead_ < num_opened_) {
+      ++num_early_reads_;
+    }
+  }
+
+  // The counters are only touched by the thread issuing the lookups.
+  bool checking_;
+  int num_opened_;
+  int num_read_ahead_;
+  int num_early_reads_;
+
+  DISALLOW_COPY_AND_ASSIGN(ReadAheadCheckingFileSystem);
+};
+
 class FileCacheTest : public CacheTestBase {
  protected:
   FileCacheTest()
@@ -169,7 +254,7 @@ class FileCacheTest : public CacheTestBase {
   MD5Hasher hasher_;
   SlowWorker worker_;
   MockTimer mock_timer_;
-  MemFileSystem file_system_;
+  ReadAheadCheckingFileSystem file_system_;
   const int64 kCleanIntervalMs;
   const int64 kTargetSize;
   const int64 kTargetInodeLimit;
@@ -202,6 +287,23 @@ TEST_F(FileCacheTest, PutGetDelete) {
   CheckNotFound("Name");
 }
 
+TEST_F(FileCacheTest, MultiGet) { TestMultiGet(); }
+
+TEST_F(FileCacheTest, MultiGetReadsAheadBeforeReading) {
+  PopulateCache(2);
+
+  // A plain Get reads its file without a hint, which the file system sees.
+  file_system_.StartChecking();
+  CheckGet("n0", "v0");
+  EXPECT_EQ(0, file_system_.num_read_ahead());
+  EXPECT_EQ(1, file_system_.num_early_reads());
+
+  file_system_.StartChecking();
+  TestMultiGet();
+  EXPECT_EQ(2, file_system_.num_read_ahead());
+  EXPECT_EQ(0, file_system_.num_early_reads());
+}
+
 // Throw a bunch of files into the cache and verify that they are
 // evicted sensibly.
 TEST_F(FileCacheTest, Clean) {
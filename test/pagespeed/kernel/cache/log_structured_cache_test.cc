@@ -0,0 +1,306 @@
+/*
+ * Licensed to the Apache Software Foundation (ASF) under one
+ * or more contributor license agreements.  See the NOTICE file
+ * distributed with this work for additional information
+ * regarding copyright ownership.  The ASF licenses this file
+ * to you under the Apache License, Version 2.0 (the
+ * "License"); you may not use this file except in compliance
+ * with the License.  You may obtain a copy of the License at
+ * 
+ *   http://www.apache.org/licenses/LICENSE-2.0
+ * 
+ * Unless required by applicable law or agreed to in writing,
+ * software distributed under the License is distributed on an
+ * "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY
+ * KIND, either express or implied.  See the License for the
+ * specific language governing permissions and limitations
+ * under the License.
+ */
+
+// Unit-test the log-structured cache.
+#include "pagespeed/kernel/cache/log_structured_cache.h"
+
+#include <unistd.h>
+
+#include <memory>
+
+#include "pagespeed/kernel/base/basictypes.h"
+#include "pagespeed/kernel/base/cache_interface.h"
+#include "pagespeed/kernel/base/google_message_handler.h"
+#include "pagespeed/kernel/base/shared_string.h"
+#include "pagespeed/kernel/base/statistics.h"
+#include "pagespeed/kernel/base/stdio_file_system.h"
+#include "pagespeed/kernel/base/string.h"
+#include "pagespeed/kernel/base/string_util.h"
+#include "pagespeed/kernel/base/thread_system.h"
+#include "pagespeed/kernel/thread/slow_worker.h"
+#include "pagespeed/kernel/util/platform.h"
+#include "pagespeed/kernel/util/simple_stats.h"
+#include "test/pagespeed/kernel/base/gtest.h"
+#include "test/pagespeed/kernel/cache/cache_test_base.h"
+
+namespace net_instaweb {
+
+namespace {
+
+const int64 kSegmentSize = 256;
+const int64 kMaxSize = 1024 * 1024;
+
+// Fills in a missing key from its Done, as a fetch path would on a miss.
+class PutOnMissCallback : public CacheInterface::Callback {
+ public:
+  PutOnMissCallback(CacheInterface* cache, const GoogleString& value)
+      : cache_(cache), value_(value), state_(CacheInterface::kAvailable) {}
+
+  void Done(CacheInterface::KeyState state) override {
+    state_ = state;
+    if (state == CacheInterface::kNotFound) {
+      cache_->Put("missing", SharedString(value_));
+    }
+  }
+
+  CacheInterface::KeyState state() const { return state_; }
+
+ private:
+  CacheInterface* cache_;
+  GoogleString value_;
+  CacheInterface::KeyState state_;
+
+  DISALLOW_COPY_AND_ASSIGN(PutOnMissCallback);
+};
+
+}  // namespace
+
+class LogStructuredCacheTest : public CacheTestBase {
+ protected:
+  LogStructuredCacheTest()
+      : thread_system_(Platform::CreateThreadSystem()),
+        stats_(thread_system_.get()),
+        path_(StrCat(GTestTempDir(), "/log_structured_cache_test")),
+        worker_(nullptr) {
+    LogStructuredCache::InitStats(&stats_);
+  }
+
+  void SetUp() override {
+    CacheTestBase::SetUp();
+    file_system_.RecursivelyMakeDir(path_, &handler_);
+    StringVector files;
+    file_system_.ListContents(path_, &files, &handler_);
+    for (const GoogleString& file : files) {
+      file_system_.RemoveFile(file.c_str(), &handler_);
+    }
+    ResetCache(kSegmentSize, kMaxSize);
+  }
+
+  // Deletes the cache and opens a new one on the same directory, as a
+  // restarted server would.
+  void ResetCache(int64 segment_size_bytes, int64 max_size_bytes) {
+    cache_.reset();
+    cache_ = std::make_unique<LogStructuredCache>(
+        path_, segment_size_bytes, max_size_bytes, thread_system_.get(),
+        worker_, &stats_, &handler_);
+    ASSERT_TRUE(cache_->Initialize());
+  }
+
+  CacheInterface* Cache() override { return cache_.get(); }
+
+  int NumSegmentFiles() {
+    StringVector files;
+    file_system_.ListContents(path_, &files, &handler_);
+    return files.size();
+  }
+
+  int64 Stat(const char* name) { return stats_.GetVariable(name)->Get(); }
+
+  void WaitForWorker(SlowWorker* worker) {
+    while (worker->IsBusy()) {
+      usleep(10);
+    }
+  }
+
+  std::unique_ptr<ThreadSystem> thread_system_;
+  SimpleStats stats_;
+  GoogleMessageHandler handler_;
+  StdioFileSystem file_system_;
+  const GoogleString path_;
+  // Runs maintenance for caches made by ResetCache, if set.
+  SlowWorker* worker_;
+  std::unique_ptr<LogStructuredCache> cache_;
+};
+
+TEST_F(LogStructuredCacheTest, PutGetDelete) {
+  CheckPut("Name", "Value");
+  CheckGet("Name", "Value");
+  CheckNotFound("Another Name");
+
+  CheckPut("Name", "NewValue");
+  CheckGet("Name", "NewValue");
+  cache_->Flush();
+  CheckGet("Name", "NewValue");
+  EXPECT_EQ(1, cache_->num_entries());
+
+  CheckDelete("Name");
+  CheckNotFound("Name");
+  EXPECT_EQ(0, cache_->num_entries());
+}
+
+TEST_F(LogStructuredCacheTest, UseCacheFromMissCallback) {
+  PutOnMissCallback callback(cache_.get(), "found");
+  cache_->Get("missing", &callback);
+  EXPECT_EQ(CacheInterface::kNotFound, callback.state());
+  CheckGet("missing", "found");
+}
+
+TEST_F(LogStructuredCacheTest, MultiGet) { TestMultiGet(); }
+
+TEST_F(LogStructuredCacheTest, Restart) {
+  CheckPut("a", "apple");
+  CheckPut("b", "banana");
+  CheckPut("c", "cherry");
+  CheckPut("a", "apricot");
+  CheckDelete("b");
+  // The destructor writes out whatever is still buffered.
+  ResetCache(kSegmentSize, kMaxSize);
+  CheckGet("a", "apricot");
+  CheckNotFound("b");
+  CheckGet("c", "cherry");
+  EXPECT_EQ(2, cache_->num_entries());
+  EXPECT_EQ(0, Stat(LogStructuredCache::kRecoveryTruncations));
+}
+
+TEST_F(LogStructuredCacheTest, RecoverFromTornWrite) {
+  CheckPut("a", "apple");
+  CheckPut("b", "banana");
+  cache_->Flush();
+
+  // Simulate a crash part-way through writing a record.
+  GoogleString segment = StrCat(path_, "/0.seg");
+  GoogleString contents;
+  ASSERT_TRUE(file_system_.ReadFile(segment.c_str(), &contents, &handler_));
+  int64 good_size = contents.size();
+  contents.append("\x12\x34\x56\x78" "CPSL" "partial record");
+  ASSERT_TRUE(file_system_.WriteFile(segment.c_str(), contents, &handler_));
+
+  ResetCache(kSegmentSize, kMaxSize);
+  EXPECT_EQ(1, Stat(LogStructuredCache::kRecoveryTruncations));
+  CheckGet("a", "apple");
+  CheckGet("b", "banana");
+  EXPECT_EQ(good_size, cache_->size_bytes());
+
+  // New records go after the last good one, so they survive a restart.
+  CheckPut("c", "cherry");
+  ResetCache(kSegmentSize, kMaxSize);
+  EXPECT_EQ(1, Stat(LogStructuredCache::kRecoveryTruncations));
+  CheckGet("a", "apple");
+  CheckGet("b", "banana");
+  CheckGet("c", "cherry");
+}
+
+TEST_F(LogStructuredCacheTest, CompactOverwrittenSegments) {
+  CheckPut("keep", "kept value");
+  for (int i = 0; i < 100; ++i) {
+    CheckPut("churn", StrCat("value ", IntegerToString(i)));
+  }
+  EXPECT_LT(0, Stat(LogStructuredCache::kCompactions));
+  EXPECT_EQ(0, Stat(LogStructuredCache::kEvictions));
+  EXPECT_GE(3, NumSegmentFiles());
+  CheckGet("keep", "kept value");
+  CheckGet("churn", "value 99");
+
+  ResetCache(kSegmentSize, kMaxSize);
+  CheckGet("keep", "kept value");
+  CheckGet("churn", "value 99");
+  EXPECT_EQ(2, cache_->num_entries());
+}
+
+TEST_F(LogStructuredCacheTest, CompactOnWorker) {
+  SlowWorker worker("log_structured_cache_maintenance", thread_system_.get());
+  worker.Start();
+  worker_ = &worker;
+  ResetCache(kSegmentSize, kMaxSize);
+
+  // Gets and Puts race with maintenance on the worker.  It may skip some of
+  // the segments filled while it is busy, but not all of them.
+  CheckPut("keep", "kept value");
+  for (int i = 0; i < 100; ++i) {
+    CheckPut("churn", StrCat("value ", IntegerToString(i)));
+    CheckGet("keep", "kept value");
+  }
+  WaitForWorker(&worker);
+  EXPECT_LT(0, Stat(LogStructuredCache::kCompactions));
+  EXPECT_EQ(0, Stat(LogStructuredCache::kWriteErrors));
+  CheckGet("keep", "kept value");
+  CheckGet("churn", "value 99");
+
+  // The worker must be stopped before the cache goes away.
+  worker.ShutDown();
+  worker_ = nullptr;
+  ResetCache(kSegmentSize, kMaxSize);
+  CheckGet("keep", "kept value");
+  CheckGet("churn", "value 99");
+  EXPECT_EQ(2, cache_->num_entries());
+}
+
+TEST_F(LogStructuredCacheTest, RetryStartingSegment) {
+  CheckPut("a", "apple");
+  cache_.reset();
+
+  // Reopen with the first segment full, and with a directory where the next
+  // segment's file should go, so that it can't be started.
+  GoogleString segment = StrCat(path_, "/0.seg");
+  GoogleString contents;
+  ASSERT_TRUE(file_system_.ReadFile(segment.c_str(), &contents, &handler_));
+  GoogleString blocker = StrCat(path_, "/1.seg");
+  ASSERT_TRUE(file_system_.MakeDir(blocker.c_str(), &handler_));
+  cache_ = std::make_unique<LogStructuredCache>(
+      path_, contents.size(), kMaxSize, thread_system_.get(), nullptr,
+      &stats_, &handler_);
+  EXPECT_FALSE(cache_->Initialize());
+  EXPECT_FALSE(cache_->IsHealthy());
+
+  // What's on disk can still be read, but nothing can be written.
+  CheckGet("a", "apple");
+  CheckPut("b", "berry");
+  CheckNotFound("b");
+
+  // Once the problem clears, the next write starts the segment.
+  ASSERT_TRUE(file_system_.RemoveDir(blocker.c_str(), &handler_));
+  CheckPut("b", "berry");
+  EXPECT_TRUE(cache_->IsHealthy());
+  CheckGet("a", "apple");
+  CheckGet("b", "berry");
+
+  ResetCache(kSegmentSize, kMaxSize);
+  CheckGet("a", "apple");
+  CheckGet("b", "berry");
+}
+
+TEST_F(LogStructuredCacheTest, EvictOldestSegments) {
+  const int64 kSmallMaxSize = 3 * kSegmentSize;
+  ResetCache(kSegmentSize, kSmallMaxSize);
+  for (int i = 0; i < 100; ++i) {
+    CheckPut(StrCat("key", IntegerToString(i)), "a value of some size");
+  }
+  EXPECT_LT(0, Stat(LogStructuredCache::kEvictions));
+  EXPECT_GE(kSmallMaxSize + kSegmentSize, cache_->size_bytes());
+  CheckNotFound("key0");
+  CheckGet("key99", "a value of some size");
+  EXPECT_GT(100, cache_->num_entries());
+}
+
+TEST_F(LogStructuredCacheTest, RejectOversizedValue) {
+  CheckPut("big", "small");
+  CheckPut("big", GoogleString(kSegmentSize, 'x'));
+  CheckNotFound("big");
+}
+
+TEST_F(LogStructuredCacheTest, ShutDown) {
+  CheckPut("a", "apple");
+  cache_->ShutDown();
+  EXPECT_FALSE(cache_->IsHealthy());
+  CheckNotFound("a");
+  ResetCache(kSegmentSize, kMaxSize);
+  CheckGet("a", "apple");
+}
+
+}  // namespace net_instaweb
@@ -121,4 +121,27 @@ TEST_F(WriteThroughCacheTest, FindShadowedValid) {
   CheckGet(&small_cache_, "Name", "valid");
 }
 
+TEST_F(WriteThroughCacheTest, MultiGet) {
+  TestMultiGet();
+}
+
+TEST_F(WriteThroughCacheTest, MultiGetFallsBackToL2) {
+  // n0 is only in L1, n1 only in L2, and n2 is shadowed by an invalid value
+  // in L1.  The misses are looked up in L2 together, and fixed up in L1.
+  CheckPut(&small_cache_, "n0", "v0");
+  CheckPut(&big_cache_, "n1", "v1");
+  CheckPut(&small_cache_, "n2", "invalid");
+  CheckPut(&big_cache_, "n2", "v2");
+  set_invalid_value("invalid");
+  Callback* n0 = AddCallback();
+  Callback* n1 = AddCallback();
+  Callback* n2 = AddCallback();
+  IssueMultiGet(n0, "n0", n1, "n1", n2, "n2");
+  WaitAndCheck(n0, "v0");
+  WaitAndCheck(n1, "v1");
+  WaitAndCheck(n2, "v2");
+  CheckGet(&small_cache_, "n1", "v1");
+  CheckGet(&small_cache_, "n2", "v2");
+}
+
 }  // namespace net_instaweb
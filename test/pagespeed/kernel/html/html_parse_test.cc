@@ -87,6 +87,20 @@ class HtmlParseTest : public HtmlParseTestBase {
     html_parse_.ParseText(input.substr(flush_index));
     html_parse_.FinishParse();
   }
+
+  // Like ParseWithFlush, but lexes the rest of the input ahead of the flush,
+  // as ProxyFetch does while a flush waits for its rewrites.
+  void ParseAheadOfFlush(StringPiece input, int flush_index) {
+    GoogleString this_id = absl::StrFormat("http://test.com/%d", flush_index);
+    output_buffer_.clear();
+    html_parse_.StartParse(this_id);
+    html_parse_.ParseText(input.substr(0, flush_index));
+    html_parse_.BeginParseAhead();
+    html_parse_.ParseText(input.substr(flush_index));
+    html_parse_.Flush();
+    html_parse_.EndParseAhead();
+    html_parse_.FinishParse();
+  }
 };
 
 class HtmlParseTestNoBody : public HtmlParseTestBase {
@@ -1996,6 +2010,27 @@ TEST_F(AttributeManipulationTest, ModifyKeepAttribute) {
       " selected />");
 }
 
+TEST_F(AttributeManipulationTest, DecodedValueSharedWhenUnescaped) {
+  HtmlElement::Attribute* href = node_->FindAttribute(HtmlName::kHref);
+  ASSERT_TRUE(href != nullptr);
+  EXPECT_EQ(href->escaped_value(), href->DecodedValueOrNull());
+
+  href->SetEscapedValue("a&amp;b");
+  EXPECT_STREQ("a&amp;b", href->escaped_value());
+  EXPECT_STREQ("a&b", href->DecodedValueOrNull());
+  EXPECT_NE(href->escaped_value(), href->DecodedValueOrNull());
+
+  // Setting a value from a piece of the current one is safe, shared or not.
+  href->SetValue(StringPiece(href->DecodedValueOrNull(), 1));
+  EXPECT_STREQ("a", href->escaped_value());
+  EXPECT_EQ(href->escaped_value(), href->DecodedValueOrNull());
+  href->SetEscapedValue(href->escaped_value() + 0);
+  EXPECT_STREQ("a", href->DecodedValueOrNull());
+  CheckExpected(
+      "<a href=\"a\" id=37 class='search!'"
+      " selected />");
+}
+
 TEST_F(AttributeManipulationTest, BadUrl) {
   EXPECT_FALSE(html_parse_.StartParse(")(*&)(*&(*"));
 
@@ -2039,6 +2074,222 @@ TEST_F(AttributeManipulationTest, CloneElement) {
       " selected />");
 }
 
+// Records the original start tag of every element, then changes the element
+// with id=x in the way the test asks for.
+class OriginalStartTagFilter : public EmptyHtmlFilter {
+ public:
+  enum Change { kNoChange, kSetValue, kErase, kAdd, kRename };
+
+  explicit OriginalStartTagFilter(HtmlParse* html_parse)
+      : html_parse_(html_parse), change_(kNoChange) {}
+
+  void StartElement(HtmlElement* element) override {
+    StringPiece tag = element->original_start_tag();
+    if (!tag.empty()) {
+      tags_.push_back(tag.as_string());
+    }
+    HtmlElement::Attribute* id = element->FindAttribute(HtmlName::kId);
+    if (id == nullptr || StringPiece(id->escaped_value()) != "x") {
+      return;
+    }
+    switch (change_) {
+      case kNoChange:
+        break;
+      case kSetValue:
+        id->SetValue("y");
+        break;
+      case kErase: {
+        HtmlElement::AttributeList* attrs = element->mutable_attributes();
+        HtmlElement::AttributeIterator iter(attrs->begin());
+        attrs->Erase(&iter);
+        break;
+      }
+      case kAdd:
+        html_parse_->AddAttribute(element, HtmlName::kAlt, "z");
+        break;
+      case kRename:
+        html_parse_->SetAttributeName(id, HtmlName::kClass);
+        break;
+    }
+  }
+
+  const char* Name() const override { return "OriginalStartTag"; }
+
+  void set_change(Change change) { change_ = change; }
+  const StringVector& tags() const { return tags_; }
+
+ private:
+  HtmlParse* html_parse_;
+  Change change_;
+  StringVector tags_;
+
+  DISALLOW_COPY_AND_ASSIGN(OriginalStartTagFilter);
+};
+
+class OriginalStartTagTest : public HtmlParseTestNoBody {
+ protected:
+  OriginalStartTagTest() : filter_(html_parse()) {}
+
+  void SetUp() override {
+    HtmlParseTestNoBody::SetUp();
+    html_parse()->AddFilter(&filter_);
+  }
+
+  bool AddHtmlTags() const override { return false; }
+
+  OriginalStartTagFilter filter_;
+};
+
+TEST_F(OriginalStartTagTest, CanonicalTagsKept) {
+  ValidateNoChanges("canonical",
+                    "<div id=a class=\"b\">1</div><img src='c' alt />"
+                    "<p>2</p><br class=d />");
+  ASSERT_EQ(3U, filter_.tags().size());
+  EXPECT_EQ("<div id=a class=\"b\"", filter_.tags()[0]);
+  EXPECT_EQ("<img src='c' alt", filter_.tags()[1]);
+  EXPECT_EQ("<br class=d", filter_.tags()[2]);
+}
+
+TEST_F(OriginalStartTagTest, NonCanonicalTagsRewritten) {
+  ValidateExpected("non_canonical",
+                   "<div  id=a>1</div><div id = a>2</div>"
+                   "<div\nid=a>3</div><div id=a >4</div>",
+                   "<div id=a>1</div><div id=a>2</div>"
+                   "<div id=a>3</div><div id=a>4</div>");
+  // Only the last one starts out canonical; the writer drops the space
+  // before its '>' either way.
+  ASSERT_EQ(1U, filter_.tags().size());
+  EXPECT_EQ("<div id=a", filter_.tags()[0]);
+}
+
+TEST_F(OriginalStartTagTest, ChangesInvalidate) {
+  filter_.set_change(OriginalStartTagFilter::kSetValue);
+  ValidateExpected("set_value", "<a id=x href=h>1</a>",
+                   "<a id=y href=h>1</a>");
+  filter_.set_change(OriginalStartTagFilter::kErase);
+  ValidateExpected("erase", "<a id=x href=h>1</a>", "<a href=h>1</a>");
+  filter_.set_change(OriginalStartTagFilter::kAdd);
+  ValidateExpected("add", "<a id=x href=h>1</a>",
+                   "<a id=x href=h alt=\"z\">1</a>");
+  filter_.set_change(OriginalStartTagFilter::kRename);
+  ValidateExpected("rename", "<a id=x href=h>1</a>",
+                   "<a class=x href=h>1</a>");
+}
+
+TEST_F(OriginalStartTagTest, OutlivesCallersInput) {
+  SetupWriter();
+  html_parse()->StartParse("http://test.com/chunks.html");
+  GoogleString chunk("<div id=a>1</div><p cl");
+  html_parse()->ParseText(chunk);
+  // The caller may reuse its buffer as soon as ParseText returns.
+  chunk.assign(chunk.size(), 'x');
+  html_parse()->ParseText("ass=b>2</p>");
+  html_parse()->FinishParse();
+  EXPECT_EQ("<div id=a>1</div><p class=b>2</p>", output_buffer_);
+  // The tag split between the two chunks is rebuilt instead.
+  ASSERT_EQ(1U, filter_.tags().size());
+  EXPECT_EQ("<div id=a", filter_.tags()[0]);
+}
+
+TEST_F(OriginalStartTagTest, CaseFoldRewrites) {
+  SetupWriter();
+  html_writer_filter_->set_case_fold(true);
+  ValidateExpected("case_fold", "<DIV ID=a>1</DIV>", "<div id=a>1</div>");
+}
+
+TEST_F(HtmlParseTest, ParseAheadMatchesFlush) {
+  SetupWriter();
+  const StringPiece kInput(
+      "<div><p>1<p>2</div><script>a=b;</script><img src=x>"
+      "<!--c--><span>3");
+  for (int i = 0, n = kInput.size(); i <= n; ++i) {
+    ParseWithFlush(kInput, i);
+    GoogleString expected = output_buffer_;
+    ParseAheadOfFlush(kInput, i);
+    EXPECT_EQ(expected, output_buffer_) << " flush " << i;
+  }
+}
+
+// Records, for each start tag seen, whether the element was rewritable.
+class RewritableFilter : public EmptyHtmlFilter {
+ public:
+  explicit RewritableFilter(HtmlParse* html_parse) : html_parse_(html_parse) {}
+
+  void StartElement(HtmlElement* element) override {
+    StrAppend(&rewritable_, element->name_str(),
+              html_parse_->IsRewritable(element) ? "+ " : "- ");
+  }
+
+  const char* Name() const override { return "Rewritable"; }
+
+  const GoogleString& rewritable() const { return rewritable_; }
+
+ private:
+  HtmlParse* html_parse_;
+  GoogleString rewritable_;
+
+  DISALLOW_COPY_AND_ASSIGN(RewritableFilter);
+};
+
+TEST_F(HtmlParseTest, ParseAheadLeavesElementsOpen) {
+  RewritableFilter filter(html_parse());
+  html_parse_.AddFilter(&filter);
+  SetupWriter();
+  html_parse_.StartParse("http://test.com/parse_ahead.html");
+  html_parse_.ParseText("<div><p><br>");
+  html_parse_.BeginParseAhead();
+  html_parse_.ParseText("1</p></div><b>2</b>");
+  html_parse_.Flush();
+
+  // The closes lexed ahead of the flush are not part of its window.
+  EXPECT_EQ("div- p- br+ ", filter.rewritable());
+  EXPECT_EQ("<div><p><br>", output_buffer_);
+  html_parse_.EndParseAhead();
+  html_parse_.FinishParse();
+  EXPECT_EQ("div- p- br+ b+ ", filter.rewritable());
+  EXPECT_EQ("<div><p><br>1</p></div><b>2</b>", output_buffer_);
+}
+
+// Remembers the last comment lexed, as event listeners see nodes as soon as
+// they are lexed.
+class CommentListener : public EmptyHtmlFilter {
+ public:
+  CommentListener() : comment_(nullptr) {}
+
+  void Comment(HtmlCommentNode* comment) override { comment_ = comment; }
+  const char* Name() const override { return "CommentListener"; }
+
+  HtmlCommentNode* comment() const { return comment_; }
+
+ private:
+  HtmlCommentNode* comment_;
+
+  DISALLOW_COPY_AND_ASSIGN(CommentListener);
+};
+
+TEST_F(HtmlParseTest, NodesLexedAheadAreOutsideEventWindow) {
+  CommentListener* listener = new CommentListener;
+  html_parse_.add_event_listener(listener);
+  SetupWriter();
+  html_parse_.StartParse("http://test.com/lexed_ahead.html");
+  html_parse_.ParseText("<div>");
+  html_parse_.BeginParseAhead();
+  html_parse_.ParseText("<!--c-->1</div>");
+  HtmlCommentNode* comment = listener->comment();
+  ASSERT_TRUE(comment != nullptr);
+
+  // The comment is lexed but held back, so filters running over the flushed
+  // window must not be able to rewrite it.
+  EXPECT_FALSE(html_parse_.IsRewritable(comment));
+  html_parse_.Flush();
+  EXPECT_FALSE(html_parse_.IsRewritable(comment));
+  EXPECT_EQ("<div>", output_buffer_);
+  html_parse_.EndParseAhead();
+  EXPECT_TRUE(html_parse_.IsRewritable(comment));
+  html_parse_.FinishParse();
+  EXPECT_EQ("<div><!--c-->1</div>", output_buffer_);
+}
+
 TEST_F(HtmlParseTest, NoDisabledFilter) {
   std::vector<GoogleString> disabled_filters;
   ASSERT_TRUE(disabled_filters.empty());
@@ -2327,6 +2578,25 @@ TEST_F(HtmlParseDeleteTest, DeleteAtStartAcrossFlush) {
   EXPECT_EQ(kInput.size(), total_successes_);
 }
 
+TEST_F(HtmlParseDeleteTest, DeleteWhileParsingAhead) {
+  delete_filter_.set_save_children(false);
+  delete_filter_.set_delete_node_type(HtmlName::kDiv);
+  delete_filter_.set_delete_from_type(HtmlName::kDiv);
+  const StringPiece kInput("1<div id=a>hello</div>2");
+  for (int i = 0, n = kInput.size(); i < n; ++i) {
+    // Deleting from the open tag always works; deleting from the close tag
+    // must fail, exactly as with a plain flush, whenever </div> comes after
+    // the flush, even though it has already been lexed.
+    for (bool on_open_tag : {true, false}) {
+      delete_filter_.set_delete_on_open_tag(on_open_tag);
+      ParseWithFlush(kInput, i);
+      GoogleString expected = output_buffer_;
+      ParseAheadOfFlush(kInput, i);
+      EXPECT_EQ(expected, output_buffer_) << " flush " << i;
+    }
+  }
+}
+
 TEST_F(HtmlParseDeleteTest, DeleteAtEndAcrossFlush) {
   delete_filter_.set_delete_on_open_tag(false);
   delete_filter_.set_save_children(false);
@@ -0,0 +1,178 @@
+/*
+ * Licensed to the Apache Software Foundation (ASF) under one
+ * or more contributor license agreements.  See the NOTICE file
+ * distributed with this work for additional information
+ * regarding copyright ownership.  The ASF licenses this file
+ * to you under the Apache License, Version 2.0 (the
+ * "License"); you may not use this file except in compliance
+ * with the License.  You may obtain a copy of the License at
+ * 
+ *   http://www.apache.org/licenses/LICENSE-2.0
+ * 
+ * Unless required by applicable law or agreed to in writing,
+ * software distributed under the License is distributed on an
+ * "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY
+ * KIND, either express or implied.  See the License for the
+ * specific language governing permissions and limitations
+ * under the License.
+ */
+
+#include "pagespeed/kernel/http/header_block.h"
+
+#include "pagespeed/kernel/base/string.h"
+#include "pagespeed/kernel/base/string_util.h"
+#include "pagespeed/kernel/http/http_names.h"
+#include "pagespeed/kernel/http/request_headers.h"
+#include "pagespeed/kernel/http/response_headers.h"
+#include "test/pagespeed/kernel/base/gtest.h"
+
+namespace net_instaweb {
+
+class HeaderBlockTest : public testing::Test {
+ protected:
+  HeaderBlockTest() {
+    response_headers_.set_major_version(1);
+    response_headers_.set_minor_version(1);
+    response_headers_.SetStatusAndReason(HttpStatus::kOK);
+    response_headers_.Add(HttpAttributes::kContentType, "text/css");
+    response_headers_.Add(HttpAttributes::kCacheControl,
+                          "max-age=300, public");
+    response_headers_.Add(HttpAttributes::kSetCookie, "a=1, b=2");
+    response_headers_.Add("cache-control", "no-transform");
+    response_headers_.Add(HttpAttributes::kSetCookie, "c=3");
+  }
+
+  // Checks that block answers every lookup the same way headers does.
+  void ExpectSameLookups(const ResponseHeaders& headers,
+                         const HeaderBlock& block) {
+    ASSERT_EQ(headers.NumAttributes(), block.NumAttributes());
+    EXPECT_EQ(headers.NumAttributeNames(), block.NumAttributeNames());
+    for (int i = 0, n = headers.NumAttributes(); i < n; ++i) {
+      EXPECT_STREQ(headers.Name(i), block.Name(i));
+      EXPECT_STREQ(headers.Value(i), block.Value(i));
+
+      ConstStringStarVector expected;
+      StringPieceVector actual;
+      ASSERT_TRUE(headers.Lookup(headers.Name(i), &expected));
+      ASSERT_TRUE(block.Lookup(headers.Name(i), &actual));
+      ASSERT_EQ(expected.size(), actual.size());
+      for (int j = 0, m = expected.size(); j < m; ++j) {
+        EXPECT_STREQ(*expected[j], actual[j]);
+      }
+    }
+  }
+
+  ResponseHeaders response_headers_;
+};
+
+TEST_F(HeaderBlockTest, Empty) {
+  HeaderBlock block;
+  StringPieceVector values;
+  StringPiece value;
+  EXPECT_TRUE(block.empty());
+  EXPECT_EQ(0, block.status_code());
+  EXPECT_EQ(0, block.NumAttributeNames());
+  EXPECT_FALSE(block.Has(HttpAttributes::kContentType));
+  EXPECT_FALSE(block.Lookup(HttpAttributes::kContentType, &values));
+  EXPECT_FALSE(block.Lookup1(HttpAttributes::kContentType, &value));
+
+  ResponseHeaders headers;
+  block.CopyToResponseHeaders(&headers);
+  EXPECT_EQ(0, headers.NumAttributes());
+}
+
+TEST_F(HeaderBlockTest, MatchesHeadersLookup) {
+  HeaderBlock block(response_headers_);
+  EXPECT_FALSE(block.empty());
+  EXPECT_EQ(HttpStatus::kOK, block.status_code());
+  EXPECT_STREQ("OK", block.reason_phrase());
+  EXPECT_EQ(1, block.major_version());
+  EXPECT_EQ(1, block.minor_version());
+  ExpectSameLookups(response_headers_, block);
+}
+
+TEST_F(HeaderBlockTest, CaseInsensitiveAndSplit) {
+  HeaderBlock block(response_headers_);
+  StringPieceVector values;
+  ASSERT_TRUE(block.Lookup("CACHE-control", &values));
+  ASSERT_EQ(3U, values.size());
+  EXPECT_STREQ("max-age=300", values[0]);
+  EXPECT_STREQ("public", values[1]);
+  EXPECT_STREQ("no-transform", values[2]);
+  EXPECT_TRUE(block.HasValue(HttpAttributes::kCacheControl, "public"));
+  EXPECT_FALSE(block.HasValue(HttpAttributes::kCacheControl, "private"));
+
+  // Set-Cookie is not comma-split.
+  ASSERT_TRUE(block.Lookup(HttpAttributes::kSetCookie, &values));
+  ASSERT_EQ(2U, values.size());
+  EXPECT_STREQ("a=1, b=2", values[0]);
+  EXPECT_STREQ("c=3", values[1]);
+
+  StringPiece value;
+  EXPECT_TRUE(block.Lookup1("content-type", &value));
+  EXPECT_STREQ("text/css", value);
+  EXPECT_FALSE(block.Lookup1(HttpAttributes::kCacheControl, &value));
+  EXPECT_FALSE(block.Has(HttpAttributes::kEtag));
+}
+
+TEST_F(HeaderBlockTest, CopiesShareStorage) {
+  HeaderBlock block(response_headers_);
+  HeaderBlock copy(block);
+  HeaderBlock assigned;
+  assigned = copy;
+  EXPECT_TRUE(block.SharesStorageWith(copy));
+  EXPECT_TRUE(block.SharesStorageWith(assigned));
+  EXPECT_EQ(block.Value(0).data(), assigned.Value(0).data());
+
+  // Values stay valid after the original goes away.
+  block = HeaderBlock();
+  EXPECT_TRUE(block.empty());
+  EXPECT_STREQ("text/css", assigned.Value(0));
+}
+
+TEST_F(HeaderBlockTest, IndependentOfSource) {
+  HeaderBlock block(response_headers_);
+  response_headers_.RemoveAll(HttpAttributes::kCacheControl);
+  response_headers_.Add(HttpAttributes::kEtag, "\"abc\"");
+  EXPECT_TRUE(block.Has(HttpAttributes::kCacheControl));
+  EXPECT_FALSE(block.Has(HttpAttributes::kEtag));
+}
+
+TEST_F(HeaderBlockTest, RoundTrip) {
+  HeaderBlock block(response_headers_);
+  ResponseHeaders copy;
+  copy.Add("X-Stale", "1");
+  block.CopyToResponseHeaders(&copy);
+  EXPECT_FALSE(copy.Has("X-Stale"));
+  EXPECT_EQ(HttpStatus::kOK, copy.status_code());
+  EXPECT_EQ(response_headers_.ToString(), copy.ToString());
+  ExpectSameLookups(copy, block);
+}
+
+TEST_F(HeaderBlockTest, RequestHeaders) {
+  RequestHeaders request_headers;
+  request_headers.Add(HttpAttributes::kAcceptEncoding, "gzip, br");
+  request_headers.Add(HttpAttributes::kUserAgent, "Mozilla/5.0");
+  HeaderBlock block(request_headers);
+  EXPECT_EQ(0, block.status_code());
+  StringPieceVector values;
+  ASSERT_TRUE(block.Lookup(HttpAttributes::kAcceptEncoding, &values));
+  ASSERT_EQ(2U, values.size());
+  EXPECT_STREQ("gzip", values[0]);
+  EXPECT_STREQ("br", values[1]);
+}
+
+TEST_F(HeaderBlockTest, ManyHeaders) {
+  // Enough distinct names to force several index resizes and collisions.
+  ResponseHeaders headers;
+  for (int i = 0; i < 200; ++i) {
+    headers.Add(StrCat("X-Header-", IntegerToString(i)),
+                IntegerToString(i * 7));
+  }
+  HeaderBlock block(headers);
+  EXPECT_EQ(200, block.NumAttributeNames());
+  ExpectSameLookups(headers, block);
+  EXPECT_FALSE(block.Has("X-Header-200"));
+}
+
+}  // namespace net_instaweb
@@ -19,8 +19,14 @@
 
 #include "pagespeed/kernel/http/user_agent_matcher.h"
 
+#include <vector>
+
+#include "pagespeed/kernel/base/basictypes.h"
 #include "pagespeed/kernel/base/scoped_ptr.h"
+#include "pagespeed/kernel/base/string_util.h"
+#include "pagespeed/kernel/base/thread_system.h"
 #include "pagespeed/kernel/http/request_headers.h"
+#include "pagespeed/kernel/util/platform.h"
 #include "test/pagespeed/kernel/base/gtest.h"
 #include "test/pagespeed/kernel/http/user_agent_matcher_test_base.h"
 
@@ -422,4 +428,191 @@ TEST_F(UserAgentMatcherTest, DoesntSupportAnimatedWebp) {
       kPagespeedInsightsDesktopUserAgent));
 }
 
+class UserAgentMatcherCacheTest : public UserAgentMatcherTestBase {
+ protected:
+  UserAgentMatcherCacheTest() : thread_system_(Platform::CreateThreadSystem()) {
+    // Use a tiny cache, so the tests below also exercise eviction.
+    user_agent_matcher_->EnableClassificationCache(thread_system_.get(), 20);
+  }
+
+  // Checks that every question about user_agent gets the same answer from
+  // the caching matcher as from a plain one.
+  void ExpectSameAnswers(const char* user_agent) {
+    SCOPED_TRACE(user_agent);
+    EXPECT_EQ(uncached_.IsIe(user_agent),
+              user_agent_matcher_->IsIe(user_agent));
+    EXPECT_EQ(uncached_.SupportsImageInlining(user_agent),
+              user_agent_matcher_->SupportsImageInlining(user_agent));
+    EXPECT_EQ(uncached_.SupportsLazyloadImages(user_agent),
+              user_agent_matcher_->SupportsLazyloadImages(user_agent));
+    EXPECT_EQ(uncached_.GetDeviceTypeForUA(user_agent),
+              user_agent_matcher_->GetDeviceTypeForUA(user_agent));
+    EXPECT_EQ(uncached_.SupportsJsDefer(user_agent, false),
+              user_agent_matcher_->SupportsJsDefer(user_agent, false));
+    EXPECT_EQ(uncached_.SupportsJsDefer(user_agent, true),
+              user_agent_matcher_->SupportsJsDefer(user_agent, true));
+    EXPECT_EQ(uncached_.LegacyWebp(user_agent),
+              user_agent_matcher_->LegacyWebp(user_agent));
+    EXPECT_EQ(uncached_.SupportsWebpLosslessAlpha(user_agent),
+              user_agent_matcher_->SupportsWebpLosslessAlpha(user_agent));
+    EXPECT_EQ(uncached_.SupportsWebpAnimated(user_agent),
+              user_agent_matcher_->SupportsWebpAnimated(user_agent));
+    EXPECT_EQ(uncached_.SupportsDnsPrefetch(user_agent),
+              user_agent_matcher_->SupportsDnsPrefetch(user_agent));
+    EXPECT_EQ(uncached_.IsAndroidUserAgent(user_agent),
+              user_agent_matcher_->IsAndroidUserAgent(user_agent));
+    EXPECT_EQ(uncached_.IsiOSUserAgent(user_agent),
+              user_agent_matcher_->IsiOSUserAgent(user_agent));
+    EXPECT_EQ(uncached_.SupportsMobilization(user_agent),
+              user_agent_matcher_->SupportsMobilization(user_agent));
+    int expected[4] = {-1, -1, -1, -1};
+    int actual[4] = {-1, -1, -1, -1};
+    EXPECT_EQ(uncached_.GetChromeBuildNumber(user_agent, &expected[0],
+                                             &expected[1], &expected[2],
+                                             &expected[3]),
+              user_agent_matcher_->GetChromeBuildNumber(
+                  user_agent, &actual[0], &actual[1], &actual[2], &actual[3]));
+    for (int i = 0; i < 4; ++i) {
+      EXPECT_EQ(expected[i], actual[i]);
+    }
+    ExpectClassificationMatches(user_agent_matcher_.get(), user_agent);
+    ExpectClassificationMatches(&uncached_, user_agent);
+  }
+
+  // Checks that a Classification from matcher answers like uncached_.
+  void ExpectClassificationMatches(const UserAgentMatcher* matcher,
+                                   const char* user_agent) {
+    UserAgentMatcher::Classification classification;
+    matcher->Classify(user_agent, &classification);
+    EXPECT_EQ(uncached_.IsIe(user_agent), classification.IsIe());
+    EXPECT_EQ(uncached_.SupportsImageInlining(user_agent),
+              classification.SupportsImageInlining());
+    EXPECT_EQ(uncached_.SupportsLazyloadImages(user_agent),
+              classification.SupportsLazyloadImages());
+    EXPECT_EQ(uncached_.GetDeviceTypeForUA(user_agent),
+              classification.device_type());
+    EXPECT_EQ(uncached_.SupportsJsDefer(user_agent, false),
+              classification.SupportsJsDefer(false));
+    EXPECT_EQ(uncached_.SupportsJsDefer(user_agent, true),
+              classification.SupportsJsDefer(true));
+    EXPECT_EQ(uncached_.LegacyWebp(user_agent), classification.LegacyWebp());
+    EXPECT_EQ(uncached_.SupportsWebpLosslessAlpha(user_agent),
+              classification.SupportsWebpLosslessAlpha());
+    EXPECT_EQ(uncached_.SupportsWebpAnimated(user_agent),
+              classification.SupportsWebpAnimated());
+    EXPECT_EQ(uncached_.SupportsDnsPrefetch(user_agent),
+              classification.SupportsDnsPrefetch());
+    EXPECT_EQ(uncached_.IsAndroidUserAgent(user_agent),
+              classification.IsAndroidUserAgent());
+    EXPECT_EQ(uncached_.IsiOSUserAgent(user_agent),
+              classification.IsiOSUserAgent());
+    EXPECT_EQ(uncached_.SupportsMobilization(user_agent),
+              classification.SupportsMobilization());
+    int expected[4] = {-1, -1, -1, -1};
+    int actual[4] = {-1, -1, -1, -1};
+    EXPECT_EQ(uncached_.GetChromeBuildNumber(user_agent, &expected[0],
+                                             &expected[1], &expected[2],
+                                             &expected[3]),
+              classification.GetChromeBuildNumber(&actual[0], &actual[1],
+                                                  &actual[2], &actual[3]));
+    for (int i = 0; i < 4; ++i) {
+      EXPECT_EQ(expected[i], actual[i]);
+    }
+  }
+
+  std::unique_ptr<ThreadSystem> thread_system_;
+  UserAgentMatcher uncached_;
+};
+
+TEST_F(UserAgentMatcherCacheTest, SameAnswersAsUncached) {
+  std::vector<const char*> user_agents = {
+      "",
+      kChromeUserAgent,
+      kChrome37UserAgent,
+      kCriOS32UserAgent,
+      kIe9UserAgent,
+      kIPhone4Safari,
+      kAndroidICSUserAgent,
+      kNexus6Chrome44UserAgent,
+      kTestingWebp,
+      kTestingWebpAnimated,
+      kTestingWebpLosslessAlpha,
+  };
+  for (int i = 0; i < kMobileUserAgentsArraySize; ++i) {
+    user_agents.push_back(kMobileUserAgents[i]);
+  }
+  for (int i = 0; i < kDesktopUserAgentsArraySize; ++i) {
+    user_agents.push_back(kDesktopUserAgents[i]);
+  }
+  for (int i = 0; i < kTabletUserAgentsArraySize; ++i) {
+    user_agents.push_back(kTabletUserAgents[i]);
+  }
+  for (int i = 0; i < kIe11UserAgentsArraySize; ++i) {
+    user_agents.push_back(kIe11UserAgents[i]);
+  }
+  // Go through twice, so we see answers both from a cold and a warm cache.
+  for (int pass = 0; pass < 2; ++pass) {
+    for (const char* user_agent : user_agents) {
+      ExpectSameAnswers(user_agent);
+    }
+  }
+}
+
+TEST_F(UserAgentMatcherCacheTest, GetDeviceTypeForUA) {
+  VerifyGetDeviceTypeForUA();
+  VerifyGetDeviceTypeForUA();
+}
+
+TEST_F(UserAgentMatcherCacheTest, SupportsImageInlining) {
+  VerifyImageInliningSupport();
+  VerifyImageInliningSupport();
+}
+
+// Calls everything a tablet, and counts how often it is asked.
+class TabletUserAgentMatcher : public UserAgentMatcher {
+ public:
+  TabletUserAgentMatcher() : num_device_type_calls_(0) {}
+
+  DeviceType GetDeviceTypeForUA(const StringPiece& user_agent) const override {
+    ++num_device_type_calls_;
+    return kTablet;
+  }
+
+  int num_device_type_calls() const { return num_device_type_calls_; }
+
+ private:
+  mutable int num_device_type_calls_;
+
+  DISALLOW_COPY_AND_ASSIGN(TabletUserAgentMatcher);
+};
+
+TEST_F(UserAgentMatcherCacheTest, ClassifyHonorsOverrides) {
+  TabletUserAgentMatcher matcher;
+  UserAgentMatcher::Classification classification;
+  matcher.Classify(kChromeUserAgent, &classification);
+  EXPECT_EQ(UserAgentMatcher::kTablet, classification.device_type());
+
+  matcher.EnableClassificationCache(thread_system_.get(), 20);
+  matcher.Classify(kChromeUserAgent, &classification);
+  EXPECT_EQ(UserAgentMatcher::kTablet, classification.device_type());
+}
+
+TEST_F(UserAgentMatcherCacheTest, FrequentUserAgentSurvivesEviction) {
+  TabletUserAgentMatcher matcher;
+  matcher.EnableClassificationCache(thread_system_.get(), 64);
+  UserAgentMatcher::Classification classification;
+  matcher.Classify(kChromeUserAgent, &classification);
+  ASSERT_EQ(1, matcher.num_device_type_calls());
+
+  // Stream many more distinct user agents through the cache than it can
+  // hold, asking about the frequent one between each.  That one is never
+  // reclassified.
+  const int kNumUserAgents = 1000;
+  for (int i = 0; i < kNumUserAgents; ++i) {
+    matcher.Classify(StrCat("Rare/", IntegerToString(i)), &classification);
+    matcher.Classify(kChromeUserAgent, &classification);
+  }
+  EXPECT_EQ(1 + kNumUserAgents, matcher.num_device_type_calls());
+}
+
 }  // namespace net_instaweb
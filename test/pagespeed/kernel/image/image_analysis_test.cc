@@ -23,6 +23,7 @@
 #include <cstddef>
 #include <cstdint>
 #include <cstdlib>
+#include <memory>
 
 #include "pagespeed/kernel/base/basictypes.h"
 #include "pagespeed/kernel/base/null_mutex.h"
@@ -40,6 +41,7 @@ namespace {
 using net_instaweb::MessageHandler;
 using net_instaweb::MockMessageHandler;
 using net_instaweb::NullMutex;
+using pagespeed::image_compression::CreateScanlineReader;
 using pagespeed::image_compression::GRAY_8;
 using pagespeed::image_compression::Histogram;
 using pagespeed::image_compression::IMAGE_GIF;
@@ -47,6 +49,7 @@ using pagespeed::image_compression::IMAGE_JPEG;
 using pagespeed::image_compression::IMAGE_PNG;
 using pagespeed::image_compression::IMAGE_UNKNOWN;
 using pagespeed::image_compression::ImageFormat;
+using pagespeed::image_compression::IsPhoto;
 using pagespeed::image_compression::kGifTestDir;
 using pagespeed::image_compression::kJpegTestDir;
 using pagespeed::image_compression::kNumColorHistogramBins;
@@ -356,6 +359,31 @@ TEST_F(ImageAnalysisTest, PhotoMetric) {
   }
 }
 
+// Verify that analyzing only part of a large image gives the same answer as
+// analyzing all of it.
+TEST_F(ImageAnalysisTest, SubsampledIsPhoto) {
+  for (size_t i = 0; i < kJpegImageCount; ++i) {
+    GoogleString image_string;
+    ASSERT_TRUE(ReadTestFile(kJpegTestDir, kJpegImages[i].file_name, "jpg",
+                             &image_string));
+    const int64 num_pixels = kJpegImages[i].width * kJpegImages[i].height;
+
+    std::unique_ptr<ScanlineReaderInterface> full_reader(
+        CreateScanlineReader(IMAGE_JPEG, image_string.data(),
+                             image_string.length(), &message_handler_));
+    ASSERT_TRUE(full_reader != nullptr);
+    const bool is_photo = IsPhoto(full_reader.get(), 0, &message_handler_);
+
+    std::unique_ptr<ScanlineReaderInterface> sampled_reader(
+        CreateScanlineReader(IMAGE_JPEG, image_string.data(),
+                             image_string.length(), &message_handler_));
+    ASSERT_TRUE(sampled_reader != nullptr);
+    EXPECT_EQ(is_photo, IsPhoto(sampled_reader.get(), num_pixels / 8,
+                                &message_handler_))
+        << kJpegImages[i].file_name;
+  }
+}
+
 TEST_F(ImageAnalysisTest, KeyInformation) {
   VerifyKeyInformation(IMAGE_GIF, kGifTestDir, "gif", kGifImages,
                        kGifImageCount);
@@ -142,4 +142,47 @@ TEST(JpegReaderTest, PartialRead) {
   ASSERT_TRUE(reader4.ReadNextScanline(&scanline));
 }
 
+// Verify that the image can be decoded at a reduced scale, and that the
+// largest reduction which still meets the requested size is picked.
+TEST(JpegReaderTest, ScaledDecode) {
+  GoogleString image;
+  void* scanline = nullptr;
+  MockMessageHandler message_handler(new NullMutex);
+  ReadTestFile(kJpegTestDir, kValidJpegImages[1], "jpg", &image);
+
+  JpegScanlineReader full_reader(&message_handler);
+  ASSERT_TRUE(full_reader.Initialize(image.c_str(), image.length()));
+  const size_t width = full_reader.GetImageWidth();
+  const size_t height = full_reader.GetImageHeight();
+  ASSERT_LT(8, width);
+  ASSERT_LT(8, height);
+
+  // A quarter of the size is just enough; an eighth isn't.
+  JpegScanlineReader reader(&message_handler);
+  ASSERT_TRUE(reader.Initialize(image.c_str(), image.length()));
+  ASSERT_TRUE(reader.SetMinimumOutputSize((width + 3) / 4, 1).Success());
+  EXPECT_EQ((width + 3) / 4, reader.GetImageWidth());
+  EXPECT_EQ((height + 3) / 4, reader.GetImageHeight());
+  EXPECT_EQ(3 * reader.GetImageWidth(), reader.GetBytesPerScanline());
+  size_t rows = 0;
+  while (reader.HasMoreScanLines()) {
+    ASSERT_TRUE(reader.ReadNextScanline(&scanline));
+    ++rows;
+  }
+  EXPECT_EQ(reader.GetImageHeight(), rows);
+
+  // No reduction meets the size, so the image is decoded at full size.
+  ASSERT_TRUE(reader.Initialize(image.c_str(), image.length()));
+  ASSERT_TRUE(reader.SetMinimumOutputSize(width, height / 2).Success());
+  EXPECT_EQ(width, reader.GetImageWidth());
+  EXPECT_EQ(height, reader.GetImageHeight());
+
+  // Re-initializing the reader undoes the scaling.
+  ASSERT_TRUE(reader.Initialize(image.c_str(), image.length()));
+  ASSERT_TRUE(reader.SetMinimumOutputSize(1, 1).Success());
+  EXPECT_EQ((width + 7) / 8, reader.GetImageWidth());
+  ASSERT_TRUE(reader.Initialize(image.c_str(), image.length()));
+  EXPECT_EQ(width, reader.GetImageWidth());
+}
+
 }  // namespace
@@ -0,0 +1,237 @@
+/*
+ * Licensed to the Apache Software Foundation (ASF) under one
+ * or more contributor license agreements.  See the NOTICE file
+ * distributed with this work for additional information
+ * regarding copyright ownership.  The ASF licenses this file
+ * to you under the Apache License, Version 2.0 (the
+ * "License"); you may not use this file except in compliance
+ * with the License.  You may obtain a copy of the License at
+ * 
+ *   http://www.apache.org/licenses/LICENSE-2.0
+ * 
+ * Unless required by applicable law or agreed to in writing,
+ * software distributed under the License is distributed on an
+ * "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY
+ * KIND, either express or implied.  See the License for the
+ * specific language governing permissions and limitations
+ * under the License.
+ */
+
+#include "pagespeed/kernel/image/resampling_pyramid.h"
+
+#include <cstdlib>
+#include <memory>
+
+#include "pagespeed/kernel/base/basictypes.h"
+#include "pagespeed/kernel/base/null_mutex.h"
+#include "pagespeed/kernel/base/string.h"
+#include "pagespeed/kernel/image/image_resizer.h"
+#include "pagespeed/kernel/image/scanline_interface.h"
+#include "pagespeed/kernel/image/scanline_status.h"
+#include "test/pagespeed/kernel/base/gtest.h"
+#include "test/pagespeed/kernel/base/mock_message_handler.h"
+
+namespace {
+
+using net_instaweb::MockMessageHandler;
+using net_instaweb::NullMutex;
+using pagespeed::image_compression::GRAY_8;
+using pagespeed::image_compression::PixelFormat;
+using pagespeed::image_compression::RGB_888;
+using pagespeed::image_compression::ResamplingPyramid;
+using pagespeed::image_compression::SCANLINE_STATUS_PARSE_ERROR;
+using pagespeed::image_compression::SCANLINE_STATUS_SUCCESS;
+using pagespeed::image_compression::ScanlineReaderInterface;
+using pagespeed::image_compression::ScanlineResizer;
+using pagespeed::image_compression::ScanlineStatus;
+
+// Reads an image from a buffer of raw pixels, optionally failing part way.
+class RawPixelReader : public ScanlineReaderInterface {
+ public:
+  RawPixelReader(const GoogleString& pixels, size_t width, size_t height,
+                 PixelFormat pixel_format, size_t bytes_per_pixel)
+      : pixels_(pixels),
+        width_(width),
+        height_(height),
+        pixel_format_(pixel_format),
+        bytes_per_row_(width * bytes_per_pixel),
+        row_(0),
+        fail_at_row_(height) {}
+
+  void set_fail_at_row(size_t row) { fail_at_row_ = row; }
+
+  bool Reset() override {
+    row_ = 0;
+    return true;
+  }
+  size_t GetBytesPerScanline() override { return bytes_per_row_; }
+  bool HasMoreScanLines() override { return row_ < height_; }
+  ScanlineStatus InitializeWithStatus(const void* image_buffer,
+                                      size_t buffer_length) override {
+    return ScanlineStatus(SCANLINE_STATUS_SUCCESS);
+  }
+  ScanlineStatus ReadNextScanlineWithStatus(
+      void** out_scanline_bytes) override {
+    if (row_ >= fail_at_row_) {
+      return ScanlineStatus(SCANLINE_STATUS_PARSE_ERROR);
+    }
+    *out_scanline_bytes = &pixels_[row_ * bytes_per_row_];
+    ++row_;
+    return ScanlineStatus(SCANLINE_STATUS_SUCCESS);
+  }
+  size_t GetImageHeight() override { return height_; }
+  size_t GetImageWidth() override { return width_; }
+  PixelFormat GetPixelFormat() override { return pixel_format_; }
+  bool IsProgressive() override { return false; }
+
+ private:
+  GoogleString pixels_;
+  const size_t width_;
+  const size_t height_;
+  const PixelFormat pixel_format_;
+  const size_t bytes_per_row_;
+  size_t row_;
+  size_t fail_at_row_;
+};
+
+// Returns a smooth RGB gradient, so that resizing it by different routes
+// should give nearly identical results.
+GoogleString Gradient(size_t width, size_t height) {
+  GoogleString pixels;
+  for (size_t y = 0; y < height; ++y) {
+    for (size_t x = 0; x < width; ++x) {
+      pixels.push_back(static_cast<char>(x * 255 / width));
+      pixels.push_back(static_cast<char>(y * 255 / height));
+      pixels.push_back(static_cast<char>((x + y) * 127 / (width + height)));
+    }
+  }
+  return pixels;
+}
+
+// Reads every scanline of reader into a string.
+GoogleString ReadAll(ScanlineReaderInterface* reader) {
+  GoogleString pixels;
+  while (reader->HasMoreScanLines()) {
+    void* scanline = nullptr;
+    EXPECT_TRUE(reader->ReadNextScanline(&scanline));
+    pixels.append(static_cast<char*>(scanline), reader->GetBytesPerScanline());
+  }
+  return pixels;
+}
+
+class ResamplingPyramidTest : public testing::Test {
+ protected:
+  ResamplingPyramidTest() : handler_(new NullMutex) {}
+
+  ResamplingPyramid* NewPyramid(const GoogleString& pixels, size_t width,
+                                size_t height, PixelFormat pixel_format,
+                                size_t bytes_per_pixel) {
+    RawPixelReader reader(pixels, width, height, pixel_format,
+                          bytes_per_pixel);
+    return ResamplingPyramid::Create(&reader, &handler_);
+  }
+
+  MockMessageHandler handler_;
+};
+
+TEST_F(ResamplingPyramidTest, HalvesUntilOnePixelWideOrHigh) {
+  std::unique_ptr<ResamplingPyramid> pyramid(
+      NewPyramid(Gradient(10, 6), 10, 6, RGB_888, 3));
+  ASSERT_TRUE(pyramid != nullptr);
+  EXPECT_EQ(10, pyramid->width());
+  EXPECT_EQ(6, pyramid->height());
+  EXPECT_EQ(RGB_888, pyramid->pixel_format());
+  // 10x6, 5x3, 3x2, 2x1.
+  EXPECT_EQ(4, pyramid->num_levels());
+  EXPECT_EQ((10 * 6 + 5 * 3 + 3 * 2 + 2 * 1) * 3, pyramid->MemoryUsage());
+}
+
+TEST_F(ResamplingPyramidTest, AveragesBlocks) {
+  // 3x3 gray image; the odd row and column are averaged on their own.
+  const char kPixels[] = {0,  4,  100,  //
+                          8,  12, 50,   //
+                          40, 20, 7};
+  std::unique_ptr<ResamplingPyramid> pyramid(
+      NewPyramid(GoogleString(kPixels, sizeof(kPixels)), 3, 3, GRAY_8, 1));
+  ASSERT_TRUE(pyramid != nullptr);
+  ASSERT_EQ(3, pyramid->num_levels());
+
+  std::unique_ptr<ScanlineReaderInterface> reader(
+      pyramid->NewReader(2, 2, &handler_));
+  ASSERT_EQ(2, reader->GetImageWidth());
+  ASSERT_EQ(2, reader->GetImageHeight());
+  const char kExpected[] = {6, 75, 30, 7};
+  EXPECT_EQ(GoogleString(kExpected, sizeof(kExpected)), ReadAll(reader.get()));
+
+  // The full size level is returned untouched.
+  reader.reset(pyramid->NewReader(3, 1, &handler_));
+  EXPECT_EQ(GoogleString(kPixels, sizeof(kPixels)), ReadAll(reader.get()));
+}
+
+TEST_F(ResamplingPyramidTest, ReaderUsesSmallestSufficientLevel) {
+  std::unique_ptr<ResamplingPyramid> pyramid(
+      NewPyramid(Gradient(64, 64), 64, 64, RGB_888, 3));
+  ASSERT_TRUE(pyramid != nullptr);
+
+  std::unique_ptr<ScanlineReaderInterface> reader(
+      pyramid->NewReader(20, 20, &handler_));
+  EXPECT_EQ(32, reader->GetImageWidth());
+  EXPECT_EQ(32, reader->GetImageHeight());
+  EXPECT_EQ(32 * 3, reader->GetBytesPerScanline());
+
+  reader.reset(pyramid->NewReader(33, 10, &handler_));
+  EXPECT_EQ(64, reader->GetImageWidth());
+
+  reader.reset(pyramid->NewReader(1, 1, &handler_));
+  EXPECT_EQ(1, reader->GetImageWidth());
+  EXPECT_EQ(1, reader->GetImageHeight());
+
+  // Readers can be reset and re-read.
+  GoogleString first = ReadAll(reader.get());
+  EXPECT_FALSE(reader->HasMoreScanLines());
+  EXPECT_TRUE(reader->Reset());
+  EXPECT_EQ(first, ReadAll(reader.get()));
+}
+
+TEST_F(ResamplingPyramidTest, ResizeMatchesResizingOriginal) {
+  const size_t kWidth = 100;
+  const size_t kHeight = 80;
+  const GoogleString pixels = Gradient(kWidth, kHeight);
+  std::unique_ptr<ResamplingPyramid> pyramid(
+      NewPyramid(pixels, kWidth, kHeight, RGB_888, 3));
+  ASSERT_TRUE(pyramid != nullptr);
+
+  const size_t kSizes[][2] = {{60, 48}, {30, 24}, {17, 13}};
+  for (const auto& size : kSizes) {
+    RawPixelReader original(pixels, kWidth, kHeight, RGB_888, 3);
+    ScanlineResizer direct(&handler_);
+    ASSERT_TRUE(direct.Initialize(&original, size[0], size[1]));
+    GoogleString expected = ReadAll(&direct);
+
+    std::unique_ptr<ScanlineReaderInterface> level(
+        pyramid->NewReader(size[0], size[1], &handler_));
+    ScanlineResizer from_pyramid(&handler_);
+    ASSERT_TRUE(from_pyramid.Initialize(level.get(), size[0], size[1]));
+    EXPECT_EQ(size[0], from_pyramid.GetImageWidth());
+    EXPECT_EQ(size[1], from_pyramid.GetImageHeight());
+    GoogleString actual = ReadAll(&from_pyramid);
+
+    ASSERT_EQ(expected.size(), actual.size());
+    for (size_t i = 0; i < expected.size(); ++i) {
+      EXPECT_LE(abs(static_cast<uint8>(expected[i]) -
+                    static_cast<uint8>(actual[i])),
+                2)
+          << "byte " << i << " of " << size[0] << "x" << size[1];
+    }
+  }
+}
+
+TEST_F(ResamplingPyramidTest, FailsIfReadingFails) {
+  RawPixelReader reader(Gradient(8, 8), 8, 8, RGB_888, 3);
+  reader.set_fail_at_row(5);
+  std::unique_ptr<ResamplingPyramid> pyramid(
+      ResamplingPyramid::Create(&reader, &handler_));
+  EXPECT_TRUE(pyramid == nullptr);
+}
+
+}  // namespace
@@ -20,6 +20,7 @@
 #include "pagespeed/kernel/js/js_tokenizer.h"
 
 #include <memory>
+#include <random>
 #include <utility>
 
 #include "pagespeed/kernel/base/google_message_handler.h"
@@ -101,6 +102,29 @@ class JsTokenizerTest : public testing::Test {
     }
     // The concatenation of all tokens should exactly reproduce the input.
     EXPECT_STREQ(original, output);
+    ExpectScannersMatchRegexes(original);
+  }
+
+  // Tokenizes the input twice, once normally and once using only the RE2
+  // patterns, and checks that both produce exactly the same tokens.
+  void ExpectScannersMatchRegexes(StringPiece input) {
+    JsTokenizer scanner_tokenizer(&patterns_, input);
+    JsTokenizer regex_tokenizer(&patterns_, input);
+    regex_tokenizer.set_use_regexes_for_test(true);
+    while (true) {
+      StringPiece scanner_token, regex_token;
+      const JsKeywords::Type scanner_type =
+          scanner_tokenizer.NextToken(&scanner_token);
+      const JsKeywords::Type regex_type =
+          regex_tokenizer.NextToken(&regex_token);
+      ASSERT_EQ(std::make_pair(regex_type, regex_token),
+                std::make_pair(scanner_type, scanner_token))
+          << "Input: " << input;
+      if (scanner_type == JsKeywords::kEndOfInput ||
+          scanner_type == JsKeywords::kError) {
+        break;
+      }
+    }
   }
 
  private:
@@ -1648,6 +1672,30 @@ TEST_F(JsTokenizerTest, JsonHeuristic) {
   ExpectEndOfInput();
 }
 
+TEST_F(JsTokenizerTest, ScannersMatchRegexes) {
+  // Glue together random fragments of JavaScript-ish text, and make sure that
+  // the hand-written ASCII scanners agree with the RE2 patterns on all of it,
+  // including the many error cases this will produce.
+  static const char* const kFragments[] = {
+      "'", "\"", "\\", "/", "//", "/*", "*/", "[", "]", "(", ")", "{", "}",
+      "0", "08", "019", "017", "0x1F", "0X", "1.5e+3", ".5", "5.", "e", "E-",
+      "a", "$_", "in", "instanceof", "x=", "return ", "\\u0041", "+", "++",
+      "-", "--", "=", "==", "!", "!=", "<<", ">>>=", "&", "|", "^", "%", "~",
+      "?", ":", ";", ",", ".", " ", "\t", "        ", "\n", "\r", "\r\n",
+      "\n\r", "<!--", "-->", "#", "@", "\xE2\x80\xA8", "\xE2\x80\xA9",
+      "\xC3\xA9", "\xE9", "\xFF",
+  };
+  std::mt19937 random(12345);
+  for (int i = 0; i < 50000; ++i) {
+    GoogleString input;
+    const int num_fragments = 1 + random() % 16;
+    for (int j = 0; j < num_fragments; ++j) {
+      input += kFragments[random() % arraysize(kFragments)];
+    }
+    ExpectScannersMatchRegexes(input);
+  }
+}
+
 TEST_F(JsTokenizerTest, TokenizeAngular) {
   ExpectTokenizeFileSuccessfully("angular.original");
 }
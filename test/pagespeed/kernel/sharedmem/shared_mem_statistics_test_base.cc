@@ -43,6 +43,9 @@ const char kVar2[] = "num_flushes";
 const char kHist1[] = "H1";
 const char kHist2[] = "Html Time us Histogram";
 
+const int kNumConcurrentChildren = 4;
+const int kNumConcurrentAdds = 10000;
+
 // We cannot init the logger unless all stats are initialized.
 const char kStatsLogFile[] = "";
 
@@ -264,6 +267,34 @@ void SharedMemStatisticsTestBase::TestAdd() {
   EXPECT_EQ(4, hist2->Maximum());
 }
 
+void SharedMemStatisticsTestBase::TestAddConcurrent() {
+  ParentInit();
+
+  // Several children hammer on the same counters at once; since variables are
+  // updated with atomic adds rather than under a lock, none of the increments
+  // may be lost.
+  for (int i = 0; i < kNumConcurrentChildren; ++i) {
+    ASSERT_TRUE(
+        CreateChild(&SharedMemStatisticsTestBase::TestAddConcurrentChild));
+  }
+  test_env_->WaitForChildren();
+  UpDownCounter* v1 = stats_->GetUpDownCounter(kVar1);
+  UpDownCounter* v2 = stats_->GetUpDownCounter(kVar2);
+  EXPECT_EQ(kNumConcurrentChildren * kNumConcurrentAdds, v1->Get());
+  EXPECT_EQ(-kNumConcurrentChildren * kNumConcurrentAdds, v2->Get());
+}
+
+void SharedMemStatisticsTestBase::TestAddConcurrentChild() {
+  std::unique_ptr<SharedMemStatistics> stats(ChildInit());
+  stats->Init(false, &handler_);
+  UpDownCounter* v1 = stats->GetUpDownCounter(kVar1);
+  UpDownCounter* v2 = stats->GetUpDownCounter(kVar2);
+  for (int i = 0; i < kNumConcurrentAdds; ++i) {
+    v1->Add(1);
+    v2->Add(-1);
+  }
+}
+
 void SharedMemStatisticsTestBase::TestSetReturningPrevious() {
   ParentInit();
 
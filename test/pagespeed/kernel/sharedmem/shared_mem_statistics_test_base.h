@@ -54,6 +54,7 @@ class SharedMemStatisticsTestBase : public testing::Test {
   void TestSet();
   void TestClear();
   void TestAdd();
+  void TestAddConcurrent();
   void TestSetReturningPrevious();
   void TestHistogram();
   void TestHistogramRender();
@@ -79,6 +80,7 @@ class SharedMemStatisticsTestBase : public testing::Test {
 
   // Adds 10x +1 to variable 1, and 10x +2 to variable 2.
   void TestAddChild();
+  void TestAddConcurrentChild();
   bool AddVars(SharedMemStatistics* stats);
   bool AddHistograms(SharedMemStatistics* stats);
   // Helper function for TestHistogramRender().
@@ -120,6 +122,10 @@ TYPED_TEST_P(SharedMemStatisticsTestTemplate, TestAdd) {
   SharedMemStatisticsTestBase::TestAdd();
 }
 
+TYPED_TEST_P(SharedMemStatisticsTestTemplate, TestAddConcurrent) {
+  SharedMemStatisticsTestBase::TestAddConcurrent();
+}
+
 TYPED_TEST_P(SharedMemStatisticsTestTemplate, TestSetReturningPrevious) {
   SharedMemStatisticsTestBase::TestSetReturningPrevious();
 }
@@ -145,7 +151,7 @@ TYPED_TEST_P(SharedMemStatisticsTestTemplate, TestTimedVariableEmulation) {
 }
 
 REGISTER_TYPED_TEST_SUITE_P(SharedMemStatisticsTestTemplate, TestCreate,
-                            TestSet, TestClear, TestAdd,
+                            TestSet, TestClear, TestAdd, TestAddConcurrent,
                             TestSetReturningPrevious, TestHistogram,
                             TestHistogramRender, TestHistogramNoExtraClear,
                             TestHistogramExtremeBuckets,
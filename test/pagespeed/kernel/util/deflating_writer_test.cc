@@ -0,0 +1,157 @@
+/*
+ * Licensed to the Apache Software Foundation (ASF) under one
+ * or more contributor license agreements.  See the NOTICE file
+ * distributed with this work for additional information
+ * regarding copyright ownership.  The ASF licenses this file
+ * to you under the Apache License, Version 2.0 (the
+ * "License"); you may not use this file except in compliance
+ * with the License.  You may obtain a copy of the License at
+ * 
+ *   http://www.apache.org/licenses/LICENSE-2.0
+ * 
+ * Unless required by applicable law or agreed to in writing,
+ * software distributed under the License is distributed on an
+ * "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY
+ * KIND, either express or implied.  See the License for the
+ * specific language governing permissions and limitations
+ * under the License.
+ */
+
+#include "pagespeed/kernel/util/deflating_writer.h"
+
+#include "pagespeed/kernel/base/null_mutex.h"
+#include "pagespeed/kernel/base/stack_buffer.h"
+#include "pagespeed/kernel/base/string.h"
+#include "pagespeed/kernel/base/string_util.h"
+#include "pagespeed/kernel/base/string_writer.h"
+#include "pagespeed/kernel/util/gzip_inflater.h"
+#include "pagespeed/kernel/util/simple_random.h"
+#include "test/pagespeed/kernel/base/gtest.h"
+
+namespace net_instaweb {
+
+namespace {
+
+// StringWriter that counts downstream flushes.
+class CountingFlushWriter : public StringWriter {
+ public:
+  explicit CountingFlushWriter(GoogleString* str)
+      : StringWriter(str), flushes_(0) {}
+  bool Flush(MessageHandler* handler) override {
+    ++flushes_;
+    return true;
+  }
+  int flushes() const { return flushes_; }
+
+ private:
+  int flushes_;
+};
+
+class DeflatingWriterTest : public testing::Test {
+ protected:
+  DeflatingWriterTest() : random_(new NullMutex) {}
+
+  // Inflates everything in compressed that can be decoded so far.
+  static GoogleString InflatePrefix(StringPiece compressed) {
+    GzipInflater inflater(GzipInflater::kGzip);
+    EXPECT_TRUE(inflater.Init());
+    EXPECT_TRUE(inflater.SetInput(compressed.data(), compressed.size()));
+    GoogleString out;
+    char buf[kStackBufferSize];
+    while (inflater.HasUnconsumedInput()) {
+      int n = inflater.InflateBytes(buf, sizeof(buf));
+      EXPECT_LE(0, n);
+      if (n <= 0) {
+        break;
+      }
+      out.append(buf, n);
+    }
+    inflater.ShutDown();
+    return out;
+  }
+
+  SimpleRandom random_;
+};
+
+TEST_F(DeflatingWriterTest, RoundTrip) {
+  for (GzipInflater::InflateType format :
+       {GzipInflater::kGzip, GzipInflater::kDeflate}) {
+    GoogleString payload = random_.GenerateHighEntropyString(100000);
+    payload += GoogleString(100000, 'a');
+    GoogleString compressed, inflated;
+    StringWriter compressed_writer(&compressed);
+    DeflatingWriter writer(format, 6, &compressed_writer);
+    for (size_t pos = 0; pos < payload.size(); pos += 777) {
+      ASSERT_TRUE(writer.Write(StringPiece(payload).substr(pos, 777),
+                               nullptr));
+    }
+    ASSERT_TRUE(writer.Finish(nullptr));
+    EXPECT_TRUE(writer.finished());
+    EXPECT_FALSE(writer.error());
+    EXPECT_GT(payload.size(), compressed.size());
+
+    StringWriter inflate_writer(&inflated);
+    ASSERT_TRUE(GzipInflater::Inflate(compressed, format, &inflate_writer));
+    EXPECT_EQ(payload, inflated);
+  }
+}
+
+TEST_F(DeflatingWriterTest, FlushMakesOutputDecodable) {
+  GoogleString compressed;
+  CountingFlushWriter compressed_writer(&compressed);
+  DeflatingWriter writer(GzipInflater::kGzip, 9, &compressed_writer);
+
+  ASSERT_TRUE(writer.Write("<html><head>", nullptr));
+  ASSERT_TRUE(writer.Write("<title>t</title></head>", nullptr));
+  ASSERT_TRUE(writer.Flush(nullptr));
+  EXPECT_EQ(1, compressed_writer.flushes());
+  EXPECT_EQ("<html><head><title>t</title></head>", InflatePrefix(compressed));
+
+  // A flush with nothing new written doesn't emit another empty block.
+  size_t size_after_flush = compressed.size();
+  ASSERT_TRUE(writer.Flush(nullptr));
+  EXPECT_EQ(size_after_flush, compressed.size());
+  EXPECT_EQ(2, compressed_writer.flushes());
+
+  ASSERT_TRUE(writer.Write("<body>hello</body></html>", nullptr));
+  ASSERT_TRUE(writer.Finish(nullptr));
+  GoogleString inflated;
+  StringWriter inflate_writer(&inflated);
+  ASSERT_TRUE(GzipInflater::Inflate(compressed, GzipInflater::kGzip,
+                                    &inflate_writer));
+  EXPECT_EQ("<html><head><title>t</title></head><body>hello</body></html>",
+            inflated);
+}
+
+TEST_F(DeflatingWriterTest, EmptyStream) {
+  GoogleString compressed, inflated;
+  StringWriter compressed_writer(&compressed);
+  DeflatingWriter writer(GzipInflater::kGzip, -1, &compressed_writer);
+  ASSERT_TRUE(writer.Finish(nullptr));
+  EXPECT_FALSE(compressed.empty());
+  EXPECT_TRUE(GzipInflater::HasGzipMagicBytes(compressed));
+  StringWriter inflate_writer(&inflated);
+  ASSERT_TRUE(GzipInflater::Inflate(compressed, GzipInflater::kGzip,
+                                    &inflate_writer));
+  EXPECT_TRUE(inflated.empty());
+}
+
+TEST_F(DeflatingWriterTest, CompressionLevel) {
+  GoogleString payload;
+  for (int i = 0; i < 2000; ++i) {
+    StrAppend(&payload, "<div class=\"item\">", IntegerToString(i), "</div>");
+  }
+  GoogleString fast, best;
+  StringWriter fast_writer(&fast), best_writer(&best);
+  DeflatingWriter fast_deflater(GzipInflater::kGzip, 1, &fast_writer);
+  DeflatingWriter best_deflater(GzipInflater::kGzip, 9, &best_writer);
+  ASSERT_TRUE(fast_deflater.Write(payload, nullptr));
+  ASSERT_TRUE(best_deflater.Write(payload, nullptr));
+  ASSERT_TRUE(fast_deflater.Finish(nullptr));
+  ASSERT_TRUE(best_deflater.Finish(nullptr));
+  EXPECT_LT(best.size(), fast.size());
+}
+
+}  // namespace
+
+}  // namespace net_instaweb
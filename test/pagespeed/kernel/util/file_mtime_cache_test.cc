@@ -0,0 +1,232 @@
+/*
+ * Licensed to the Apache Software Foundation (ASF) under one
+ * or more contributor license agreements.  See the NOTICE file
+ * distributed with this work for additional information
+ * regarding copyright ownership.  The ASF licenses this file
+ * to you under the Apache License, Version 2.0 (the
+ * "License"); you may not use this file except in compliance
+ * with the License.  You may obtain a copy of the License at
+ * 
+ *   http://www.apache.org/licenses/LICENSE-2.0
+ * 
+ * Unless required by applicable law or agreed to in writing,
+ * software distributed under the License is distributed on an
+ * "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY
+ * KIND, either express or implied.  See the License for the
+ * specific language governing permissions and limitations
+ * under the License.
+ */
+
+#include "pagespeed/kernel/util/file_mtime_cache.h"
+
+#include <sys/time.h>
+#include <unistd.h>
+
+#include <cstdio>
+#include <memory>
+
+#include "pagespeed/kernel/base/google_message_handler.h"
+#include "pagespeed/kernel/base/stdio_file_system.h"
+#include "pagespeed/kernel/base/string_util.h"
+#include "pagespeed/kernel/base/thread_system.h"
+#include "pagespeed/kernel/base/timer.h"
+#include "pagespeed/kernel/util/platform.h"
+#include "test/pagespeed/kernel/base/gtest.h"
+#include "test/pagespeed/kernel/base/mock_timer.h"
+
+namespace net_instaweb {
+namespace {
+
+const int64 kFallbackTtlMs = 5 * Timer::kSecondMs;
+
+class FileMtimeCacheTest : public testing::Test {
+ protected:
+  FileMtimeCacheTest()
+      : thread_system_(Platform::CreateThreadSystem()),
+        timer_(thread_system_->NewMutex(), MockTimer::kApr_5_2010_ms),
+        cache_(&file_system_, thread_system_.get(), &timer_, kFallbackTtlMs,
+               &handler_) {}
+
+  void SetUp() override {
+    dir_ = StrCat(GTestTempDir(), "/file_mtime_cache_test");
+    if (file_system_.Exists(dir_.c_str(), &handler_).is_true()) {
+      RemoveTree(dir_);
+    }
+    ASSERT_TRUE(file_system_.RecursivelyMakeDir(StrCat(dir_, "/sub"),
+                                                &handler_));
+  }
+
+  void TearDown() override {
+    cache_.ShutDown();
+    RemoveTree(dir_);
+  }
+
+  void RemoveTree(const GoogleString& path) {
+    StringVector entries;
+    file_system_.ListContents(path, &entries, &handler_);
+    for (int i = 0, n = entries.size(); i < n; ++i) {
+      if (file_system_.IsDir(entries[i].c_str(), &handler_).is_true()) {
+        RemoveTree(entries[i]);
+      } else {
+        file_system_.RemoveFile(entries[i].c_str(), &handler_);
+      }
+    }
+    file_system_.RemoveDir(path.c_str(), &handler_);
+  }
+
+  // Writes filename and gives it the specified mtime.
+  void WriteFile(const GoogleString& filename, int64 mtime_sec) {
+    ASSERT_TRUE(file_system_.WriteFile(filename.c_str(), "contents",
+                                       &handler_));
+    SetMtime(filename, mtime_sec);
+  }
+
+  void SetMtime(const GoogleString& filename, int64 mtime_sec) {
+    struct timeval times[2];
+    times[0].tv_sec = mtime_sec;
+    times[0].tv_usec = 0;
+    times[1] = times[0];
+    ASSERT_EQ(0, utimes(filename.c_str(), times));
+  }
+
+  int64 Mtime(const GoogleString& filename) {
+    int64 mtime_sec = -1;
+    EXPECT_TRUE(cache_.Mtime(filename, &mtime_sec, &handler_));
+    return mtime_sec;
+  }
+
+  GoogleMessageHandler handler_;
+  StdioFileSystem file_system_;
+  std::unique_ptr<ThreadSystem> thread_system_;
+  MockTimer timer_;
+  FileMtimeCache cache_;
+  GoogleString dir_;
+};
+
+TEST_F(FileMtimeCacheTest, PassesThroughUntilStarted) {
+  GoogleString filename = StrCat(dir_, "/a.css");
+  WriteFile(filename, 1000);
+  EXPECT_EQ(1000, Mtime(filename));
+  SetMtime(filename, 2000);
+  EXPECT_EQ(2000, Mtime(filename));
+  EXPECT_EQ(0, cache_.num_cached_entries());
+}
+
+TEST_F(FileMtimeCacheTest, ServesFromMemoryUntilModified) {
+  ASSERT_TRUE(cache_.StartWithoutThreadForTesting());
+  GoogleString filename = StrCat(dir_, "/sub/a.css");
+  WriteFile(filename, 1000);
+  cache_.ApplyPendingEvents();
+
+  EXPECT_EQ(1000, Mtime(filename));
+  EXPECT_EQ(1, cache_.num_cached_entries());
+
+  // Until the event is applied we keep serving what we remembered, no matter
+  // how much time passes...
+  SetMtime(filename, 2000);
+  timer_.AdvanceMs(100 * kFallbackTtlMs);
+  EXPECT_EQ(1000, Mtime(filename));
+
+  // ...and once it is, we notice the change.
+  cache_.ApplyPendingEvents();
+  EXPECT_EQ(0, cache_.num_cached_entries());
+  EXPECT_EQ(2000, Mtime(filename));
+  EXPECT_EQ(1, cache_.num_cached_entries());
+}
+
+TEST_F(FileMtimeCacheTest, ReplacedByRename) {
+  ASSERT_TRUE(cache_.StartWithoutThreadForTesting());
+  GoogleString filename = StrCat(dir_, "/sub/a.css");
+  GoogleString temp = StrCat(dir_, "/sub/a.css.tmp");
+  WriteFile(filename, 1000);
+  WriteFile(temp, 2000);
+  cache_.ApplyPendingEvents();
+  EXPECT_EQ(1000, Mtime(filename));
+
+  ASSERT_EQ(0, rename(temp.c_str(), filename.c_str()));
+  cache_.ApplyPendingEvents();
+  EXPECT_EQ(2000, Mtime(filename));
+}
+
+TEST_F(FileMtimeCacheTest, DirectoryRenameInvalidatesEverythingBelow) {
+  ASSERT_TRUE(cache_.StartWithoutThreadForTesting());
+  GoogleString filename = StrCat(dir_, "/sub/a.css");
+  GoogleString other = StrCat(dir_, "/other");
+  WriteFile(filename, 1000);
+  ASSERT_TRUE(file_system_.MakeDir(other.c_str(), &handler_));
+  WriteFile(StrCat(other, "/a.css"), 2000);
+  cache_.ApplyPendingEvents();
+  EXPECT_EQ(1000, Mtime(filename));
+  int watches = cache_.num_watches();
+
+  // Swap in a different directory holding the file.  The file itself is
+  // untouched, but the watch on its directory reports the move.
+  GoogleString sub = StrCat(dir_, "/sub");
+  ASSERT_EQ(0, rename(sub.c_str(), StrCat(dir_, "/old").c_str()));
+  ASSERT_EQ(0, rename(other.c_str(), sub.c_str()));
+  cache_.ApplyPendingEvents();
+  EXPECT_EQ(0, cache_.num_cached_entries());
+  EXPECT_GT(watches, cache_.num_watches());
+  EXPECT_EQ(2000, Mtime(filename));
+  EXPECT_EQ(watches, cache_.num_watches());
+}
+
+TEST_F(FileMtimeCacheTest, WatchesOnlyTheFilesDirectory) {
+  ASSERT_TRUE(cache_.StartWithoutThreadForTesting());
+  GoogleString filename = StrCat(dir_, "/sub/a.css");
+  WriteFile(filename, 1000);
+  cache_.ApplyPendingEvents();
+  EXPECT_EQ(1000, Mtime(filename));
+  EXPECT_EQ(1, cache_.num_watches());
+
+  // Churn in the parent directory is neither watched nor a reason to drop
+  // the entry.
+  WriteFile(StrCat(dir_, "/b.css"), 2000);
+  cache_.ApplyPendingEvents();
+  EXPECT_EQ(1, cache_.num_cached_entries());
+  EXPECT_EQ(1000, Mtime(filename));
+}
+
+TEST_F(FileMtimeCacheTest, DeletedFileIsNotCached) {
+  ASSERT_TRUE(cache_.StartWithoutThreadForTesting());
+  GoogleString filename = StrCat(dir_, "/sub/a.css");
+  WriteFile(filename, 1000);
+  cache_.ApplyPendingEvents();
+  EXPECT_EQ(1000, Mtime(filename));
+
+  ASSERT_TRUE(file_system_.RemoveFile(filename.c_str(), &handler_));
+  cache_.ApplyPendingEvents();
+  int64 mtime_sec;
+  EXPECT_FALSE(cache_.Mtime(filename, &mtime_sec, &handler_));
+  EXPECT_EQ(0, cache_.num_cached_entries());
+}
+
+TEST_F(FileMtimeCacheTest, NonCanonicalPathsPassThrough) {
+  ASSERT_TRUE(cache_.StartWithoutThreadForTesting());
+  WriteFile(StrCat(dir_, "/sub/a.css"), 1000);
+  EXPECT_EQ(1000, Mtime(StrCat(dir_, "//sub/a.css")));
+  EXPECT_EQ(1000, Mtime(StrCat(dir_, "/sub/../sub/a.css")));
+  EXPECT_EQ(1000, Mtime(StrCat(dir_, "/./sub/a.css")));
+  EXPECT_EQ(0, cache_.num_cached_entries());
+  EXPECT_EQ(0, cache_.num_watches());
+}
+
+TEST_F(FileMtimeCacheTest, EventThreadInvalidates) {
+  ASSERT_TRUE(cache_.Start());
+  GoogleString filename = StrCat(dir_, "/sub/a.css");
+  WriteFile(filename, 1000);
+
+  // Events from writing the file may still be in flight, in which case the
+  // first lookups aren't cached.  Either way the answer is right.
+  EXPECT_EQ(1000, Mtime(filename));
+  SetMtime(filename, 2000);
+  int64 mtime_sec = 1000;
+  for (int i = 0; i < 1000 && mtime_sec != 2000; ++i) {
+    usleep(1000);
+    mtime_sec = Mtime(filename);
+  }
+  EXPECT_EQ(2000, mtime_sec);
+}
+
+}  // namespace
+}  // namespace net_instaweb
@@ -19,6 +19,8 @@
 
 #include "pagespeed/kernel/util/statistics_logger.h"
 
+#include <algorithm>
+#include <cstring>
 #include <map>
 #include <set>
 #include <vector>
@@ -50,6 +52,9 @@ namespace {
 
 const int64 kLoggingIntervalMs = 3 * Timer::kSecondMs;
 const int64 kMaxLogfileSizeKb = 10;
+// Large enough for many records, which with kMaxLogfileSizeKb would
+// make the logfile be trimmed after every few dumps.
+const int64 kLargeMaxLogfileSizeKb = 64;
 const char kStatsLogFile[] = "mod_pagespeed_stats.log";
 const char kTimestampVarName[] = "timestamp_";
 const char kUnloggedVariable[] = "unlogged_variable_";
@@ -71,8 +76,13 @@ class StatisticsLoggerTest : public ::testing::Test {
         // SharedMemStatisticsTestBase which test those interactions.
         logger_(kLoggingIntervalMs, kMaxLogfileSizeKb, kStatsLogFile,
                 stats_.AddVariable(kTimestampVarName)->impl(), &handler_,
-                &stats_, &file_system_, &timer_) {
+                &stats_, &file_system_, &timer_),
+        large_logger_(kLoggingIntervalMs, kLargeMaxLogfileSizeKb,
+                      kStatsLogFile,
+                      stats_.AddVariable(kTimestampVarName)->impl(),
+                      &handler_, &stats_, &file_system_, &timer_) {
     logger_.InitStatsForTest();
+    large_logger_.Init();
     // Another non-logged statistics.
     stats_.AddVariable(kUnloggedVariable);
   }
@@ -81,8 +91,16 @@ class StatisticsLoggerTest : public ::testing::Test {
 
   static void SetUpTestSuite() { HtmlKeywords::Init(); }
 
-  void DumpConsoleVarsToWriter(int64 current_time_ms, Writer* writer) {
-    logger_.DumpConsoleVarsToWriter(current_time_ms, writer);
+  // Reads the logfile into contents and indexes it.
+  void ReadLogfile(GoogleString* contents, StatisticsLogfileIndex* index) {
+    ASSERT_TRUE(file_system_.ReadFile(kStatsLogFile, contents, &handler_));
+    ASSERT_TRUE(index->Init(*contents));
+  }
+
+  // Advances time by more than the logging interval and dumps.
+  void AdvanceAndDump(StatisticsLogger* logger) {
+    timer_.AdvanceMs(2 * kLoggingIntervalMs);
+    logger->UpdateAndDumpIfRequired();
   }
 
   static GoogleString CreateVariableDataResponse(bool has_unused_variable,
@@ -159,6 +177,7 @@ class StatisticsLoggerTest : public ::testing::Test {
   MemFileSystem file_system_;
   SimpleStats stats_;
   StatisticsLogger logger_;
+  StatisticsLogger large_logger_;
 };
 
 TEST_F(StatisticsLoggerTest, TestParseDataFromReader) {
@@ -420,27 +439,179 @@ TEST_F(StatisticsLoggerTest, ConsistentNumberArgs) {
 TEST_F(StatisticsLoggerTest, FromStats) {
   stats_.GetVariable(kUnloggedVariable)->Add(2300);
   stats_.GetVariable("num_flushes")->Add(300);
+  stats_.GetVariable("cache_hits")->Add(5);
+
+  AdvanceAndDump(&logger_);
+  GoogleString contents;
+  StatisticsLogfileIndex index;
+  ReadLogfile(&contents, &index);
+  ASSERT_EQ(1, index.num_records());
+  EXPECT_EQ(timer_.NowMs(), index.timestamp(0));
+  EXPECT_EQ(-1, index.FindColumn(kUnloggedVariable));
+  EXPECT_EQ(-1, index.FindColumn("timestamp"));
+
+  int num_flushes_column = index.FindColumn("num_flushes");
+  ASSERT_LE(0, num_flushes_column);
+  EXPECT_EQ(300, index.value(0, num_flushes_column));
+  int cache_hits_column = index.FindColumn("cache_hits");
+  ASSERT_LE(0, cache_hits_column);
+  EXPECT_EQ(5, index.value(0, cache_hits_column));
+  int cache_misses_column = index.FindColumn("cache_misses");
+  ASSERT_LE(0, cache_misses_column);
+  EXPECT_EQ(0, index.value(0, cache_misses_column));
+
+  // Further dumps append records to the same file.
+  stats_.GetVariable("num_flushes")->Add(10);
+  AdvanceAndDump(&logger_);
+  ReadLogfile(&contents, &index);
+  ASSERT_EQ(2, index.num_records());
+  EXPECT_EQ(timer_.NowMs(), index.timestamp(1));
+  EXPECT_EQ(300, index.value(0, num_flushes_column));
+  EXPECT_EQ(310, index.value(1, num_flushes_column));
+}
+
+TEST_F(StatisticsLoggerTest, BinaryLogfileTimeRange) {
+  std::vector<int64> dump_times;
+  for (int i = 0; i < 10; ++i) {
+    stats_.GetVariable("cache_hits")->Add(1);
+    AdvanceAndDump(&large_logger_);
+    dump_times.push_back(timer_.NowMs());
+  }
+
+  std::set<GoogleString> var_titles;
+  var_titles.insert("cache_hits");
+  var_titles.insert("not_logged");
+
+  // Records 2 to 7, skipping every other one.
+  GoogleString json_dump;
+  StringWriter writer(&json_dump);
+  large_logger_.DumpJSON(false, var_titles, dump_times[2], dump_times[7],
+                         3 * kLoggingIntervalMs, &writer, &handler_);
+  EXPECT_EQ(StrCat("{\"timestamps\": [", Integer64ToString(dump_times[2]),
+                   ", ", Integer64ToString(dump_times[4]), ", ",
+                   Integer64ToString(dump_times[6]),
+                   "],\"variables\": {\"cache_hits\": [3, 5, 7],"
+                   "\"not_logged\": [0, 0, 0]}}"),
+            json_dump);
+
+  // The graphs page gets all of its variables, logged or not.
+  GoogleString json_dump_graphs;
+  StringWriter writer_graphs(&json_dump_graphs);
+  large_logger_.DumpJSON(true, var_titles, dump_times[8], dump_times[9], 0,
+                         &writer_graphs, &handler_);
+  EXPECT_THAT(json_dump_graphs, ::testing::HasSubstr(StrCat(
+                                    "\"timestamps\": [",
+                                    Integer64ToString(dump_times[8]), ", ",
+                                    Integer64ToString(dump_times[9]), "]")));
+  EXPECT_THAT(json_dump_graphs,
+              ::testing::HasSubstr("\"cache_hits\": [9, 10]"));
+}
+
+TEST_F(StatisticsLoggerTest, ReplacesTextLogfile) {
+  std::set<GoogleString> var_titles;
+  int64 start_time;
+  int64 end_time;
+  int64 granularity_ms;
+  CreateFakeLogfile(&var_titles, &start_time, &end_time, &granularity_ms);
+
+  // Logfiles in the old text format are still readable...
+  GoogleString json_dump;
+  StringWriter writer(&json_dump);
+  logger_.DumpJSON(false, var_titles, start_time, end_time, granularity_ms,
+                   &writer, &handler_);
+  EXPECT_THAT(json_dump, ::testing::HasSubstr("\"cache_hits\": [400, "));
+
+  // ...but are replaced when the next record is logged.
+  AdvanceAndDump(&logger_);
+  GoogleString contents;
+  StatisticsLogfileIndex index;
+  ReadLogfile(&contents, &index);
+  EXPECT_EQ(1, index.num_records());
+}
+
+TEST_F(StatisticsLoggerTest, TrimmingKeepsRecentRecords) {
+  const int64 kLargeMaxLogfileSizeBytes = kLargeMaxLogfileSizeKb * 1024;
+
+  GoogleString contents;
+  StatisticsLogfileIndex index;
+  int max_records = 0;
+  bool trimmed = false;
+  for (int i = 0; i < 200; ++i) {
+    AdvanceAndDump(&large_logger_);
+    ReadLogfile(&contents, &index);
+    EXPECT_GE(kLargeMaxLogfileSizeBytes, contents.size());
+    // The newest record is always kept.
+    ASSERT_LT(0, index.num_records());
+    EXPECT_EQ(timer_.NowMs(), index.timestamp(index.num_records() - 1));
+    if (index.num_records() < max_records) {
+      trimmed = true;
+      // About half of the logfile survives trimming.
+      EXPECT_LE(max_records / 2 - 1, index.num_records());
+    }
+    max_records = std::max(max_records, index.num_records());
+  }
+  EXPECT_TRUE(trimmed);
+}
+
+TEST_F(StatisticsLoggerTest, TrimmingDropsTornRecord) {
+  // Log one record to learn the header and record layout.
+  AdvanceAndDump(&large_logger_);
+  GoogleString contents;
+  StatisticsLogfileIndex index;
+  ReadLogfile(&contents, &index);
+  ASSERT_EQ(1, index.num_records());
+  const size_t record_size = index.record_size();
+  const GoogleString header = contents.substr(0, contents.size() - record_size);
+  const GoogleString record = contents.substr(header.size());
+
+  // Fill the logfile past its limit with records timestamped 0, 1, ...,
+  // ending with a partially written record, as after a crash.
+  const int64 num_records = kLargeMaxLogfileSizeKb * 1024 / record_size + 2;
+  GoogleString logfile = header;
+  for (int64 i = 0; i < num_records; ++i) {
+    GoogleString numbered = record;
+    memcpy(&numbered[0], &i, sizeof(i));
+    logfile += numbered;
+  }
+  logfile += record.substr(0, 3);
+  ASSERT_TRUE(file_system_.WriteFile(kStatsLogFile, logfile, &handler_));
+
+  large_logger_.TrimLogfileIfNeeded();
+  ReadLogfile(&contents, &index);
+  EXPECT_EQ(header, contents.substr(0, header.size()));
+  EXPECT_EQ(0, (contents.size() - header.size()) % record_size);
+  // The most recent whole records are kept, in order.
+  ASSERT_LT(0, index.num_records());
+  const int64 first_kept = num_records - index.num_records();
+  for (int i = 0; i < index.num_records(); ++i) {
+    EXPECT_EQ(first_kept + i, index.timestamp(i));
+  }
+}
 
-  GoogleString logger_output;
-  StringWriter logger_writer(&logger_output);
-  DumpConsoleVarsToWriter(MockTimer::kApr_5_2010_ms, &logger_writer);
-
-  std::vector<StringPiece> lines;
-  SplitStringPieceToVector(logger_output, "\n", &lines, true);
-  ASSERT_LE(2, lines.size());
-  EXPECT_EQ("timestamp: 1270493486000", lines[0]);
-  for (int i = 1; i < lines.size(); ++i) {
-    std::vector<StringPiece> parts;
-    SplitStringPieceToVector(lines[i], ":", &parts, false);
-    ASSERT_EQ(2, parts.size()) << lines[i];
-
-    StringPiece name = parts[0];
-    int64 value;
-    TrimWhitespace(&parts[1]);
-    ASSERT_TRUE(StringToInt64(parts[1], &value)) << parts[1];
-
-    EXPECT_EQ(value, stats_.GetVariable(name)->Get());
+TEST_F(StatisticsLoggerTest, AppendingDropsTornRecord) {
+  for (int i = 0; i < 3; ++i) {
+    AdvanceAndDump(&large_logger_);
   }
+  GoogleString contents;
+  StatisticsLogfileIndex index;
+  ReadLogfile(&contents, &index);
+  ASSERT_EQ(3, index.num_records());
+  const int64 first_timestamp = index.timestamp(0);
+
+  // Simulate a crash part way through appending a fourth record.
+  ASSERT_TRUE(file_system_.WriteFile(
+      kStatsLogFile, StrCat(contents, contents.substr(contents.size() - 5)),
+      &handler_));
+
+  // The history survives, and the next record lands on a record boundary.
+  AdvanceAndDump(&large_logger_);
+  ReadLogfile(&contents, &index);
+  ASSERT_EQ(4, index.num_records());
+  EXPECT_EQ(0, (contents.size() - (index.RecordsFrom(0).data() -
+                                   contents.data())) %
+                   index.record_size());
+  EXPECT_EQ(first_timestamp, index.timestamp(0));
+  EXPECT_EQ(timer_.NowMs(), index.timestamp(3));
 }
 
 TEST_F(StatisticsLoggerTest, LogfileTrimming) {
@@ -2122,6 +2122,93 @@ UnicodeText Parser::ExtractCharset() {
   return result;
 }
 
+void Parser::Tokenize(TokenHandler* handler) {
+  Tracer trace(__func__, this);
+
+  // Set after @import so that its string form is reported as a URL.
+  bool after_import = false;
+  while (!Done()) {
+    const char* start = in_;
+    TokenType type = kDelimToken;
+    switch (*in_) {
+      case ' ':
+      case '\t':
+      case '\r':
+      case '\n':
+      case '\f':
+        while (in_ < end_ && IsSpace(*in_)) in_++;
+        handler->HandleToken(kWhitespaceToken,
+                             CssStringPiece(start, in_ - start));
+        continue;
+      case '\'':
+      case '"': {
+        char delim = *in_;
+        if (after_import) {
+          UnicodeText url = (delim == '"') ? ParseString<'"'>()
+                                           : ParseString<'\''>();
+          handler->HandleUrl(CssStringPiece(start, in_ - start), url);
+          after_import = false;
+          continue;
+        }
+        // Same extent as ParseString(), without unescaping the contents.
+        in_++;
+        while (in_ < end_ && *in_ != delim && *in_ != '\n') {
+          in_ += (*in_ == '\\' && in_ + 1 < end_) ? 2 : 1;
+        }
+        if (in_ < end_ && *in_ == delim) in_++;
+        type = kStringToken;
+        break;
+      }
+      case '/':
+        if (in_ + 1 < end_ && in_[1] == '*') {
+          SkipComment();
+          handler->HandleToken(kCommentToken,
+                               CssStringPiece(start, in_ - start));
+          continue;
+        }
+        in_++;
+        break;
+      case '@':
+        in_++;
+        ParseIdent();
+        type = (in_ - start > 1) ? kAtKeywordToken : kDelimToken;
+        break;
+      default:
+        if (StartsIdent(*in_) || *in_ == '\\') {
+          ParseIdent();
+          if (in_ == start) {
+            // Characters 128-160 do not start identifiers.
+            in_++;
+            break;
+          }
+          type = kIdentToken;
+          if (in_ - start == 3 && in_ < end_ && *in_ == '(' &&
+              StringCaseEquals(CssStringPiece(start, 3), "url")) {
+            const char* ident_end = in_;
+            in_++;  // Skip '('.
+            std::unique_ptr<Value> url(ParseUrl());
+            if (url != nullptr) {
+              in_++;  // Skip ')'; ParseUrl() verified it is there.
+              handler->HandleUrl(CssStringPiece(start, in_ - start),
+                                 url->GetStringValue());
+              after_import = false;
+              continue;
+            }
+            ReportParsingError(kFunctionError, "Malformed url()");
+            in_ = ident_end;
+          }
+        } else {
+          in_++;
+        }
+        break;
+    }
+    CssStringPiece text(start, in_ - start);
+    after_import =
+        (type == kAtKeywordToken && StringCaseEquals(text, "@import"));
+    handler->HandleToken(type, text);
+  }
+}
+
 UnicodeText Parser::ParseCharset() {
   Tracer trace(__func__, this);
 
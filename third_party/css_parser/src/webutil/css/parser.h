@@ -161,6 +161,44 @@ class Parser {
   // duplicating a ton of our code.
   UnicodeText ExtractCharset();
 
+  // Streaming mode.
+  //
+  // Tokenize() lexes the document from the current position to the end
+  // without building any Stylesheet, Ruleset, Selector or Value objects.
+  // Each token is handed to the TokenHandler as a span of the original bytes,
+  // so concatenating all the spans reproduces the input exactly.  This is
+  // all that URL rewriting and whitespace minification need, and it avoids
+  // allocating thousands of AST nodes for large stylesheets.
+  //
+  // URLs are reported with their unescaped value, both for url(...) and for
+  // the string form of @import ("@import 'foo.css';").  A url( that is not
+  // closed by a matching ) is reported as kFunctionError and lexed as an
+  // ordinary identifier followed by '('; unterminated comments are reported
+  // as kCssCommentError.
+  enum TokenType {
+    kWhitespaceToken,  // Run of [ \t\r\n\f].
+    kCommentToken,     // /* ... */
+    kIdentToken,       // Identifier chars and escapes; includes numbers.
+    kAtKeywordToken,   // @ followed by an identifier.
+    kStringToken,      // '...' or "...", including the quotes.
+    kUrlToken,         // url(...) or the string following @import.
+    kDelimToken,       // Any other single character.
+  };
+
+  class TokenHandler {
+   public:
+    virtual ~TokenHandler() {}
+
+    // Called for every token other than kUrlToken.
+    virtual void HandleToken(TokenType type, CssStringPiece text) = 0;
+
+    // Called for kUrlToken.  text is the verbatim span and url the unescaped
+    // URL it contains.
+    virtual void HandleUrl(CssStringPiece text, const UnicodeText& url) = 0;
+  };
+
+  void Tokenize(TokenHandler* handler);
+
   // current position in the parse.
   const char* getpos() const { return in_; }
 
@@ -2699,4 +2699,54 @@ TEST_F(ParserTest, BadPartialImportEncoding) {
   EXPECT_NE(Parser::kNoError, parser.errors_seen_mask());
 }
 
+// Records tokens as "type:text" (and "url:text=value" for URLs).
+class RecordingTokenHandler : public Parser::TokenHandler {
+ public:
+  void HandleToken(Parser::TokenType type, CssStringPiece text) override {
+    const char* kNames[] = {"ws", "comment", "ident", "at", "str", "url",
+                            "delim"};
+    tokens_.push_back(string(kNames[type]) + ":" + string(text));
+    text_.append(text.data(), text.size());
+  }
+  void HandleUrl(CssStringPiece text, const UnicodeText& url) override {
+    tokens_.push_back("url:" + string(text) + "=" + UnicodeTextToUTF8(url));
+    text_.append(text.data(), text.size());
+  }
+  std::vector<string> tokens_;
+  string text_;
+};
+
+TEST_F(ParserTest, Tokenize) {
+  const char kCss[] =
+      "@import 'a.css';\n"
+      "/* c */.b\\:x{background:URL( \"i m.png\" ) 1.5em}";
+  Parser parser(kCss);
+  RecordingTokenHandler handler;
+  parser.Tokenize(&handler);
+  EXPECT_EQ(Parser::kNoError, parser.errors_seen_mask());
+  const char* kExpected[] = {
+      "at:@import", "ws: ", "url:'a.css'=a.css", "delim:;", "ws:\n",
+      "comment:/* c */", "delim:.", "ident:b\\:x", "delim:{",
+      "ident:background", "delim::", "url:URL( \"i m.png\" )=i m.png",
+      "ws: ", "ident:1", "delim:.", "ident:5em", "delim:}"};
+  ASSERT_EQ(arraysize(kExpected), handler.tokens_.size());
+  for (int i = 0, n = handler.tokens_.size(); i < n; ++i) {
+    EXPECT_EQ(kExpected[i], handler.tokens_[i]);
+  }
+  // Token spans cover the input exactly.
+  EXPECT_EQ(kCss, handler.text_);
+}
+
+TEST_F(ParserTest, TokenizeErrors) {
+  Parser parser("a{b:url(x y)}'open\n/* unclosed");
+  RecordingTokenHandler handler;
+  parser.Tokenize(&handler);
+  EXPECT_TRUE(Parser::kFunctionError & parser.errors_seen_mask());
+  EXPECT_TRUE(Parser::kCssCommentError & parser.errors_seen_mask());
+  EXPECT_EQ("ident:url", handler.tokens_[4]);
+  EXPECT_EQ("delim:(", handler.tokens_[5]);
+  EXPECT_EQ("str:'open", handler.tokens_[11]);
+  EXPECT_EQ("comment:/* unclosed", handler.tokens_.back());
+}
+
 }  // namespace Css